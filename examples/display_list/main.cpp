@@ -0,0 +1,175 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License (https://opensource.org/licenses/MIT)
+=============================================================================*/
+#include <elements.hpp>
+#include <cstring>
+#include <iostream>
+
+using namespace cycfi::elements;
+
+// Main window background color
+auto constexpr bkd_color = rgba(35, 35, 37, 255);
+auto background = box(bkd_color);
+
+constexpr int frame_width = 400;
+constexpr int frame_height = 300;
+
+// A procedural image, drawn shrunk (from its mip chain) in the frame
+pixmap_ptr make_photo()
+{
+   auto photo = std::make_shared<pixmap>(point{ 256, 256 });
+   {
+      pixmap_context ctx{ *photo };
+      canvas cnv{ *ctx.context() };
+      for (int i = 0; i != 16; ++i)
+      {
+         cnv.fill_style(i % 2? colors::light_sky_blue : colors::dark_slate_blue);
+         cnv.rect({ i * 16.0f, 0, i * 16.0f + 16, 256 });
+         cnv.fill();
+      }
+      auto gr = canvas::radial_gradient{ { 128, 128 }, 0, { 128, 128 }, 128 };
+      gr.add_color_stop({ 0.0f, colors::gold });
+      gr.add_color_stop({ 1.0f, colors::gold.opacity(0) });
+      cnv.fill_style(gr);
+      cnv.rect({ 0, 0, 256, 256 });
+      cnv.fill();
+   }
+   photo->mipmapped(true);
+   return photo;
+}
+
+// One frame, with a bit of everything that a display_list records: paths,
+// solid and gradient styles, a shadow, text, a glyph run and a pixmap.
+void draw_frame(canvas& cnv, pixmap const& photo, master_glyphs& glyphs_)
+{
+   auto state = cnv.new_state();
+
+   cnv.fill_style(bkd_color);
+   cnv.rect({ 0, 0, frame_width, frame_height });
+   cnv.fill();
+
+   cnv.fill_style(rgba(0, 0, 0, 80));
+   cnv.fill_shadow({ 20, 20, 220, 140 }, 8, 3);
+
+   auto lg = canvas::linear_gradient{ { 0, 20 }, { 0, 140 } };
+   lg.add_color_stop({ 0.0f, rgba(80, 80, 84, 255) });
+   lg.add_color_stop({ 1.0f, rgba(50, 50, 54, 255) });
+   cnv.fill_style(lg);
+   cnv.begin_path();
+   cnv.round_rect({ 20, 20, 220, 140 }, 8);
+   cnv.fill();
+
+   auto rg = canvas::radial_gradient{ { 300, 80 }, 10, { 300, 80 }, 60 };
+   rg.add_color_stop({ 0.0f, colors::orange });
+   rg.add_color_stop({ 1.0f, colors::orange_red.opacity(0.5) });
+   cnv.fill_style(rg);
+   cnv.begin_path();
+   cnv.circle({ 300, 80, 60 });
+   cnv.fill();
+
+   cnv.stroke_style(colors::white.opacity(0.6));
+   cnv.line_width(2);
+   cnv.begin_path();
+   cnv.move_to({ 20, 280 });
+   cnv.line_to({ 120, 180 });
+   cnv.line_to({ 220, 280 });
+   cnv.stroke();
+
+   cnv.fill_style(colors::white);
+   cnv.font(get_theme().label_font, 14);
+   cnv.text_align(cnv.left | cnv.baseline);
+   cnv.fill_text({ 36, 60 }, "Recorded text");
+   glyphs_.draw({ 36, 100 }, cnv);
+
+   cnv.draw(photo, rect{ 0, 0, 256, 256 }, rect{ 260, 170, 324, 234 });
+}
+
+cairo_surface_t* make_frame_surface()
+{
+   return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, frame_width, frame_height);
+}
+
+bool same_pixels(cairo_surface_t* a, cairo_surface_t* b)
+{
+   cairo_surface_flush(a);
+   cairo_surface_flush(b);
+   auto stride = cairo_image_surface_get_stride(a);
+   return std::memcmp(
+      cairo_image_surface_get_data(a)
+    , cairo_image_surface_get_data(b)
+    , std::size_t(stride) * frame_height
+   ) == 0;
+}
+
+// Records a frame, replays it onto another surface and compares the
+// pixels. The replay is itself recorded and compared with the original
+// list. Returns a report.
+std::string check_replay()
+{
+   auto photo = make_photo();
+   auto& thm = get_theme();
+   std::string const text = "A recorded glyph run";
+   master_glyphs glyphs_{ text, thm.label_font, 14 };
+
+   auto live = make_frame_surface();
+   auto replayed = make_frame_surface();
+   display_list list;
+   display_list replay_list;
+   {
+      // The first draw of the shrunk photo picks its mip level, the
+      // second makes an exact size copy. Draw the frame once so that the
+      // recorded frame already shows what the replay will.
+      auto cr = cairo_create(live);
+      canvas cnv{ *cr };
+      draw_frame(cnv, *photo, glyphs_);
+
+      cnv.record(list);
+      draw_frame(cnv, *photo, glyphs_);
+      cnv.stop_recording();
+      cairo_destroy(cr);
+   }
+   {
+      auto cr = cairo_create(replayed);
+      canvas cnv{ *cr };
+      cnv.record(replay_list);
+      list.replay(cnv);
+      cnv.stop_recording();
+      cairo_destroy(cr);
+   }
+
+   list.write(std::cout);
+
+   bool pixels_ok = same_pixels(live, replayed);
+   bool list_ok = list == replay_list && list.hash() == replay_list.hash();
+   cairo_surface_destroy(live);
+   cairo_surface_destroy(replayed);
+
+   std::string report =
+      std::to_string(list.count()) + " commands, " + std::to_string(list.bytes()) + " bytes\n"
+      "Replayed pixels: " + (pixels_ok? "identical" : "DIFFERENT") + "\n"
+      "Recorded replay: " + (list_ok? "identical" : "DIFFERENT") + "\n"
+      ;
+   std::cout << report;
+   return report;
+}
+
+int main(int argc, char* argv[])
+{
+   app _app(argc, argv, "Display List", "com.cycfi.display-list");
+   window _win(_app.name());
+   _win.on_close = [&_app]() { _app.stop(); };
+
+   auto report = check_replay();
+
+   view view_(_win);
+
+   view_.content(
+      margin({ 20, 20, 20, 20 }, static_text_box(report)),
+      background
+   );
+
+   _app.run();
+   return 0;
+}
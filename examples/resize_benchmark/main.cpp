@@ -0,0 +1,94 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License (https://opensource.org/licenses/MIT)
+=============================================================================*/
+#include <elements.hpp>
+#include <chrono>
+#include <iostream>
+
+using namespace cycfi::elements;
+
+// Main window background color
+auto constexpr bkd_color = rgba(35, 35, 37, 255);
+auto background = box(bkd_color);
+
+std::string const sentences =
+   "You and I are adventurers of the quantum cycle. The goal of expanding wave "
+   "functions is to plant the seeds of non-locality rather than pain. "
+   "The complexity of the present time seems to demand a redefining of our "
+   "bodies if we are going to survive. "
+   "We are at a crossroads of will and greed. Humankind has nothing to lose. "
+;
+
+// A single paragraph of at least 100k characters (no newlines)
+std::string make_paragraph()
+{
+   std::string text;
+   while (text.size() < 100000)
+      text += sentences;
+   return text;
+}
+
+// Re-break the paragraph on every step of a simulated continuous resize:
+// the width sweeps from 300 to 1300 and back, one pixel at a time. The
+// first break runs with a cold advance cache and is timed separately.
+void run_benchmark(std::string const& text)
+{
+   using clock = std::chrono::steady_clock;
+   using ms = std::chrono::duration<double, std::milli>;
+
+   auto const& thm = get_theme();
+   master_glyphs shape{ text, thm.text_box_font, thm.text_box_font_size };
+   std::vector<glyphs> lines;
+
+   auto start = clock::now();
+   shape.break_lines(300, lines);
+   auto cold = ms(clock::now() - start).count();
+
+   int steps = 0;
+   std::size_t num_lines = 0;
+   start = clock::now();
+   for (int i = 0; i != 2000; ++i, ++steps)
+   {
+      float width = 300 + (i < 1000 ? i : 2000 - i);
+      lines.clear();
+      shape.break_lines(width, lines);
+      num_lines += lines.size();
+   }
+   auto total = ms(clock::now() - start).count();
+
+   std::cout
+      << "resize benchmark: " << text.size() << " characters" << std::endl
+      << "  first break (cold cache): " << cold << " ms" << std::endl
+      << "  " << steps << " breaks: " << total << " ms, "
+      << (total / steps) << " ms per break, "
+      << (num_lines / steps) << " lines on average" << std::endl
+      ;
+}
+
+int main(int argc, char* argv[])
+{
+   app _app(argc, argv, "Resize Benchmark", "com.cycfi.resize-benchmark");
+   window _win(_app.name());
+   _win.on_close = [&_app]() { _app.stop(); };
+
+   auto text = make_paragraph();
+   run_benchmark(text);
+
+   view view_(_win);
+
+   // Resize the window to re-break the paragraph interactively.
+   view_.content(
+      scroller(
+         margin(
+            { 20, 20, 20, 20 },
+            static_text_box(text)
+         )
+      ),
+      background
+   );
+
+   _app.run();
+   return 0;
+}
@@ -11,56 +11,6 @@ using namespace cycfi::elements;
 auto constexpr bkd_color = rgba(35, 35, 37, 255);
 auto background = box(bkd_color);
 
-class table_cell_composer
-{
-public:
-    using composer_fn = std::function<element_ptr(size_t line, size_t index)>;
-    table_cell_composer(size_t lines, size_t columns, composer_fn &&fn)
-        : _num_lines(lines)
-        , _num_columns(columns)
-        , _composer(fn)
-    {}
-    element_ptr compose(size_t line, size_t col) {
-        return _composer(line, col);
-    }
-
-    size_t lines() {return _num_lines;}
-    size_t columns() {return _num_columns;}
-
-private:
-    size_t _num_lines, _num_columns;
-    composer_fn _composer;
-};
-
-class table_list : public vdynamic_list
-{
-public:
-    using table_composer_ptr = std::shared_ptr<table_cell_composer>;
-
-    element_ptr line_maker(size_t line)
-    {
-      if(h_list[line].get() == nullptr)
-      {
-          auto h_composer =
-                  basic_horizontal_cell_composer(_table_composer->columns(),
-                                                 [&, line](size_t col) {return _table_composer->compose(line, col);});
-          h_list[line] = share(hdynamic_list(h_composer));
-      }
-      return h_list[line];
-    };
-
-    table_list(table_composer_ptr ptr)
-        : vdynamic_list(basic_vertical_cell_composer(ptr->lines(), [&](size_t line) {return line_maker(line);})),
-          _table_composer(ptr),
-          h_list(ptr->lines(), nullptr)
-    {
-
-    }
-protected:
-    table_composer_ptr _table_composer;
-    std::vector<element_ptr> h_list;
-};
-
 int main(int argc, char* argv[])
 {
    app _app(argc, argv, "Table List", "com.cycfi.table-list");
@@ -70,36 +20,39 @@ int main(int argc, char* argv[])
    view view_(_win);
 
 
-   size_t lines = 500;
-   size_t columns = 100;
+   std::size_t rows = 1000000;
+   std::size_t columns = 200;
 
-   std::vector<std::vector<element_ptr>> ptr_list(lines);
-   for(size_t i = 0; i < lines; i++)
+   // Row 0 and column 0 are the frozen headers
+   auto&& make_cell = [](std::size_t row, std::size_t col) -> element_ptr
    {
-       ptr_list[i].resize(columns, nullptr);
-   }
+      if (row == 0 || col == 0)
+      {
+         auto text = (row == 0)?
+            ((col == 0)? std::string{} : "Col " + std::to_string(col)) :
+            "Row " + std::to_string(row)
+            ;
+         return share(layer(align_center_middle(label(text)), box(bkd_color)));
+      }
 
-   auto && make_cell = [&](size_t l, size_t c)
-   {
-       color cell_color = ((l % 2 == 0) ? colors::red : colors::blue).opacity(c % 2 == 0 ? 1.0 : 0.5);
-       return share(limit({{100, 50}, {200, 100}},layer(
-                              label(std::string(std::to_string(l) + "  " + std::to_string(c))),
-                              rbox(cell_color, 6)
-                              )));
+      color cell_color = ((row % 2 == 0) ? colors::red : colors::blue).opacity(col % 2 == 0 ? 1.0 : 0.5);
+      return share(layer(
+         label(std::to_string(row) + "  " + std::to_string(col)),
+         rbox(cell_color, 6)
+      ));
    };
 
-   table_cell_composer comp(lines, columns, make_cell);
-   table_list l(share(comp));
-
+   auto composer = basic_grid_composer(50, 100, rows, columns, make_cell);
+   composer->column_width(0, 120);
 
    view_.content(
-               margin({10, 10, 10, 10},
-                      scroller(
-                          hold(share(l))
-                          )
-                      ),
-               background
-               );
+      margin({10, 10, 10, 10},
+         scroller(
+            dynamic_grid(composer, 1, 1)
+         )
+      ),
+      background
+   );
 
    _app.run();
    return 0;
@@ -4,6 +4,7 @@
    Distributed under the MIT License (https://opensource.org/licenses/MIT)
 =============================================================================*/
 #include <elements.hpp>
+#include <cstring>
 
 using namespace cycfi::elements;
 
@@ -68,14 +69,20 @@ auto make_edit_box()
    // set the font of text box to 文泉驿 open source font: http://wenq.org/wqy2/index.cgi
    char const* font_family = "文泉驿微米黑, \"WenQuanYi Micro Hei\"";
    auto text = text1+text2+text3;
+   auto tbox = basic_text_box(text, font_descr{ font_family });
+
+   // Two separate color spans in one row, with plain text between and
+   // after them
+   for (auto word : { "traverse", "become" })
+      tbox.color_span(text.find(word), std::strlen(word), colors::gold);
 
    return
       scroller(
          margin(
             { 20, 20, 20, 20 },
             align_left_top(hsize(800,
-               basic_text_box(text, font_descr{ font_family }
-            )))
+               std::move(tbox)
+            ))
          )
       );
 }
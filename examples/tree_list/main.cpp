@@ -0,0 +1,70 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License (https://opensource.org/licenses/MIT)
+=============================================================================*/
+#include <elements.hpp>
+
+using namespace cycfi::elements;
+
+// Main window background color
+auto constexpr bkd_color = rgba(35, 35, 37, 255);
+auto background = box(bkd_color);
+
+// A synthetic project tree: 100 folders with 50,000 files each. The node
+// id of folder i is i+1. The node id of file j in folder i has the folder
+// id in the upper 32 bits and j+1 in the lower 32 bits. The root is 0.
+class project_tree : public tree_model
+{
+public:
+
+   static constexpr std::size_t num_folders = 100;
+   static constexpr std::size_t num_files = 50000;
+
+   node_id root() const override
+   {
+      return 0;
+   }
+
+   std::size_t child_count(node_id node) const override
+   {
+      if (node == 0)
+         return num_folders;
+      return (node >> 32)? 0 : num_files;
+   }
+
+   node_id child(node_id node, std::size_t index) const override
+   {
+      if (node == 0)
+         return index+1;
+      return (node << 32) | (index+1);
+   }
+
+   element_ptr compose(node_id node) override
+   {
+      auto text = (node >> 32)?
+         "File " + std::to_string(node & 0xffffffff) :
+         "Folder " + std::to_string(node)
+         ;
+      return share(align_left_middle(label(text)));
+   }
+};
+
+int main(int argc, char* argv[])
+{
+   app _app(argc, argv, "Tree List", "com.cycfi.tree-list");
+   window _win(_app.name());
+   _win.on_close = [&_app]() { _app.stop(); };
+
+   view view_(_win);
+
+   auto content = share(tree_list{ std::make_shared<project_tree>(), 200, 24 });
+
+   view_.content(
+      margin({ 10, 10, 10, 10 }, vscroller(hold(content))),
+      background
+   );
+
+   _app.run();
+   return 0;
+}
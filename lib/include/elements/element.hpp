@@ -7,10 +7,12 @@
 #define ELEMENTS_MAY_4_2016
 
 #include <elements/element/align.hpp>
+#include <elements/element/async_image.hpp>
 #include <elements/element/button.hpp>
 #include <elements/element/composite.hpp>
 #include <elements/element/child_window.hpp>
 #include <elements/element/dial.hpp>
+#include <elements/element/dynamic_grid.hpp>
 #include <elements/element/dynamic_list.hpp>
 #include <elements/element/floating.hpp>
 #include <elements/element/flow.hpp>
@@ -29,9 +31,12 @@
 #include <elements/element/size.hpp>
 #include <elements/element/slider.hpp>
 #include <elements/element/text.hpp>
+#include <elements/element/text_viewer.hpp>
 #include <elements/element/thumbwheel.hpp>
 #include <elements/element/tile.hpp>
+#include <elements/element/tiled_image.hpp>
 #include <elements/element/tooltip.hpp>
+#include <elements/element/tree_list.hpp>
 
 // Include this last
 #include <elements/element/gallery.hpp>
@@ -0,0 +1,64 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_ASYNC_IMAGE_OCTOBER_19_2026)
+#define ELEMENTS_ASYNC_IMAGE_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <elements/support/pixmap.hpp>
+#include <memory>
+
+namespace cycfi { namespace elements
+{
+   namespace detail
+   {
+      struct async_image_state;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Async Image
+   //
+   // An image that is decoded in the background, by a small pool of worker
+   // threads, for building views with many images (e.g. a gallery of
+   // thumbnails) without blocking. Until the image is ready, a placeholder
+   // is drawn. The size is read from the file's header up front (or given)
+   // so the limits do not change when the image arrives. When it does, the
+   // element is refreshed.
+   //
+   // Images that are drawn (i.e. visible) are decoded first, the most
+   // recently drawn ones before the others. The decoded pixmaps are shared
+   // through the pixmap_cache.
+   ////////////////////////////////////////////////////////////////////////////
+   class async_image : public element
+   {
+   public:
+                              async_image(char const* filename, float scale = 1);
+                              async_image(char const* filename, extent size, float scale = 1);
+                              ~async_image();
+
+                              async_image(async_image&& rhs) = default;
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    draw(context const& ctx) override;
+
+      extent                  size() const            { return _size; }
+      bool                    ready() const;
+      bool                    failed() const;
+
+   protected:
+
+      virtual void            draw_placeholder(context const& ctx);
+
+   private:
+
+      using state_ptr = std::shared_ptr<detail::async_image_state>;
+
+      state_ptr               _state;
+      pixmap_ptr              _pixmap;          // Set once ready
+      extent                  _size;
+   };
+}}
+
+#endif
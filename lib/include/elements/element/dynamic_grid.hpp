@@ -0,0 +1,327 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DYNAMIC_GRID_OCTOBER_19_2026)
+#define ELEMENTS_DYNAMIC_GRID_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The grid composer abstract class. Same idea as the cell_composer used
+   // by dynamic_list, but cells are addressed by (row, col). Row heights
+   // and column widths are shared: all cells in a row have the same height
+   // and all cells in a column have the same width.
+   ////////////////////////////////////////////////////////////////////////////
+   class grid_composer : public std::enable_shared_from_this<grid_composer>
+   {
+   public:
+
+      virtual                 ~grid_composer() = default;
+
+      virtual std::size_t     rows() const = 0;
+      virtual std::size_t     columns() const = 0;
+      virtual void            resize(std::size_t rows, std::size_t columns) = 0;
+      virtual element_ptr     compose(std::size_t row, std::size_t col) = 0;
+      virtual float           row_height(std::size_t row, basic_context const& ctx) const = 0;
+      virtual float           column_width(std::size_t col, basic_context const& ctx) const = 0;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // This grid composer has a fixed row height and per-column widths. All
+   // columns start with the same default width. Call dynamic_grid::update()
+   // after changing a column width.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename Base = grid_composer>
+   class static_limits_grid_composer : public Base
+   {
+   public:
+
+      using base_type = static_limits_grid_composer<Base>;
+
+                              template <typename... Rest>
+                              static_limits_grid_composer(
+                                 float row_height, float column_width
+                               , Rest&& ...rest
+                              );
+
+      float                   row_height(std::size_t row, basic_context const& ctx) const override;
+      float                   column_width(std::size_t col, basic_context const& ctx) const override;
+      void                    column_width(std::size_t col, float width);
+
+   private:
+
+      float                   _row_height;
+      float                   _column_width;
+      std::vector<float>      _column_widths;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // This grid composer has fixed number of rows and columns.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename Base = grid_composer>
+   class fixed_size_grid_composer : public Base
+   {
+   public:
+
+      using base_type = fixed_size_grid_composer<Base>;
+
+                              template <typename... Rest>
+                              fixed_size_grid_composer(
+                                 std::size_t rows, std::size_t columns
+                               , Rest&& ...rest
+                              )
+                               : Base(std::forward<Rest>(rest)...)
+                               , _rows(rows)
+                               , _columns(columns)
+                              {}
+
+      std::size_t             rows() const override { return _rows; }
+      std::size_t             columns() const override { return _columns; }
+      void                    resize(std::size_t rows, std::size_t columns) override
+                              { _rows = rows; _columns = columns; }
+
+   private:
+
+      std::size_t             _rows;
+      std::size_t             _columns;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // This grid composer composes the cell element using a provided function
+   // with the signature: element_ptr(std::size_t row, std::size_t col).
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F, typename Base = grid_composer>
+   class function_grid_composer : public Base
+   {
+   public:
+
+      using base_type = function_grid_composer<F, Base>;
+
+                              template <typename... Rest>
+                              function_grid_composer(F&& compose_, Rest&& ...rest)
+                               : Base(std::forward<Rest>(rest)...)
+                               , _compose(compose_)
+                              {}
+
+      element_ptr             compose(std::size_t row, std::size_t col) override
+                              { return _compose(row, col); }
+
+   private:
+
+      F                       _compose;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // basic_grid_composer given the row height, default column width, number
+   // of rows and columns and a compose function.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   inline auto basic_grid_composer(
+      float row_height, float column_width
+    , std::size_t rows, std::size_t columns, F&& compose
+   )
+   {
+      using ftype = remove_cvref_t<F>;
+      using return_type =
+         static_limits_grid_composer<
+            fixed_size_grid_composer<
+               function_grid_composer<ftype>
+            >
+         >;
+      return share(
+         return_type{
+            row_height
+          , column_width
+          , rows
+          , columns
+          , std::forward<ftype>(compose)
+         }
+      );
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The dynamic_grid class
+   //
+   // A two-dimensional dynamic_list. Both axes are virtualized: only the
+   // cells that intersect the clip area are composed, laid out and drawn,
+   // and cells that scroll out of the visible area are released. Locating
+   // the visible rows and columns (for drawing) and the cell under a point
+   // (for hit testing) are binary searches over the row and column
+   // positions, so the cost is O(log n + visible cells) regardless of the
+   // size of the grid.
+   //
+   // The first frozen_rows rows and frozen_cols columns are headers. When
+   // the grid is inside a scroller, these stay pinned to the top and left
+   // edges of the scroller's visible area.
+   ////////////////////////////////////////////////////////////////////////////
+   class dynamic_grid : public element
+   {
+   public:
+
+      using composer_ptr = std::shared_ptr<grid_composer>;
+      static constexpr auto npos = std::numeric_limits<std::size_t>::max();
+
+                              dynamic_grid(
+                                 composer_ptr composer
+                               , std::size_t frozen_rows = 0
+                               , std::size_t frozen_cols = 0
+                              )
+                               : _composer(composer)
+                               , _frozen_rows(frozen_rows)
+                               , _frozen_cols(frozen_cols)
+                              {}
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    draw(context const& ctx) override;
+      void                    layout(context const& ctx) override;
+
+      void                    update();
+      void                    update(basic_context const& ctx) const;
+      void                    resize(std::size_t rows, std::size_t columns);
+
+      std::size_t             frozen_rows() const { return _frozen_rows; }
+      std::size_t             frozen_cols() const { return _frozen_cols; }
+      void                    frozen(std::size_t rows, std::size_t cols);
+
+      bool                    wants_control() const override;
+      bool                    click(context const& ctx, mouse_button btn) override;
+      void                    drag(context const& ctx, mouse_button btn) override;
+      bool                    key(context const& ctx, key_info k) override;
+      bool                    text(context const& ctx, text_info info) override;
+      bool                    cursor(context const& ctx, point p, cursor_tracking status) override;
+      bool                    scroll(context const& ctx, point dir, point p) override;
+
+      bool                    wants_focus() const override;
+      void                    begin_focus() override;
+      void                    end_focus() override;
+      element const*          focus() const override;
+      element*                focus() override;
+      void                    focus(std::size_t row, std::size_t col);
+      virtual void            reset();
+
+      struct hit_info
+      {
+         element_ptr          element;
+         rect                 bounds   = rect{};
+         std::size_t          row      = npos;
+         std::size_t          col      = npos;
+      };
+
+      rect                    bounds_of(context const& ctx, std::size_t row, std::size_t col) const;
+      hit_info                hit_element(context const& ctx, point p, bool control) const;
+
+   private:
+
+      struct cell_info
+      {
+         element_ptr          elem_ptr;
+         int                  layout_id = -1;
+      };
+
+      // A region is a block of cells sharing the same offset: the scrolling
+      // body, the frozen header rows, the frozen header columns and the
+      // frozen corner. Regions are listed in paint order.
+      struct region
+      {
+         std::size_t          first_row, last_row;
+         std::size_t          first_col, last_col;
+         point                offset;
+         rect                 area;
+      };
+
+      struct cell_range
+      {
+         std::size_t          first_row = 0, last_row = 0;
+         std::size_t          first_col = 0, last_col = 0;
+
+         bool                 operator==(cell_range const& rhs) const;
+         bool                 operator!=(cell_range const& rhs) const { return !(*this == rhs); }
+      };
+
+      using regions = std::array<region, 4>;
+      using cells_map = std::unordered_map<std::uint64_t, cell_info>;
+
+      std::size_t             num_rows() const { return _row_pos.empty()? 0 : _row_pos.size()-1; }
+      std::size_t             num_cols() const { return _col_pos.empty()? 0 : _col_pos.size()-1; }
+      std::uint64_t           key_of(std::size_t row, std::size_t col) const;
+
+      point                   pin_offset(context const& ctx) const;
+      regions                 make_regions(rect const& bounds, point pin) const;
+      cell_range              visible_range(region const& rgn, rect const& bounds, rect area) const;
+      rect                    cell_bounds(rect const& bounds, region const& rgn, std::size_t row, std::size_t col) const;
+      cell_info&              get_cell(context const& ctx, std::size_t row, std::size_t col, rect const& bounds) const;
+      element*                cell_element(std::size_t row, std::size_t col) const;
+      void                    release_hidden_cells(context const& ctx, regions const& rgns);
+      void                    new_focus(context const& ctx, std::size_t row, std::size_t col);
+      bool                    is_tracked(std::size_t row, std::size_t col) const;
+
+      composer_ptr            _composer;
+      std::size_t             _frozen_rows;
+      std::size_t             _frozen_cols;
+
+      mutable std::vector<double> _row_pos;
+      mutable std::vector<double> _col_pos;
+      mutable cells_map       _cells;
+      mutable int             _layout_id = 0;
+      mutable bool            _update_request = true;
+
+      point                   _previous_size;
+      cell_range              _retained;
+
+      std::size_t             _focus_row = npos;
+      std::size_t             _focus_col = npos;
+      std::size_t             _click_row = npos;
+      std::size_t             _click_col = npos;
+      std::size_t             _hover_row = npos;
+      std::size_t             _hover_col = npos;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename Base>
+   template <typename... Rest>
+   inline static_limits_grid_composer<Base>::static_limits_grid_composer(
+      float row_height
+    , float column_width
+    , Rest&& ...rest
+   )
+    : Base(std::forward<Rest>(rest)...)
+    , _row_height(row_height)
+    , _column_width(column_width)
+   {}
+
+   template <typename Base>
+   inline float static_limits_grid_composer<Base>::row_height(
+      std::size_t /*row*/, basic_context const& /*ctx*/) const
+   {
+      return _row_height;
+   }
+
+   template <typename Base>
+   inline float static_limits_grid_composer<Base>::column_width(
+      std::size_t col, basic_context const& /*ctx*/) const
+   {
+      return (col < _column_widths.size())? _column_widths[col] : _column_width;
+   }
+
+   template <typename Base>
+   inline void static_limits_grid_composer<Base>::column_width(std::size_t col, float width)
+   {
+      if (col >= _column_widths.size())
+         _column_widths.resize(col+1, _column_width);
+      _column_widths[col] = width;
+   }
+}}
+
+#endif
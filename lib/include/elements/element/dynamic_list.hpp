@@ -279,6 +279,8 @@ namespace cycfi { namespace elements
       void                    	 focus(std::size_t index);
       virtual void            	 reset();
       void 						 resize(size_t n);
+      void                       insert(std::size_t pos, std::size_t num_items);
+      void                       erase(std::size_t pos, std::size_t num_items);
 
        struct hit_info
        {
@@ -311,6 +313,9 @@ namespace cycfi { namespace elements
 
    private:
 
+      void                       update_positions(basic_context const& ctx) const;
+      void                       shift_indices(std::size_t pos, std::ptrdiff_t delta, std::size_t num_erased = 0);
+
       composer_ptr               _composer;
       point                      _previous_size;
       std::size_t                _previous_window_start = 0;
@@ -319,6 +324,7 @@ namespace cycfi { namespace elements
       mutable double 			 _main_axis_full_size = 0;
       mutable int                _layout_id = 0;
       mutable bool               _update_request = true;
+      mutable std::size_t        _update_from = -1;
 
       int 					   	 _focus = -1;
       int 					     _saved_focus = -1;
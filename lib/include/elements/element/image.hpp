@@ -15,6 +15,9 @@ namespace cycfi { namespace elements
 {
    ////////////////////////////////////////////////////////////////////////////
    // Images
+   //
+   // Images loaded from files (including gizmos and sprites) share their
+   // pixmaps through the pixmap_cache.
    ////////////////////////////////////////////////////////////////////////////
    class image : public element
    {
@@ -30,6 +33,7 @@ namespace cycfi { namespace elements
    protected:
 
       elements::pixmap&       pixmap() const  { return *_pixmap.get(); }
+      pixmap_ptr const&       shared_pixmap() const  { return _pixmap; }
 
    private:
 
@@ -63,7 +67,14 @@ namespace cycfi { namespace elements
    // Variants of the gizmo are the hgizmo and vgizmo both having 3 patches
    // allowing resizing in one dimension (horozontally or vertically) only.
    //
+   // The patches are composed into a pixmap the size of the gizmo (in
+   // device pixels), which is then blitted on every draw. The composed
+   // pixmaps are kept in a small process-wide cache keyed by the source
+   // pixmap, the size and the device scale, so gizmos of the same image
+   // and size share one.
+   //
    ////////////////////////////////////////////////////////////////////////////
+
    class gizmo : public image
    {
    public:
@@ -7,10 +7,14 @@
 #define ELEMENTS_TEXT_APRIL_17_2016
 
 #include <elements/support/glyphs.hpp>
+#include <elements/support/text_search.hpp>
+#include <elements/support/text_storage.hpp>
 #include <elements/support/theme.hpp>
+#include <elements/support/undo_history.hpp>
 #include <elements/element/element.hpp>
 
 #include <infra/string_view.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -38,6 +42,24 @@ namespace cycfi { namespace elements
 
    ////////////////////////////////////////////////////////////////////////////
    // Static Text Box
+   //
+   // The text is held in a text_storage (a rope_text_storage by default),
+   // so edits are O(log n) and snapshots are cheap. get_text() flattens the
+   // storage into a string on demand.
+   //
+   // The text is laid out per paragraph (the text between newlines). Each
+   // paragraph is shaped and line-broken on its own, so an edit reshapes
+   // only the paragraphs it touches. The paragraphs that follow are just
+   // shifted by the number of bytes and rows added or removed.
+   //
+   // Spans of the text may be given their own font and size, or color (e.g.
+   // for syntax or search highlighting). Font spans reshape the paragraphs
+   // they touch. Color spans are applied when drawing only. The spans move
+   // along with the text as it is edited. All the rows have the height of
+   // the tallest font.
+   //
+   // find highlights all the occurrences of a pattern in the visible rows.
+   // The matches are kept up to date as the text is edited.
    ////////////////////////////////////////////////////////////////////////////
    class static_text_box
     : public element
@@ -59,29 +81,123 @@ namespace cycfi { namespace elements
       void                    layout(context const& ctx) override;
       void                    draw(context const& ctx) override;
 
-      std::string const&      get_text() const override            { return _text; }
+      std::string const&      get_text() const override;
       void                    set_text(string_view text) override;
 
-      std::string const&      value() const override           { return _text; }
+      std::string const&      value() const override           { return get_text(); }
       void                    value(string_view val) override;
 
-   private:
+      text_storage const&     storage() const                  { return *_storage; }
+      void                    storage(text_storage_ptr storage_);
 
-      void                    sync() const;
+      void                    font_span(std::size_t pos, std::size_t n, font font_, float size);
+      void                    color_span(std::size_t pos, std::size_t n, color color_);
+      void                    clear_font_spans(std::size_t pos = 0, std::size_t n = -1);
+      void                    clear_color_spans(std::size_t pos = 0, std::size_t n = -1);
+      font_runs const&        font_spans() const               { return _font_spans; }
+      color_runs const&       color_spans() const              { return _color_spans; }
+
+                              // Returns the number of matches
+      std::size_t             find(string_view pattern, bool ignore_case = false);
+      void                    clear_find();
+      text_search const&      find_results() const             { return _search; }
 
    protected:
 
-      std::string             _text;
+      struct paragraph
+      {
+                              paragraph(
+                                 std::string text_
+                               , std::size_t offset_
+                               , master_glyphs const& source
+                               , font_runs const& runs
+                              );
+
+         using cluster_position = glyphs::cluster_position;
+
+         void                 break_rows(float width_);
+         void                 index_rows();
+         std::size_t          find_row(std::size_t offset) const;
+         cluster_position const* find_cluster(std::size_t row, std::size_t offset) const;
+         cluster_position const* find_cluster(std::size_t row, float x) const;
+         cluster_position const& row_end(std::size_t row) const;
+
+         std::string          text;             // The paragraph text, sans the newline
+         master_glyphs        shape;            // The shaped text
+         std::vector<glyphs>  rows;             // The paragraph's rows
+         std::size_t          offset;           // Byte offset of the paragraph in the text
+         std::size_t          first_row = 0;    // Index of the paragraph's first row
+         float                width = -1;       // The width the rows were broken at
+         bool                 attributed;       // Has font runs
+
+         // The row index, built on demand by index_rows: the cluster
+         // positions of all the rows (offsets are relative to the paragraph)
+         // and the index of the first cluster of each row.
+         std::vector<cluster_position> clusters;
+         std::vector<std::size_t> row_clusters;
+      };
+
+      using paragraph_ptr = std::unique_ptr<paragraph>;
+      using paragraph_vector = std::vector<paragraph_ptr>;
+
+      void                    replace_text(std::size_t pos, std::size_t n, string_view str);
+
+                              // Called by replace_text after the text is
+                              // changed, with what was actually replaced.
+      virtual void            text_replaced(
+                                 std::size_t /* pos */
+                               , string_view /* removed */
+                               , string_view /* inserted */
+                              ) {}
+      std::size_t             num_rows() const;
+      glyphs::font_metrics    line_metrics() const;
+      paragraph_vector::const_iterator
+                              find_paragraph(std::size_t offset) const;
+      paragraph_vector::const_iterator
+                              find_paragraph_row(std::size_t row) const;
+
       mutable master_glyphs   _layout;
-      std::vector<glyphs>     _rows;
+      mutable paragraph_vector _paragraphs;
       color                   _color;
       point                   _current_size = { -1, -1 };
+
+   private:
+
+      void                    sync() const;
+      void                    split_paragraphs(
+                                 std::size_t first, std::size_t last
+                               , paragraph_vector& paragraphs
+                              ) const;
+      void                    update_paragraphs(
+                                 std::size_t pos
+                               , std::size_t erased, std::size_t inserted
+                              );
+      void                    break_rows(float width) const;
+      void                    draw_matches(context const& ctx, std::size_t row, float bottom);
+      void                    shift_spans(
+                                 std::size_t pos
+                               , std::size_t erased, std::size_t inserted
+                              );
+
+      text_storage_ptr        _storage;
+      font_runs               _font_spans;
+      color_runs              _color_spans;
+      color_runs              _row_colors;
+      text_search             _search;
+      mutable glyphs::font_metrics _metrics;
+      mutable std::string     _text;
+      mutable bool            _text_valid = false;
+      mutable std::size_t     _rows_from = 0;
+      mutable float           _rows_width = -1;
    };
 
    ////////////////////////////////////////////////////////////////////////////
    // Editable Text Box
+   //
+   // Edits are added to the view's undo_history as deltas. Consecutive
+   // typing and deleting are coalesced into a single undo step.
    ////////////////////////////////////////////////////////////////////////////
-   class basic_text_box : public static_text_box
+   class basic_text_box : public static_text_box, public undoable_text
    {
    public:
                               basic_text_box(
@@ -115,6 +231,17 @@ namespace cycfi { namespace elements
       void                    select_all();
       void                    select_none();
 
+                              // Select the next or previous find match,
+                              // wrapping around. Returns false if there are
+                              // no matches.
+      bool                    select_next_match(context const& ctx);
+      bool                    select_prev_match(context const& ctx);
+
+      void                    apply_delta(
+                                 std::size_t pos, std::size_t n, string_view str
+                               , int select_start, int select_end
+                              ) override;
+
       virtual void            draw_selection(context const& ctx);
       virtual void            draw_caret(context const& ctx);
       virtual bool            word_break(char const* utf8) const;
@@ -132,27 +259,34 @@ namespace cycfi { namespace elements
 
       struct glyph_metrics
       {
-         char const* str;           // The start of the utf8 string
+         int         index;         // Byte index of the glyph (-1 if none)
          point       pos;           // Position where glyph is drawn
          rect        bounds;        // Glyph bounds
          float       line_height;   // Line height
       };
 
-      char const*             caret_position(context const& ctx, point p);
-      glyph_metrics           glyph_info(context const& ctx, char const* s);
-
-      struct state_saver;
-      using state_saver_f = std::function<void()>;
-
-      state_saver_f           capture_state();
+      int                     caret_position(context const& ctx, point p);
+      glyph_metrics           glyph_info(context const& ctx, int index);
+
+      void                    text_replaced(
+                                 std::size_t pos
+                               , string_view removed
+                               , string_view inserted
+                              ) override;
+      void                    commit_edits(
+                                 context const& ctx
+                               , undo_history::selection before
+                               , bool coalesce
+                              );
 
       int                     _select_start;
       int                     _select_end;
       float                   _current_x;
-      state_saver_f           _typing_state;
+      std::vector<text_delta> _edits;           // Recorded, not yet committed
       bool                    _is_focus : 1;
       bool                    _show_caret : 1;
       bool                    _caret_started : 1;
+      bool                    _recording : 1;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,105 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_VIEWER_OCTOBER_19_2026)
+#define ELEMENTS_TEXT_VIEWER_OCTOBER_19_2026
+
+#include <elements/support/glyphs.hpp>
+#include <elements/support/text_source.hpp>
+#include <elements/support/theme.hpp>
+#include <elements/element/element.hpp>
+
+#include <infra/filesystem.hpp>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Text Viewer
+   //
+   // A read-only viewer for very large text, such as log files. The text is
+   // read from a text_source (e.g. a file) and is never held in memory as
+   // a whole. Line starts are indexed by a background thread.
+   // Only the visible lines are read, shaped and drawn. Recently shaped
+   // lines are kept in a small cache.
+   //
+   // Lines are not wrapped. Very long lines are truncated to max_line_size
+   // bytes for display.
+   //
+   // In follow mode (like tail -f), the source is polled for new data and
+   // the view scrolls to the end whenever lines are added. The text_viewer
+   // is meant to be placed inside a scroller.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_viewer : public element
+   {
+   public:
+
+      static constexpr std::size_t max_line_size = 4096;
+
+                              text_viewer(
+                                 text_source_ptr source
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                               , color color_      = get_theme().text_box_font_color
+                              );
+
+                              text_viewer(
+                                 fs::path const& path
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                               , color color_      = get_theme().text_box_font_color
+                              );
+
+                              ~text_viewer();
+
+                              text_viewer(text_viewer&& rhs) = default;
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    draw(context const& ctx) override;
+
+      std::size_t             num_lines() const;
+      bool                    indexing() const;
+      std::string             line(std::size_t i) const;
+
+      bool                    follow() const;
+      void                    follow(view& view_, bool follow_);
+      void                    go_to_line(view& view_, std::size_t line);
+
+   private:
+
+      struct line_index;
+      struct poll_state;
+
+      using poll_state_ptr = std::shared_ptr<poll_state>;
+
+      struct shaped_line
+      {
+         std::size_t          line;
+         std::size_t          size;             // The raw line size in the source
+         std::string          text;             // The displayed text
+         master_glyphs        shape;
+      };
+
+      using line_cache = std::list<shaped_line>;
+      using line_cache_index = std::unordered_map<std::size_t, line_cache::iterator>;
+
+      float                   line_height() const;
+      glyphs&                 get_line(std::size_t line, std::size_t max_cache);
+      static void             poll(poll_state_ptr const& state, view& view_);
+
+      std::shared_ptr<line_index> _index;
+      poll_state_ptr          _poll;
+      master_glyphs           _font;
+      color                   _color;
+      line_cache              _cache;
+      line_cache_index        _cache_index;
+   };
+}}
+
+#endif
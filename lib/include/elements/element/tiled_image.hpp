@@ -0,0 +1,198 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TILED_IMAGE_OCTOBER_19_2026)
+#define ELEMENTS_TILED_IMAGE_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <elements/support/pixmap.hpp>
+#include <infra/filesystem.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_source: The tiles of a tiled_image
+   //
+   // The image is a pyramid of levels. Level 0 is the full image, and each
+   // level above it is half the size of the one below (rounded up), up to
+   // the first one that fits in a single tile. Each level is cut into
+   // tile_size x tile_size tiles, from the top-left. The tiles at the right
+   // and bottom edges may be smaller. Sizes are in pixels.
+   //
+   // load returns the tile at (col, row) of a level, or nullptr if there is
+   // none. Sources that have only the full image may return nullptr for the
+   // levels above 0: tile then makes those from the 4 tiles below them.
+   // Both are called from worker threads, possibly concurrently.
+   ////////////////////////////////////////////////////////////////////////////
+   class tile_source
+   {
+   public:
+                              tile_source(int width, int height, int tile_size = 256);
+      virtual                 ~tile_source() = default;
+
+      int                     width() const           { return _width; }
+      int                     height() const          { return _height; }
+      int                     tile_size() const       { return _tile_size; }
+      int                     num_levels() const      { return _num_levels; }
+      int                     level_width(int level) const;
+      int                     level_height(int level) const;
+      int                     columns(int level) const;
+      int                     rows(int level) const;
+
+      virtual pixmap_ptr      load(int level, int col, int row) = 0;
+      pixmap_ptr              tile(int level, int col, int row);
+
+   protected:
+                              // Downsamples the tiles below. complete is
+                              // set to false if some of those are missing.
+      pixmap_ptr              load_from_below(int level, int col, int row, bool& complete);
+
+   private:
+
+      int                     _width;
+      int                     _height;
+      int                     _tile_size;
+      int                     _num_levels;
+   };
+
+   using tile_source_ptr = std::shared_ptr<tile_source>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_provider: A tile_source that calls a function for its tiles
+   ////////////////////////////////////////////////////////////////////////////
+   class tile_provider : public tile_source
+   {
+   public:
+
+      using function = std::function<pixmap_ptr(int level, int col, int row)>;
+
+                              tile_provider(
+                                 int width, int height
+                               , function f, int tile_size = 256
+                              );
+
+      pixmap_ptr              load(int level, int col, int row) override;
+
+   private:
+
+      function                _f;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // disk_tile_cache: Generates the tile pyramid of another source on disk,
+   // as PNG files in dir, on demand. Tiles that are already there are read
+   // back instead. The levels above 0 that the source does not provide are
+   // made from the cached tiles below them. The cache is discarded if the
+   // size of the source (or its tile size) changes.
+   ////////////////////////////////////////////////////////////////////////////
+   class disk_tile_cache : public tile_source
+   {
+   public:
+                              disk_tile_cache(tile_source_ptr source, fs::path dir);
+
+      pixmap_ptr              load(int level, int col, int row) override;
+
+   private:
+
+      fs::path                tile_path(int level, int col, int row) const;
+
+      tile_source_ptr         _source;
+      fs::path                _dir;
+   };
+
+   namespace detail
+   {
+      struct tiled_image_state;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Tiled Image
+   //
+   // An image too big to be a single pixmap, such as a huge scan, drawn from
+   // a tile_source. Only the tiles that intersect the visible area are
+   // loaded, at the level that best fits the current zoom (the transform
+   // and device scale). Tiles are loaded in the background by a small pool
+   // of worker threads, the ones nearest the center of the view first, and
+   // requests for tiles that scroll out of view are dropped. Until a tile
+   // arrives, a coarser one already in memory is drawn in its place.
+   //
+   // Loaded tiles are kept in an LRU cache of cache_budget bytes. The size
+   // of the element is the size of the image, in pixels. Place it in a
+   // scroller (and a scale element, for zooming).
+   ////////////////////////////////////////////////////////////////////////////
+   class tiled_image : public element
+   {
+   public:
+
+      static constexpr std::size_t default_cache_budget = 128 * 1024 * 1024;
+
+                              tiled_image(tile_source_ptr source);
+                              ~tiled_image();
+
+                              tiled_image(tiled_image&& rhs) = default;
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    draw(context const& ctx) override;
+
+      tile_source&            source() const          { return *_source; }
+      std::size_t             cache_budget() const    { return _budget; }
+      void                    cache_budget(std::size_t budget);
+
+   protected:
+
+      virtual void            draw_placeholder(context const& ctx, rect bounds);
+
+   private:
+
+      friend struct detail::tiled_image_state;
+
+      struct tile_key
+      {
+         bool                 operator==(tile_key const& rhs) const;
+
+         int                  level;
+         int                  col;
+         int                  row;
+      };
+
+      struct tile_key_hash
+      {
+         std::size_t          operator()(tile_key const& key) const;
+      };
+
+      struct cached_tile
+      {
+         tile_key             key;
+         pixmap_ptr           pixmap;
+         std::size_t          bytes;
+         std::uint64_t        frame;            // The frame it was last drawn in
+      };
+
+      using tile_list = std::list<cached_tile>;
+      using tile_map = std::unordered_map<tile_key, tile_list::iterator, tile_key_hash>;
+      using state_ptr = std::shared_ptr<detail::tiled_image_state>;
+
+      cached_tile*            find(tile_key key);
+      void                    add(tile_key key, pixmap_ptr pm);
+      void                    trim();
+      bool                    draw_tile(context const& ctx, tile_key key, rect dest);
+
+      tile_source_ptr         _source;
+      state_ptr               _state;
+      tile_list               _tiles;           // Most recently used first
+      tile_map                _map;
+      std::size_t             _bytes = 0;
+      std::size_t             _budget = default_cache_budget;
+      std::uint64_t           _frame = 0;
+   };
+}}
+
+#endif
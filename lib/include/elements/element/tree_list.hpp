@@ -0,0 +1,134 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TREE_LIST_OCTOBER_19_2026)
+#define ELEMENTS_TREE_LIST_OCTOBER_19_2026
+
+#include <elements/element/dynamic_list.hpp>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree model abstract class
+   //
+   // Nodes are identified by an opaque node_id chosen by the model. The
+   // root node is not displayed; its children are the top-level rows.
+   ////////////////////////////////////////////////////////////////////////////
+   class tree_model : public std::enable_shared_from_this<tree_model>
+   {
+   public:
+
+      using node_id = std::uint64_t;
+
+      virtual                 ~tree_model() = default;
+
+      virtual node_id         root() const = 0;
+      virtual std::size_t     child_count(node_id node) const = 0;
+      virtual node_id         child(node_id node, std::size_t index) const = 0;
+      virtual element_ptr     compose(node_id node) = 0;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree cell composer maintains the flattened list of visible rows
+   // (the nodes whose ancestors are all expanded, in depth-first order).
+   // Expanding a node inserts its visible descendants right after it, and
+   // collapsing a node removes them; the rest of the rows are untouched and
+   // the model is not walked again. Expanded nodes are remembered, so
+   // collapsing and re-expanding a node restores its subtree as it was.
+   ////////////////////////////////////////////////////////////////////////////
+   class tree_cell_composer : public static_limits_cell_composer<>
+   {
+   public:
+
+      using model_ptr = std::shared_ptr<tree_model>;
+      using node_id = tree_model::node_id;
+
+                              tree_cell_composer(
+                                 model_ptr model
+                               , float min_width, float row_height, float indent
+                              );
+
+      std::size_t             size() const override { return _rows.size(); }
+      void                    resize(size_t /*s*/) override {}
+      element_ptr             compose(std::size_t index) override;
+
+      void                    rebuild();
+      std::size_t             expand(std::size_t row);
+      std::size_t             collapse(std::size_t row);
+
+      node_id                 node(std::size_t row) const { return _rows[row].node; }
+      std::size_t             depth(std::size_t row) const { return _rows[row].depth; }
+      bool                    is_expanded(node_id node) const;
+      bool                    has_children(std::size_t row) const;
+      float                   indent() const { return _indent; }
+
+   private:
+
+      struct row_info
+      {
+         node_id              node;
+         std::uint32_t        depth;
+      };
+
+      using rows_vector = std::vector<row_info>;
+
+      void                    flatten(node_id node, std::uint32_t depth, rows_vector& rows) const;
+
+      model_ptr               _model;
+      float                   _indent;
+      rows_vector             _rows;
+      std::unordered_set<node_id> _expanded;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree_list class
+   //
+   // A vertical dynamic_list of fixed-height rows presenting a tree_model.
+   // Each row is indented by its depth and shows a disclosure icon if the
+   // node has children. Clicking the icon expands or collapses the node.
+   // Expanding a node costs O(visible descendants) model calls, regardless
+   // of the size of the tree.
+   ////////////////////////////////////////////////////////////////////////////
+   class tree_list : public dynamic_list
+   {
+   public:
+
+      using model_ptr = tree_cell_composer::model_ptr;
+      using node_id = tree_model::node_id;
+
+                              tree_list(
+                                 model_ptr model
+                               , float min_width, float row_height
+                               , float indent = 16
+                              );
+
+      bool                    click(context const& ctx, mouse_button btn) override;
+
+      void                    rebuild();
+      std::size_t             num_rows() const { return _tree->size(); }
+      node_id                 node(std::size_t row) const { return _tree->node(row); }
+      std::size_t             depth(std::size_t row) const { return _tree->depth(row); }
+      bool                    is_expanded(std::size_t row) const;
+      bool                    has_children(std::size_t row) const;
+
+      void                    expand(std::size_t row);
+      void                    collapse(std::size_t row);
+      void                    toggle(std::size_t row);
+
+   private:
+
+      using tree_composer_ptr = std::shared_ptr<tree_cell_composer>;
+
+                              tree_list(tree_composer_ptr tree);
+
+      tree_composer_ptr       _tree;
+   };
+}}
+
+#endif
@@ -12,14 +12,24 @@
 #include <elements/support/circle.hpp>
 #include <elements/support/color.hpp>
 #include <elements/support/context.hpp>
+#include <elements/support/display_list.hpp>
 #include <elements/support/font.hpp>
 #include <elements/support/glyphs.hpp>
+#include <elements/support/icon_atlas.hpp>
 #include <elements/support/icon_ids.hpp>
+#include <elements/support/mapped_file.hpp>
 #include <elements/support/pixmap.hpp>
+#include <elements/support/pixmap_cache.hpp>
 #include <elements/support/point.hpp>
 #include <elements/support/rect.hpp>
+#include <elements/support/resource_bundle.hpp>
+#include <elements/support/shaped_text.hpp>
+#include <elements/support/text_search.hpp>
+#include <elements/support/text_source.hpp>
 #include <elements/support/draw_utils.hpp>
+#include <elements/support/text_storage.hpp>
 #include <elements/support/text_utils.hpp>
 #include <elements/support/theme.hpp>
+#include <elements/support/undo_history.hpp>
 
 #endif
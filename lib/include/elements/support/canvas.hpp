@@ -13,19 +13,22 @@
 #include <elements/support/font.hpp>
 #include <infra/filesystem.hpp>
 
+#include <array>
 #include <vector>
 #include <functional>
-#include <stack>
 #include <cmath>
 #include <cassert>
 
 extern "C"
 {
    typedef struct _cairo cairo_t;
+   typedef struct _cairo_pattern cairo_pattern_t;
 }
 
 namespace cycfi { namespace elements
 {
+   class display_list;
+
    class canvas
    {
    public:
@@ -127,6 +130,10 @@ namespace cycfi { namespace elements
       void              stroke_rect(elements::rect r);
       void              stroke_round_rect(elements::rect r, float radius);
 
+                        // Fills the blurred shadow of a round rect, with a
+                        // gaussian of standard deviation blur.
+      void              fill_shadow(elements::rect r, float radius, float blur);
+
       ///////////////////////////////////////////////////////////////////////////////////
       // Font
       void              font(elements::font const& font_);
@@ -169,6 +176,11 @@ namespace cycfi { namespace elements
       void              draw(pixmap const& pm, elements::rect dest);
       void              draw(pixmap const& pm, point pos);
 
+                        // Draws a8 pixmaps (masks) in the fill style
+      void              draw_mask(pixmap const& pm, elements::rect src, elements::rect dest);
+      void              draw_mask(pixmap const& pm, elements::rect dest);
+      void              draw_mask(pixmap const& pm, point pos);
+
       ///////////////////////////////////////////////////////////////////////////////////
       // States
       class state
@@ -191,29 +203,106 @@ namespace cycfi { namespace elements
       void              save();
       void              restore();
 
+      ///////////////////////////////////////////////////////////////////////////////////
+      // Recording
+
+                        // Records what is drawn (see display_list), from
+                        // now until stop_recording. list is cleared first.
+      void              record(display_list& list);
+      void              stop_recording();
+      display_list*     recording() const    { return _recording; }
+
    private:
 
       friend class glyphs;
+      friend class display_list;
+
+      // Composite operations (pixmaps, shadows, text) are recorded as one
+      // command. The canvas calls they make are not.
+      class pause_recording
+      {
+      public:
+                        pause_recording(canvas& cnv_)
+                         : cnv(cnv_), list(cnv_._recording)
+                        { cnv._recording = nullptr; }
+                        pause_recording(pause_recording const&) = delete;
+                        ~pause_recording() { cnv._recording = list; }
+
+      private:
+
+         canvas&        cnv;
+         display_list*  list;
+      };
 
       void              apply_fill_style();
       void              apply_stroke_style();
 
+      // The pattern space of a gradient. Gradients share cached patterns
+      // defined in a unit space, and this maps user space to that.
+      struct pattern_matrix
+      {
+         double         xx, yx;
+         double         xy, yy;
+         double         x0, y0;
+      };
+
+      // A fill or stroke style: a color or a (gradient) pattern. Copying
+      // a pattern adds a reference, so styles are copied (on save and
+      // restore) without allocating.
+      class paint
+      {
+      public:
+                        paint() = default;
+                        paint(paint const& rhs);
+                        paint(paint&& rhs) noexcept;
+                        ~paint();
+
+         paint&         operator=(paint const& rhs);
+         paint&         operator=(paint&& rhs) noexcept;
+         explicit       operator bool() const { return _kind != none; }
+         bool           is_pattern() const { return _kind == pattern; }
+
+         void           set(color c);
+         void           set(cairo_pattern_t* pattern, pattern_matrix const& mat); // Takes ownership
+         void           apply(cairo_t& context) const;
+
+      private:
+
+         enum kind_enum { none, solid, pattern };
+
+         kind_enum      _kind = none;
+         color          _color;
+         cairo_pattern_t* _pattern = nullptr;
+         pattern_matrix _matrix = { 1, 0, 0, 1, 0, 0 };
+      };
+
       struct canvas_state
       {
-         std::function<void()>   stroke_style;
-         std::function<void()>   fill_style;
+         paint                   stroke_style;
+         paint                   fill_style;
          int                     align          = 0;
 
          enum pattern_state { none_set, stroke_set, fill_set };
          pattern_state           pattern_set = none_set;
       };
 
-      using state_stack = std::stack<canvas_state>;
+      // The first few saved states are kept in a small fixed array. Most
+      // canvases (e.g. those made for measuring text) save little or not
+      // at all, and this keeps them small. Deeper nesting spills over to
+      // the heap. The spill storage is pooled (per thread) and reused by
+      // later canvases.
+      static constexpr std::size_t max_saved_states = 4;
+      static constexpr std::size_t min_spill_capacity = 32;
+
+      using saved_states = std::array<canvas_state, max_saved_states>;
 
       cairo_t&          _context;
       canvas_state      _state;
-      state_stack       _state_stack;
+      saved_states      _saved;
+      std::size_t       _depth = 0;
+      std::vector<canvas_state> _spill;
       float             _pre_scale = 1.0f;
+      display_list*     _recording = nullptr;
    };
 }}
 
@@ -59,11 +59,6 @@ namespace cycfi { namespace elements
       stroke();
    }
 
-   inline void canvas::text_align(int align)
-   {
-      _state.align = align;
-   }
-
    inline void canvas::draw(pixmap const& pm, elements::rect dest)
    {
       draw(pm, { 0, 0, pm.size() }, dest);
@@ -74,6 +69,16 @@ namespace cycfi { namespace elements
       draw(pm, { 0, 0, pm.size() }, { pos, pm.size() });
    }
 
+   inline void canvas::draw_mask(pixmap const& pm, elements::rect dest)
+   {
+      draw_mask(pm, { 0, 0, pm.size() }, dest);
+   }
+
+   inline void canvas::draw_mask(pixmap const& pm, point pos)
+   {
+      draw_mask(pm, { 0, 0, pm.size() }, { pos, pm.size() });
+   }
+
    inline canvas::state::state(canvas& cnv_)
      : cnv(&cnv_)
    {
@@ -102,12 +107,15 @@ namespace cycfi { namespace elements
       return *this;
    }
 
+   // Patterns are shared (see fill_style), and their matrix may have been
+   // changed by another user since. They are always applied again.
    inline void canvas::apply_fill_style()
    {
       if (_state.pattern_set != _state.fill_set && _state.fill_style)
       {
-         _state.fill_style();
-         _state.pattern_set = _state.fill_set;
+         _state.fill_style.apply(_context);
+         _state.pattern_set =
+            _state.fill_style.is_pattern()? _state.none_set : _state.fill_set;
       }
    }
 
@@ -115,8 +123,9 @@ namespace cycfi { namespace elements
    {
       if (_state.pattern_set != _state.stroke_set && _state.stroke_style)
       {
-         _state.stroke_style();
-         _state.pattern_set = _state.stroke_set;
+         _state.stroke_style.apply(_context);
+         _state.pattern_set =
+            _state.stroke_style.is_pattern()? _state.none_set : _state.stroke_set;
       }
    }
 
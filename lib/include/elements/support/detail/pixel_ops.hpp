@@ -0,0 +1,61 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DETAIL_PIXEL_OPS_OCTOBER_19_2026)
+#define ELEMENTS_DETAIL_PIXEL_OPS_OCTOBER_19_2026
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace cycfi { namespace elements { namespace detail
+{
+   // Converts straight (non-premultiplied) RGBA bytes to cairo's
+   // CAIRO_FORMAT_ARGB32: native endian 32-bit ARGB, with premultiplied
+   // alpha. Vectorized with AVX2 (if the CPU supports it) or SSE2, with a
+   // scalar fallback. Large images are converted in parallel.
+   void rgba_to_argb32(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   );
+
+   // Extracts the alpha of ARGB32 pixels into A8 pixels
+   void argb32_to_a8(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   );
+
+   // Halves a 32-bit per pixel image (ARGB32 or RGB24) with a 2x2 box
+   // filter, averaging each channel. The destination is (width+1)/2 by
+   // (height+1)/2 pixels; odd edges reuse the last row or column.
+   void downsample_2x(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   );
+
+   // Blurs A8 pixels, in place, with an approximate gaussian of the given
+   // standard deviation (in pixels). The pixels beyond the edges are taken
+   // as transparent.
+   void blur_a8(
+      std::uint8_t* data, std::size_t stride
+    , int width, int height, float sigma
+   );
+
+   // The box radius blur_a8 uses for sigma. The blur reaches 3 times that
+   // far (one box per pass).
+   int blur_a8_radius(float sigma);
+
+   // Calls f(first_row, last_row) for bands of rows, in parallel if there
+   // are enough pixels to make it worthwhile.
+   void parallel_rows(
+      int width, int height
+    , std::function<void(int first, int last)> const& f
+   );
+}}}
+
+#endif
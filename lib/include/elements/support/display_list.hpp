@@ -0,0 +1,126 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DISPLAY_LIST_OCTOBER_19_2026)
+#define ELEMENTS_DISPLAY_LIST_OCTOBER_19_2026
+
+#include <elements/support/canvas.hpp>
+#include <elements/support/pixmap.hpp>
+#include <cairo.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iosfwd>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // display_list: A recording of canvas calls
+   //
+   // A canvas records into a display_list (see canvas::record) while it
+   // draws: paths, styles, transforms, states, text, glyph runs, pixmap
+   // and mask blits, and shadows. The commands are kept in a compact byte
+   // buffer. Pixmaps and fonts are referenced, not copied: the list keeps
+   // their cairo surfaces and font faces alive, and share the mip chains
+   // of mipmapped pixmaps, so a replay draws from the same variants.
+   //
+   // A list can be replayed onto any canvas, compared or hashed (to tell
+   // if a frame draws the same as the last one), and written out as text,
+   // for offline profiling. Drawing done through the canvas' cairo_context
+   // directly is not recorded.
+   ////////////////////////////////////////////////////////////////////////////
+   class display_list
+   {
+   public:
+                              display_list() = default;
+                              display_list(display_list&& rhs) noexcept;
+                              display_list(display_list const&) = delete;
+                              ~display_list();
+
+      display_list&           operator=(display_list&& rhs) noexcept;
+      display_list&           operator=(display_list const&) = delete;
+
+      bool                    operator==(display_list const& rhs) const;
+      bool                    operator!=(display_list const& rhs) const;
+
+      void                    clear();
+      bool                    empty() const     { return _count == 0; }
+      std::size_t             count() const     { return _count; }
+      std::size_t             bytes() const     { return _buffer.size(); }
+      std::uint64_t           hash() const;
+
+      void                    replay(canvas& cnv) const;
+      void                    write(std::ostream& out) const;
+
+   private:
+
+      friend class canvas;
+      friend class glyphs;
+
+      enum class op : std::uint8_t
+      {
+         save, restore,
+         translate, rotate, scale, skew,
+         begin_path, close_path, fill, fill_preserve, stroke, stroke_preserve, clip,
+         move_to, line_to, arc, rect, round_rect,
+         fill_color, stroke_color, line_width, linear_gradient, radial_gradient,
+         fill_rule, shadow,
+         font, font_size, text_align, fill_text, stroke_text, glyphs,
+         draw, draw_mask
+      };
+
+      template <typename... T>
+      void                    add(op o, T const&... args);
+
+      template <typename T>
+      void                    put(T const& val);
+      void                    put_string(char const* utf8);
+      void                    put_surface(cairo_surface_t* surface, std::uint32_t generation);
+      void                    put_pixmap(pixmap const& pm);
+      void                    put_font(cairo_font_face_t* face);
+      void                    put_scaled_font(cairo_scaled_font_t* font);
+
+      void                    add_glyphs(
+                                 cairo_scaled_font_t* font
+                               , cairo_glyph_t const* glyphs, int num_glyphs
+                               , point offset, color const* c
+                              );
+
+      std::vector<std::uint8_t>        _buffer;
+      std::size_t                      _count = 0;
+      std::vector<cairo_surface_t*>    _surfaces;
+      std::vector<pixmap::variants_ptr> _variants;
+      std::vector<cairo_font_face_t*>  _fonts;
+      std::vector<cairo_scaled_font_t*> _scaled_fonts;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   inline void display_list::put(T const& val)
+   {
+      auto  size_ = _buffer.size();
+      _buffer.resize(size_ + sizeof(T));
+      std::memcpy(_buffer.data() + size_, &val, sizeof(T));
+   }
+
+   template <typename... T>
+   inline void display_list::add(op o, T const&... args)
+   {
+      put(o);
+      (void)std::initializer_list<int>{ (put(args), 0)... };
+      ++_count;
+   }
+
+   inline bool display_list::operator!=(display_list const& rhs) const
+   {
+      return !(*this == rhs);
+   }
+}}
+
+#endif
@@ -8,6 +8,7 @@
 
 #include <infra/string_view.hpp>
 #include <infra/filesystem.hpp>
+#include <cstdint>
 #include <vector>
 
 extern "C"
@@ -54,8 +55,18 @@ namespace cycfi { namespace elements
       };
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // font_descr: A comma separated list of font families (the first one
+   // that is installed is used) and the desired weight, slant and stretch.
+   //
+   // The hash of the families is computed once, on construction, so that
+   // fonts can be looked up by font_descr quickly. The families string is
+   // not copied and must outlive the font_descr.
+   ////////////////////////////////////////////////////////////////////////////
    struct font_descr
    {
+      constexpr            font_descr(string_view families = {});
+
       font_descr           normal() const;
 
       font_descr           weight(font_constants::weight_enum w) const;
@@ -86,7 +97,12 @@ namespace cycfi { namespace elements
       font_descr           extra_expanded() const;
       font_descr           ultra_expanded() const;
 
+      std::uint64_t        hash() const;
+      bool                 operator==(font_descr const& rhs) const;
+      bool                 operator!=(font_descr const& rhs) const;
+
       string_view          _families;
+      std::uint64_t        _families_hash;
       uint8_t              _weight = font_constants::weight_normal;
       uint8_t              _slant = font_constants::slant_normal;
       uint8_t              _stretch = font_constants::stretch_normal;
@@ -104,6 +120,10 @@ namespace cycfi { namespace elements
       font&                operator=(font&& rhs) noexcept;
       explicit             operator bool() const;
 
+                           // Fonts are equal if they have the same face
+      bool                 operator==(font const& rhs) const;
+      bool                 operator!=(font const& rhs) const;
+
    private:
 
       friend class canvas;
@@ -113,6 +133,51 @@ namespace cycfi { namespace elements
    ////////////////////////////////////////////////////////////////////////////
    // Inlines
    ////////////////////////////////////////////////////////////////////////////
+   namespace detail
+   {
+      constexpr std::uint64_t fnv_basis = 14695981039346656037ull;
+      constexpr std::uint64_t fnv_prime = 1099511628211ull;
+
+      constexpr std::uint64_t fnv1a(string_view s, std::uint64_t h = fnv_basis)
+      {
+         for (auto c : s)
+         {
+            h ^= std::uint8_t(c);
+            h *= fnv_prime;
+         }
+         return h;
+      }
+   }
+
+   constexpr font_descr::font_descr(string_view families)
+    : _families(families)
+    , _families_hash(detail::fnv1a(families))
+   {}
+
+   inline std::uint64_t font_descr::hash() const
+   {
+      auto h = _families_hash;
+      h = (h ^ _weight) * detail::fnv_prime;
+      h = (h ^ _slant) * detail::fnv_prime;
+      h = (h ^ _stretch) * detail::fnv_prime;
+      return h;
+   }
+
+   inline bool font_descr::operator==(font_descr const& rhs) const
+   {
+      return _families_hash == rhs._families_hash
+         && _weight == rhs._weight
+         && _slant == rhs._slant
+         && _stretch == rhs._stretch
+         && _families == rhs._families
+         ;
+   }
+
+   inline bool font_descr::operator!=(font_descr const& rhs) const
+   {
+      return !(*this == rhs);
+   }
+
    inline font_descr font_descr::normal() const
    {
       font_descr r = *this;
@@ -306,11 +371,26 @@ namespace cycfi { namespace elements
       return _handle;
    }
 
+   inline bool font::operator==(font const& rhs) const
+   {
+      return _handle == rhs._handle;
+   }
+
+   inline bool font::operator!=(font const& rhs) const
+   {
+      return _handle != rhs._handle;
+   }
+
 #if defined(__APPLE__)
    fs::path get_user_fonts_directory();
 #endif
 
    std::vector<fs::path>& font_paths();
+
+   // The directory where the index of the installed fonts is cached, to
+   // speed up startup. Defaults to the user's cache directory. Set to an
+   // empty path, before any font is created, to disable the cache.
+   fs::path& font_index_path();
 }}
 
 #endif
@@ -11,12 +11,39 @@
 #include <elements/support/canvas.hpp>
 #include <elements/support/text_utils.hpp>
 #include <cairo.h>
+#include <algorithm>
 #include <vector>
 #include <stdexcept>
 #include <string>
 
 namespace cycfi { namespace elements
 {
+   ////////////////////////////////////////////////////////////////////////////
+   // Attributed text runs. Offsets and lengths are in bytes, relative to the
+   // start of the text. The runs are sorted and do not overlap. Font runs are
+   // shaped, each with its own font and size, but are line-broken together.
+   // Color runs are applied only when drawing, so recoloring a run does not
+   // reshape anything. Text not covered by a run gets the default font or
+   // color.
+   ////////////////////////////////////////////////////////////////////////////
+   struct font_run
+   {
+      std::size_t          offset;
+      std::size_t          length;
+      font                 font_;
+      float                size;
+   };
+
+   struct color_run
+   {
+      std::size_t          offset;
+      std::size_t          length;
+      color                color_;
+   };
+
+   using font_runs = std::vector<font_run>;
+   using color_runs = std::vector<color_run>;
+
    ////////////////////////////////////////////////////////////////////////////
    // glyphs: Text drawing and measuring utility
    ////////////////////////////////////////////////////////////////////////////
@@ -34,12 +61,23 @@ namespace cycfi { namespace elements
                            );
 
       void                 draw(point pos, canvas& canvas_);
+      void                 draw(point pos, canvas& canvas_, color_runs const& colors);
       float                width() const;
 
                            // for_each F signature:
                            // bool f(char const* utf8, float left, float right);
                            template <typename F>
-      void                 for_each(F f);
+      void                 for_each(F f) const;
+
+      struct cluster_position
+      {
+         std::size_t       offset;  // Byte offset from begin()
+         float             x;       // Offset from the start of the glyphs
+      };
+
+                           // Appends the position of each cluster, followed
+                           // by the end (size(), width()).
+      void                 cluster_positions(std::vector<cluster_position>& positions) const;
 
       std::size_t          size() const      { return _last - _first; }
       char const*          begin() const     { return _first; }
@@ -52,9 +90,14 @@ namespace cycfi { namespace elements
          float             leading;
       };
 
+                           // The maximum metrics of all the fonts, if the
+                           // text is attributed.
       font_metrics         metrics() const;
 
    protected:
+
+      friend class master_glyphs;
+
                            glyphs(char const* first, char const* last);
 
       using scaled_font = cairo_scaled_font_t;
@@ -62,6 +105,16 @@ namespace cycfi { namespace elements
       using cluster = cairo_text_cluster_t;
       using cluster_flags = cairo_text_cluster_flags_t;
 
+      // The glyphs of attributed text are shaped in runs, each with its own
+      // scaled font. The runs are owned by the master_glyphs.
+      struct shaped_run
+      {
+         scaled_font*      font;
+         glyph const*      last;             // One past the run's last glyph
+      };
+
+      scaled_font*         font_of(glyph const* g) const;
+
       char const*          _first;
       char const*          _last;
       scaled_font*         _scaled_font   = nullptr;
@@ -70,6 +123,8 @@ namespace cycfi { namespace elements
       cluster*             _clusters      = nullptr;
       int                  _cluster_count = 0;
       cluster_flags        _clusterflags;
+      shaped_run const*    _runs          = nullptr;
+      int                  _run_count     = 0;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -94,6 +149,21 @@ namespace cycfi { namespace elements
                             , point start = { 0, 0 }
                            );
 
+                           master_glyphs(
+                              char const* first, char const* last
+                            , scaled_font* scaled_font_
+                            , point start = { 0, 0 }
+                           );
+
+                           // Attributed text. The text not covered by the
+                           // runs gets the font of the source.
+                           master_glyphs(
+                              char const* first, char const* last
+                            , master_glyphs const& source
+                            , font_runs const& runs
+                            , point start = { 0, 0 }
+                           );
+
                            master_glyphs(
                               string_view str
                             , font font_, float size
@@ -127,12 +197,20 @@ namespace cycfi { namespace elements
       void                 text(char const* first, char const* last, point start = { 0, 0 });
       void                 text(string_view str, point start = { 0, 0 });
       void                 text(std::string const& str, point start = { 0, 0 });
+      void                 text(
+                              char const* first, char const* last
+                            , font_runs const& runs, point start = { 0, 0 }
+                           );
 
    private:
                            master_glyphs(master_glyphs const&) = delete;
       master_glyphs&       operator=(master_glyphs const& rhs) = delete;
 
       void                 build(point start = { 0, 0 });
+      void                 build(font_runs const& runs, point start);
+      void                 release();
+
+      std::vector<shaped_run> _shaped_runs;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -178,16 +256,31 @@ namespace cycfi { namespace elements
       text(str.data(), str.data() + str.size(), start);
    }
 
+   inline glyphs::scaled_font* glyphs::font_of(glyph const* g) const
+   {
+      if (_run_count == 0)
+         return _scaled_font;
+
+      // The first run that ends after g
+      auto i = std::upper_bound(_runs, _runs + _run_count, g,
+         [](glyph const* g, shaped_run const& run)
+         {
+            return g < run.last;
+         }
+      );
+      return (i == _runs + _run_count)? _runs[_run_count-1].font : i->font;
+   }
+
    template <typename F>
-   inline void glyphs::for_each(F f)
+   inline void glyphs::for_each(F f) const
    {
+      if (_first == _last)
+         return;
+
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
 
-      if (_first == _last)
-         return;
-
       int   glyph_index = 0;
       int   byte_index = 0;
       float start_x = _glyphs->x;
@@ -197,7 +290,7 @@ namespace cycfi { namespace elements
          cairo_text_cluster_t* cluster = _clusters + i;
          cairo_glyph_t* glyph = _glyphs + glyph_index;
          cairo_text_extents_t extents;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
+         cairo_scaled_font_glyph_extents(font_of(glyph), glyph, 1, &extents);
 
          float x = glyph->x - start_x;
          if (!f(_first + byte_index, x, x + extents.x_advance))
@@ -0,0 +1,67 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_ICON_ATLAS_OCTOBER_19_2026)
+#define ELEMENTS_ICON_ATLAS_OCTOBER_19_2026
+
+#include <elements/support/canvas.hpp>
+#include <elements/support/font.hpp>
+#include <elements/support/pixmap.hpp>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // icon_atlas: The glyphs of an icon font at one size (in device pixels),
+   // rasterized on first use into a single a8 pixmap. Drawing an icon is a
+   // masked blit of its cell, in the current fill style.
+   //
+   // get_icon_atlas returns the shared atlas for a font and size. The size
+   // is rounded to a quarter pixel, so nearly equal sizes share an atlas.
+   // Only the most recently used few are kept. Use them from the UI thread
+   // only.
+   ////////////////////////////////////////////////////////////////////////////
+   class icon_atlas
+   {
+   public:
+                              icon_atlas(elements::font font_, float size);
+
+      elements::font const&   font() const      { return _font; }
+      float                   size() const      { return _size; }
+
+                              // Draws the icon centered in bounds, as
+                              // draw_icon does. scale is the number of
+                              // device pixels per user unit.
+      void                    draw(canvas& cnv, rect bounds, std::uint32_t code, float scale);
+
+   private:
+
+      struct glyph
+      {
+         rect                 src;              // In the atlas, in pixels
+         point                offset;           // Of src, from the pen position
+         float                width;            // The ink width
+      };
+
+      glyph const&            get(std::uint32_t code);
+      point                   allocate(int width, int height);
+
+      elements::font          _font;
+      float                   _size;
+      float                   _ascent = 0;
+      float                   _descent = 0;
+      std::unique_ptr<pixmap> _pixmap;
+      std::unordered_map<std::uint32_t, glyph> _glyphs;
+      int                     _shelf_x = 0;     // The free space of the
+      int                     _shelf_y = 0;     // current shelf (row) of
+      int                     _shelf_height = 0;// cells
+   };
+
+   icon_atlas&                get_icon_atlas(font const& font_, float size);
+}}
+
+#endif
@@ -0,0 +1,41 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_MAPPED_FILE_OCTOBER_19_2026)
+#define ELEMENTS_MAPPED_FILE_OCTOBER_19_2026
+
+#include <infra/filesystem.hpp>
+#include <cstddef>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // mapped_file: A read-only memory mapping of a whole file. Evaluates to
+   // false if the file could not be opened or mapped, or if it is empty.
+   ////////////////////////////////////////////////////////////////////////////
+   class mapped_file
+   {
+   public:
+                              mapped_file(fs::path const& path);
+                              ~mapped_file();
+
+                              mapped_file(mapped_file const&) = delete;
+      mapped_file&            operator=(mapped_file const&) = delete;
+
+      explicit                operator bool() const   { return _data != nullptr; }
+      char const*             data() const            { return _data; }
+      std::size_t             size() const            { return _size; }
+
+   private:
+
+      char const*             _data = nullptr;
+      std::size_t             _size = 0;
+#if defined(_WIN32)
+      void*                   _map = nullptr;   // The file mapping HANDLE
+#endif
+   };
+}}
+
+#endif
@@ -8,8 +8,10 @@
 
 #include <vector>
 #include <memory>
+#include <cstdint>
 #include <cairo.h>
 #include <elements/support/point.hpp>
+#include <elements/support/rect.hpp>
 #include <stdexcept>
 
 namespace cycfi { namespace elements
@@ -18,39 +20,93 @@ namespace cycfi { namespace elements
 
    ////////////////////////////////////////////////////////////////////////////
    // Pixmaps
+   //
+   // When a mipmapped pixmap is drawn scaled down, the canvas samples from a
+   // mip chain (successive half-size copies, built lazily and cached) rather
+   // than the full resolution image, so shrinking is cheaper and does not
+   // alias. A pixmap drawn repeatedly at the same size also keeps a copy
+   // pre-scaled to exactly that size. The copies take up to a third more
+   // memory than the pixmap itself (not counted by the pixmap_cache), so
+   // pixmaps are not mipmapped by default: opt in with mipmapped(true) for
+   // images that are drawn shrunk. The cached copies are dropped whenever
+   // the pixmap is drawn into (with a pixmap_context) or rescaled. They are
+   // built while drawing, so a mipmapped pixmap must be drawn from the UI
+   // thread only.
    ////////////////////////////////////////////////////////////////////////////
    struct failed_to_load_pixmap : std::runtime_error
    {
       using std::runtime_error::runtime_error;
    };
 
+   // a8 pixmaps are alpha only masks, 1/4 the size of argb32 pixmaps. They
+   // are drawn with canvas::draw_mask, in the current fill style. Images
+   // loaded as a8 keep only their alpha.
+   enum class pixmap_format
+   {
+      argb32,
+      a8
+   };
+
    class pixmap
    {
    public:
 
-      explicit          pixmap(point size, float scale = 1);
-      explicit          pixmap(char const* filename, float scale = 1);
+      explicit          pixmap(
+                           point size, float scale = 1
+                         , pixmap_format format = pixmap_format::argb32
+                        );
+      explicit          pixmap(
+                           char const* filename, float scale = 1
+                         , pixmap_format format = pixmap_format::argb32
+                        );
                         pixmap(pixmap const& rhs) = delete;
-                        pixmap(pixmap&& rhs);
+                        pixmap(pixmap&& rhs) noexcept;
                         ~pixmap();
 
       pixmap&           operator=(pixmap const& rhs) = delete;
-      pixmap&           operator=(pixmap&& rhs);
+      pixmap&           operator=(pixmap&& rhs) noexcept;
 
       extent            size() const;
       float             scale() const;
       void              scale(float val);
+      pixmap_format     format() const;
+
+      bool              mipmapped() const       { return _mipmapped; }
+      void              mipmapped(bool val);
 
    private:
 
       friend class canvas;
+      friend class display_list;
       friend class pixmap_context;
 
+      struct variants;
+      using variants_ptr = std::shared_ptr<variants>;
+
+      void              invalidate();
+      variants*         get_variants() const;   // nullptr if not mipmapped
+      void              set_source(cairo_t& ctx, rect src) const;
+
+      // Sets surface (or its variant that best fits the current transform)
+      // as the source. Also used by display_list::replay.
+      static void       set_source(
+                           cairo_t& ctx, cairo_surface_t* surface
+                         , variants* v, rect src
+                        );
+
       cairo_surface_t*  _surface;
+      bool              _mipmapped;
+      mutable variants_ptr _variants;           // Shared with display_lists
+      std::uint32_t     _generation = 0;  // Bumped when the pixels may change
    };
 
    using pixmap_ptr = std::shared_ptr<pixmap>;
 
+   // The size of the image in a file (or resource bundle), read from its
+   // header without decoding it, in the same units as pixmap::size().
+   // Returns { 0, 0 } if unknown.
+   extent               pixmap_size(char const* filename, float scale = 1);
+
    ////////////////////////////////////////////////////////////////////////////
    // pixmap_context allows drawing into a pixmap
    ////////////////////////////////////////////////////////////////////////////
@@ -59,20 +115,26 @@ namespace cycfi { namespace elements
    public:
 
       explicit          pixmap_context(pixmap& pm)
+                         : _pixmap(&pm)
                         {
                            _context = cairo_create(pm._surface);
+                           pm.invalidate();
                         }
 
                         ~pixmap_context()
                         {
                            if (_context)
                               cairo_destroy(_context);
+                           if (_pixmap)
+                              _pixmap->invalidate();
                         }
 
                         pixmap_context(pixmap_context&& rhs) noexcept
                          : _context(rhs._context)
+                         , _pixmap(rhs._pixmap)
                         {
                            rhs._context = nullptr;
+                           rhs._pixmap = nullptr;
                         }
 
       cairo_t*          context() const { return _context; }
@@ -81,26 +143,8 @@ namespace cycfi { namespace elements
                         pixmap_context(pixmap_context const&) = delete;
 
       cairo_t*          _context;
+      pixmap*           _pixmap;
    };
-
-   ////////////////////////////////////////////////////////////////////////////
-   // Inlines
-   ////////////////////////////////////////////////////////////////////////////
-   inline pixmap::pixmap(pixmap&& rhs)
-    : _surface(rhs._surface)
-   {
-      rhs._surface = nullptr;
-   }
-
-   inline pixmap& pixmap::operator=(pixmap&& rhs)
-   {
-      if (this != &rhs)
-      {
-         _surface = rhs._surface;
-         rhs._surface = nullptr;
-      }
-      return *this;
-   }
 }}
 
 #endif
@@ -0,0 +1,96 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_PIXMAP_CACHE_OCTOBER_19_2026)
+#define ELEMENTS_PIXMAP_CACHE_OCTOBER_19_2026
+
+#include <elements/support/pixmap.hpp>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // pixmap_cache: Process-wide cache of pixmaps loaded from files, keyed by
+   // the resolved path (or resource bundle path), the scale and the format
+   // (masks and full color pixmaps of a file are separate). Images that
+   // load the same file share a single pixmap, so cached pixmaps must not be
+   // modified.
+   //
+   // Pixmaps in use are always found, regardless of the budget. In addition,
+   // the most recently used pixmaps are kept alive, up to budget() bytes,
+   // so that a pixmap that is dropped (e.g. when a view is rebuilt) and
+   // loaded again soon is not decoded again.
+   ////////////////////////////////////////////////////////////////////////////
+   class pixmap_cache
+   {
+   public:
+
+      static constexpr std::size_t default_budget = 64 * 1024 * 1024;
+
+      struct statistics
+      {
+         std::size_t          hits = 0;
+         std::size_t          misses = 0;
+         std::size_t          pixmaps = 0;      // Pixmaps in the cache
+         std::size_t          bytes = 0;        // The pixel bytes of those
+         std::size_t          retained_bytes = 0; // Kept alive by the cache
+      };
+
+                              // Throws failed_to_load_pixmap
+      pixmap_ptr              load(
+                                 char const* filename, float scale = 1
+                               , pixmap_format format = pixmap_format::argb32
+                              );
+
+                              // Returns the pixmap if it is already loaded,
+                              // or null. Never decodes.
+      pixmap_ptr              find(
+                                 char const* filename, float scale = 1
+                               , pixmap_format format = pixmap_format::argb32
+                              );
+
+      std::size_t             budget() const;
+      void                    budget(std::size_t bytes);
+      statistics              stats() const;
+      void                    clear();
+
+   private:
+
+      using key_type = std::pair<std::string, float>;
+      struct entry;
+      using entry_map = std::map<key_type, entry>;
+      using lru_list = std::list<entry_map::iterator>;
+
+      struct entry
+      {
+         std::weak_ptr<pixmap> pixmap_;
+         pixmap_ptr           retained;         // Null if not retained
+         std::size_t          bytes = 0;
+         lru_list::iterator   lru;
+      };
+
+      pixmap_ptr              find(key_type const& key);
+      void                    retain(entry_map::iterator i, pixmap_ptr const& pm);
+      void                    trim();
+      void                    purge();
+
+      mutable std::mutex      _mutex;
+      entry_map               _entries;
+      lru_list                _lru;             // Most recently used first
+      std::size_t             _retained_bytes = 0;
+      std::size_t             _budget = default_budget;
+      std::size_t             _hits = 0;
+      std::size_t             _misses = 0;
+   };
+
+   pixmap_cache& get_pixmap_cache();
+}}
+
+#endif
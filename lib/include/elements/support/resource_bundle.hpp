@@ -0,0 +1,83 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_RESOURCE_BUNDLE_OCTOBER_19_2026)
+#define ELEMENTS_RESOURCE_BUNDLE_OCTOBER_19_2026
+
+#include <elements/support/mapped_file.hpp>
+#include <infra/filesystem.hpp>
+#include <infra/string_view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // resource_bundle: A read-only archive of resource files (images, fonts,
+   // etc.) packed in a single file, with a hashed index of their paths.
+   // Paths are relative, with '/' separators (e.g. "icons/play.png").
+   //
+   // A bundle is either memory-mapped from a file, or is data already in
+   // memory, such as an array linked into a plugin's binary. Finding a
+   // resource is a hash lookup. Nothing is copied or read from the file
+   // system. The data returned stays valid as long as the bundle does.
+   //
+   // Use resource_bundle::create to pack a directory into a bundle.
+   ////////////////////////////////////////////////////////////////////////////
+   class resource_bundle
+   {
+   public:
+                              resource_bundle(fs::path const& path);
+                              resource_bundle(char const* data, std::size_t size);
+
+                              resource_bundle(resource_bundle const&) = delete;
+      resource_bundle&        operator=(resource_bundle const&) = delete;
+
+      explicit                operator bool() const   { return _header != nullptr; }
+
+                              // Returns an empty string_view if there is no
+                              // such resource.
+      string_view             find(string_view path) const;
+
+      std::size_t             size() const;
+      string_view             path(std::size_t i) const;
+      string_view             data(std::size_t i) const;
+
+                              // Packs all the files in dir (and its
+                              // subdirectories) into a bundle. Returns false
+                              // on failure.
+      static bool             create(fs::path const& bundle, fs::path const& dir);
+
+      struct header;
+      struct entry;
+
+   private:
+
+      void                    open(char const* data, std::size_t size);
+
+      std::unique_ptr<mapped_file> _file;
+      std::vector<std::uint64_t> _copy;   // For unaligned data
+      char const*             _data = nullptr;
+      header const*           _header = nullptr;
+      entry const*            _entries = nullptr;
+   };
+
+   using resource_bundle_ptr = std::shared_ptr<resource_bundle const>;
+
+   // Resource bundles are searched, in the order they were added, by
+   // find_resource. pixmap and font look for their files in the bundles
+   // first, before searching the resource paths and the installed fonts.
+   // Add bundles before loading any resource. Bundles cannot be removed.
+
+   void add_resource_bundle(resource_bundle_ptr bundle);
+   std::vector<resource_bundle_ptr> resource_bundles();
+
+   // Returns an empty string_view if the resource is not in any bundle.
+   string_view find_resource(string_view path);
+}}
+
+#endif
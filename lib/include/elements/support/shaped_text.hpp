@@ -0,0 +1,81 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_SHAPED_TEXT_OCTOBER_19_2026)
+#define ELEMENTS_SHAPED_TEXT_OCTOBER_19_2026
+
+#include <elements/support/glyphs.hpp>
+#include <infra/string_view.hpp>
+#include <cairo.h>
+#include <memory>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   namespace detail
+   {
+      // Holds the text of a shaped_text. This is a base class of
+      // shaped_text so that the text is constructed before the glyphs
+      // that point into it.
+      struct shaped_text_storage
+      {
+         std::string          _text;
+      };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // shaped_text: A single-line run of text shaped once into glyphs, with
+   // its extents precomputed. Glyph positions are relative to the text
+   // origin (the start of the baseline).
+   ////////////////////////////////////////////////////////////////////////////
+   class shaped_text : private detail::shaped_text_storage, public master_glyphs
+   {
+   public:
+                              shaped_text(string_view text, cairo_scaled_font_t* scaled_font_);
+
+                              shaped_text(shaped_text const&) = delete;
+      shaped_text&            operator=(shaped_text const&) = delete;
+
+      std::string const&      text() const         { return _text; }
+      cairo_text_extents_t const& extents() const  { return _extents; }
+      cairo_font_extents_t const& font_extents() const { return _font_extents; }
+      std::size_t             memory_size() const;
+
+      void                    show(cairo_t& cr, point p) const;
+      void                    path(cairo_t& cr, point p) const;
+
+   private:
+
+      cairo_text_extents_t    _extents;
+      cairo_font_extents_t    _font_extents;
+   };
+
+   using shaped_text_ptr = std::shared_ptr<shaped_text const>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Process-wide shaped text cache
+   //
+   // get_shaped_text returns the shaped run for the given font face, size
+   // and UTF-8 text, shaping it only if it is not yet in the cache. The
+   // cache is LRU with a memory budget (in bytes). Evicted runs stay valid
+   // for as long as they are referenced.
+   ////////////////////////////////////////////////////////////////////////////
+   shaped_text_ptr            get_shaped_text(cairo_font_face_t* face, float size, string_view utf8);
+
+   struct shaped_text_cache_info
+   {
+      std::size_t             hits = 0;
+      std::size_t             misses = 0;
+      std::size_t             entries = 0;
+      std::size_t             bytes = 0;
+      std::size_t             budget = 0;
+   };
+
+   shaped_text_cache_info     get_shaped_text_cache_info();
+   void                       set_shaped_text_cache_budget(std::size_t bytes);
+   void                       clear_shaped_text_cache();
+}}
+
+#endif
@@ -0,0 +1,80 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_SEARCH_OCTOBER_19_2026)
+#define ELEMENTS_TEXT_SEARCH_OCTOBER_19_2026
+
+#include <elements/support/text_storage.hpp>
+#include <infra/string_view.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // find_text: Finds the first occurrence of pattern in text, starting at
+   // pos. Returns string_view::npos if there is none, or if the pattern is
+   // empty. If ignore_case is true, ASCII letters are compared without
+   // regard to case. Other characters are compared as is.
+   //
+   // The scan is vectorized with AVX2 (if the CPU supports it) or SSE2,
+   // with a scalar fallback for other targets.
+   ////////////////////////////////////////////////////////////////////////////
+   std::size_t find_text(
+      string_view text, string_view pattern
+    , bool ignore_case = false, std::size_t pos = 0
+   );
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_search: All the occurrences of a pattern in a text_storage,
+   // including overlapping ones, sorted by position.
+   //
+   // find is incremental: if the new pattern extends the previous one (as
+   // when the user is typing), only the previous matches are checked.
+   // update keeps the matches in sync with edits to the text, rescanning
+   // only around the edit.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_search
+   {
+   public:
+
+      using match_list = std::vector<std::size_t>;
+      using const_iterator = match_list::const_iterator;
+
+      void                    find(text_storage const& text, string_view pattern, bool ignore_case = false);
+      void                    update(
+                                 text_storage const& text
+                               , std::size_t pos
+                               , std::size_t erased, std::size_t inserted
+                              );
+      void                    refresh(text_storage const& text);
+      void                    clear();
+
+      std::string const&      pattern() const      { return _pattern; }
+      bool                    ignore_case() const  { return _ignore_case; }
+      match_list const&       matches() const      { return _matches; }
+      std::size_t             size() const         { return _matches.size(); }
+      bool                    empty() const        { return _matches.empty(); }
+
+                              // The first match that ends after pos
+      const_iterator          first_match(std::size_t pos) const;
+
+   private:
+
+      bool                    match_at(text_storage const& text, std::size_t pos) const;
+      void                    scan(
+                                 text_storage const& text
+                               , std::size_t first, std::size_t last
+                               , match_list& out
+                              ) const;
+
+      std::string             _pattern;
+      bool                    _ignore_case = false;
+      match_list              _matches;
+   };
+}}
+
+#endif
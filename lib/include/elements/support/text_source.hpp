@@ -0,0 +1,77 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_SOURCE_OCTOBER_19_2026)
+#define ELEMENTS_TEXT_SOURCE_OCTOBER_19_2026
+
+#include <infra/filesystem.hpp>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // text_source: A read-only, possibly very large and possibly growing,
+   // source of UTF-8 text, read in chunks. All member functions must be
+   // thread safe: sources are read from background threads.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_source
+   {
+   public:
+
+      virtual                 ~text_source() = default;
+
+      virtual std::size_t     size() const = 0;
+
+                              // Reads up to n bytes at pos into out, replacing
+                              // its contents.
+      virtual void            read(std::size_t pos, std::size_t n, std::string& out) const = 0;
+
+                              // Checks the source for new data (e.g. a log
+                              // file that is being appended to). Returns true
+                              // if the size changed.
+      virtual bool            update() { return false; }
+   };
+
+   using text_source_ptr = std::shared_ptr<text_source>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // file_text_source: A file, read with positional reads (pread). The file
+   // is not memory-mapped: a mapping faults if the file is truncated while
+   // it is being read (e.g. a log rotated with copytruncate). Here, a read
+   // past the end of a truncated file simply comes back short. update()
+   // re-reads the file size.
+   ////////////////////////////////////////////////////////////////////////////
+   class file_text_source : public text_source
+   {
+   public:
+                              file_text_source(fs::path const& path);
+                              ~file_text_source();
+
+                              file_text_source(file_text_source const&) = delete;
+      file_text_source&       operator=(file_text_source const&) = delete;
+
+      bool                    is_open() const;
+      std::size_t             size() const override;
+      void                    read(std::size_t pos, std::size_t n, std::string& out) const override;
+      bool                    update() override;
+
+   private:
+
+      std::size_t             file_size() const;
+
+      mutable std::mutex      _mutex;
+      std::size_t             _size = 0;
+#if defined(_WIN32)
+      void*                   _file;            // The file HANDLE
+#else
+      int                     _fd;
+#endif
+   };
+}}
+
+#endif
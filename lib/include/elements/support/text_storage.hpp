@@ -0,0 +1,174 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_STORAGE_OCTOBER_19_2026)
+#define ELEMENTS_TEXT_STORAGE_OCTOBER_19_2026
+
+#include <infra/string_view.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   class text_storage;
+   using text_storage_ptr = std::shared_ptr<text_storage>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // A contiguous chunk of text, starting at byte offset in its storage.
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_chunk
+   {
+      std::size_t             offset = 0;
+      string_view             text;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_storage: The text storage abstract class
+   //
+   // Holds UTF-8 text that is not necessarily contiguous. The text is
+   // accessed in chunks, either directly through chunk and for_each_chunk,
+   // or per codepoint through text_cursor. snapshot returns an independent
+   // copy of the storage; subsequent edits to one do not affect the other.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_storage
+   {
+   public:
+
+      virtual                 ~text_storage() = default;
+
+      virtual std::size_t     size() const = 0;
+      virtual void            replace(std::size_t pos, std::size_t n, string_view str) = 0;
+      virtual text_storage_ptr snapshot() const = 0;
+
+                              // Returns the chunk containing pos, or an empty
+                              // chunk at size() if pos is at or past the end.
+      virtual text_chunk      chunk(std::size_t pos) const = 0;
+
+      bool                    empty() const { return size() == 0; }
+      void                    insert(std::size_t pos, string_view str) { replace(pos, 0, str); }
+      void                    erase(std::size_t pos, std::size_t n) { replace(pos, n, {}); }
+      std::string             substr(std::size_t pos, std::size_t n) const;
+      std::string             str() const { return substr(0, size()); }
+
+                              // for_each_chunk F signature:
+                              // void f(string_view chunk);
+                              template <typename F>
+      void                    for_each_chunk(std::size_t pos, std::size_t n, F f) const;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // string_text_storage: Plain std::string storage. Edits are O(n), and so
+   // are snapshots.
+   ////////////////////////////////////////////////////////////////////////////
+   class string_text_storage : public text_storage
+   {
+   public:
+                              string_text_storage(std::string text = "")
+                               : _text(std::move(text))
+                              {}
+
+      std::size_t             size() const override { return _text.size(); }
+      void                    replace(std::size_t pos, std::size_t n, string_view str) override;
+      text_storage_ptr        snapshot() const override;
+      text_chunk              chunk(std::size_t pos) const override;
+
+   private:
+
+      std::string             _text;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // rope_text_storage: A persistent, balanced (AVL) rope of small leaf
+   // chunks. Edits are O(log n) and copy only the path to the edited leaf.
+   // The nodes are immutable and shared, so snapshots are O(1).
+   ////////////////////////////////////////////////////////////////////////////
+   namespace detail
+   {
+      struct rope_node;
+   }
+
+   class rope_text_storage : public text_storage
+   {
+   public:
+                              rope_text_storage(string_view text = {});
+
+      std::size_t             size() const override;
+      void                    replace(std::size_t pos, std::size_t n, string_view str) override;
+      text_storage_ptr        snapshot() const override;
+      text_chunk              chunk(std::size_t pos) const override;
+
+   private:
+
+      using node_ptr = std::shared_ptr<detail::rope_node const>;
+
+      node_ptr                _root;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_cursor: Bidirectional UTF-8 iteration over a text_storage.
+   // Codepoints may straddle chunks. The storage must not be modified while
+   // the cursor is in use.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_cursor
+   {
+   public:
+                              text_cursor(text_storage const& storage, std::size_t pos = 0);
+
+      std::size_t             position() const  { return _pos; }
+      void                    position(std::size_t pos);
+      bool                    at_start() const  { return _pos == 0; }
+      bool                    at_end() const    { return _pos >= _size; }
+
+      char                    byte() const      { return byte_at(_pos); }
+      unsigned                codepoint() const;
+
+                              // The UTF-8 bytes of the codepoint at the
+                              // cursor, valid until the cursor is moved.
+      char const*             utf8() const;
+
+      text_cursor&            next();
+      text_cursor&            prev();
+
+   private:
+
+      char                    byte_at(std::size_t pos) const;
+
+      text_storage const*     _storage;
+      std::size_t             _size;
+      std::size_t             _pos;
+      mutable text_chunk      _chunk;
+      mutable char            _utf8[4];
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   inline void text_storage::for_each_chunk(std::size_t pos, std::size_t n, F f) const
+   {
+      auto last = pos + std::min(n, size() - std::min(pos, size()));
+      while (pos < last)
+      {
+         auto c = chunk(pos);
+         auto first = pos - c.offset;
+         auto len = std::min(c.text.size() - first, last - pos);
+         f(c.text.substr(first, len));
+         pos += len;
+      }
+   }
+
+   inline char text_cursor::byte_at(std::size_t pos) const
+   {
+      if (pos >= _size)
+         return '\0';
+      if (pos < _chunk.offset || pos - _chunk.offset >= _chunk.text.size())
+         _chunk = _storage->chunk(pos);
+      return _chunk.text[pos - _chunk.offset];
+   }
+}}
+
+#endif
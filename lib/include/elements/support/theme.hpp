@@ -59,6 +59,7 @@ namespace cycfi { namespace elements
       font                 text_box_font;
       float                text_box_font_size;
       color                text_box_hilite_color;
+      color                text_box_find_hilite_color;
       color                text_box_caret_color;
       float                text_box_caret_width;
       color                inactive_font_color;
@@ -75,6 +76,8 @@ namespace cycfi { namespace elements
       color                minor_grid_color;
       float                minor_grid_width;
 
+      color                image_placeholder_color;
+
       float                dialog_button_size;
       extent               message_textbox_size;
 
@@ -0,0 +1,155 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_UNDO_HISTORY_OCTOBER_19_2026)
+#define ELEMENTS_UNDO_HISTORY_OCTOBER_19_2026
+
+#include <infra/string_view.hpp>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // text_delta: A text edit. At pos, removed was replaced by inserted.
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_delta
+   {
+      std::size_t             pos = 0;
+      std::string             removed;
+      std::string             inserted;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // undoable_text: The text edited by text_deltas. apply_delta replaces n
+   // bytes at pos with str, then sets the selection.
+   //
+   // The undo_history refers to its targets through a weak handle. The
+   // handle follows the text when it is moved, and expires when the text
+   // is destroyed or replaced (assigned to), so the history never calls a
+   // dead target, nor one that merely reuses its address.
+   ////////////////////////////////////////////////////////////////////////////
+   class undoable_text
+   {
+   public:
+
+      using handle = std::shared_ptr<undoable_text*>;
+      using weak_handle = std::weak_ptr<undoable_text*>;
+
+                              undoable_text();
+                              undoable_text(undoable_text const& rhs);
+                              undoable_text(undoable_text&& rhs) noexcept;
+      virtual                 ~undoable_text() = default;
+
+      undoable_text&          operator=(undoable_text const& rhs);
+      undoable_text&          operator=(undoable_text&& rhs) noexcept;
+
+      virtual void            apply_delta(
+                                 std::size_t pos, std::size_t n, string_view str
+                               , int select_start, int select_end
+                              ) = 0;
+
+      handle const&           undo_handle() const { return _handle; }
+
+   private:
+
+      handle                  _handle;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // undo_history: The undo and redo stacks
+   //
+   // Text edits are kept as deltas, so an undo step costs the size of the
+   // edit, not the size of the text. Consecutive typing (edits added with
+   // coalesce = true, that continue where the previous edit left off) is
+   // merged into a single step. Generic tasks (undo and redo functions) are
+   // supported too.
+   //
+   // Everything added between begin_group and end_group, possibly across
+   // elements, is undone and redone as a single step. Groups may nest.
+   //
+   // The history is capped at max_bytes (the sizes of the deltas, plus a
+   // fixed cost per entry). The oldest steps are dropped first.
+   ////////////////////////////////////////////////////////////////////////////
+   class undo_history
+   {
+   public:
+
+      static constexpr std::size_t default_max_bytes = 16 * 1024 * 1024;
+
+      struct task
+      {
+         std::function<void()> undo;
+         std::function<void()> redo;
+      };
+
+      struct selection
+      {
+         int                  start = -1;
+         int                  end = -1;
+      };
+
+      void                    add(task t);
+      void                    add(
+                                 undoable_text& target, text_delta delta
+                               , selection before, selection after
+                               , bool coalesce = false
+                              );
+
+      bool                    has_undo() const  { return !_undo.empty(); }
+      bool                    has_redo() const  { return !_redo.empty(); }
+      bool                    undo();
+      bool                    redo();
+      void                    clear();
+
+      void                    begin_group();
+      void                    end_group();
+      void                    break_coalescing() { _coalesce = false; }
+
+      std::size_t             size() const      { return _undo.size(); }
+      std::size_t             bytes() const     { return _bytes; }
+      std::size_t             max_bytes() const { return _max_bytes; }
+      void                    max_bytes(std::size_t max);
+
+   private:
+
+      struct entry
+      {
+         task                 t;                // For tasks
+         bool                 is_edit = false;  // A text edit, not a task
+         undoable_text::weak_handle target;     // For text edits
+         text_delta           delta;
+         selection            before;
+         selection            after;
+      };
+
+      struct step
+      {
+         std::vector<entry>   entries;
+         std::size_t          bytes = 0;
+      };
+
+      using step_list = std::deque<step>;
+
+      static std::size_t      entry_bytes(entry const& e);
+      step&                   current_step();
+      void                    add_entry(entry e);
+      void                    trim();
+
+      step_list               _undo;
+      step_list               _redo;
+      std::size_t             _bytes = 0;
+      std::size_t             _max_bytes = default_max_bytes;
+      int                     _group = 0;
+      bool                    _group_started = false;
+      bool                    _coalesce = false;
+   };
+}}
+
+#endif
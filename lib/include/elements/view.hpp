@@ -10,6 +10,7 @@
 #include <elements/support/rect.hpp>
 #include <elements/support/canvas.hpp>
 #include <elements/support/theme.hpp>
+#include <elements/support/undo_history.hpp>
 #include <elements/element/element.hpp>
 #include <elements/element/layer.hpp>
 #include <elements/element/size.hpp>
@@ -56,17 +57,14 @@ namespace cycfi { namespace elements
       void                    refresh(context const& ctx, int outward = 0);
       rect                    dirty() const;
 
-      struct undo_redo_task
-      {
-         std::function<void()> undo;
-         std::function<void()> redo;
-      };
+      using undo_redo_task = undo_history::task;
 
       void                    add_undo(undo_redo_task t);
       bool                    has_undo();
       bool                    has_redo();
       bool                    undo();
       bool                    redo();
+      undo_history&           history()              { return _history; }
 
       using content_type = layer_composite;
       using layers_type = layer_composite::container_type;
@@ -128,9 +126,7 @@ namespace cycfi { namespace elements
       mouse_button            _current_button;
       bool                    _is_focus = false;
 
-      using undo_stack_type = std::stack<undo_redo_task>;
-      undo_stack_type         _undo_stack;
-      undo_stack_type         _redo_stack;
+      undo_history            _history;
 
       io_context              _io;
       io_context::work        _work;
@@ -162,12 +158,12 @@ namespace cycfi { namespace elements
 
    inline bool view::has_undo()
    {
-      return !_undo_stack.empty();
+      return _history.has_undo();
    }
 
    inline bool  view::has_redo()
    {
-      return !_redo_stack.empty();
+      return _history.has_redo();
    }
 
    inline view::content_type& view::content()
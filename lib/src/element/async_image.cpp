@@ -0,0 +1,270 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/async_image.hpp>
+#include <elements/support/context.hpp>
+#include <elements/support/pixmap_cache.hpp>
+#include <elements/support/theme.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The shared state of an async_image and its decoding job. The pixmap,
+   // the failed flag and the view and element to refresh are guarded by the
+   // mutex. The element clears self when it is destroyed.
+   ////////////////////////////////////////////////////////////////////////////
+   struct detail::async_image_state
+   {
+      std::string             filename;
+      float                   scale;
+      std::atomic<std::uint64_t> priority{ 0 };
+
+      std::mutex              mutex;
+      pixmap_ptr              pixmap_;
+      bool                    failed = false;
+      view*                   view_ = nullptr;
+      async_image*            self = nullptr;
+   };
+
+   namespace
+   {
+      using state = detail::async_image_state;
+      using state_ptr = std::shared_ptr<state>;
+
+      // Incremented on every draw of an image that is not ready yet. Jobs
+      // with a higher priority (drawn more recently) are decoded first.
+      std::atomic<std::uint64_t> draw_count{ 0 };
+
+      ////////////////////////////////////////////////////////////////////////
+      // The decoding workers
+      ////////////////////////////////////////////////////////////////////////
+      class decoder
+      {
+      public:
+                              decoder();
+                              ~decoder();
+
+         void                 post(state_ptr const& s);
+         void                 wake();
+
+      private:
+
+         void                 run();
+
+         std::mutex           _mutex;
+         std::condition_variable _cv;
+         std::vector<std::weak_ptr<state>> _queue;
+         std::vector<std::thread> _threads;
+         bool                 _stopping = false;
+      };
+
+      decoder::decoder()
+      {
+         // The cache must outlive the workers
+         get_pixmap_cache();
+
+         auto n = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+         for (auto i = 0u; i != n; ++i)
+            _threads.emplace_back([this]{ run(); });
+      }
+
+      decoder::~decoder()
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+         }
+         _cv.notify_all();
+         for (auto& t : _threads)
+            t.join();
+      }
+
+      void decoder::post(state_ptr const& s)
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(s);
+         }
+         _cv.notify_one();
+      }
+
+      void decoder::run()
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         while (true)
+         {
+            _cv.wait(lock, [this]{ return _stopping || !_queue.empty(); });
+            if (_stopping)
+               return;
+
+            // Pick the job with the highest priority, dropping the ones
+            // whose images are gone.
+            state_ptr job;
+            std::uint64_t best = 0;
+            auto found = _queue.end();
+            for (auto i = _queue.begin(); i != _queue.end();)
+            {
+               auto s = i->lock();
+               if (!s)
+               {
+                  i = _queue.erase(i);
+                  continue;
+               }
+               auto p = s->priority.load(std::memory_order_relaxed);
+               if (!job || p > best)
+               {
+                  job = std::move(s);
+                  best = p;
+                  found = i;
+               }
+               ++i;
+            }
+            if (!job)
+               continue;
+            _queue.erase(found);
+
+            lock.unlock();
+            pixmap_ptr pm;
+            try
+            {
+               pm = get_pixmap_cache().load(job->filename.c_str(), job->scale);
+            }
+            catch (failed_to_load_pixmap const&)
+            {
+            }
+
+            {
+               std::lock_guard<std::mutex> state_lock(job->mutex);
+               job->pixmap_ = pm;
+               job->failed = !pm;
+               if (pm && job->view_)
+               {
+                  // Refresh on the UI thread, if the image is still there
+                  auto& view_ = *job->view_;
+                  std::weak_ptr<state> w = job;
+                  view_.post(
+                     [w, &view_]
+                     {
+                        if (auto s = w.lock())
+                        {
+                           std::lock_guard<std::mutex> state_lock(s->mutex);
+                           if (s->self)
+                              view_.refresh(*s->self);
+                        }
+                     }
+                  );
+               }
+            }
+            job.reset();
+            lock.lock();
+         }
+      }
+
+      decoder& get_decoder()
+      {
+         static decoder d;
+         return d;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // async_image
+   ////////////////////////////////////////////////////////////////////////////
+   async_image::async_image(char const* filename, float scale)
+    : async_image(filename, pixmap_size(filename, scale), scale)
+   {}
+
+   async_image::async_image(char const* filename, extent size, float scale)
+    : _size(size)
+   {
+      // Already loaded? Then there's nothing to wait for.
+      _pixmap = get_pixmap_cache().find(filename, scale);
+      if (_pixmap)
+         return;
+
+      _state = std::make_shared<detail::async_image_state>();
+      _state->filename = filename;
+      _state->scale = scale;
+      get_decoder().post(_state);
+   }
+
+   async_image::~async_image()
+   {
+      if (_state)
+      {
+         std::lock_guard<std::mutex> lock(_state->mutex);
+         _state->self = nullptr;
+         _state->view_ = nullptr;
+      }
+   }
+
+   bool async_image::ready() const
+   {
+      if (_pixmap)
+         return true;
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      return _state->pixmap_ != nullptr;
+   }
+
+   bool async_image::failed() const
+   {
+      if (_pixmap)
+         return false;
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      return _state->failed;
+   }
+
+   view_limits async_image::limits(basic_context const& /* ctx */) const
+   {
+      return { { _size.x, _size.y }, { _size.x, _size.y } };
+   }
+
+   void async_image::draw(context const& ctx)
+   {
+      if (!_pixmap && _state)
+      {
+         std::lock_guard<std::mutex> lock(_state->mutex);
+         if (_state->pixmap_)
+         {
+            _pixmap = std::move(_state->pixmap_);
+            _state->self = nullptr;
+            _state->view_ = nullptr;
+         }
+         else
+         {
+            // Visible: decode this one first
+            _state->priority = ++draw_count;
+            _state->view_ = &ctx.view;
+            _state->self = this;
+         }
+      }
+
+      if (_pixmap)
+      {
+         auto size_ = _pixmap->size();
+         ctx.canvas.draw(*_pixmap, rect{ 0, 0, size_.x, size_.y }, ctx.bounds);
+      }
+      else
+      {
+         draw_placeholder(ctx);
+      }
+   }
+
+   void async_image::draw_placeholder(context const& ctx)
+   {
+      auto& cnv = ctx.canvas;
+      cnv.fill_style(get_theme().image_placeholder_color);
+      cnv.fill_rect(ctx.bounds);
+   }
+}}
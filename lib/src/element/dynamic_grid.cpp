@@ -0,0 +1,579 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/dynamic_grid.hpp>
+#include <elements/element/port.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      // positions holds the running sum of the row heights (or column
+      // widths), with positions[0] == 0 and positions[n] == full extent.
+      // Returns the index i such that positions[i] <= pos < positions[i+1].
+      std::size_t find_span(std::vector<double> const& positions, double pos)
+      {
+         auto it = std::upper_bound(positions.begin(), positions.end(), pos);
+         if (it == positions.begin())
+            return 0;
+         return std::size_t(it - positions.begin()) - 1;
+      }
+
+      bool is_empty_area(rect const& r)
+      {
+         return r.left >= r.right || r.top >= r.bottom;
+      }
+   }
+
+   bool dynamic_grid::cell_range::operator==(cell_range const& rhs) const
+   {
+      return first_row == rhs.first_row && last_row == rhs.last_row
+         && first_col == rhs.first_col && last_col == rhs.last_col;
+   }
+
+   view_limits dynamic_grid::limits(basic_context const& ctx) const
+   {
+      if (_update_request)
+         update(ctx);
+      if (num_rows() && num_cols())
+      {
+         auto width = float(_col_pos.back());
+         auto height = float(_row_pos.back());
+         return {{ width, height }, { width, height }};
+      }
+      return {{ 0, 0 }, { 0, 0 }};
+   }
+
+   void dynamic_grid::draw(context const& ctx)
+   {
+      if (_update_request)
+         update(ctx);
+      if (!num_rows() || !num_cols())
+         return;
+
+      auto& cnv = ctx.canvas;
+      auto  clip_extent = cnv.clip_extent();
+      if (!intersects(ctx.bounds, clip_extent))
+         return;
+
+      auto rgns = make_regions(ctx.bounds, pin_offset(ctx));
+      for (auto const& rgn : rgns)
+      {
+         auto area = clip(clip_extent, rgn.area);
+         if (is_empty_area(area))
+            continue;
+
+         auto state = cnv.new_state();
+         cnv.rect(area);
+         cnv.clip();
+
+         auto range = visible_range(rgn, ctx.bounds, area);
+         for (auto row = range.first_row; row != range.last_row; ++row)
+         {
+            for (auto col = range.first_col; col != range.last_col; ++col)
+            {
+               auto bounds = cell_bounds(ctx.bounds, rgn, row, col);
+               auto& cell = get_cell(ctx, row, col, bounds);
+               context rctx { ctx, cell.elem_ptr.get(), bounds };
+               cell.elem_ptr->draw(rctx);
+            }
+         }
+      }
+
+      release_hidden_cells(ctx, rgns);
+      _previous_size.x = ctx.bounds.width();
+      _previous_size.y = ctx.bounds.height();
+   }
+
+   void dynamic_grid::layout(context const& ctx)
+   {
+      if (_previous_size.x != ctx.bounds.width() ||
+         _previous_size.y != ctx.bounds.height())
+      {
+         _previous_size.x = ctx.bounds.width();
+         _previous_size.y = ctx.bounds.height();
+         ++_layout_id;
+      }
+   }
+
+   void dynamic_grid::update()
+   {
+      _update_request = true;
+      _cells.clear();
+      _row_pos.clear();
+      _col_pos.clear();
+      _retained = {};
+   }
+
+   void dynamic_grid::update(basic_context const& ctx) const
+   {
+      _row_pos.clear();
+      _col_pos.clear();
+      if (_composer)
+      {
+         auto rows = _composer->rows();
+         auto cols = _composer->columns();
+         if (rows && cols)
+         {
+            _row_pos.resize(rows+1);
+            _col_pos.resize(cols+1);
+
+            double y = 0;
+            for (std::size_t i = 0; i != rows; ++i)
+            {
+               _row_pos[i] = y;
+               y += _composer->row_height(i, ctx);
+            }
+            _row_pos[rows] = y;
+
+            double x = 0;
+            for (std::size_t i = 0; i != cols; ++i)
+            {
+               _col_pos[i] = x;
+               x += _composer->column_width(i, ctx);
+            }
+            _col_pos[cols] = x;
+         }
+      }
+      ++_layout_id;
+      _update_request = false;
+   }
+
+   void dynamic_grid::resize(std::size_t rows, std::size_t columns)
+   {
+      _composer->resize(rows, columns);
+      reset();
+      update();
+   }
+
+   void dynamic_grid::frozen(std::size_t rows, std::size_t cols)
+   {
+      _frozen_rows = rows;
+      _frozen_cols = cols;
+   }
+
+   std::uint64_t dynamic_grid::key_of(std::size_t row, std::size_t col) const
+   {
+      return std::uint64_t(row) * num_cols() + col;
+   }
+
+   point dynamic_grid::pin_offset(context const& ctx) const
+   {
+      auto frozen_rows = std::min(_frozen_rows, num_rows());
+      auto frozen_cols = std::min(_frozen_cols, num_cols());
+      if (!frozen_rows && !frozen_cols)
+         return { 0, 0 };
+
+      // The frozen headers stick to the top-left of the enclosing
+      // scroller's visible area (or the view if there is no scroller).
+      auto sc = scrollable::find(ctx);
+      rect visible = sc.context_ptr? sc.context_ptr->bounds : ctx.view_bounds();
+
+      point pin = { 0, 0 };
+      if (frozen_rows)
+      {
+         auto max_y = float(_row_pos.back() - _row_pos[frozen_rows]);
+         pin.y = clamp(visible.top - ctx.bounds.top, 0.0f, max_y);
+      }
+      if (frozen_cols)
+      {
+         auto max_x = float(_col_pos.back() - _col_pos[frozen_cols]);
+         pin.x = clamp(visible.left - ctx.bounds.left, 0.0f, max_x);
+      }
+      return pin;
+   }
+
+   dynamic_grid::regions dynamic_grid::make_regions(rect const& bounds, point pin) const
+   {
+      auto rows = num_rows();
+      auto cols = num_cols();
+      auto frozen_rows = std::min(_frozen_rows, rows);
+      auto frozen_cols = std::min(_frozen_cols, cols);
+
+      float band_left = bounds.left + pin.x;
+      float band_top = bounds.top + pin.y;
+      float body_left = band_left + float(_col_pos[frozen_cols]);
+      float body_top = band_top + float(_row_pos[frozen_rows]);
+
+      return {{
+         // Scrolling body
+         { frozen_rows, rows, frozen_cols, cols, { 0, 0 }
+         , { body_left, body_top, bounds.right, bounds.bottom } }
+
+         // Frozen header rows
+       , { 0, frozen_rows, frozen_cols, cols, { 0, pin.y }
+         , { body_left, band_top, bounds.right, body_top } }
+
+         // Frozen header columns
+       , { frozen_rows, rows, 0, frozen_cols, { pin.x, 0 }
+         , { band_left, body_top, body_left, bounds.bottom } }
+
+         // Frozen corner
+       , { 0, frozen_rows, 0, frozen_cols, pin
+         , { band_left, band_top, body_left, body_top } }
+      }};
+   }
+
+   dynamic_grid::cell_range
+   dynamic_grid::visible_range(region const& rgn, rect const& bounds, rect area) const
+   {
+      cell_range range;
+      if (rgn.first_row == rgn.last_row || rgn.first_col == rgn.last_col)
+         return range;
+
+      double top = area.top - (bounds.top + rgn.offset.y);
+      double bottom = area.bottom - (bounds.top + rgn.offset.y);
+      double left = area.left - (bounds.left + rgn.offset.x);
+      double right = area.right - (bounds.left + rgn.offset.x);
+
+      range.first_row = std::max(rgn.first_row, find_span(_row_pos, top));
+      range.last_row = std::min(rgn.last_row, find_span(_row_pos, bottom) + 1);
+      range.first_col = std::max(rgn.first_col, find_span(_col_pos, left));
+      range.last_col = std::min(rgn.last_col, find_span(_col_pos, right) + 1);
+
+      if (range.first_row >= range.last_row || range.first_col >= range.last_col)
+         return {};
+      return range;
+   }
+
+   rect dynamic_grid::cell_bounds(
+      rect const& bounds, region const& rgn, std::size_t row, std::size_t col) const
+   {
+      float left = bounds.left + rgn.offset.x;
+      float top = bounds.top + rgn.offset.y;
+      return {
+         left + float(_col_pos[col])
+       , top + float(_row_pos[row])
+       , left + float(_col_pos[col+1])
+       , top + float(_row_pos[row+1])
+      };
+   }
+
+   dynamic_grid::cell_info& dynamic_grid::get_cell(
+      context const& ctx, std::size_t row, std::size_t col, rect const& bounds) const
+   {
+      auto& cell = _cells[key_of(row, col)];
+      if (!cell.elem_ptr)
+         cell.elem_ptr = _composer->compose(row, col);
+      if (cell.layout_id != _layout_id)
+      {
+         context rctx { ctx, cell.elem_ptr.get(), bounds };
+         cell.elem_ptr->layout(rctx);
+         cell.layout_id = _layout_id;
+      }
+      return cell;
+   }
+
+   element* dynamic_grid::cell_element(std::size_t row, std::size_t col) const
+   {
+      if (row >= num_rows() || col >= num_cols())
+         return nullptr;
+      auto i = _cells.find(key_of(row, col));
+      return (i != _cells.end())? i->second.elem_ptr.get() : nullptr;
+   }
+
+   bool dynamic_grid::is_tracked(std::size_t row, std::size_t col) const
+   {
+      return (row == _focus_row && col == _focus_col)
+         || (row == _click_row && col == _click_col)
+         || (row == _hover_row && col == _hover_col)
+         ;
+   }
+
+   void dynamic_grid::release_hidden_cells(context const& ctx, regions const& rgns)
+   {
+      // Release the cells that are no longer in the visible area. Cells are
+      // retained based on the visible area, not the clip extent, so partial
+      // refreshes do not discard (and later recompose) visible cells.
+      auto sc = scrollable::find(ctx);
+      rect visible = clip(sc.context_ptr? sc.context_ptr->bounds : ctx.view_bounds(), ctx.bounds);
+      auto retained = is_empty_area(visible)?
+         cell_range{} : visible_range(rgns[0], ctx.bounds, visible);
+      if (retained == _retained)
+         return;
+      _retained = retained;
+
+      auto frozen_rows = std::min(_frozen_rows, num_rows());
+      auto frozen_cols = std::min(_frozen_cols, num_cols());
+      auto cols = num_cols();
+      for (auto i = _cells.begin(); i != _cells.end();)
+      {
+         std::size_t row = i->first / cols;
+         std::size_t col = i->first % cols;
+         bool row_visible = row < frozen_rows
+            || (row >= retained.first_row && row < retained.last_row);
+         bool col_visible = col < frozen_cols
+            || (col >= retained.first_col && col < retained.last_col);
+
+         if ((row_visible && col_visible) || is_tracked(row, col))
+            ++i;
+         else
+            i = _cells.erase(i);
+      }
+   }
+
+   rect dynamic_grid::bounds_of(context const& ctx, std::size_t row, std::size_t col) const
+   {
+      if (row >= num_rows() || col >= num_cols())
+         return {};
+      auto rgns = make_regions(ctx.bounds, pin_offset(ctx));
+      for (auto const& rgn : rgns)
+      {
+         if (row >= rgn.first_row && row < rgn.last_row
+            && col >= rgn.first_col && col < rgn.last_col)
+            return cell_bounds(ctx.bounds, rgn, row, col);
+      }
+      return {};
+   }
+
+   dynamic_grid::hit_info dynamic_grid::hit_element(context const& ctx, point p, bool control) const
+   {
+      if (!num_rows() || !num_cols() || !ctx.bounds.includes(p))
+         return {};
+
+      // Test the regions in reverse paint order: the frozen headers are
+      // drawn over the scrolling body.
+      auto rgns = make_regions(ctx.bounds, pin_offset(ctx));
+      for (auto i = rgns.rbegin(); i != rgns.rend(); ++i)
+      {
+         auto const& rgn = *i;
+         if (is_empty_area(rgn.area) || !rgn.area.includes(p))
+            continue;
+
+         auto range = visible_range(rgn, ctx.bounds, { p.x, p.y, p.x, p.y });
+         if (range.first_row == range.last_row)
+            return {};
+
+         auto row = range.first_row;
+         auto col = range.first_col;
+         auto bounds = cell_bounds(ctx.bounds, rgn, row, col);
+         auto& cell = get_cell(ctx, row, col, bounds);
+         auto& e = *cell.elem_ptr;
+         if (!control || e.wants_control())
+         {
+            context ectx{ ctx, &e, bounds };
+            if (e.hit_test(ectx, p))
+               return hit_info{ e.shared_from_this(), bounds, row, col };
+         }
+         return {};
+      }
+      return {};
+   }
+
+   bool dynamic_grid::wants_control() const
+   {
+      for (auto const& cell : _cells)
+         if (cell.second.elem_ptr && cell.second.elem_ptr->wants_control())
+            return true;
+      return false;
+   }
+
+   bool dynamic_grid::click(context const& ctx, mouse_button btn)
+   {
+      if (btn.down)
+      {
+         hit_info info = hit_element(ctx, btn.pos, true);
+         if (info.element)
+         {
+            if (info.element->wants_focus()
+               && (info.row != _focus_row || info.col != _focus_col))
+               new_focus(ctx, info.row, info.col);
+
+            context ectx{ ctx, info.element.get(), info.bounds };
+            if (info.element->click(ectx, btn))
+            {
+               _click_row = info.row;
+               _click_col = info.col;
+               return true;
+            }
+         }
+      }
+      else if (auto e = cell_element(_click_row, _click_col))
+      {
+         context ectx{ ctx, e, bounds_of(ctx, _click_row, _click_col) };
+         _click_row = _click_col = npos;
+         return e->click(ectx, btn);
+      }
+      _click_row = _click_col = npos;
+      return false;
+   }
+
+   void dynamic_grid::drag(context const& ctx, mouse_button btn)
+   {
+      if (auto e = cell_element(_click_row, _click_col))
+      {
+         context ectx{ ctx, e, bounds_of(ctx, _click_row, _click_col) };
+         e->drag(ectx, btn);
+      }
+   }
+
+   bool dynamic_grid::key(context const& ctx, key_info k)
+   {
+      if (auto e = cell_element(_focus_row, _focus_col))
+      {
+         context ectx{ ctx, e, bounds_of(ctx, _focus_row, _focus_col) };
+         if (e->key(ectx, k))
+            return true;
+      }
+
+      // Tab to the next (or previous, with shift) cell that wants focus.
+      // The search is limited to one row's worth of cells so that huge
+      // grids of non-focusable cells do not compose everything.
+      if ((k.action == key_action::press || k.action == key_action::repeat)
+         && k.key == key_code::tab && num_rows() && num_cols())
+      {
+         auto const cols = num_cols();
+         auto const size = std::uint64_t(num_rows()) * cols;
+         bool reverse = k.modifiers & mod_shift;
+         bool has_focus = _focus_row != npos && _focus_col != npos;
+         std::uint64_t pos = has_focus?
+            key_of(_focus_row, _focus_col) : (reverse? size : std::uint64_t(-1));
+
+         for (std::size_t n = 0; n != cols; ++n)
+         {
+            if (reverse? pos == 0 : pos+1 == size)
+               break;
+            pos = reverse? pos-1 : pos+1;
+
+            std::size_t row = pos / cols;
+            std::size_t col = pos % cols;
+            auto bounds = bounds_of(ctx, row, col);
+            if (get_cell(ctx, row, col, bounds).elem_ptr->wants_focus())
+            {
+               new_focus(ctx, row, col);
+               scrollable::find(ctx).scroll_into_view(bounds);
+               return true;
+            }
+         }
+      }
+      return false;
+   }
+
+   bool dynamic_grid::text(context const& ctx, text_info info)
+   {
+      if (auto e = cell_element(_focus_row, _focus_col))
+      {
+         context ectx{ ctx, e, bounds_of(ctx, _focus_row, _focus_col) };
+         return e->text(ectx, info);
+      }
+      return false;
+   }
+
+   bool dynamic_grid::cursor(context const& ctx, point p, cursor_tracking status)
+   {
+      auto leave_hovered =
+         [&]()
+         {
+            if (auto e = cell_element(_hover_row, _hover_col))
+            {
+               context ectx{ ctx, e, bounds_of(ctx, _hover_row, _hover_col) };
+               e->cursor(ectx, p, cursor_tracking::leaving);
+            }
+            _hover_row = _hover_col = npos;
+         };
+
+      if (status == cursor_tracking::leaving)
+      {
+         leave_hovered();
+         return false;
+      }
+
+      hit_info info = hit_element(ctx, p, true);
+      if (info.row != _hover_row || info.col != _hover_col)
+      {
+         leave_hovered();
+         status = cursor_tracking::entering;
+      }
+      else
+      {
+         status = cursor_tracking::hovering;
+      }
+
+      if (info.element)
+      {
+         _hover_row = info.row;
+         _hover_col = info.col;
+         context ectx{ ctx, info.element.get(), info.bounds };
+         return info.element->cursor(ectx, p, status);
+      }
+      return false;
+   }
+
+   bool dynamic_grid::scroll(context const& ctx, point dir, point p)
+   {
+      hit_info info = hit_element(ctx, p, true);
+      if (info.element)
+      {
+         context ectx{ ctx, info.element.get(), info.bounds };
+         return info.element->scroll(ectx, dir, p);
+      }
+      return false;
+   }
+
+   void dynamic_grid::new_focus(context const& ctx, std::size_t row, std::size_t col)
+   {
+      if (auto e = cell_element(_focus_row, _focus_col))
+      {
+         e->end_focus();
+         ctx.view.refresh(ctx);
+      }
+
+      _focus_row = row;
+      _focus_col = col;
+      if (auto e = cell_element(_focus_row, _focus_col))
+      {
+         e->begin_focus();
+         ctx.view.refresh(ctx);
+      }
+   }
+
+   bool dynamic_grid::wants_focus() const
+   {
+      for (auto const& cell : _cells)
+         if (cell.second.elem_ptr && cell.second.elem_ptr->wants_focus())
+            return true;
+      return false;
+   }
+
+   void dynamic_grid::begin_focus()
+   {
+      if (auto e = cell_element(_focus_row, _focus_col))
+         e->begin_focus();
+   }
+
+   void dynamic_grid::end_focus()
+   {
+      if (auto e = cell_element(_focus_row, _focus_col))
+         e->end_focus();
+   }
+
+   element const* dynamic_grid::focus() const
+   {
+      return cell_element(_focus_row, _focus_col);
+   }
+
+   element* dynamic_grid::focus()
+   {
+      return cell_element(_focus_row, _focus_col);
+   }
+
+   void dynamic_grid::focus(std::size_t row, std::size_t col)
+   {
+      if (row < num_rows() && col < num_cols())
+      {
+         _focus_row = row;
+         _focus_col = col;
+      }
+   }
+
+   void dynamic_grid::reset()
+   {
+      _focus_row = _focus_col = npos;
+      _click_row = _click_col = npos;
+      _hover_row = _hover_col = npos;
+   }
+}}
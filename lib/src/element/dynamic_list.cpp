@@ -16,6 +16,10 @@ namespace cycfi { namespace elements
          {
             update(ctx);
          }
+         else if (_update_from != std::size_t(-1))
+         {
+            update_positions(ctx);
+         }
          auto secondary_limits = _composer->secondary_axis_limits(ctx);
          if (_composer->size())
          {
@@ -30,6 +34,8 @@ namespace cycfi { namespace elements
        // Johann Philippe : this seems to be necessary for context where a hdynamic_list is inside vdynamic_list (2D tables)
       if (_update_request)
            update(ctx);
+      else if (_update_from != std::size_t(-1))
+           update_positions(ctx);
 
       auto& cnv = ctx.canvas;
       auto  state = cnv.new_state();
@@ -134,6 +140,30 @@ namespace cycfi { namespace elements
       }
       ++_layout_id;
       _update_request = false;
+      _update_from = -1;
+   }
+
+   void dynamic_list::update_positions(basic_context const& ctx) const
+   {
+      // Recompute the positions of the cells starting at _update_from.
+      // Only the cells inserted since the last update (main_axis_size < 0)
+      // query the composer for their size.
+      auto from = std::min(_update_from, _cells.size());
+      double y = 0;
+      if (from != 0)
+         y = _cells[from-1].pos + _cells[from-1].main_axis_size;
+
+      for (auto i = from; i != _cells.size(); ++i)
+      {
+         auto& cell = _cells[i];
+         if (cell.main_axis_size < 0)
+            cell.main_axis_size = _composer->main_axis_size(i, ctx);
+         cell.pos = y;
+         y += cell.main_axis_size;
+      }
+      _main_axis_full_size = y;
+      _update_from = -1;
+      ++_layout_id;
    }
 
 
@@ -452,6 +482,56 @@ namespace cycfi { namespace elements
        this->update();
    }
 
+   void dynamic_list::insert(std::size_t pos, std::size_t num_items)
+   {
+      // The composer is expected to already include the new items. Cells
+      // are spliced in without recomposing or resizing the existing ones.
+      // If the cells are not yet built, the next update picks them up.
+      if (_update_request || num_items == 0)
+         return;
+
+      pos = std::min(pos, _cells.size());
+      _cells.insert(_cells.begin() + pos, num_items, cell_info{ 0, -1, nullptr });
+      _update_from = std::min(_update_from, pos);
+      shift_indices(pos, std::ptrdiff_t(num_items));
+   }
+
+   void dynamic_list::erase(std::size_t pos, std::size_t num_items)
+   {
+      if (_update_request || num_items == 0 || pos >= _cells.size())
+         return;
+
+      num_items = std::min(num_items, _cells.size() - pos);
+      _cells.erase(_cells.begin() + pos, _cells.begin() + pos + num_items);
+      _update_from = std::min(_update_from, pos);
+      shift_indices(pos, -std::ptrdiff_t(num_items), num_items);
+   }
+
+   void dynamic_list::shift_indices(std::size_t pos, std::ptrdiff_t delta, std::size_t num_erased)
+   {
+      auto&& shift = [&](int ix) -> int
+      {
+         if (ix < 0 || std::size_t(ix) < pos)
+            return ix;
+         if (std::size_t(ix) < pos + num_erased)
+            return -1;
+         return int(ix + delta);
+      };
+
+      _focus = shift(_focus);
+      _saved_focus = shift(_saved_focus);
+      _click_tracking = shift(_click_tracking);
+      _cursor_tracking = shift(_cursor_tracking);
+
+      std::set<int> hovering;
+      for (auto ix : _cursor_hovering)
+         if (auto i = shift(ix); i != -1)
+            hovering.insert(i);
+      _cursor_hovering.swap(hovering);
+
+      _previous_window_start = _previous_window_end = 0;
+   }
+
    dynamic_list::hit_info dynamic_list::hit_element(context const& ctx, point p, bool control) const
    {
       auto&& test_element =
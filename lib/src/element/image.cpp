@@ -6,7 +6,11 @@
 #include <elements/element/image.hpp>
 #include <elements/support.hpp>
 #include <elements/support/context.hpp>
+#include <elements/support/pixmap_cache.hpp>
 #include <algorithm>
+#include <cmath>
+#include <list>
+#include <memory>
 
 namespace cycfi { namespace elements
 {
@@ -14,7 +18,7 @@ namespace cycfi { namespace elements
    // image implementation
    ////////////////////////////////////////////////////////////////////////////
    image::image(char const* filename, float scale)
-    : _pixmap(std::make_shared<elements::pixmap>(filename, scale))
+    : _pixmap(get_pixmap_cache().load(filename, scale))
    {
    }
 
@@ -95,6 +99,134 @@ namespace cycfi { namespace elements
          parts[1] = corner.move(dest.left, dest.bottom - (div_v+1));
          parts[2] = max(parts[0], parts[1]).inset(0, div_v);
       }
+
+      using parts_function = void(*)(rect src, rect dest, rect parts[]);
+
+      // Composed pixmaps bigger than this are not worth the memory. Draw
+      // the patches directly.
+      constexpr float max_composed_pixels = 2048 * 2048;
+
+      void draw_parts(
+         canvas& cnv, pixmap const& pm
+       , rect bounds, parts_function parts, int n
+      )
+      {
+         rect  src[9];
+         rect  dest[9];
+         auto  size_ = pm.size();
+         rect  src_bounds{ 0, 0, size_.x, size_.y };
+
+         parts(src_bounds, src_bounds, src);
+         parts(src_bounds, bounds, dest);
+         for (int i = 0; i < n; i++)
+            cnv.draw(pm, src[i], dest[i]);
+      }
+
+      struct composed_key
+      {
+         bool              operator==(composed_key const& rhs) const
+                           {
+                              // Compare the owners, not the addresses: a
+                              // new pixmap may reuse a destroyed one's.
+                              return !source.owner_before(rhs.source)
+                                 && !rhs.source.owner_before(source)
+                                 && parts == rhs.parts && size == rhs.size
+                                 && scale == rhs.scale;
+                           }
+
+         std::weak_ptr<pixmap> source;
+         parts_function    parts;
+         point             size;
+         float             scale;
+      };
+
+      // Like the rest of the drawing, this is used from the UI thread only.
+      // Bounded by the number of entries and by their total pixels.
+      pixmap const& get_composed(composed_key key, pixmap const& pm, int n)
+      {
+         static constexpr std::size_t capacity = 16;
+         static constexpr float max_total_pixels = 2 * max_composed_pixels;
+         using entry = std::pair<composed_key, pixmap_ptr>;
+         static std::list<entry> composed;   // Most recently used first
+         static float total_pixels = 0;
+
+         auto pixels = [](pixmap const& pm)
+         {
+            auto size_ = pm.size();
+            auto scale = pm.scale();
+            return (size_.x / scale) * (size_.y / scale);
+         };
+
+         for (auto i = composed.begin(); i != composed.end();)
+         {
+            if (i->first.source.expired())
+            {
+               // The source is gone. Its composed pixmap is of no more use.
+               total_pixels -= pixels(*i->second);
+               i = composed.erase(i);
+            }
+            else if (i->first == key)
+            {
+               composed.splice(composed.begin(), composed, i);
+               return *i->second;
+            }
+            else
+            {
+               ++i;
+            }
+         }
+
+         // The pixmap's scale is the size of a pixel, in user units
+         auto w = std::ceil(key.size.x * key.scale);
+         auto h = std::ceil(key.size.y * key.scale);
+         auto composed_pm = std::make_shared<pixmap>(point{ w, h }, 1 / key.scale);
+         {
+            pixmap_context pm_ctx{ *composed_pm };
+            canvas cnv{ *pm_ctx.context() };
+            draw_parts(cnv, pm, rect{ 0, 0, key.size.x, key.size.y }, key.parts, n);
+         }
+
+         composed.emplace_front(key, composed_pm);
+         total_pixels += pixels(*composed_pm);
+         while (composed.size() > 1
+            && (composed.size() > capacity || total_pixels > max_total_pixels))
+         {
+            total_pixels -= pixels(*composed.back().second);
+            composed.pop_back();
+         }
+         return *composed.front().second;
+      }
+
+      void draw_cached(
+         context const& ctx, pixmap_ptr const& pm
+       , parts_function parts, int n
+      )
+      {
+         auto  bounds = ctx.bounds;
+         auto& cr = ctx.canvas.cairo_context();
+
+         // Device pixels per user unit. Compose only for plain (possibly
+         // scaled) transforms, where one scale fits both axes.
+         cairo_matrix_t mat;
+         cairo_get_matrix(&cr, &mat);
+         double tsx, tsy;
+         cairo_surface_get_device_scale(cairo_get_target(&cr), &tsx, &tsy);
+         auto  sx = float(mat.xx * tsx);
+         auto  sy = float(mat.yy * tsy);
+         auto  w = std::ceil(bounds.width() * sx);
+         auto  h = std::ceil(bounds.height() * sx);
+
+         if (mat.xy != 0 || mat.yx != 0 || sx <= 0 || std::abs(sx - sy) > 1e-3f
+            || w < 1 || h < 1 || w * h > max_composed_pixels)
+         {
+            draw_parts(ctx.canvas, *pm, bounds, parts, n);
+            return;
+         }
+
+         auto  size_ = point{ bounds.width(), bounds.height() };
+         auto& composed = get_composed({ pm, parts, size_, sx }, *pm, n);
+         ctx.canvas.draw(composed, rect{ 0, 0, size_.x, size_.y }, bounds);
+      }
    }
 
    gizmo::gizmo(char const* filename, float scale)
@@ -113,16 +245,7 @@ namespace cycfi { namespace elements
 
    void gizmo::draw(context const& ctx)
    {
-      rect  src[9];
-      rect  dest[9];
-      auto  size_ = size();
-      rect  src_bounds{ 0, 0, size_.x, size_.y };
-
-      gizmo_parts(src_bounds, src_bounds, src);
-      gizmo_parts(src_bounds, ctx.bounds, dest);
-
-      for (int i = 0; i < 9; i++)
-         ctx.canvas.draw(pixmap(), src[i], dest[i]);
+      draw_cached(ctx, shared_pixmap(), gizmo_parts, 9);
    }
 
    hgizmo::hgizmo(char const* filename, float scale)
@@ -141,16 +264,7 @@ namespace cycfi { namespace elements
 
    void hgizmo::draw(context const& ctx)
    {
-      rect  src[3];
-      rect  dest[3];
-      auto  size_ = size();
-      rect  src_bounds{ 0, 0, size_.x, size_.y };
-
-      hgizmo_parts(src_bounds, src_bounds, src);
-      hgizmo_parts(src_bounds, ctx.bounds, dest);
-      ctx.canvas.draw(pixmap(), src[0], dest[0]);
-      ctx.canvas.draw(pixmap(), src[1], dest[1]);
-      ctx.canvas.draw(pixmap(), src[2], dest[2]);
+      draw_cached(ctx, shared_pixmap(), hgizmo_parts, 3);
    }
 
    vgizmo::vgizmo(char const* filename, float scale)
@@ -169,16 +283,7 @@ namespace cycfi { namespace elements
 
    void vgizmo::draw(context const& ctx)
    {
-      rect  src[3];
-      rect  dest[3];
-      auto  size_ = size();
-      rect  src_bounds{ 0, 0, size_.x, size_.y };
-
-      vgizmo_parts(src_bounds, src_bounds, src);
-      vgizmo_parts(src_bounds, ctx.bounds, dest);
-      ctx.canvas.draw(pixmap(), src[0], dest[0]);
-      ctx.canvas.draw(pixmap(), src[1], dest[1]);
-      ctx.canvas.draw(pixmap(), src[2], dest[2]);
+      draw_cached(ctx, shared_pixmap(), vgizmo_parts, 3);
    }
 
    basic_sprite::basic_sprite(char const* filename, float height, float scale)
@@ -9,6 +9,8 @@
 #include <elements/support/text_utils.hpp>
 #include <elements/support/context.hpp>
 #include <elements/view.hpp>
+#include <algorithm>
+#include <iterator>
 #include <utility>
 
 namespace cycfi { namespace elements
@@ -18,22 +20,241 @@ namespace cycfi { namespace elements
    ////////////////////////////////////////////////////////////////////////////
    // Static Text Box
    ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      char const* const empty_text = "";
+
+      // Paragraphs end at \n, \r, \r\n (one break) or NEL (U+0085, which is
+      // C2 85 in UTF-8). These are the bytes that may end a break.
+      bool is_break_byte(char c)
+      {
+         return c == '\n' || c == '\r' || c == '\x85';
+      }
+
+      // The byte at pos, or -1 if pos is at or past the end
+      int byte_at(text_storage const& storage, std::size_t pos)
+      {
+         auto  chunk = storage.chunk(pos);
+         if (chunk.text.empty())
+            return -1;
+         return std::uint8_t(chunk.text[pos - chunk.offset]);
+      }
+
+      // Returns the first span that ends after pos. Spans (font_run and
+      // color_run) are sorted and do not overlap.
+      template <typename Spans>
+      auto first_span(Spans& spans, std::size_t pos)
+      {
+         using span = typename std::decay_t<Spans>::value_type;
+         return std::partition_point(spans.begin(), spans.end(),
+            [pos](span const& s)
+            {
+               return s.offset + s.length <= pos;
+            }
+         );
+      }
+
+      // Collects the spans within [first, last), clipped, with offsets
+      // relative to first.
+      template <typename Run>
+      void clip_spans(
+         std::vector<Run> const& spans
+       , std::size_t first, std::size_t last
+       , std::vector<Run>& out
+      )
+      {
+         out.clear();
+         for (auto i = first_span(spans, first); i != spans.end() && i->offset < last; ++i)
+         {
+            auto  f = std::max(i->offset, first);
+            auto  l = std::min(i->offset + i->length, last);
+            out.push_back(*i);
+            out.back().offset = f - first;
+            out.back().length = l - f;
+         }
+      }
+
+      // Replaces the spans within [pos, pos+n) with run, if not null.
+      // Spans that straddle the range are trimmed. Returns false if nothing
+      // changed.
+      template <typename Run>
+      bool set_span(std::vector<Run>& spans, std::size_t pos, std::size_t n, Run const* run)
+      {
+         auto  last = pos + n;
+         auto  i = first_span(spans, pos);
+         auto  j = i;
+         while (j != spans.end() && j->offset < last)
+            ++j;
+         if (i == j && !run)
+            return false;
+
+         std::vector<Run> pieces;
+         if (i != j && i->offset < pos)
+         {
+            pieces.push_back(*i);
+            pieces.back().length = pos - i->offset;
+         }
+         if (run)
+            pieces.push_back(*run);
+         if (i != j)
+         {
+            auto const& back = *(j-1);
+            auto  end = back.offset + back.length;
+            if (end > last)
+            {
+               pieces.push_back(back);
+               pieces.back().offset = last;
+               pieces.back().length = end - last;
+            }
+         }
+
+         i = spans.erase(i, j);
+         spans.insert(i, pieces.begin(), pieces.end());
+         return true;
+      }
+
+      // Moves the spans along with an edit. Text inserted inside a span
+      // extends it. Text inserted at either end of a span does not. Spans
+      // that are entirely erased are removed.
+      template <typename Run>
+      void shift_span_offsets(
+         std::vector<Run>& spans
+       , std::size_t pos
+       , std::size_t erased, std::size_t inserted
+      )
+      {
+         auto  end = pos + erased;
+         for (auto i = first_span(spans, pos); i != spans.end();)
+         {
+            auto  f = i->offset;
+            auto  l = f + i->length;
+            f = (f < pos)? f : (f >= end)? f - erased + inserted : pos + inserted;
+            l = (l >= end)? l - erased + inserted : pos;
+            if (l <= f)
+            {
+               i = spans.erase(i);
+            }
+            else
+            {
+               i->offset = f;
+               i->length = l - f;
+               ++i;
+            }
+         }
+      }
+   }
+
+   static_text_box::paragraph::paragraph(
+      std::string text_
+    , std::size_t offset_
+    , master_glyphs const& source
+    , font_runs const& runs
+   )
+    : text(std::move(text_))
+    , shape(text.data(), text.data() + text.size(), source, runs)
+    , offset(offset_)
+    , attributed(!runs.empty())
+   {}
+
+   void static_text_box::paragraph::break_rows(float width_)
+   {
+      rows.clear();
+      clusters.clear();
+      row_clusters.clear();
+      shape.break_lines(width_, rows);
+      width = width_;
+   }
+
+   void static_text_box::paragraph::index_rows()
+   {
+      if (!row_clusters.empty())
+         return;
+
+      for (auto const& row : rows)
+      {
+         auto  first = clusters.size();
+         row_clusters.push_back(first);
+         row.cluster_positions(clusters);
+
+         // Make the offsets relative to the paragraph
+         auto  base = std::size_t(row.begin() - text.data());
+         for (auto i = first; i != clusters.size(); ++i)
+            clusters[i].offset += base;
+      }
+      row_clusters.push_back(clusters.size());
+   }
+
+   std::size_t static_text_box::paragraph::find_row(std::size_t offset) const
+   {
+      // Returns the last row that starts at or before offset
+      auto i = std::upper_bound(
+         rows.begin(), rows.end(), text.data() + offset,
+         [](char const* p, glyphs const& row)
+         {
+            return p < row.begin();
+         }
+      );
+      return (i == rows.begin())? 0 : (i - rows.begin()) - 1;
+   }
+
+   static_text_box::paragraph::cluster_position const&
+   static_text_box::paragraph::row_end(std::size_t row) const
+   {
+      return clusters[row_clusters[row+1] - 1];
+   }
+
+   static_text_box::paragraph::cluster_position const*
+   static_text_box::paragraph::find_cluster(std::size_t row, std::size_t offset) const
+   {
+      // Returns the first cluster in the row at or after offset, or the
+      // row's end
+      auto  f = clusters.data() + row_clusters[row];
+      auto  l = &row_end(row);
+      return std::lower_bound(f, l, offset,
+         [](cluster_position const& c, std::size_t offset)
+         {
+            return c.offset < offset;
+         }
+      );
+   }
+
+   static_text_box::paragraph::cluster_position const*
+   static_text_box::paragraph::find_cluster(std::size_t row, float x) const
+   {
+      // Returns the cluster under x (the clusters span from their x to the
+      // x of the next), or the row's end if x is past the row.
+      auto  f = clusters.data() + row_clusters[row];
+      auto  l = &row_end(row);
+      if (x >= l->x)
+         return l;
+      auto i = std::upper_bound(f, l, x,
+         [](float x, cluster_position const& c)
+         {
+            return x < c.x;
+         }
+      );
+      return (i == f)? f : i-1;
+   }
+
    static_text_box::static_text_box(
       std::string text
     , font font_
     , float size
     , color color_
    )
-    : _text(std::move(text))
-    , _layout(_text.data(), _text.data() + _text.size(), font_, size)
+    : _layout(empty_text, empty_text, font_, size) // Holds the font only
     , _color(color_)
-   {}
+    , _storage(std::make_shared<rope_text_storage>(text))
+    , _metrics(_layout.metrics())
+   {
+      split_paragraphs(0, _storage->size(), _paragraphs);
+   }
 
    view_limits static_text_box::limits(basic_context const& /* ctx */) const
    {
       sync();
 
-      auto  size = _layout.metrics();
+      auto  size = line_metrics();
       auto  min_line_height = size.ascent + size.descent + size.leading;
       float line_height =
          (_current_size.y == -1) ?
@@ -49,64 +270,440 @@ namespace cycfi { namespace elements
 
    void static_text_box::layout(context const& ctx)
    {
+      auto  prev_size = _current_size;
+      _current_size.x = ctx.bounds.width();
       sync();
 
-      _rows.clear();
-      auto  new_x = ctx.bounds.width();
-      _layout.break_lines(new_x, _rows);
-      auto  size = _layout.metrics();
-      auto  new_y = _rows.size() * (size.ascent + size.descent + size.leading);
+      auto  size = line_metrics();
+      _current_size.y = num_rows() * (size.ascent + size.descent + size.leading);
 
       // Refresh the union of the old and new bounds if the size has changed
-      if (_current_size.x != new_x || _current_size.y != new_y)
+      if (prev_size.x != _current_size.x || prev_size.y != _current_size.y)
       {
-         if (_current_size.x != -1 && _current_size.y != -1)
-            ctx.view.refresh(max(ctx.bounds, rect(ctx.bounds.top_left(), extent{_current_size})));
+         if (prev_size.x != -1 && prev_size.y != -1)
+            ctx.view.refresh(max(ctx.bounds, rect(ctx.bounds.top_left(), extent{prev_size})));
          else
             ctx.view.refresh(ctx.bounds);
       }
-
-      _current_size.x = new_x;
-      _current_size.y = new_y;
    }
 
    void static_text_box::draw(context const& ctx)
    {
+      sync();
+
       auto& cnv = ctx.canvas;
       auto  state = cnv.new_state();
-      auto  metrics = _layout.metrics();
+      auto  metrics = line_metrics();
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
       auto  x = ctx.bounds.left;
-      auto  y = ctx.bounds.top + metrics.ascent;
+      auto  top = ctx.bounds.top;
       auto  clip_extent = cnv.clip_extent();
+      auto  bottom = std::min(ctx.bounds.bottom, clip_extent.bottom);
+
+      // Start from the first row in the clip
+      std::size_t row = 0;
+      if (clip_extent.top > top)
+         row = std::size_t((clip_extent.top - top) / line_height);
+      if (row >= num_rows())
+         return;
 
       cnv.rect(ctx.bounds);
       cnv.clip();
+      if (!_search.empty())
+         draw_matches(ctx, row, bottom);
       cnv.fill_style(_color);
-      for (auto& row : _rows)
+      for (auto i = find_paragraph_row(row); i != _paragraphs.end(); ++i)
+      {
+         auto& p = **i;
+         auto  r = (row > p.first_row)? row - p.first_row : 0;
+         for (; r < p.rows.size(); ++r)
+         {
+            auto  y = top + metrics.ascent + ((p.first_row + r) * line_height);
+            if (y - metrics.ascent > bottom)
+               return;
+            if (y + metrics.descent > clip_extent.top)
+            {
+               auto& row = p.rows[r];
+               if (_color_spans.empty())
+               {
+                  row.draw({ x, y }, cnv);
+               }
+               else
+               {
+                  auto  first = p.offset + (row.begin() - p.text.data());
+                  clip_spans(_color_spans, first, first + row.size(), _row_colors);
+                  row.draw({ x, y }, cnv, _row_colors);
+               }
+            }
+         }
+      }
+   }
+
+   void static_text_box::draw_matches(context const& ctx, std::size_t row, float bottom)
+   {
+      auto& cnv = ctx.canvas;
+      auto  metrics = line_metrics();
+      auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
+      auto  x = ctx.bounds.left;
+      auto  top = ctx.bounds.top;
+      auto  size = _search.pattern().size();
+      auto  end = _search.matches().end();
+
+      // Add the highlights of the visible rows to the path, then fill them
+      // all at once.
+      bool  any = false;
+      for (auto i = find_paragraph_row(row); i != _paragraphs.end(); ++i)
       {
-         if (y + metrics.descent > clip_extent.top)
-            row.draw({ x, y }, cnv);
-         y += line_height;
-         if (y > ctx.bounds.bottom + metrics.ascent)
+         auto& p = **i;
+         auto  r = (row > p.first_row)? row - p.first_row : 0;
+         for (; r < p.rows.size(); ++r)
+         {
+            auto  y = top + ((p.first_row + r) * line_height);
+            if (y > bottom)
+               break;
+
+            auto const& rw = p.rows[r];
+            auto  first = p.offset + (rw.begin() - p.text.data());
+            auto  last = first + rw.size();
+            for (auto m = _search.first_match(first); m != end && *m < last; ++m)
+            {
+               auto  f = std::max(*m, first);
+               auto  l = std::min(*m + size, last);
+               if (l <= f)
+                  continue;
+
+               p.index_rows();
+               auto  x1 = p.find_cluster(r, f - p.offset)->x;
+               auto  x2 = p.find_cluster(r, l - p.offset)->x;
+               cnv.rect({ x + x1, y, x + x2, y + line_height });
+               any = true;
+            }
+         }
+         if (r < p.rows.size())
             break;
       }
+
+      if (any)
+      {
+         cnv.fill_style(get_theme().text_box_find_hilite_color);
+         cnv.fill();
+      }
    }
 
    void static_text_box::sync() const
    {
-      auto f = _text.data();
-      auto l = _text.data() + _text.size();
-      if (f != _layout.begin() || l != _layout.end())
-         _layout.text(f, l);
+      if (_current_size.x != -1)
+         break_rows(_current_size.x);
+   }
+
+   void static_text_box::split_paragraphs(
+      std::size_t first, std::size_t last
+    , paragraph_vector& paragraphs
+   ) const
+   {
+      std::string text;
+      std::size_t offset = first;
+      std::size_t pos = first;
+      font_runs   runs;
+
+      auto  make_paragraph = [&]()
+      {
+         clip_spans(_font_spans, offset, offset + text.size(), runs);
+         return std::make_unique<paragraph>(std::move(text), offset, _layout, runs);
+      };
+
+      // A break may straddle two chunks: the \n of a \r\n is skipped when
+      // it is seen, and the C2 of a NEL is taken back from the text.
+      bool  after_cr = false;
+      _storage->for_each_chunk(first, last - first,
+         [&](string_view chunk)
+         {
+            auto  f = chunk.begin();
+            auto  l = chunk.end();
+            while (true)
+            {
+               if (after_cr && f != l)
+               {
+                  after_cr = false;
+                  if (*f == '\n')
+                  {
+                     ++f;
+                     ++offset;
+                  }
+               }
+
+               auto  nl = std::find_if(f, l, is_break_byte);
+               text.append(f, nl);
+               if (nl == l)
+                  break;
+               f = nl + 1;
+               if (*nl == '\x85')
+               {
+                  if (text.empty() || text.back() != '\xC2')
+                  {
+                     text.push_back(*nl);    // Not a NEL
+                     continue;
+                  }
+                  text.pop_back();
+               }
+               paragraphs.push_back(make_paragraph());
+               text.clear();
+               offset = pos + (nl - chunk.begin()) + 1;
+               after_cr = *nl == '\r';
+            }
+            pos += chunk.size();
+         }
+      );
+      paragraphs.push_back(make_paragraph());
+   }
+
+   void static_text_box::update_paragraphs(
+      std::size_t pos
+    , std::size_t erased, std::size_t inserted
+   )
+   {
+      // Find the first and last paragraphs touched by the edit. For this
+      // purpose, a paragraph includes the newline that ends it. Note that
+      // the paragraphs still have the offsets before the edit.
+      std::size_t first = find_paragraph(pos) - _paragraphs.begin();
+      std::size_t last = find_paragraph(pos + erased) - _paragraphs.begin();
+
+      // An edit next to a break may join a \r and a \n into one \r\n
+      // break. Include the paragraph on that side, then.
+      auto  end = [&]
+      {
+         auto const& p = *_paragraphs[last];
+         return p.offset + p.text.size() + inserted - erased;
+      };
+      if (first > 0 && byte_at(*_storage, _paragraphs[first]->offset - 1) == '\r')
+         --first;
+      if (last + 1 < _paragraphs.size() && end() > _paragraphs[first]->offset
+         && byte_at(*_storage, end()) == '\n' && byte_at(*_storage, end() - 1) == '\r')
+         ++last;
+
+      // Reshape the edited text, from the start of the first paragraph to
+      // the end of the last, splitting it into new paragraphs as needed.
+      paragraph_vector reshaped;
+      split_paragraphs(_paragraphs[first]->offset, end(), reshaped);
+
+      // Shift the paragraphs that follow
+      auto  delta = std::ptrdiff_t(inserted) - std::ptrdiff_t(erased);
+      for (auto i = _paragraphs.begin() + last + 1; i != _paragraphs.end(); ++i)
+         (*i)->offset += delta;
+
+      auto  i = _paragraphs.erase(
+         _paragraphs.begin() + first, _paragraphs.begin() + last + 1);
+      _paragraphs.insert(
+         i, std::make_move_iterator(reshaped.begin())
+       , std::make_move_iterator(reshaped.end()));
+
+      _rows_from = std::min(_rows_from, first);
+   }
+
+   void static_text_box::break_rows(float width) const
+   {
+      if (width != _rows_width)
+      {
+         _rows_width = width;
+         _rows_from = 0;
+      }
+
+      if (_rows_from >= _paragraphs.size())
+         return;
+
+      // Break the paragraphs that were reshaped (or all of them, if the
+      // width changed), and shift the rows of the rest.
+      std::size_t row = 0;
+      if (_rows_from > 0)
+      {
+         auto const& prev = *_paragraphs[_rows_from-1];
+         row = prev.first_row + prev.rows.size();
+      }
+
+      for (auto i = _paragraphs.begin() + _rows_from; i != _paragraphs.end(); ++i)
+      {
+         auto& p = **i;
+         if (p.width != width)
+            p.break_rows(width);
+         p.first_row = row;
+         row += p.rows.size();
+      }
+      _rows_from = -1;
+
+      // The rows have the height of the tallest font
+      _metrics = _layout.metrics();
+      if (!_font_spans.empty())
+      {
+         for (auto const& p : _paragraphs)
+         {
+            if (p->attributed)
+            {
+               auto  m = p->shape.metrics();
+               _metrics.ascent = std::max(_metrics.ascent, m.ascent);
+               _metrics.descent = std::max(_metrics.descent, m.descent);
+               _metrics.leading = std::max(_metrics.leading, m.leading);
+            }
+         }
+      }
+   }
+
+   glyphs::font_metrics static_text_box::line_metrics() const
+   {
+      return _metrics;
+   }
+
+   std::size_t static_text_box::num_rows() const
+   {
+      if (_paragraphs.empty())
+         return 0;
+      auto const& last = *_paragraphs.back();
+      return last.first_row + last.rows.size();
+   }
+
+   static_text_box::paragraph_vector::const_iterator
+   static_text_box::find_paragraph(std::size_t offset) const
+   {
+      // Returns the last paragraph that starts at or before offset
+      auto i = std::upper_bound(
+         _paragraphs.begin(), _paragraphs.end(), offset,
+         [](std::size_t offset, paragraph_ptr const& p)
+         {
+            return offset < p->offset;
+         }
+      );
+      return (i == _paragraphs.begin())? i : i-1;
+   }
+
+   static_text_box::paragraph_vector::const_iterator
+   static_text_box::find_paragraph_row(std::size_t row) const
+   {
+      // Returns the paragraph containing the row
+      auto i = std::upper_bound(
+         _paragraphs.begin(), _paragraphs.end(), row,
+         [](std::size_t row, paragraph_ptr const& p)
+         {
+            return row < p->first_row;
+         }
+      );
+      return (i == _paragraphs.begin())? i : i-1;
+   }
+
+   void static_text_box::replace_text(std::size_t pos, std::size_t n, string_view str)
+   {
+      pos = std::min(pos, _storage->size());
+      n = std::min(n, _storage->size() - pos);
+
+      // Trim what the old and new text have in common at both ends, so that
+      // replacing the whole text (e.g. set_text) reshapes only what changed.
+      auto  old_text = _storage->substr(pos, n);
+      string_view old = old_text;
+      std::size_t common = std::min(old.size(), str.size());
+      std::size_t prefix = 0;
+      while (prefix < common && old[prefix] == str[prefix])
+         ++prefix;
+      std::size_t suffix = 0;
+      while (suffix < (common - prefix)
+         && old[old.size() - suffix - 1] == str[str.size() - suffix - 1])
+         ++suffix;
+
+      pos += prefix;
+      n -= prefix + suffix;
+      str = str.substr(prefix, str.size() - prefix - suffix);
+      if (n == 0 && str.empty())
+         return;
+
+      auto  removed = old.substr(prefix, n);
+      _storage->replace(pos, n, str);
+      _text_valid = false;
+      _search.update(*_storage, pos, n, str.size());
+      shift_spans(pos, n, str.size());
+      update_paragraphs(pos, n, str.size());
+      text_replaced(pos, removed, str);
+   }
+
+   std::string const& static_text_box::get_text() const
+   {
+      if (!_text_valid)
+      {
+         _text = _storage->str();
+         _text_valid = true;
+      }
+      return _text;
    }
 
    void static_text_box::set_text(string_view text)
    {
-      _text = std::string(text);
-      _rows.clear();
-      _layout.text(_text.data(), _text.data() + _text.size());
-      _layout.break_lines(_current_size.x, _rows);
+      replace_text(0, _storage->size(), text);
+   }
+
+   void static_text_box::storage(text_storage_ptr storage_)
+   {
+      _storage = std::move(storage_);
+      _text_valid = false;
+      _font_spans.clear();
+      _color_spans.clear();
+      _search.refresh(*_storage);
+      _paragraphs.clear();
+      split_paragraphs(0, _storage->size(), _paragraphs);
+      _rows_from = 0;
+   }
+
+   std::size_t static_text_box::find(string_view pattern, bool ignore_case)
+   {
+      _search.find(*_storage, pattern, ignore_case);
+      return _search.size();
+   }
+
+   void static_text_box::clear_find()
+   {
+      _search.clear();
+   }
+
+   void static_text_box::shift_spans(
+      std::size_t pos
+    , std::size_t erased, std::size_t inserted
+   )
+   {
+      shift_span_offsets(_font_spans, pos, erased, inserted);
+      shift_span_offsets(_color_spans, pos, erased, inserted);
+   }
+
+   void static_text_box::font_span(std::size_t pos, std::size_t n, font font_, float size)
+   {
+      pos = std::min(pos, _storage->size());
+      n = std::min(n, _storage->size() - pos);
+      if (n == 0)
+         return;
+
+      font_run run{ pos, n, font_, size };
+      set_span(_font_spans, pos, n, &run);
+      update_paragraphs(pos, n, n);
+   }
+
+   void static_text_box::color_span(std::size_t pos, std::size_t n, color color_)
+   {
+      pos = std::min(pos, _storage->size());
+      n = std::min(n, _storage->size() - pos);
+      if (n == 0)
+         return;
+
+      color_run run{ pos, n, color_ };
+      set_span(_color_spans, pos, n, &run);
+   }
+
+   void static_text_box::clear_font_spans(std::size_t pos, std::size_t n)
+   {
+      pos = std::min(pos, _storage->size());
+      n = std::min(n, _storage->size() - pos);
+      if (set_span<font_run>(_font_spans, pos, n, nullptr))
+         update_paragraphs(pos, n, n);
+   }
+
+   void static_text_box::clear_color_spans(std::size_t pos, std::size_t n)
+   {
+      pos = std::min(pos, _storage->size());
+      n = std::min(n, _storage->size() - pos);
+      set_span<color_run>(_color_spans, pos, n, nullptr);
    }
 
    void static_text_box::value(string_view val)
@@ -125,6 +722,7 @@ namespace cycfi { namespace elements
     , _is_focus(false)
     , _show_caret(true)
     , _caret_started(false)
+    , _recording(false)
    {}
 
    basic_text_box::~basic_text_box()
@@ -147,51 +745,51 @@ namespace cycfi { namespace elements
       if (!btn.down) // released? return early
          return true;
 
-      if (_text.empty())
+      ctx.view.history().break_coalescing();
+
+      if (storage().empty())
       {
          _select_start = _select_end = 0;
          scroll_into_view(ctx, false);
          return true;
       }
 
-      char const*   _first = _text.data();
-      char const*   _last = _first + _text.size();
-
-      if (char const* pos = caret_position(ctx, btn.pos))
+      int pos = caret_position(ctx, btn.pos);
+      if (pos != -1)
       {
          if (btn.num_clicks != 1)
          {
-            char const* end = pos;
-            char const* start = pos;
+            text_cursor end{ storage(), std::size_t(pos) };
+            text_cursor start = end;
 
             auto fixup = [&]()
             {
-               if (start != _first)
-                  start = next_utf8(_last, start);
-               _select_start = int(start - _first);
-               _select_end = int(end - _first);
+               if (!start.at_start())
+                  start.next();
+               _select_start = int(start.position());
+               _select_end = int(end.position());
             };
 
             if (btn.num_clicks == 2)
             {
-               while (end < _last && !word_break(end))
-                  end = next_utf8(_last, end);
-               while (start > _first && !word_break(start))
-                  start = prev_utf8(_first, start);
+               while (!end.at_end() && !word_break(end.utf8()))
+                  end.next();
+               while (!start.at_start() && !word_break(start.utf8()))
+                  start.prev();
                fixup();
             }
             else if (btn.num_clicks == 3)
             {
-               while (end < _last && !is_newline(uint8_t(*end)))
-                  end++;
-               while (start > _first && !is_newline(uint8_t(*start)))
-                  start--;
+               while (!end.at_end() && !is_newline(uint8_t(end.byte())))
+                  end.next();
+               while (!start.at_start() && !is_newline(uint8_t(start.byte())))
+                  start.prev();
                fixup();
             }
          }
          else
          {
-            auto hit = int(pos - _first);
+            auto hit = pos;
             if ((btn.modifiers == mod_shift) && (_select_start != -1))
             {
                if (hit < _select_start)
@@ -212,10 +810,10 @@ namespace cycfi { namespace elements
 
    void basic_text_box::drag(context const& ctx, mouse_button btn)
    {
-      char const* first = &_text[0];
-      if (char const* pos = caret_position(ctx, btn.pos))
+      int pos = caret_position(ctx, btn.pos);
+      if (pos != -1)
       {
-         _select_end = int(pos-first);
+         _select_end = pos;
          ctx.view.refresh(ctx);
          scroll_into_view(ctx, true);
       }
@@ -231,24 +829,6 @@ namespace cycfi { namespace elements
       return false;
    }
 
-   namespace
-   {
-      void add_undo(
-         context const& ctx
-       , std::function<void()>& typing_state
-       , std::function<void()> undo_f
-       , std::function<void()> redo_f
-      )
-      {
-         if (typing_state)
-         {
-            ctx.view.add_undo({ typing_state, undo_f });
-            typing_state = {}; // reset
-         }
-         ctx.view.add_undo({ undo_f, redo_f });
-      }
-   }
-
    void break_()
    {
    }
@@ -264,22 +844,12 @@ namespace cycfi { namespace elements
          std::swap(_select_end, _select_start);
 
       std::string text = codepoint_to_utf8(info_.codepoint);
+      undo_history::selection before{ _select_start, _select_end };
 
-      if (!_typing_state)
-         _typing_state = capture_state();
-
-      bool replace = false;
-      if (_select_start == _select_end)
-      {
-         _text.insert(_select_start, text);
-      }
-      else
-      {
-         _text.replace(_select_start, _select_end-_select_start, text);
-         replace = true;
-      }
-
-      _layout.text(_text.data(), _text.data() + _text.size());
+      bool replace = _select_start != _select_end;
+      _recording = true;
+      replace_text(_select_start, _select_end-_select_start, text);
+      _recording = false;
       layout(ctx);
 
       if (replace)
@@ -293,6 +863,7 @@ namespace cycfi { namespace elements
          _select_end = _select_start += text.length();
          scroll_into_view(ctx, true);
       }
+      commit_edits(ctx, before, true);
       return true;
    }
 
@@ -319,90 +890,76 @@ namespace cycfi { namespace elements
 
       int start = std::min(_select_end, _select_start);
       int end = std::max(_select_end, _select_start);
-      std::function<void()> undo_f = capture_state();
+      undo_history::selection before{ _select_start, _select_end };
+      bool coalesce = false;
 
       auto up_down = [this, &ctx, k, &move_caret]()
       {
          bool up = k.key == key_code::up;
          glyph_metrics info;
-         info = glyph_info(ctx, &_text[_select_end]);
-         if (info.str)
+         info = glyph_info(ctx, _select_end);
+         if (info.index != -1)
          {
             auto y = up ? -info.line_height : +info.line_height;
             auto pos = point{ ctx.bounds.left + _current_x, info.pos.y + y };
-            char const* cp = caret_position(ctx, pos);
-            if (cp)
-               _select_end = int(cp - &_text[0]);
+            int cp = caret_position(ctx, pos);
+            if (cp != -1)
+               _select_end = cp;
             else
-               _select_end = up ? 0 : int(_text.size());
+               _select_end = up ? 0 : int(storage().size());
             move_caret = true;
          }
       };
 
       auto next_char = [this]()
       {
-         if (_select_end < static_cast<int>(_text.size()))
-         {
-            char const* end = _text.data() + _text.size();
-            char const* p = next_utf8(end, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
-         }
+         text_cursor p{ storage(), std::size_t(_select_end) };
+         _select_end = int(p.next().position());
       };
 
       auto prev_char = [this]()
       {
-         if (_select_end > 0)
-         {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
-         }
+         text_cursor p{ storage(), std::size_t(_select_end) };
+         _select_end = int(p.prev().position());
       };
 
       auto next_word = [this]()
       {
-         if (_select_end < static_cast<int>(_text.size()))
-         {
-            char const* p = &_text[_select_end];
-            char const* end = _text.data() + _text.size();
-            while (p != end && word_break(p))
-               p = next_utf8(end, p);
-            while (p != end && !word_break(p))
-               p = next_utf8(end, p);
-            _select_end = int(p - &_text[0]);
-         }
+         text_cursor p{ storage(), std::size_t(_select_end) };
+         while (!p.at_end() && word_break(p.utf8()))
+            p.next();
+         while (!p.at_end() && !word_break(p.utf8()))
+            p.next();
+         _select_end = int(p.position());
       };
 
       auto prev_word = [this]()
       {
          if (_select_end > 0)
          {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
-            while (p != start && word_break(p))
-               p = prev_utf8(start, p);
-            while (p != start && !word_break(p))
-               p = prev_utf8(start, p);
-            if (p != start)
-            {
-               char const* end = _text.data() + _text.size();
-               p = next_utf8(end, p);
-            }
-            _select_end = int(p - &_text[0]);
+            text_cursor p{ storage(), std::size_t(_select_end) };
+            p.prev();
+            while (!p.at_start() && word_break(p.utf8()))
+               p.prev();
+            while (!p.at_start() && !word_break(p.utf8()))
+               p.prev();
+            if (!p.at_start())
+               p.next();
+            _select_end = int(p.position());
          }
       };
 
+      _recording = true;
       if (k.action == key_action::press || k.action == key_action::repeat)
       {
          switch (k.key)
          {
             case key_code::enter:
                {
-                  _text.replace(start, end-start, "\n");
-                  _select_start += 1;
+                  replace_text(start, end-start, "\n");
+                  _select_start = start + 1;
                   _select_end = _select_start;
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -412,7 +969,7 @@ namespace cycfi { namespace elements
                {
                   delete_(k.key == key_code::_delete);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
+                  coalesce = true;
                   handled = true;
                }
                break;
@@ -458,7 +1015,7 @@ namespace cycfi { namespace elements
                if (k.modifiers & mod_action)
                {
                   _select_start = 0;
-                  _select_end = int(_text.size());
+                  _select_end = int(storage().size());
                   handled = true;
                }
                break;
@@ -468,7 +1025,6 @@ namespace cycfi { namespace elements
                {
                   cut(ctx.view, start, end);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -486,7 +1042,6 @@ namespace cycfi { namespace elements
                {
                   paste(ctx.view, start, end);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -494,12 +1049,6 @@ namespace cycfi { namespace elements
             case key_code::z:
                if (k.modifiers & mod_action)
                {
-                  if (_typing_state)
-                  {
-                     ctx.view.add_undo({ _typing_state, undo_f });
-                     _typing_state = {}; // reset
-                  }
-
                   if (k.modifiers & mod_shift)
                      ctx.view.redo();
                   else
@@ -512,17 +1061,19 @@ namespace cycfi { namespace elements
                break;
          }
       }
+      _recording = false;
+      commit_edits(ctx, before, coalesce);
 
       if (move_caret)
       {
-         clamp(_select_start, 0, int(_text.size()));
-         clamp(_select_end, 0, int(_text.size()));
+         ctx.view.history().break_coalescing();
+         clamp(_select_start, 0, int(storage().size()));
+         clamp(_select_end, 0, int(storage().size()));
          if (!(k.modifiers & mod_shift))
             _select_start = _select_end;
       }
       else if (handled)
       {
-         _layout.text(_text.data(), _text.data() + _text.size());
          layout(ctx);
          ctx.view.refresh(ctx);
       }
@@ -551,9 +1102,9 @@ namespace cycfi { namespace elements
       bool has_caret = false;
 
       // Handle the case where text is empty
-      if (_text.empty())
+      if (storage().empty())
       {
-         auto  size = _layout.metrics();
+         auto  size = line_metrics();
          auto  line_height = size.ascent + size.descent + size.leading;
          auto  width = theme.text_box_caret_width;
          auto  left = ctx.bounds.left;
@@ -574,7 +1125,7 @@ namespace cycfi { namespace elements
       // Draw the caret
       else if (_select_start == _select_end)
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         auto  start_info = glyph_info(ctx, _select_start);
          auto width = theme.text_box_caret_width;
          rect& caret = start_info.bounds;
 
@@ -617,13 +1168,13 @@ namespace cycfi { namespace elements
       auto& canvas = ctx.canvas;
       auto const& theme = get_theme();
 
-      if (!_text.empty())
+      if (!storage().empty())
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         auto  start_info = glyph_info(ctx, _select_start);
          rect& r1 = start_info.bounds;
          r1.right = ctx.bounds.right;
 
-         auto  end_info = glyph_info(ctx, _text.data() + _select_end);
+         auto  end_info = glyph_info(ctx, _select_end);
          rect& r2 = end_info.bounds;
          r2.right = r2.left;
          r2.left = ctx.bounds.left;
@@ -653,112 +1204,73 @@ namespace cycfi { namespace elements
       }
    }
 
-   char const* basic_text_box::caret_position(context const& ctx, point p)
+   int basic_text_box::caret_position(context const& ctx, point p)
    {
-      auto  x = ctx.bounds.left;
-      auto  y = ctx.bounds.top;
-      auto  metrics = _layout.metrics();
+      auto  metrics = line_metrics();
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
 
-      char const* found = nullptr;
-      for (auto& row : _rows)
-      {
-         // Check if p is within this row
-         if ((p.y >= y) && (p.y < y + line_height))
-         {
-            // Check if we are at the very start of the row or beyond
-            if (p.x <= x)
-            {
-               found = row.begin();
-               break;
-            }
-
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [p, x, &found](char const* utf8, float left, float right)
-               {
-                  if ((p.x >= (x + left)) && (p.x < (x + right)))
-                  {
-                     found = utf8;
-                     return false;
-                  }
-                  return true;
-               }
-            );
-            // Assume it's at the end of the row if we haven't found a hit
-            if (!found)
-               found = row.end();
-            break;
-         }
-         y += line_height;
-      }
-      return found;
+      if (p.y < ctx.bounds.top)
+         return -1;
+      auto  row = std::size_t((p.y - ctx.bounds.top) / line_height);
+      if (row >= num_rows())
+         return -1;
+
+      auto& para = **find_paragraph_row(row);
+      para.index_rows();
+
+      // Check if we are at the very start of the row or beyond
+      auto  r = row - para.first_row;
+      auto  x = p.x - ctx.bounds.left;
+      if (x <= 0)
+         return int(para.offset + para.clusters[para.row_clusters[r]].offset);
+      return int(para.offset + para.find_cluster(r, x)->offset);
    }
 
-   basic_text_box::glyph_metrics basic_text_box::glyph_info(context const& ctx, char const* s)
+   basic_text_box::glyph_metrics basic_text_box::glyph_info(context const& ctx, int index)
    {
-      auto  metrics = _layout.metrics();
+      auto  metrics = line_metrics();
       auto  x = ctx.bounds.left;
-      auto  y = ctx.bounds.top + metrics.ascent;
       auto  descent = metrics.descent;
       auto  ascent = metrics.ascent;
       auto  leading = metrics.leading;
       auto  line_height = ascent + descent + leading;
 
       glyph_metrics info;
-      info.str = nullptr;
+      info.index = -1;
       info.line_height = line_height;
 
-      // Check if s is at the very end
-      if (s == _text.data() + _text.size())
-      {
-         auto const& last_row = _rows.back();
-         auto        rightmost = x + last_row.width();
-         auto        bottom_y = y + (line_height * (_rows.size() - 1));
-
-         info.pos = { rightmost, bottom_y };
-         info.bounds = { rightmost, bottom_y - ascent, rightmost + 10, bottom_y + descent };
-         info.str = s;
+      auto  offset = std::size_t(index);
+      auto  i = find_paragraph(offset);
+      if (i == _paragraphs.end() || (*i)->rows.empty())
          return info;
-      }
 
-      glyphs*  prev_row = nullptr;
-      for (auto& row : _rows)
+      auto& para = **i;
+      para.index_rows();
+
+      // Find the row. If the glyph is past the end of its row (e.g. at the
+      // newline that ends the paragraph, at the very end, or in between
+      // the end of the row and the start of the next), it is at the end of
+      // the row.
+      auto  rel = std::min(offset - para.offset, para.text.size());
+      auto  r = para.find_row(rel);
+      auto  y = ctx.bounds.top + ascent + ((para.first_row + r) * line_height);
+      auto const& end = para.row_end(r);
+      auto  c = para.find_cluster(r, rel);
+
+      if (c == &end)
       {
-         // Check if s is within this row
-         if (s >= row.begin() && s < row.end())
-         {
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [s, &info, x, y, ascent, descent](char const* utf8, float left, float right)
-               {
-                  if (utf8 >= s)
-                  {
-                     info.pos = { x + left, y };
-                     info.bounds = { x + left, y - ascent, x + right, y + descent };
-                     info.str = utf8;
-                     return false;
-                  }
-                  return true;
-               }
-            );
-            break;
-         }
-         // This handles the case where s is in between the start of the
-         // current row and the end of the previous.
-         else if (s < row.begin() && prev_row)
-         {
-            auto  rightmost = x + prev_row->width();
-            auto  prev_y = y - line_height;
-            info.pos = { rightmost, prev_y };
-            info.bounds = { rightmost, prev_y - ascent, rightmost + 10, prev_y + descent };
-            info.str = s;
-            break;
-         }
-         y += line_height;
-         prev_row = &row;
+         auto  rightmost = x + end.x;
+         info.pos = { rightmost, y };
+         info.bounds = { rightmost, y - ascent, rightmost + 10, y + descent };
+         info.index = index;
+         return info;
       }
 
+      auto  left = x + c->x;
+      auto  right = x + (c+1)->x;
+      info.pos = { left, y };
+      info.bounds = { left, y - ascent, right, y + descent };
+      info.index = int(para.offset + c->offset);
       return info;
    }
 
@@ -770,26 +1282,21 @@ namespace cycfi { namespace elements
       {
          if (start == end)
          {
+            text_cursor p{ storage(), std::size_t(start) };
             if (forward)
             {
-               char const* start_p = &_text[start];
-               char const* end_p = &_text[0] + _text.size();
-               char const* p = next_utf8(end_p, start_p);
-               start = int(start_p - &_text[0]);
-               _text.erase(start, p - start_p);
+               replace_text(start, p.next().position() - start, "");
             }
             else if (start > 0)
             {
-               char const* start_p = &_text[0];
-               char const* end_p = &_text[start];
-               char const* p = prev_utf8(start_p, end_p);
-               start = int(p - &_text[0]);
-               _text.erase(start, end_p - p);
+               auto  end_p = start;
+               start = int(p.prev().position());
+               replace_text(start, end_p - start, "");
             }
          }
          else
          {
-            _text.erase(start, end-start);
+            replace_text(start, end-start, "");
          }
          _select_end = _select_start = start;
       }
@@ -801,7 +1308,7 @@ namespace cycfi { namespace elements
       {
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
-         clipboard(_text.substr(start, end_-start_));
+         clipboard(storage().substr(start_, end_-start_));
          delete_(false);
       }
    }
@@ -812,7 +1319,7 @@ namespace cycfi { namespace elements
       {
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
-         clipboard(_text.substr(start, end_-start_));
+         clipboard(storage().substr(start_, end_-start_));
       }
    }
 
@@ -823,48 +1330,60 @@ namespace cycfi { namespace elements
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
          std::string ins = clipboard();
-         _text.replace(start, end_-start_, ins);
+         replace_text(start, end_-start_, ins);
          start += ins.size();
          _select_end = _select_start = start;
       }
    }
 
-   struct basic_text_box::state_saver
+   void basic_text_box::text_replaced(
+      std::size_t pos
+    , string_view removed
+    , string_view inserted
+   )
    {
-      state_saver(basic_text_box* this_)
-       : text(this_->_text)
-       , select_start(this_->_select_start)
-       , select_end(this_->_select_end)
-       , save_text(this_->_text)
-       , save_select_start(this_->_select_start)
-       , save_select_end(this_->_select_end)
-      {}
-
-      void operator()()
-      {
-         text = save_text;
-         select_start = save_select_start;
-         select_end = save_select_end;
-      }
+      if (_recording)
+         _edits.push_back({ pos, std::string(removed), std::string(inserted) });
+   }
 
-      std::string&   text;
-      int&           select_start;
-      int&           select_end;
+   void basic_text_box::commit_edits(
+      context const& ctx
+    , undo_history::selection before
+    , bool coalesce
+   )
+   {
+      if (_edits.empty())
+         return;
 
-      std::string    save_text;
-      int            save_select_start;
-      int            save_select_end;
-   };
+      // Edits made by a single action are undone together
+      auto& history = ctx.view.history();
+      undo_history::selection after{ _select_start, _select_end };
+      bool  group = _edits.size() > 1;
+      if (group)
+         history.begin_group();
+      for (auto& d : _edits)
+         history.add(*this, std::move(d), before, after, coalesce && !group);
+      if (group)
+         history.end_group();
+      _edits.clear();
+   }
 
-   std::function<void()>
-   basic_text_box::capture_state()
+   void basic_text_box::apply_delta(
+      std::size_t pos, std::size_t n, string_view str
+    , int select_start, int select_end
+   )
    {
-      return state_saver(this);
+      auto  recording = _recording;
+      _recording = false;
+      replace_text(pos, n, str);
+      _recording = recording;
+      _select_start = select_start;
+      _select_end = select_end;
    }
 
    void basic_text_box::scroll_into_view(context const& ctx, bool save_x)
    {
-      if (_text.empty())
+      if (storage().empty())
       {
          auto caret = rect{
             ctx.bounds.left-1,
@@ -882,8 +1401,8 @@ namespace cycfi { namespace elements
       if (_select_end == -1)
          return;
 
-      auto info = glyph_info(ctx, &_text[_select_end]);
-      if (info.str)
+      auto info = glyph_info(ctx, _select_end);
+      if (info.index != -1)
       {
          auto caret = rect{
             info.bounds.left-1,
@@ -918,20 +1437,20 @@ namespace cycfi { namespace elements
 
    void basic_text_box::select_start(int pos)
    {
-      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text.size())))
+      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(storage().size())))
          _select_start = pos;
    }
 
    void basic_text_box::select_end(int pos)
    {
-      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text.size())))
+      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(storage().size())))
          _select_end = pos;
    }
 
    void basic_text_box::select_all()
    {
       _select_start = 0;
-      _select_end = int(_text.size());
+      _select_end = int(storage().size());
    }
 
    void basic_text_box::select_none()
@@ -939,6 +1458,43 @@ namespace cycfi { namespace elements
       _select_start = _select_end = -1;
    }
 
+   bool basic_text_box::select_next_match(context const& ctx)
+   {
+      auto const& matches = find_results().matches();
+      if (matches.empty())
+         return false;
+
+      // Start after the current match, if one is selected
+      auto  pos = std::size_t(std::max(_select_start, 0));
+      if (_select_start != -1 && _select_start != _select_end)
+         ++pos;
+
+      auto  i = std::lower_bound(matches.begin(), matches.end(), pos);
+      if (i == matches.end())
+         i = matches.begin();
+
+      _select_start = int(*i);
+      _select_end = int(*i + find_results().pattern().size());
+      scroll_into_view(ctx, true);
+      return true;
+   }
+
+   bool basic_text_box::select_prev_match(context const& ctx)
+   {
+      auto const& matches = find_results().matches();
+      if (matches.empty())
+         return false;
+
+      auto  pos = (_select_start == -1)? storage().size() : std::size_t(_select_start);
+      auto  i = std::lower_bound(matches.begin(), matches.end(), pos);
+      i = (i == matches.begin())? matches.end() - 1 : i - 1;
+
+      _select_start = int(*i);
+      _select_end = int(*i + find_results().pattern().size());
+      scroll_into_view(ctx, true);
+      return true;
+   }
+
    bool basic_text_box::word_break(char const* utf8) const
    {
       auto cp = codepoint(utf8);
@@ -956,7 +1512,7 @@ namespace cycfi { namespace elements
    ////////////////////////////////////////////////////////////////////////////
    view_limits basic_input_box::limits(basic_context const& /* ctx */) const
    {
-      auto  size = _layout.metrics();
+      auto  size = line_metrics();
       auto  line_height = size.ascent + size.descent + size.leading;
       return { { 32, line_height }, { full_extent, line_height } };
    }
@@ -971,7 +1527,7 @@ namespace cycfi { namespace elements
 
             auto& canvas = ctx.canvas;
             auto& theme = get_theme();
-            auto  size = _layout.metrics();
+            auto  size = line_metrics();
 
             canvas.text_align(canvas::left);
             canvas.font(theme.text_box_font, theme.text_box_font_size);
@@ -1025,7 +1581,7 @@ namespace cycfi { namespace elements
 
             case key_code::end:
                {
-                  int end = int(_text.size());
+                  int end = int(storage().size());
                   select_start(end);
                   select_end(end);
                   scroll_into_view(ctx, false);
@@ -1065,13 +1621,13 @@ namespace cycfi { namespace elements
             ins += *p;
          }
 
-         _text.replace(start_, end_-start_, ins);
+         replace_text(start_, end_-start_, ins);
          start_ += ins.size();
          select_start(start_);
          select_end(start_);
 
          if (on_text)
-            on_text(_text);
+            on_text(get_text());
       }
    }
 
@@ -1079,7 +1635,7 @@ namespace cycfi { namespace elements
    {
       basic_text_box::delete_(forward);
       if (on_text)
-         on_text(_text);
+         on_text(get_text());
    }
 
    bool basic_input_box::click(context const& ctx, mouse_button btn)
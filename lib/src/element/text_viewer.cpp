@@ -0,0 +1,440 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/text_viewer.hpp>
+#include <elements/element/port.hpp>
+#include <elements/support/context.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   using namespace std::chrono_literals;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The line index
+   //
+   // The background thread scans the source for newlines and appends the
+   // line starts. Everything here is guarded by the mutex, except for the
+   // source, which is thread safe.
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_viewer::line_index
+   {
+      using line_starts = std::vector<std::uint64_t>;
+
+      static constexpr std::size_t block_size = 1024 * 1024;
+
+                              line_index(text_source_ptr source_)
+                               : source(std::move(source_))
+                              {}
+
+      void                    start();
+      void                    stop();
+      void                    run();
+
+      std::size_t             num_lines() const;
+      std::pair<std::size_t, std::size_t> line_range(std::size_t line) const;
+
+      text_source_ptr         source;
+      std::thread             thread;
+      mutable std::mutex      mutex;
+      std::condition_variable cv;
+      line_starts             starts = { 0 };   // The start of each line
+      std::size_t             indexed = 0;      // The number of bytes scanned so far
+      std::size_t             generation = 0;   // Incremented when the source is truncated
+      bool                    caught_up = false;
+      bool                    follow = false;
+      bool                    stopping = false;
+   };
+
+   void text_viewer::line_index::start()
+   {
+      thread = std::thread([this]{ run(); });
+   }
+
+   void text_viewer::line_index::stop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      cv.notify_all();
+      if (thread.joinable())
+         thread.join();
+   }
+
+   void text_viewer::line_index::run()
+   {
+      std::string block;
+      std::vector<std::uint64_t> found;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!stopping)
+      {
+         auto size = source->size();
+         if (size < indexed)
+         {
+            // The source was truncated (e.g. a rotated log). Start over.
+            starts.assign(1, 0);
+            indexed = 0;
+            ++generation;
+         }
+
+         if (indexed < size)
+         {
+            caught_up = false;
+            auto pos = indexed;
+            lock.unlock();
+
+            source->read(pos, block_size, block);
+            found.clear();
+            for (char const *p = block.data(), *last = p + block.size(); p != last; ++p)
+            {
+               p = static_cast<char const*>(std::memchr(p, '\n', last - p));
+               if (!p)
+                  break;
+               found.push_back(pos + (p - block.data()) + 1);
+            }
+
+            lock.lock();
+            starts.insert(starts.end(), found.begin(), found.end());
+            indexed = pos + block.size();
+            continue;
+         }
+
+         caught_up = true;
+         if (follow)
+         {
+            cv.wait_for(lock, 250ms);
+            if (stopping)
+               break;
+            lock.unlock();
+            source->update();
+            lock.lock();
+         }
+         else
+         {
+            cv.wait(lock);
+         }
+      }
+   }
+
+   std::size_t text_viewer::line_index::num_lines() const
+   {
+      // The last line start is not a line if nothing follows it yet
+      return (starts.back() < indexed)? starts.size() : starts.size() - 1;
+   }
+
+   std::pair<std::size_t, std::size_t>
+   text_viewer::line_index::line_range(std::size_t line) const
+   {
+      if (line >= num_lines())
+         return { indexed, indexed };
+      std::size_t first = starts[line];
+      std::size_t last = (line + 1 < starts.size())? starts[line + 1] - 1 : indexed;
+      return { first, last };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The polling state
+   //
+   // Shared with the poll callbacks posted to the view. The callbacks hold
+   // it weakly, so a callback that fires after the text_viewer was moved
+   // finds the moved viewer's state, and one that fires after it was
+   // destroyed does nothing. Used by the UI thread only.
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_viewer::poll_state
+   {
+      std::shared_ptr<line_index> index;
+      std::size_t             num_lines = 0;    // The number of lines last drawn
+      std::size_t             generation = 0;   // The index generation last drawn
+      std::size_t             scroll_to = std::size_t(-1);
+      bool                    started = false;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_viewer
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      char const* const empty_text = "";
+
+      constexpr std::size_t min_line_cache = 128;
+
+      // Strips the trailing carriage return and truncates the line to max
+      // bytes, at a UTF-8 codepoint boundary.
+      void display_text(std::string& text, std::size_t max)
+      {
+         if (!text.empty() && text.back() == '\r')
+            text.pop_back();
+         if (text.size() > max)
+         {
+            auto n = max;
+            while (n > 0 && (std::uint8_t(text[n]) & 0xC0) == 0x80)
+               --n;
+            text.resize(n);
+         }
+      }
+   }
+
+   text_viewer::text_viewer(
+      text_source_ptr source
+    , font font_
+    , float size
+    , color color_
+   )
+    : _index(std::make_shared<line_index>(std::move(source)))
+    , _poll(std::make_shared<poll_state>())
+    , _font(empty_text, empty_text, font_, size)
+    , _color(color_)
+   {
+      _poll->index = _index;
+      _index->start();
+   }
+
+   text_viewer::text_viewer(
+      fs::path const& path
+    , font font_
+    , float size
+    , color color_
+   )
+    : text_viewer(std::make_shared<file_text_source>(path), font_, size, color_)
+   {}
+
+   text_viewer::~text_viewer()
+   {
+      if (_index)
+         _index->stop();
+   }
+
+   float text_viewer::line_height() const
+   {
+      auto metrics = _font.metrics();
+      return metrics.ascent + metrics.descent + metrics.leading;
+   }
+
+   view_limits text_viewer::limits(basic_context const& /* ctx */) const
+   {
+      auto height = float(double(std::max<std::size_t>(num_lines(), 1)) * line_height());
+      return { { 200, height }, { full_extent, height } };
+   }
+
+   std::size_t text_viewer::num_lines() const
+   {
+      std::lock_guard<std::mutex> lock(_index->mutex);
+      return _index->num_lines();
+   }
+
+   bool text_viewer::indexing() const
+   {
+      std::lock_guard<std::mutex> lock(_index->mutex);
+      return !_index->caught_up;
+   }
+
+   std::string text_viewer::line(std::size_t i) const
+   {
+      std::pair<std::size_t, std::size_t> range;
+      {
+         std::lock_guard<std::mutex> lock(_index->mutex);
+         range = _index->line_range(i);
+      }
+      std::string text;
+      _index->source->read(range.first, range.second - range.first, text);
+      return text;
+   }
+
+   bool text_viewer::follow() const
+   {
+      std::lock_guard<std::mutex> lock(_index->mutex);
+      return _index->follow;
+   }
+
+   void text_viewer::follow(view& view_, bool follow_)
+   {
+      {
+         std::lock_guard<std::mutex> lock(_index->mutex);
+         _index->follow = follow_;
+      }
+      _index->cv.notify_all();
+      if (follow_)
+      {
+         // Scroll to the end, and start polling, on the next draw
+         _poll->scroll_to = std::size_t(-1) - 1;
+         view_.refresh(*this);
+      }
+   }
+
+   void text_viewer::go_to_line(view& view_, std::size_t line)
+   {
+      // The scroll happens in draw, where the scroller is known
+      _poll->scroll_to = line;
+      view_.refresh(*this);
+   }
+
+   glyphs& text_viewer::get_line(std::size_t line, std::size_t max_cache)
+   {
+      std::pair<std::size_t, std::size_t> range;
+      {
+         std::lock_guard<std::mutex> lock(_index->mutex);
+         range = _index->line_range(line);
+      }
+      auto size = range.second - range.first;
+
+      auto i = _cache_index.find(line);
+      if (i != _cache_index.end())
+      {
+         _cache.splice(_cache.begin(), _cache, i->second);
+         auto& entry = *i->second;
+         if (entry.size == size)
+            return entry.shape;
+      }
+      else
+      {
+         // The entry's text must be set after it is in the list. The shape
+         // points into it.
+         _cache.push_front({ line, 0, {}, master_glyphs{ empty_text, empty_text, _font } });
+         _cache_index[line] = _cache.begin();
+         while (_cache.size() > max_cache)
+         {
+            _cache_index.erase(_cache.back().line);
+            _cache.pop_back();
+         }
+      }
+
+      auto& entry = _cache.front();
+      entry.size = size;
+      _index->source->read(range.first, std::min(size, max_line_size + 1), entry.text);
+      display_text(entry.text, max_line_size);
+      entry.shape.text(entry.text.data(), entry.text.data() + entry.text.size());
+      return entry.shape;
+   }
+
+   void text_viewer::draw(context const& ctx)
+   {
+      auto& cnv = ctx.canvas;
+      auto  state = cnv.new_state();
+      auto  metrics = _font.metrics();
+      auto  lh = line_height();
+      auto  top = ctx.bounds.top;
+      auto  clip_extent = cnv.clip_extent();
+      auto  bottom = std::min(ctx.bounds.bottom, clip_extent.bottom);
+      auto& poll_ = *_poll;
+
+      std::size_t lines;
+      std::size_t generation;
+      {
+         std::lock_guard<std::mutex> lock(_index->mutex);
+         lines = _index->num_lines();
+         generation = _index->generation;
+      }
+
+      if (generation != poll_.generation)
+      {
+         // The source was truncated and reindexed
+         poll_.generation = generation;
+         _cache.clear();
+         _cache_index.clear();
+      }
+
+      // Line positions are computed in double, relative to the clip top.
+      // With millions of lines, i * lh in float is off by several pixels.
+      double clip_top = clip_extent.top;
+      double clip_offset = clip_top - top;   // From the text top to the clip top
+      auto  line_top = [&](std::size_t i)
+      {
+         return float(clip_top + (double(i) * lh - clip_offset));
+      };
+
+      if (poll_.scroll_to != std::size_t(-1))
+      {
+         auto line = std::min(poll_.scroll_to, std::max<std::size_t>(lines, 1) - 1);
+         poll_.scroll_to = std::size_t(-1);
+         auto y = line_top(line);
+         scrollable::find(ctx).scroll_into_view(
+            { ctx.bounds.left, y, ctx.bounds.left, y + lh });
+      }
+
+      std::size_t first = 0;
+      if (clip_offset > 0)
+         first = std::size_t(clip_offset / lh);
+      std::size_t last = std::min<std::size_t>(
+         lines, std::size_t((double(bottom) - top) / lh) + 1);
+
+      if (first < last)
+      {
+         auto max_cache = std::max(min_line_cache, 2 * (last - first));
+         if (_cache.size() > max_cache)
+            max_cache = _cache.size();   // Do not thrash the cache on resize
+
+         cnv.rect(ctx.bounds);
+         cnv.clip();
+         cnv.fill_style(_color);
+         for (auto i = first; i != last; ++i)
+         {
+            auto y = line_top(i) + metrics.ascent;
+            get_line(i, max_cache).draw({ ctx.bounds.left, y }, cnv);
+         }
+      }
+
+      poll_.num_lines = lines;
+      poll(_poll, ctx.view);
+   }
+
+   // While the source is being indexed, or while following, poll for new
+   // lines and relayout if there are any.
+   void text_viewer::poll(poll_state_ptr const& state, view& view_)
+   {
+      if (state->started)
+         return;
+
+      bool follow_;
+      bool caught_up;
+      {
+         std::lock_guard<std::mutex> lock(state->index->mutex);
+         follow_ = state->index->follow;
+         caught_up = state->index->caught_up;
+      }
+
+      if (caught_up && !follow_)
+         return;
+
+      state->started = true;
+      std::weak_ptr<poll_state> w = state;
+      view_.post(100ms,
+         [w, &view_]()
+         {
+            auto state = w.lock();
+            if (!state)
+               return;
+
+            state->started = false;
+            std::size_t lines;
+            std::size_t generation;
+            bool follow_;
+            {
+               std::lock_guard<std::mutex> lock(state->index->mutex);
+               lines = state->index->num_lines();
+               generation = state->index->generation;
+               follow_ = state->index->follow;
+            }
+            if (lines != state->num_lines || generation != state->generation)
+            {
+               if (follow_)
+                  state->scroll_to = std::size_t(-1) - 1;
+               view_.layout();
+            }
+            else
+            {
+               poll(state, view_);
+            }
+         }
+      );
+   }
+}}
@@ -0,0 +1,662 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/tiled_image.hpp>
+#include <elements/support/context.hpp>
+#include <elements/support/detail/pixel_ops.hpp>
+#include <elements/support/theme.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_source
+   ////////////////////////////////////////////////////////////////////////////
+   tile_source::tile_source(int width, int height, int tile_size)
+    : _width(std::max(width, 1))
+    , _height(std::max(height, 1))
+    , _tile_size(std::max(tile_size, 1))
+    , _num_levels(1)
+   {
+      while (level_width(_num_levels-1) > _tile_size || level_height(_num_levels-1) > _tile_size)
+         ++_num_levels;
+   }
+
+   int tile_source::level_width(int level) const
+   {
+      return ((_width - 1) >> level) + 1;
+   }
+
+   int tile_source::level_height(int level) const
+   {
+      return ((_height - 1) >> level) + 1;
+   }
+
+   int tile_source::columns(int level) const
+   {
+      return (level_width(level) + _tile_size - 1) / _tile_size;
+   }
+
+   int tile_source::rows(int level) const
+   {
+      return (level_height(level) + _tile_size - 1) / _tile_size;
+   }
+
+   pixmap_ptr tile_source::tile(int level, int col, int row)
+   {
+      auto pm = load(level, col, row);
+      if (!pm && level > 0)
+      {
+         bool complete;
+         pm = load_from_below(level, col, row, complete);
+      }
+      return pm;
+   }
+
+   pixmap_ptr tile_source::load_from_below(int level, int col, int row, bool& complete)
+   {
+      complete = true;
+      if (level <= 0)
+         return nullptr;
+
+      // The area of the level below that this tile covers, in its pixels
+      auto  below = level - 1;
+      auto  x = col * _tile_size * 2;
+      auto  y = row * _tile_size * 2;
+      auto  w = std::min(_tile_size * 2, level_width(below) - x);
+      auto  h = std::min(_tile_size * 2, level_height(below) - y);
+      if (w <= 0 || h <= 0)
+         return nullptr;
+
+      pixmap area{ point{ float(w), float(h) } };
+      bool  any = false;
+      {
+         pixmap_context pm_ctx{ area };
+         canvas cnv{ *pm_ctx.context() };
+         for (int j = 0; j != 2; ++j)
+         {
+            for (int i = 0; i != 2; ++i)
+            {
+               auto  c = col * 2 + i;
+               auto  r = row * 2 + j;
+               if (c >= columns(below) || r >= rows(below))
+                  continue;
+
+               auto  child = tile(below, c, r);
+               if (!child)
+               {
+                  complete = false;
+                  continue;
+               }
+               any = true;
+               auto  size_ = child->size();
+               auto  src = rect{ 0, 0, size_.x, size_.y };
+               cnv.draw(*child, src, src.move(i * _tile_size, j * _tile_size));
+            }
+         }
+      }
+      if (!any)
+         return nullptr;
+
+      auto  result = std::make_shared<pixmap>(point{ float((w + 1) / 2), float((h + 1) / 2) });
+      {
+         pixmap_context from{ area };
+         pixmap_context to{ *result };
+         auto  src = cairo_get_target(from.context());
+         auto  dest = cairo_get_target(to.context());
+         cairo_surface_flush(src);
+         cairo_surface_flush(dest);
+         detail::downsample_2x(
+            cairo_image_surface_get_data(src), cairo_image_surface_get_stride(src)
+          , cairo_image_surface_get_data(dest), cairo_image_surface_get_stride(dest)
+          , w, h
+         );
+         cairo_surface_mark_dirty(dest);
+      }
+      return result;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_provider
+   ////////////////////////////////////////////////////////////////////////////
+   tile_provider::tile_provider(int width, int height, function f, int tile_size)
+    : tile_source(width, height, tile_size)
+    , _f(std::move(f))
+   {}
+
+   pixmap_ptr tile_provider::load(int level, int col, int row)
+   {
+      return _f(level, col, row);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // disk_tile_cache
+   ////////////////////////////////////////////////////////////////////////////
+   disk_tile_cache::disk_tile_cache(tile_source_ptr source, fs::path dir)
+    : tile_source(source->width(), source->height(), source->tile_size())
+    , _source(std::move(source))
+    , _dir(std::move(dir))
+   {
+      std::ostringstream info;
+      info << "elements-tiles " << width() << ' ' << height() << ' ' << tile_size() << '\n';
+
+      auto  info_path = _dir / "tiles.info";
+      std::string current;
+      {
+         std::ifstream file(info_path);
+         std::getline(file, current, '\0');
+      }
+      if (current == info.str())
+         return;
+
+      // Stale or new: remove the levels (numbered directories) and start over
+      std::error_code ec;
+      fs::create_directories(_dir, ec);
+      for (auto const& entry : fs::directory_iterator(_dir, ec))
+      {
+         auto  name = entry.path().filename().string();
+         auto  is_digit = [](char c) { return c >= '0' && c <= '9'; };
+         if (!name.empty() && std::all_of(name.begin(), name.end(), is_digit))
+            fs::remove_all(entry.path(), ec);
+      }
+      std::ofstream file(info_path);
+      file << info.str();
+   }
+
+   fs::path disk_tile_cache::tile_path(int level, int col, int row) const
+   {
+      return _dir / std::to_string(level)
+         / (std::to_string(col) + '_' + std::to_string(row) + ".png");
+   }
+
+   pixmap_ptr disk_tile_cache::load(int level, int col, int row)
+   {
+      auto  path = tile_path(level, col, row);
+      std::error_code ec;
+      if (fs::exists(path, ec))
+      {
+         try
+         {
+            return std::make_shared<pixmap>(path.string().c_str());
+         }
+         catch (failed_to_load_pixmap const&)
+         {
+            // Corrupt: make it again
+         }
+      }
+
+      bool  complete = true;
+      auto  pm = _source->load(level, col, row);
+      if (!pm && level > 0)
+         pm = load_from_below(level, col, row, complete);
+
+      // Tiles made from incomplete parts are not saved, so they are made
+      // again when the missing parts become available.
+      if (pm && complete)
+      {
+         fs::create_directories(path.parent_path(), ec);
+
+         // Write to a temporary file first, so concurrent loads never see
+         // a partial tile.
+         auto  tmp = path;
+         tmp += '.' + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+         pixmap_context pm_ctx{ *pm };
+         if (cairo_surface_write_to_png(
+               cairo_get_target(pm_ctx.context()), tmp.string().c_str()) == CAIRO_STATUS_SUCCESS)
+         {
+            fs::rename(tmp, path, ec);
+         }
+         if (ec || fs::exists(tmp, ec))
+            fs::remove(tmp, ec);
+      }
+      return pm;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The shared state of a tiled_image and its loading jobs. Everything but
+   // the source and the priority is guarded by the mutex. The element
+   // clears self when it is destroyed.
+   ////////////////////////////////////////////////////////////////////////////
+   struct detail::tiled_image_state
+   {
+      using tile_key = tiled_image::tile_key;
+      using tile = std::pair<tile_key, pixmap_ptr>;
+
+      tile_source_ptr         source;
+      std::atomic<std::uint64_t> priority{ 0 };
+
+      std::mutex              mutex;
+      std::vector<tile_key>   queue;            // Wanted tiles, first ones first
+      std::vector<tile_key>   loading;
+      std::vector<tile>       arrived;
+      view*                   view_ = nullptr;
+      tiled_image*            self = nullptr;
+      bool                    refresh_posted = false;
+
+      bool                    requested(tile_key key) const;
+   };
+
+   bool detail::tiled_image_state::requested(tile_key key) const
+   {
+      auto  same = [key](tile_key k) { return k == key; };
+      auto  same_tile = [key](tile const& t) { return t.first == key; };
+      return std::any_of(loading.begin(), loading.end(), same)
+         || std::any_of(arrived.begin(), arrived.end(), same_tile);
+   }
+
+   namespace
+   {
+      using state = detail::tiled_image_state;
+      using state_ptr = std::shared_ptr<state>;
+
+      // Incremented on every draw that needs tiles. Images drawn more
+      // recently are served first.
+      std::atomic<std::uint64_t> draw_count{ 0 };
+
+      ////////////////////////////////////////////////////////////////////////
+      // The loading workers
+      ////////////////////////////////////////////////////////////////////////
+      class tile_loader
+      {
+      public:
+                              tile_loader();
+                              ~tile_loader();
+
+         void                 post(state_ptr const& s);
+
+      private:
+
+         void                 run();
+         state_ptr            next_job(state::tile_key& key);
+
+         std::mutex           _mutex;
+         std::condition_variable _cv;
+         std::vector<std::weak_ptr<state>> _states;
+         std::vector<std::thread> _threads;
+         bool                 _work = false;
+         bool                 _stopping = false;
+      };
+
+      tile_loader::tile_loader()
+      {
+         auto n = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+         for (auto i = 0u; i != n; ++i)
+            _threads.emplace_back([this]{ run(); });
+      }
+
+      tile_loader::~tile_loader()
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+         }
+         _cv.notify_all();
+         for (auto& t : _threads)
+            t.join();
+      }
+
+      void tile_loader::post(state_ptr const& s)
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto  same = [&s](std::weak_ptr<state> const& w)
+            {
+               return !w.owner_before(s) && !s.owner_before(w);
+            };
+            if (std::none_of(_states.begin(), _states.end(), same))
+               _states.push_back(s);
+            _work = true;
+         }
+         _cv.notify_all();
+      }
+
+      // Called with _mutex locked. Takes the first wanted tile of the image
+      // drawn most recently, dropping the images that are gone.
+      state_ptr tile_loader::next_job(state::tile_key& key)
+      {
+         state_ptr job;
+         std::uint64_t best = 0;
+         for (auto i = _states.begin(); i != _states.end();)
+         {
+            auto s = i->lock();
+            if (!s)
+            {
+               i = _states.erase(i);
+               continue;
+            }
+            ++i;
+            std::lock_guard<std::mutex> lock(s->mutex);
+            auto p = s->priority.load(std::memory_order_relaxed);
+            if (!s->queue.empty() && (!job || p > best))
+            {
+               job = std::move(s);
+               best = p;
+            }
+         }
+
+         if (job)
+         {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            key = job->queue.front();
+            job->queue.erase(job->queue.begin());
+            job->loading.push_back(key);
+         }
+         return job;
+      }
+
+      void tile_loader::run()
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         while (true)
+         {
+            _cv.wait(lock, [this]{ return _stopping || _work; });
+            if (_stopping)
+               return;
+
+            state::tile_key key;
+            auto job = next_job(key);
+            if (!job)
+            {
+               _work = false;
+               continue;
+            }
+
+            lock.unlock();
+            pixmap_ptr pm;
+            try
+            {
+               pm = job->source->tile(key.level, key.col, key.row);
+            }
+            catch (std::exception const&)
+            {
+            }
+
+            {
+               std::lock_guard<std::mutex> state_lock(job->mutex);
+               job->loading.erase(
+                  std::find(job->loading.begin(), job->loading.end(), key));
+               job->arrived.emplace_back(key, std::move(pm));
+
+               // Refresh on the UI thread, once for all the tiles that
+               // arrive before it gets to it.
+               if (job->view_ && !job->refresh_posted)
+               {
+                  job->refresh_posted = true;
+                  auto& view_ = *job->view_;
+                  std::weak_ptr<state> w = job;
+                  view_.post(
+                     [w, &view_]
+                     {
+                        if (auto s = w.lock())
+                        {
+                           std::lock_guard<std::mutex> state_lock(s->mutex);
+                           s->refresh_posted = false;
+                           if (s->self)
+                              view_.refresh(*s->self);
+                        }
+                     }
+                  );
+               }
+            }
+            job.reset();
+            lock.lock();
+         }
+      }
+
+      tile_loader& get_tile_loader()
+      {
+         static tile_loader loader;
+         return loader;
+      }
+
+      // Snaps r to device pixels, so that adjacent tiles meet without seams
+      rect snap(cairo_t& cr, rect r)
+      {
+         double x1 = r.left, y1 = r.top, x2 = r.right, y2 = r.bottom;
+         cairo_user_to_device(&cr, &x1, &y1);
+         cairo_user_to_device(&cr, &x2, &y2);
+         x1 = std::round(x1);
+         y1 = std::round(y1);
+         x2 = std::round(x2);
+         y2 = std::round(y2);
+         cairo_device_to_user(&cr, &x1, &y1);
+         cairo_device_to_user(&cr, &x2, &y2);
+         return { float(x1), float(y1), float(x2), float(y2) };
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tiled_image
+   ////////////////////////////////////////////////////////////////////////////
+   bool tiled_image::tile_key::operator==(tile_key const& rhs) const
+   {
+      return level == rhs.level && col == rhs.col && row == rhs.row;
+   }
+
+   std::size_t tiled_image::tile_key_hash::operator()(tile_key const& key) const
+   {
+      auto  h = std::hash<int>{};
+      return (h(key.level) * 31 + h(key.col)) * 1000003 + h(key.row);
+   }
+
+   tiled_image::tiled_image(tile_source_ptr source)
+    : _source(std::move(source))
+    , _state(std::make_shared<detail::tiled_image_state>())
+   {
+      _state->source = _source;
+   }
+
+   tiled_image::~tiled_image()
+   {
+      if (_state)
+      {
+         std::lock_guard<std::mutex> lock(_state->mutex);
+         _state->queue.clear();
+         _state->self = nullptr;
+         _state->view_ = nullptr;
+      }
+   }
+
+   view_limits tiled_image::limits(basic_context const& /* ctx */) const
+   {
+      auto  w = float(_source->width());
+      auto  h = float(_source->height());
+      return { { w, h }, { w, h } };
+   }
+
+   void tiled_image::cache_budget(std::size_t budget)
+   {
+      _budget = budget;
+      trim();
+   }
+
+   tiled_image::cached_tile* tiled_image::find(tile_key key)
+   {
+      auto  i = _map.find(key);
+      if (i == _map.end())
+         return nullptr;
+      _tiles.splice(_tiles.begin(), _tiles, i->second);
+      return &*i->second;
+   }
+
+   void tiled_image::add(tile_key key, pixmap_ptr pm)
+   {
+      std::size_t bytes = sizeof(cached_tile);
+      if (pm)
+      {
+         auto  size_ = pm->size();
+         bytes += std::size_t(size_.x) * std::size_t(size_.y) * 4;
+      }
+
+      if (auto i = _map.find(key); i != _map.end())
+      {
+         _bytes -= i->second->bytes;
+         _tiles.erase(i->second);
+         _map.erase(i);
+      }
+      _tiles.push_front({ key, std::move(pm), bytes, _frame });
+      _map[key] = _tiles.begin();
+      _bytes += bytes;
+   }
+
+   void tiled_image::trim()
+   {
+      // Never evict the tiles drawn in the current frame
+      while (_bytes > _budget && !_tiles.empty() && _tiles.back().frame != _frame)
+      {
+         _bytes -= _tiles.back().bytes;
+         _map.erase(_tiles.back().key);
+         _tiles.pop_back();
+      }
+   }
+
+   bool tiled_image::draw_tile(context const& ctx, tile_key key, rect dest)
+   {
+      if (auto t = find(key))
+      {
+         t->frame = _frame;
+         if (t->pixmap)
+         {
+            auto  size_ = t->pixmap->size();
+            ctx.canvas.draw(*t->pixmap, rect{ 0, 0, size_.x, size_.y }, dest);
+         }
+         else
+         {
+            draw_placeholder(ctx, dest);
+         }
+         return true;
+      }
+
+      // Not loaded yet. Draw the part of a coarser tile that covers it, if
+      // we have one.
+      auto  ts = _source->tile_size();
+      auto  w = std::min(ts, _source->level_width(key.level) - key.col * ts);
+      auto  h = std::min(ts, _source->level_height(key.level) - key.row * ts);
+      for (int level = key.level + 1; level < _source->num_levels(); ++level)
+      {
+         auto  shift = level - key.level;
+         auto  t = find({ level, key.col >> shift, key.row >> shift });
+         if (t && t->pixmap)
+         {
+            t->frame = _frame;
+            auto  scale_ = 1.0f / (1 << shift);
+            auto  x = key.col * ts * scale_ - t->key.col * ts;
+            auto  y = key.row * ts * scale_ - t->key.row * ts;
+            ctx.canvas.draw(*t->pixmap, rect{ x, y, x + w * scale_, y + h * scale_ }, dest);
+            return false;
+         }
+      }
+      draw_placeholder(ctx, dest);
+      return false;
+   }
+
+   void tiled_image::draw(context const& ctx)
+   {
+      if (!_state)
+         return;
+      ++_frame;
+
+      // Take the tiles that arrived since the last draw
+      {
+         std::lock_guard<std::mutex> lock(_state->mutex);
+         for (auto& t : _state->arrived)
+            add(t.first, std::move(t.second));
+         _state->arrived.clear();
+      }
+
+      auto& cnv = ctx.canvas;
+      auto& cr = cnv.cairo_context();
+      auto  bounds = ctx.bounds;
+      auto  visible = clip(bounds, cnv.clip_extent());
+      if (visible.width() <= 0 || visible.height() <= 0)
+         return;
+
+      // Device pixels per image pixel. Pick the level with at least that
+      // much detail.
+      cairo_matrix_t mat;
+      cairo_get_matrix(&cr, &mat);
+      double tsx, tsy;
+      cairo_surface_get_device_scale(cairo_get_target(&cr), &tsx, &tsy);
+      auto  dx = std::hypot(mat.xx, mat.yx) * tsx * bounds.width() / _source->width();
+      auto  dy = std::hypot(mat.xy, mat.yy) * tsy * bounds.height() / _source->height();
+      auto  d = std::max(dx, dy);
+      auto  last_level = _source->num_levels() - 1;
+      auto  level = (d > 0)? std::clamp(int(std::floor(std::log2(1 / d))), 0, last_level) : last_level;
+
+      // The visible tiles of the level
+      auto  ts = float(_source->tile_size());
+      auto  ux = bounds.width() / _source->level_width(level);
+      auto  uy = bounds.height() / _source->level_height(level);
+      auto  col_first = std::max(int((visible.left - bounds.left) / (ux * ts)), 0);
+      auto  row_first = std::max(int((visible.top - bounds.top) / (uy * ts)), 0);
+      auto  col_last = std::min(int(std::ceil((visible.right - bounds.left) / (ux * ts))), _source->columns(level));
+      auto  row_last = std::min(int(std::ceil((visible.bottom - bounds.top) / (uy * ts))), _source->rows(level));
+      bool  axis_aligned = mat.xy == 0 && mat.yx == 0;
+
+      auto  center = center_point(visible);
+      std::vector<std::pair<float, tile_key>> missing;
+      for (int row = row_first; row < row_last; ++row)
+      {
+         for (int col = col_first; col < col_last; ++col)
+         {
+            auto  dest = rect{
+               bounds.left + col * ts * ux
+             , bounds.top + row * ts * uy
+             , bounds.left + std::min((col + 1) * ts, float(_source->level_width(level))) * ux
+             , bounds.top + std::min((row + 1) * ts, float(_source->level_height(level))) * uy
+            };
+            if (axis_aligned)
+               dest = snap(cr, dest);
+
+            tile_key key{ level, col, row };
+            if (!draw_tile(ctx, key, dest))
+            {
+               auto  c = center_point(dest);
+               auto  dist = (c.x - center.x) * (c.x - center.x) + (c.y - center.y) * (c.y - center.y);
+               missing.emplace_back(dist, key);
+            }
+         }
+      }
+
+      // Ask for the missing tiles, the ones nearest the center first. Any
+      // tiles asked for before and no longer visible are dropped.
+      std::sort(missing.begin(), missing.end(),
+         [](auto const& a, auto const& b) { return a.first < b.first; });
+      {
+         std::lock_guard<std::mutex> lock(_state->mutex);
+         _state->view_ = &ctx.view;
+         _state->self = this;
+         _state->queue.clear();
+         for (auto const& m : missing)
+            if (!_state->requested(m.second))
+               _state->queue.push_back(m.second);
+         if (!_state->queue.empty())
+            _state->priority = ++draw_count;
+      }
+      if (!missing.empty())
+         get_tile_loader().post(_state);
+
+      trim();
+   }
+
+   void tiled_image::draw_placeholder(context const& ctx, rect bounds)
+   {
+      auto& cnv = ctx.canvas;
+      cnv.fill_style(get_theme().image_placeholder_color);
+      cnv.fill_rect(bounds);
+   }
+}}
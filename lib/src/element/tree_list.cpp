@@ -0,0 +1,250 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/tree_list.hpp>
+#include <elements/element/proxy.hpp>
+#include <elements/support/icon_ids.hpp>
+#include <elements/support/text_utils.hpp>
+#include <elements/support/theme.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      ////////////////////////////////////////////////////////////////////////
+      // A tree row: indents the composed node element by its depth and
+      // draws the disclosure icon in front of it.
+      ////////////////////////////////////////////////////////////////////////
+      class tree_row_element : public proxy_base
+      {
+      public:
+                                 tree_row_element(
+                                    element_ptr subject
+                                  , tree_cell_composer const& tree
+                                  , tree_model::node_id node
+                                  , std::size_t depth
+                                  , bool has_children
+                                 )
+                                  : _subject(subject)
+                                  , _tree(tree)
+                                  , _node(node)
+                                  , _offset(tree.indent() * (depth+1))
+                                  , _has_children(has_children)
+                                 {}
+
+         view_limits             limits(basic_context const& ctx) const override;
+         void                    draw(context const& ctx) override;
+         void                    prepare_subject(context& ctx) override;
+
+         element const&          subject() const override { return *_subject; }
+         element&                subject() override { return *_subject; }
+
+      private:
+
+         element_ptr             _subject;
+         tree_cell_composer const& _tree;
+         tree_model::node_id     _node;
+         float                   _offset;
+         bool                    _has_children;
+      };
+
+      view_limits tree_row_element::limits(basic_context const& ctx) const
+      {
+         auto e_limits = subject().limits(ctx);
+         e_limits.min.x += _offset;
+         e_limits.max.x = std::min(e_limits.max.x + _offset, full_extent);
+         return e_limits;
+      }
+
+      void tree_row_element::draw(context const& ctx)
+      {
+         if (_has_children)
+         {
+            auto& thm = get_theme();
+            rect icon_bounds = ctx.bounds;
+            icon_bounds.left += _offset - _tree.indent();
+            icon_bounds.width(_tree.indent());
+            auto code = _tree.is_expanded(_node)? icons::down_dir : icons::right_dir;
+            draw_icon(ctx.canvas, icon_bounds, code, thm.icon_font_size * 0.75);
+         }
+         proxy_base::draw(ctx);
+      }
+
+      void tree_row_element::prepare_subject(context& ctx)
+      {
+         ctx.bounds.left += _offset;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tree_cell_composer
+   ////////////////////////////////////////////////////////////////////////////
+   tree_cell_composer::tree_cell_composer(
+      model_ptr model
+    , float min_width, float row_height, float indent
+   )
+    : static_limits_cell_composer<>(min_width, row_height)
+    , _model(model)
+    , _indent(indent)
+   {
+      rebuild();
+   }
+
+   element_ptr tree_cell_composer::compose(std::size_t index)
+   {
+      auto const& row = _rows[index];
+      return share(
+         tree_row_element{
+            _model->compose(row.node), *this
+          , row.node, row.depth, has_children(index)
+         }
+      );
+   }
+
+   void tree_cell_composer::rebuild()
+   {
+      _rows.clear();
+      flatten(_model->root(), 0, _rows);
+   }
+
+   void tree_cell_composer::flatten(
+      node_id node, std::uint32_t depth, rows_vector& rows) const
+   {
+      auto size = _model->child_count(node);
+      for (std::size_t i = 0; i != size; ++i)
+      {
+         auto child = _model->child(node, i);
+         rows.push_back({ child, depth });
+         if (is_expanded(child))
+            flatten(child, depth+1, rows);
+      }
+   }
+
+   std::size_t tree_cell_composer::expand(std::size_t row)
+   {
+      auto const& info = _rows[row];
+      if (!_expanded.insert(info.node).second)
+         return 0;
+
+      rows_vector children;
+      flatten(info.node, info.depth+1, children);
+      _rows.insert(_rows.begin() + row + 1, children.begin(), children.end());
+      return children.size();
+   }
+
+   std::size_t tree_cell_composer::collapse(std::size_t row)
+   {
+      auto const& info = _rows[row];
+      if (_expanded.erase(info.node) == 0)
+         return 0;
+
+      // The visible descendants are the rows that follow, up to the next
+      // row at the same depth or shallower.
+      auto first = _rows.begin() + row + 1;
+      auto last = std::find_if(first, _rows.end(),
+         [depth = info.depth](auto const& r) { return r.depth <= depth; });
+      auto n = std::size_t(last - first);
+      _rows.erase(first, last);
+      return n;
+   }
+
+   bool tree_cell_composer::is_expanded(node_id node) const
+   {
+      return _expanded.find(node) != _expanded.end();
+   }
+
+   bool tree_cell_composer::has_children(std::size_t row) const
+   {
+      return _model->child_count(_rows[row].node) != 0;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tree_list
+   ////////////////////////////////////////////////////////////////////////////
+   tree_list::tree_list(
+      model_ptr model
+    , float min_width, float row_height
+    , float indent
+   )
+    : tree_list(std::make_shared<tree_cell_composer>(model, min_width, row_height, indent))
+   {}
+
+   tree_list::tree_list(tree_composer_ptr tree)
+    : dynamic_list(tree)
+    , _tree(tree)
+   {}
+
+   bool tree_list::click(context const& ctx, mouse_button btn)
+   {
+      if (btn.down && !_cells.empty())
+      {
+         // Find the row under the mouse, then check if the click is on its
+         // disclosure icon.
+         auto it = std::lower_bound(_cells.begin(), _cells.end(),
+            btn.pos.y - ctx.bounds.top,
+            [](auto const& cell, double pivot)
+            {
+               return (cell.pos + cell.main_axis_size) < pivot;
+            }
+         );
+
+         if (it != _cells.end())
+         {
+            std::size_t row = it - _cells.begin();
+            float left = ctx.bounds.left + _tree->indent() * depth(row);
+            if (btn.pos.x >= left && btn.pos.x < left + _tree->indent()
+               && has_children(row))
+            {
+               toggle(row);
+               ctx.view.post([&view = ctx.view]{ view.layout(); });
+               return true;
+            }
+         }
+      }
+      return dynamic_list::click(ctx, btn);
+   }
+
+   void tree_list::rebuild()
+   {
+      _tree->rebuild();
+      reset();
+      update();
+   }
+
+   bool tree_list::is_expanded(std::size_t row) const
+   {
+      return _tree->is_expanded(_tree->node(row));
+   }
+
+   bool tree_list::has_children(std::size_t row) const
+   {
+      return _tree->has_children(row);
+   }
+
+   void tree_list::expand(std::size_t row)
+   {
+      if (row < num_rows())
+         insert(row+1, _tree->expand(row));
+   }
+
+   void tree_list::collapse(std::size_t row)
+   {
+      if (row < num_rows())
+         erase(row+1, _tree->collapse(row));
+   }
+
+   void tree_list::toggle(std::size_t row)
+   {
+      if (row < num_rows())
+      {
+         if (is_expanded(row))
+            collapse(row);
+         else
+            expand(row);
+      }
+   }
+}}
@@ -4,62 +4,415 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/support/canvas.hpp>
+#include <elements/support/display_list.hpp>
+#include <elements/support/shaped_text.hpp>
+#include <elements/support/detail/pixel_ops.hpp>
 #include <cairo.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <list>
 #include <memory>
 
 namespace cycfi { namespace elements
 {
    namespace
    {
-      struct cairo_pattern_deleter
+      void add_color_stops(cairo_pattern_t* pat, std::vector<canvas::color_stop> const& space)
       {
-         void operator()(cairo_pattern_t* pattern) const
+         for (auto cs : space)
          {
-            if (pattern)
-               cairo_pattern_destroy(pattern);
+            cairo_pattern_add_color_stop_rgba(
+               pat, cs.offset,
+               cs.color.red, cs.color.green, cs.color.blue, cs.color.alpha
+            );
          }
+      }
+
+      // Gradients are drawn from a cache of patterns, so that drawing the
+      // same gradient over and over (as controls drawn with the theme do)
+      // reuses one cairo pattern. The patterns are defined in a unit space:
+      // linear gradients go from (0, 0) to (1, 0), and radial gradients
+      // are centered at (0, 0), with a unit outer radius. A pattern matrix
+      // maps user space to that, so gradients that differ only in their
+      // position and size share a pattern. Like the rest of the drawing,
+      // the cache is used from the UI thread only.
+      class pattern_cache
+      {
+      public:
+
+         static constexpr std::size_t capacity = 64;
+         static constexpr std::size_t num_params = 4;
+
+         enum kind_enum { linear, radial };
+         using params = std::array<float, num_params>;
+         using stops = std::vector<canvas::color_stop>;
+
+                           ~pattern_cache();
+
+         cairo_pattern_t*  get(kind_enum kind, params const& par, stops const& space);
+
+      private:
+
+         struct entry
+         {
+            std::size_t       hash;
+            kind_enum         kind;
+            params            par;
+            stops             space;
+            cairo_pattern_t*  pattern;
+            std::uint64_t     used;
+         };
+
+         static std::size_t   hash(kind_enum kind, params const& par, stops const& space);
+         static bool          equal(entry const& e, kind_enum kind, params const& par, stops const& space);
+         static cairo_pattern_t* make(kind_enum kind, params const& par, stops const& space);
+
+         std::vector<entry>   _entries;
+         std::uint64_t        _clock = 0;
       };
 
-      // use shared pointer instead of unique because std::function wants copyable types
-      using cairo_pattern_ptr = std::shared_ptr<cairo_pattern_t>;
+      pattern_cache::~pattern_cache()
+      {
+         for (auto& e : _entries)
+            cairo_pattern_destroy(e.pattern);
+      }
 
-      cairo_pattern_ptr make_linear_pattern(canvas::linear_gradient const& gr)
+      std::size_t pattern_cache::hash(kind_enum kind, params const& par, stops const& space)
       {
-         cairo_pattern_t* pat = cairo_pattern_create_linear(
-            gr.start.x, gr.start.y, gr.end.x, gr.end.y
-         );
+         std::size_t h = kind;
+         auto combine = [&h](float f)
+         {
+            std::uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            h ^= bits + 0x9e3779b9 + (h << 6) + (h >> 2);
+         };
+
+         for (auto f : par)
+            combine(f);
+         for (auto const& cs : space)
+         {
+            combine(cs.offset);
+            combine(cs.color.red);
+            combine(cs.color.green);
+            combine(cs.color.blue);
+            combine(cs.color.alpha);
+         }
+         return h;
+      }
 
-         for (auto cs : gr.space)
+      bool pattern_cache::equal(
+         entry const& e, kind_enum kind, params const& par, stops const& space)
+      {
+         if (e.kind != kind || e.par != par || e.space.size() != space.size())
+            return false;
+         for (std::size_t i = 0; i != space.size(); ++i)
          {
-            cairo_pattern_add_color_stop_rgba(
-               pat, cs.offset,
-               cs.color.red, cs.color.green, cs.color.blue, cs.color.alpha
+            auto const& a = e.space[i];
+            auto const& b = space[i];
+            if (a.offset != b.offset || a.color != b.color)
+               return false;
+         }
+         return true;
+      }
+
+      cairo_pattern_t* pattern_cache::make(kind_enum kind, params const& par, stops const& space)
+      {
+         cairo_pattern_t* pat = (kind == linear)?
+            cairo_pattern_create_linear(0, 0, 1, 0) :
+            cairo_pattern_create_radial(0, 0, par[0], par[1], par[2], par[3])
+            ;
+
+         add_color_stops(pat, space);
+         return pat;
+      }
+
+      cairo_pattern_t* pattern_cache::get(kind_enum kind, params const& par, stops const& space)
+      {
+         auto h = hash(kind, par, space);
+         ++_clock;
+         for (auto& e : _entries)
+         {
+            if (e.hash == h && equal(e, kind, par, space))
+            {
+               e.used = _clock;
+               return cairo_pattern_reference(e.pattern);
+            }
+         }
+
+         auto pat = make(kind, par, space);
+         if (_entries.size() < capacity)
+         {
+            _entries.push_back({ h, kind, par, space, pat, _clock });
+         }
+         else
+         {
+            // Replace the least recently used. Its stops vector is reused.
+            auto& e = *std::min_element(_entries.begin(), _entries.end(),
+               [](entry const& a, entry const& b) { return a.used < b.used; }
             );
+            cairo_pattern_destroy(e.pattern);
+            e.hash = h;
+            e.kind = kind;
+            e.par = par;
+            e.space.assign(space.begin(), space.end());
+            e.pattern = pat;
+            e.used = _clock;
          }
+         return cairo_pattern_reference(pat);
+      }
 
-         return cairo_pattern_ptr(pat, cairo_pattern_deleter{});
+      pattern_cache& get_pattern_cache()
+      {
+         static pattern_cache cache;
+         return cache;
+      }
+
+      // Nearby values map to the same pattern, so that rounding in the
+      // normalization does not defeat the cache.
+      inline float quantize(float v)
+      {
+         return std::round(v * 4096) / 4096;
       }
 
-      cairo_pattern_ptr make_radial_pattern(canvas::radial_gradient const& gr)
+      cairo_pattern_t* make_linear_pattern(
+         canvas::linear_gradient const& gr, cairo_matrix_t& mat)
       {
-         cairo_pattern_t* pat = cairo_pattern_create_radial(
-            gr.c1.x, gr.c1.y, gr.c1_radius,
-            gr.c2.x, gr.c2.y, gr.c2_radius
+         double dx = gr.end.x - gr.start.x;
+         double dy = gr.end.y - gr.start.y;
+         double len2 = dx*dx + dy*dy;
+         if (len2 == 0)
+         {
+            // Degenerate: cairo paints it with the last color stop
+            auto pat = cairo_pattern_create_linear(
+               gr.start.x, gr.start.y, gr.end.x, gr.end.y);
+            add_color_stops(pat, gr.space);
+            cairo_matrix_init_identity(&mat);
+            return pat;
+         }
+
+         // Rotate and scale start..end to (0, 0)..(1, 0)
+         cairo_matrix_init(&mat
+          , dx / len2, -dy / len2
+          , dy / len2, dx / len2
+          , -(gr.start.x*dx + gr.start.y*dy) / len2
+          , (gr.start.x*dy - gr.start.y*dx) / len2
          );
+         return get_pattern_cache().get(pattern_cache::linear, {}, gr.space);
+      }
 
-         for (auto cs : gr.space)
+      cairo_pattern_t* make_radial_pattern(
+         canvas::radial_gradient const& gr, cairo_matrix_t& mat)
+      {
+         float scale = (gr.c2_radius > 0)? gr.c2_radius : gr.c1_radius;
+         if (scale <= 0)
          {
-            cairo_pattern_add_color_stop_rgba(
-               pat, cs.offset,
-               cs.color.red, cs.color.green, cs.color.blue, cs.color.alpha
+            // Degenerate: nothing to normalize
+            auto pat = cairo_pattern_create_radial(
+               gr.c1.x, gr.c1.y, gr.c1_radius,
+               gr.c2.x, gr.c2.y, gr.c2_radius
+            );
+            add_color_stops(pat, gr.space);
+            cairo_matrix_init_identity(&mat);
+            return pat;
+         }
+
+         // Move c1 to the origin and scale by 1/scale
+         cairo_matrix_init(&mat
+          , 1.0 / scale, 0
+          , 0, 1.0 / scale
+          , -gr.c1.x / scale, -gr.c1.y / scale
+         );
+         pattern_cache::params par = {
+            quantize(gr.c1_radius / scale)
+          , quantize((gr.c2.x - gr.c1.x) / scale)
+          , quantize((gr.c2.y - gr.c1.y) / scale)
+          , quantize(gr.c2_radius / scale)
+         };
+         return get_pattern_cache().get(pattern_cache::radial, par, gr.space);
+      }
+   }
+
+   namespace
+   {
+      // Shadows are drawn from blurred masks, cached by size, corner radius
+      // and blur (all in device pixels). Most shadows use a nine-patch mask
+      // (size 0 x 0) that fits any rect large enough: the round rect's
+      // edges are stretched from its middle row and column. Smaller rects
+      // get a mask of their own.
+      struct shadow_key
+      {
+         bool              operator==(shadow_key const& rhs) const
+                           {
+                              return width == rhs.width && height == rhs.height
+                                 && radius == rhs.radius && blur == rhs.blur;
+                           }
+
+         int               width;
+         int               height;
+         float             radius;
+         float             blur;
+      };
+
+      // Room for the blur around the shape. One more pixel than the blur
+      // reaches, so that the middle row and column of a nine-patch are
+      // flanked by identical ones, for filtering.
+      inline int shadow_pad(float blur)
+      {
+         return 3 * detail::blur_a8_radius(blur) + 1;
+      }
+
+      pixmap_ptr make_shadow_mask(shadow_key key)
+      {
+         auto  pad = shadow_pad(key.blur);
+         auto  corner = int(std::ceil(key.radius));
+
+         // The nine-patch shape has straight edges long enough for the
+         // blur to see nothing but the straight edge at their middle.
+         auto  w = key.width? key.width : 2 * (corner + pad) + 1;
+         auto  h = key.height? key.height : 2 * (corner + pad) + 1;
+         auto  mask = std::make_shared<pixmap>(
+            point{ float(w + 2 * pad), float(h + 2 * pad) }, 1, pixmap_format::a8);
+         {
+            pixmap_context pm_ctx{ *mask };
+            auto  cr = pm_ctx.context();
+            canvas cnv{ *cr };
+            cnv.fill_style(colors::black);
+            cnv.fill_round_rect(
+               rect{ float(pad), float(pad), float(pad + w), float(pad + h) }, key.radius);
+
+            auto  surface = cairo_get_target(cr);
+            cairo_surface_flush(surface);
+            detail::blur_a8(
+               cairo_image_surface_get_data(surface)
+             , cairo_image_surface_get_stride(surface)
+             , w + 2 * pad, h + 2 * pad, key.blur
             );
+            cairo_surface_mark_dirty(surface);
+         }
+         return mask;
+      }
+
+      // Like the rest of the drawing, this is used from the UI thread only
+      pixmap const& get_shadow_mask(shadow_key key)
+      {
+         static constexpr std::size_t capacity = 32;
+         using entry = std::pair<shadow_key, pixmap_ptr>;
+         static std::list<entry> masks;   // Most recently used first
+
+         for (auto i = masks.begin(); i != masks.end(); ++i)
+         {
+            if (i->first == key)
+            {
+               masks.splice(masks.begin(), masks, i);
+               return *i->second;
+            }
          }
 
-         return cairo_pattern_ptr(pat, cairo_pattern_deleter{});
+         masks.emplace_front(key, make_shadow_mask(key));
+         if (masks.size() > capacity)
+            masks.pop_back();
+         return *masks.front().second;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // paint
+   ////////////////////////////////////////////////////////////////////////////
+   canvas::paint::paint(paint const& rhs)
+    : _kind(rhs._kind)
+    , _color(rhs._color)
+    , _pattern(rhs._pattern? cairo_pattern_reference(rhs._pattern) : nullptr)
+    , _matrix(rhs._matrix)
+   {}
+
+   canvas::paint::paint(paint&& rhs) noexcept
+    : _kind(rhs._kind)
+    , _color(rhs._color)
+    , _pattern(rhs._pattern)
+    , _matrix(rhs._matrix)
+   {
+      rhs._kind = none;
+      rhs._pattern = nullptr;
+   }
+
+   canvas::paint::~paint()
+   {
+      if (_pattern)
+         cairo_pattern_destroy(_pattern);
+   }
+
+   canvas::paint& canvas::paint::operator=(paint const& rhs)
+   {
+      if (this != &rhs)
+      {
+         if (rhs._pattern)
+            cairo_pattern_reference(rhs._pattern);
+         if (_pattern)
+            cairo_pattern_destroy(_pattern);
+         _kind = rhs._kind;
+         _color = rhs._color;
+         _pattern = rhs._pattern;
+         _matrix = rhs._matrix;
+      }
+      return *this;
+   }
+
+   canvas::paint& canvas::paint::operator=(paint&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         if (_pattern)
+            cairo_pattern_destroy(_pattern);
+         _kind = rhs._kind;
+         _color = rhs._color;
+         _pattern = rhs._pattern;
+         _matrix = rhs._matrix;
+         rhs._kind = none;
+         rhs._pattern = nullptr;
+      }
+      return *this;
+   }
+
+   void canvas::paint::set(color c)
+   {
+      if (_pattern)
+         cairo_pattern_destroy(_pattern);
+      _pattern = nullptr;
+      _kind = solid;
+      _color = c;
+   }
+
+   void canvas::paint::set(cairo_pattern_t* pattern_, pattern_matrix const& mat)
+   {
+      if (_pattern)
+         cairo_pattern_destroy(_pattern);
+      _pattern = pattern_;
+      _matrix = mat;
+      _kind = pattern;
+   }
+
+   void canvas::paint::apply(cairo_t& context) const
+   {
+      if (_kind == solid)
+      {
+         cairo_set_source_rgba(&context, _color.red, _color.green, _color.blue, _color.alpha);
+      }
+      else if (_kind == pattern)
+      {
+         cairo_matrix_t m;
+         cairo_matrix_init(&m, _matrix.xx, _matrix.yx, _matrix.xy, _matrix.yy, _matrix.x0, _matrix.y0);
+         cairo_pattern_set_matrix(_pattern, &m);
+         cairo_set_source(&context, _pattern);
       }
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // canvas
+   ////////////////////////////////////////////////////////////////////////////
    canvas::canvas(cairo_t& context_)
     : _context(context_)
    {}
@@ -68,8 +421,34 @@ namespace cycfi { namespace elements
     : _context(rhs._context)
    {}
 
+   namespace
+   {
+      // Spill storage for saved states, kept across canvases. A view makes
+      // a new canvas for every draw, so without this, nesting deeper than
+      // the inline states would allocate on every frame.
+      template <typename State>
+      std::vector<std::vector<State>>& spill_pool()
+      {
+         thread_local std::vector<std::vector<State>> pool;
+         return pool;
+      }
+
+      // Enough for the canvases that are alive at the same time (e.g. a
+      // view's canvas and one drawing into a pixmap)
+      constexpr std::size_t max_pooled_spills = 4;
+   }
+
    canvas::~canvas()
    {
+      if (_spill.capacity())
+      {
+         auto& pool = spill_pool<canvas_state>();
+         if (pool.size() < max_pooled_spills)
+         {
+            _spill.clear();
+            pool.push_back(std::move(_spill));
+         }
+      }
    }
 
    void canvas::pre_scale(float sc)
@@ -85,21 +464,29 @@ namespace cycfi { namespace elements
 
    void canvas::translate(point p)
    {
+      if (_recording)
+         _recording->add(display_list::op::translate, p);
       cairo_translate(&_context, p.x, p.y);
    }
 
    void canvas::rotate(float rad)
    {
+      if (_recording)
+         _recording->add(display_list::op::rotate, rad);
       cairo_rotate(&_context, rad);
    }
 
    void canvas::scale(point p)
    {
+      if (_recording)
+         _recording->add(display_list::op::scale, p);
       cairo_scale(&_context, p.x, p.y);
    }
 
    void canvas::skew(float sx, float sy)
    {
+      if (_recording)
+         _recording->add(display_list::op::skew, sx, sy);
       cairo_matrix_t mat;
       cairo_matrix_init(&mat, 1, 0, sx, 1, 0, sy);
       cairo_transform(&_context, &mat);
@@ -123,40 +510,54 @@ namespace cycfi { namespace elements
 
    void canvas::begin_path()
    {
+      if (_recording)
+         _recording->add(display_list::op::begin_path);
       cairo_new_path(&_context);
    }
 
    void canvas::close_path()
    {
+      if (_recording)
+         _recording->add(display_list::op::close_path);
       cairo_close_path(&_context);
    }
 
    void canvas::fill()
    {
+      if (_recording)
+         _recording->add(display_list::op::fill);
       apply_fill_style();
       cairo_fill(&_context);
    }
 
    void canvas::fill_preserve()
    {
+      if (_recording)
+         _recording->add(display_list::op::fill_preserve);
       apply_fill_style();
       cairo_fill_preserve(&_context);
    }
 
    void canvas::stroke()
    {
+      if (_recording)
+         _recording->add(display_list::op::stroke);
       apply_stroke_style();
       cairo_stroke(&_context);
    }
 
    void canvas::stroke_preserve()
    {
+      if (_recording)
+         _recording->add(display_list::op::stroke_preserve);
       apply_stroke_style();
       cairo_stroke_preserve(&_context);
    }
 
    void canvas::clip()
    {
+      if (_recording)
+         _recording->add(display_list::op::clip);
       cairo_clip(&_context);
    }
 
@@ -181,11 +582,15 @@ namespace cycfi { namespace elements
 
    void canvas::move_to(point p)
    {
+      if (_recording)
+         _recording->add(display_list::op::move_to, p);
       cairo_move_to(&_context, p.x, p.y);
    }
 
    void canvas::line_to(point p)
    {
+      if (_recording)
+         _recording->add(display_list::op::line_to, p);
       cairo_line_to(&_context, p.x, p.y);
    }
 
@@ -200,6 +605,8 @@ namespace cycfi { namespace elements
       bool ccw
    )
    {
+      if (_recording)
+         _recording->add(display_list::op::arc, p, radius, start_angle, end_angle, ccw);
       if (ccw)
          cairo_arc_negative(&_context, p.x, p.y, radius, start_angle, end_angle);
       else
@@ -208,11 +615,15 @@ namespace cycfi { namespace elements
 
    void canvas::rect(struct rect r)
    {
+      if (_recording)
+         _recording->add(display_list::op::rect, r);
       cairo_rectangle(&_context, r.left, r.top, r.width(), r.height());
    }
 
    void canvas::round_rect(struct rect bounds, float radius)
    {
+      if (_recording)
+         _recording->add(display_list::op::round_rect, bounds, radius);
       auto x = bounds.left;
       auto y = bounds.top;
       auto r = bounds.right;
@@ -230,51 +641,71 @@ namespace cycfi { namespace elements
 
    void canvas::fill_style(color c)
    {
-      _state.fill_style = [this, c]()
-      {
-         cairo_set_source_rgba(&_context, c.red, c.green, c.blue, c.alpha);
-      };
+      if (_recording)
+         _recording->add(display_list::op::fill_color, c);
+      _state.fill_style.set(c);
       if (_state.pattern_set == _state.fill_set)
          _state.pattern_set = _state.none_set;
    }
 
    void canvas::stroke_style(color c)
    {
-      _state.stroke_style = [this, c]()
-      {
-         cairo_set_source_rgba(&_context, c.red, c.green, c.blue, c.alpha);
-      };
+      if (_recording)
+         _recording->add(display_list::op::stroke_color, c);
+      _state.stroke_style.set(c);
       if (_state.pattern_set == _state.stroke_set)
          _state.pattern_set = _state.none_set;
    }
 
    void canvas::line_width(float w)
    {
+      if (_recording)
+         _recording->add(display_list::op::line_width, w);
       cairo_set_line_width(&_context, w);
    }
 
    void canvas::fill_style(linear_gradient const& gr)
    {
-      _state.fill_style = [this, pat = make_linear_pattern(gr)]()
+      if (_recording)
       {
-         cairo_set_source(&_context, pat.get());
-      };
+         _recording->add(
+            display_list::op::linear_gradient, gr.start, gr.end, std::uint32_t(gr.space.size()));
+         for (auto cs : gr.space)
+         {
+            _recording->put(cs.offset);
+            _recording->put(cs.color);
+         }
+      }
+      cairo_matrix_t m;
+      auto pat = make_linear_pattern(gr, m);
+      _state.fill_style.set(pat, { m.xx, m.yx, m.xy, m.yy, m.x0, m.y0 });
       if (_state.pattern_set == _state.fill_set)
          _state.pattern_set = _state.none_set;
    }
 
    void canvas::fill_style(radial_gradient const& gr)
    {
-      _state.fill_style = [this, pat = make_radial_pattern(gr)]()
+      if (_recording)
       {
-         cairo_set_source(&_context, pat.get());
-      };
+         _recording->add(
+            display_list::op::radial_gradient, gr.c1, gr.c1_radius, gr.c2, gr.c2_radius, std::uint32_t(gr.space.size()));
+         for (auto cs : gr.space)
+         {
+            _recording->put(cs.offset);
+            _recording->put(cs.color);
+         }
+      }
+      cairo_matrix_t m;
+      auto pat = make_radial_pattern(gr, m);
+      _state.fill_style.set(pat, { m.xx, m.yx, m.xy, m.yy, m.x0, m.y0 });
       if (_state.pattern_set == _state.fill_set)
          _state.pattern_set = _state.none_set;
    }
 
    void canvas::fill_rule(fill_rule_enum rule)
    {
+      if (_recording)
+         _recording->add(display_list::op::fill_rule, std::uint8_t(rule));
       cairo_set_fill_rule(
          &_context, rule == fill_winding ? CAIRO_FILL_RULE_WINDING : CAIRO_FILL_RULE_EVEN_ODD);
    }
@@ -282,7 +713,14 @@ namespace cycfi { namespace elements
    void canvas::font(elements::font const& font_)
    {
       if (font_._handle)
+      {
+         if (_recording)
+         {
+            _recording->add(display_list::op::font);
+            _recording->put_font(font_._handle);
+         }
          cairo_set_font_face(&_context, font_._handle);
+      }
    }
 
    void canvas::font(elements::font const& font_, float size)
@@ -293,19 +731,19 @@ namespace cycfi { namespace elements
 
    void canvas::font_size(float size)
    {
+      if (_recording)
+         _recording->add(display_list::op::font_size, size);
       cairo_set_font_size(&_context, size);
    }
 
    namespace
    {
-      point get_text_start(cairo_t& _context, point p, int align, char const* utf8)
+      point get_text_start(
+         point p, int align
+       , cairo_text_extents_t const& extents
+       , cairo_font_extents_t const& font_extents
+      )
       {
-         cairo_text_extents_t extents;
-         cairo_text_extents(&_context, utf8, &extents);
-
-         cairo_font_extents_t font_extents;
-         cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
-
          switch (align & 0x3)
          {
             case canvas::text_alignment::right:
@@ -338,32 +776,96 @@ namespace cycfi { namespace elements
 
          return p;
       }
+
+      point get_text_start(cairo_t& _context, point p, int align, char const* utf8)
+      {
+         cairo_text_extents_t extents;
+         cairo_text_extents(&_context, utf8, &extents);
+
+         cairo_font_extents_t font_extents;
+         cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
+
+         return get_text_start(p, align, extents, font_extents);
+      }
+
+      // Get the cached shaped text for the current font face and size. The
+      // cache handles plain (unskewed, unrotated) font matrices only. For
+      // anything else, this returns null and we let cairo do the shaping.
+      shaped_text_ptr get_shaped_text(cairo_t& _context, char const* utf8)
+      {
+         cairo_matrix_t m;
+         cairo_get_font_matrix(&_context, &m);
+         if (m.xy != 0 || m.yx != 0 || m.xx != m.yy)
+            return {};
+         return elements::get_shaped_text(cairo_get_font_face(&_context), m.xx, utf8);
+      }
+   }
+
+   void canvas::text_align(int align)
+   {
+      if (_recording)
+         _recording->add(display_list::op::text_align, align);
+      _state.align = align;
    }
 
    void canvas::fill_text(point p, char const* utf8)
    {
+      if (_recording)
+      {
+         _recording->add(display_list::op::fill_text, p);
+         _recording->put_string(utf8);
+      }
       apply_fill_style();
-      p = get_text_start(_context, p, _state.align, utf8);
-      cairo_move_to(&_context, p.x, p.y);
-      cairo_show_text(&_context, utf8);
+      if (auto run = get_shaped_text(_context, utf8))
+      {
+         p = get_text_start(p, _state.align, run->extents(), run->font_extents());
+         run->show(_context, p);
+      }
+      else
+      {
+         p = get_text_start(_context, p, _state.align, utf8);
+         cairo_move_to(&_context, p.x, p.y);
+         cairo_show_text(&_context, utf8);
+      }
    }
 
    void canvas::stroke_text(point p, char const* utf8)
    {
+      if (_recording)
+      {
+         _recording->add(display_list::op::stroke_text, p);
+         _recording->put_string(utf8);
+      }
+      pause_recording pause{ *this };
       apply_stroke_style();
-      p = get_text_start(_context, p, _state.align, utf8);
-      cairo_move_to(&_context, p.x, p.y);
-      cairo_text_path(&_context, utf8);
+      if (auto run = get_shaped_text(_context, utf8))
+      {
+         p = get_text_start(p, _state.align, run->extents(), run->font_extents());
+         run->path(_context, p);
+      }
+      else
+      {
+         p = get_text_start(_context, p, _state.align, utf8);
+         cairo_move_to(&_context, p.x, p.y);
+         cairo_text_path(&_context, utf8);
+      }
       stroke();
    }
 
    canvas::text_metrics canvas::measure_text(char const* utf8)
    {
       cairo_text_extents_t extents;
-      cairo_text_extents(&_context, utf8, &extents);
-
       cairo_font_extents_t font_extents;
-      cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
+      if (auto run = get_shaped_text(_context, utf8))
+      {
+         extents = run->extents();
+         font_extents = run->font_extents();
+      }
+      else
+      {
+         cairo_text_extents(&_context, utf8, &extents);
+         cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
+      }
 
       return {
          /*ascent=*/    float(font_extents.ascent),
@@ -375,28 +877,175 @@ namespace cycfi { namespace elements
 
    void canvas::draw(pixmap const& pm, elements::rect src, elements::rect dest)
    {
+      if (_recording)
+      {
+         _recording->add(display_list::op::draw, src, dest);
+         _recording->put_pixmap(pm);
+      }
+      pause_recording pause{ *this };
       auto  state = new_state();
       auto  w = dest.width();
       auto  h = dest.height();
       translate(dest.top_left());
       auto scale_ = point{ w/src.width(), h/src.height() };
       scale(scale_);
-      cairo_set_source_surface(&_context, pm._surface, -src.left, -src.top);
+      pm.set_source(_context, src);
       rect({ 0, 0, w/scale_.x, h/scale_.y });
       cairo_fill(&_context);
    }
 
+   void canvas::draw_mask(pixmap const& pm, elements::rect src, elements::rect dest)
+   {
+      if (_recording)
+      {
+         _recording->add(display_list::op::draw_mask, src, dest);
+         _recording->put_surface(pm._surface, pm._generation);
+      }
+      pause_recording pause{ *this };
+      auto  state = new_state();
+      auto  w = dest.width();
+      auto  h = dest.height();
+      translate(dest.top_left());
+      auto scale_ = point{ w/src.width(), h/src.height() };
+      scale(scale_);
+      rect({ 0, 0, w/scale_.x, h/scale_.y });
+      cairo_clip(&_context);
+      apply_fill_style();
+      cairo_mask_surface(&_context, pm._surface, -src.left, -src.top);
+   }
+
+   void canvas::fill_shadow(elements::rect r, float radius, float blur)
+   {
+      if (_recording)
+         _recording->add(display_list::op::shadow, r, radius, blur);
+      pause_recording pause{ *this };
+
+      // Device pixels per user unit
+      cairo_matrix_t mat;
+      cairo_get_matrix(&_context, &mat);
+      double tsx, tsy;
+      cairo_surface_get_device_scale(cairo_get_target(&_context), &tsx, &tsy);
+      auto  sx = float(std::sqrt(std::abs(mat.xx * mat.yy - mat.xy * mat.yx)) * tsx);
+      if (sx <= 0 || r.width() <= 0 || r.height() <= 0)
+         return;
+
+      // Quarter pixels are close enough to share masks
+      auto  quarter = [](float v) { return std::round(v * 4) / 4; };
+      auto  blur_px = quarter(blur * sx);
+      auto  radius_px = quarter(std::min(radius, std::min(r.width(), r.height()) / 2) * sx);
+      if (blur_px < 0.25f)
+      {
+         fill_round_rect(r, radius);
+         return;
+      }
+
+      auto  pad = shadow_pad(blur_px);
+      auto  corner = int(std::ceil(radius_px));
+      auto  px = 1 / sx;
+      auto  ext = r.inset(-pad * px, -pad * px);
+
+      // Put the patch seams on device pixels, if we can
+      if (mat.xy == 0 && mat.yx == 0 && mat.xx > 0 && mat.yy > 0)
+      {
+         auto  snap_x = [&](float x)
+         {
+            auto d = std::round((mat.xx * x + mat.x0) * tsx);
+            return float((d / tsx - mat.x0) / mat.xx);
+         };
+         auto  snap_y = [&](float y)
+         {
+            auto d = std::round((mat.yy * y + mat.y0) * tsy);
+            return float((d / tsy - mat.y0) / mat.yy);
+         };
+         ext = { snap_x(ext.left), snap_y(ext.top), snap_x(ext.right), snap_y(ext.bottom) };
+      }
+
+      if (r.width() * sx < 2 * (corner + pad) + 1 || r.height() * sx < 2 * (corner + pad) + 1)
+      {
+         // Too small for the nine-patch
+         auto  w = int(std::ceil(r.width() * sx));
+         auto  h = int(std::ceil(r.height() * sx));
+         auto& mask = get_shadow_mask({ w, h, radius_px, blur_px });
+         auto  size_ = mask.size();
+         draw_mask(mask, { ext.left, ext.top, ext.left + size_.x * px, ext.top + size_.y * px });
+         return;
+      }
+
+      // The nine-patch. Its corners are n pixels, and the edges are
+      // stretched from the single row or column between them.
+      auto& mask = get_shadow_mask({ 0, 0, radius_px, blur_px });
+      auto  n = float(corner + 2 * pad);
+      auto  k = n * px;
+      float const sxs[] = { 0, n, n + 1, 2 * n + 1 };
+      float const dxs[] = { ext.left, ext.left + k, ext.right - k, ext.right };
+      float const dys[] = { ext.top, ext.top + k, ext.bottom - k, ext.bottom };
+
+      for (int row = 0; row != 3; ++row)
+      {
+         for (int col = 0; col != 3; ++col)
+         {
+            elements::rect dest = { dxs[col], dys[row], dxs[col + 1], dys[row + 1] };
+            if (row == 1 && col == 1)
+               fill_rect(dest);   // The middle is solid
+            else
+               draw_mask(mask, { sxs[col], sxs[row], sxs[col + 1], sxs[row + 1] }, dest);
+         }
+      }
+   }
+
    void canvas::save()
    {
+      if (_recording)
+         _recording->add(display_list::op::save);
       cairo_save(&_context);
-      _state_stack.push(_state);
+      if (_depth < max_saved_states)
+         _saved[_depth] = _state;
+      else
+      {
+         if (!_spill.capacity())
+         {
+            auto& pool = spill_pool<canvas_state>();
+            if (!pool.empty())
+            {
+               _spill = std::move(pool.back());
+               pool.pop_back();
+            }
+            else
+            {
+               _spill.reserve(min_spill_capacity);
+            }
+         }
+         _spill.push_back(_state);
+      }
+      ++_depth;
    }
 
    void canvas::restore()
    {
-      _state = _state_stack.top();
-      _state_stack.pop();
+      if (_recording)
+         _recording->add(display_list::op::restore);
+      assert(_depth > 0);
+      --_depth;
+      if (_depth < max_saved_states)
+      {
+         _state = std::move(_saved[_depth]);
+      }
+      else
+      {
+         _state = std::move(_spill.back());
+         _spill.pop_back();
+      }
       cairo_restore(&_context);
    }
-}}
 
+   void canvas::record(display_list& list)
+   {
+      list.clear();
+      _recording = &list;
+   }
+
+   void canvas::stop_recording()
+   {
+      _recording = nullptr;
+   }
+}}
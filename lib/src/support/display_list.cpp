@@ -0,0 +1,554 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/display_list.hpp>
+#include <ostream>
+#include <utility>
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      struct reader
+      {
+         template <typename T>
+         T get()
+         {
+            T val;
+            std::memcpy(&val, p, sizeof(T));
+            p += sizeof(T);
+            return val;
+         }
+
+         // Strings are stored with their size, and a null terminator
+         char const* string()
+         {
+            auto  n = get<std::uint32_t>();
+            auto  s = reinterpret_cast<char const*>(p);
+            p += n + 1;
+            return s;
+         }
+
+         template <typename T>
+         T* pointer()
+         {
+            return reinterpret_cast<T*>(std::uintptr_t(get<std::uint64_t>()));
+         }
+
+         std::uint8_t const* p;
+      };
+
+      char const* const op_names[] =
+      {
+         "save", "restore",
+         "translate", "rotate", "scale", "skew",
+         "begin_path", "close_path", "fill", "fill_preserve", "stroke", "stroke_preserve", "clip",
+         "move_to", "line_to", "arc", "rect", "round_rect",
+         "fill_color", "stroke_color", "line_width", "linear_gradient", "radial_gradient",
+         "fill_rule", "shadow",
+         "font", "font_size", "text_align", "fill_text", "stroke_text", "glyphs",
+         "draw", "draw_mask"
+      };
+
+      std::ostream& operator<<(std::ostream& out, point p)
+      {
+         return out << p.x << ' ' << p.y;
+      }
+
+      std::ostream& operator<<(std::ostream& out, rect r)
+      {
+         return out << r.left << ' ' << r.top << ' ' << r.right << ' ' << r.bottom;
+      }
+
+      std::ostream& operator<<(std::ostream& out, color c)
+      {
+         return out << c.red << ' ' << c.green << ' ' << c.blue << ' ' << c.alpha;
+      }
+   }
+
+   display_list::display_list(display_list&& rhs) noexcept
+    : _buffer(std::move(rhs._buffer))
+    , _count(rhs._count)
+    , _surfaces(std::move(rhs._surfaces))
+    , _variants(std::move(rhs._variants))
+    , _fonts(std::move(rhs._fonts))
+    , _scaled_fonts(std::move(rhs._scaled_fonts))
+   {
+      rhs._count = 0;
+   }
+
+   display_list::~display_list()
+   {
+      clear();
+   }
+
+   display_list& display_list::operator=(display_list&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         clear();
+         _buffer = std::move(rhs._buffer);
+         _count = rhs._count;
+         _surfaces = std::move(rhs._surfaces);
+         _variants = std::move(rhs._variants);
+         _fonts = std::move(rhs._fonts);
+         _scaled_fonts = std::move(rhs._scaled_fonts);
+         rhs._count = 0;
+      }
+      return *this;
+   }
+
+   bool display_list::operator==(display_list const& rhs) const
+   {
+      // Pixmaps and fonts are recorded by address (and pixmaps by
+      // generation, too). The list holds on to them, so the addresses
+      // cannot be reused while the list exists.
+      return _buffer == rhs._buffer;
+   }
+
+   void display_list::clear()
+   {
+      // The buffers keep their capacity, so recording the same frame
+      // again does not allocate.
+      for (auto s : _surfaces)
+         cairo_surface_destroy(s);
+      for (auto f : _fonts)
+         cairo_font_face_destroy(f);
+      for (auto f : _scaled_fonts)
+         cairo_scaled_font_destroy(f);
+      _surfaces.clear();
+      _variants.clear();
+      _fonts.clear();
+      _scaled_fonts.clear();
+      _buffer.clear();
+      _count = 0;
+   }
+
+   std::uint64_t display_list::hash() const
+   {
+      return detail::fnv1a(
+         string_view{ reinterpret_cast<char const*>(_buffer.data()), _buffer.size() });
+   }
+
+   void display_list::put_string(char const* utf8)
+   {
+      auto  n = std::strlen(utf8);
+      put(std::uint32_t(n));
+      _buffer.insert(_buffer.end(), utf8, utf8 + n + 1);
+   }
+
+   void display_list::put_surface(cairo_surface_t* surface, std::uint32_t generation)
+   {
+      _surfaces.push_back(cairo_surface_reference(surface));
+      put(std::uint64_t(reinterpret_cast<std::uintptr_t>(surface)));
+      put(generation);
+   }
+
+   // The pixmap's surface, and its variants, if it is mipmapped. The
+   // variants are recorded by address (or 0), like the surface.
+   void display_list::put_pixmap(pixmap const& pm)
+   {
+      put_surface(pm._surface, pm._generation);
+      auto  v = pm.get_variants();
+      if (v)
+         _variants.push_back(pm._variants);
+      put(std::uint64_t(reinterpret_cast<std::uintptr_t>(v)));
+   }
+
+   void display_list::put_font(cairo_font_face_t* face)
+   {
+      _fonts.push_back(cairo_font_face_reference(face));
+      put(std::uint64_t(reinterpret_cast<std::uintptr_t>(face)));
+   }
+
+   void display_list::put_scaled_font(cairo_scaled_font_t* font)
+   {
+      _scaled_fonts.push_back(cairo_scaled_font_reference(font));
+      put(std::uint64_t(reinterpret_cast<std::uintptr_t>(font)));
+   }
+
+   void display_list::add_glyphs(
+      cairo_scaled_font_t* font
+    , cairo_glyph_t const* glyphs, int num_glyphs
+    , point offset, color const* c
+   )
+   {
+      add(op::glyphs, offset, std::uint8_t(c != nullptr), c? *c : color{}
+       , std::uint32_t(num_glyphs));
+      put_scaled_font(font);
+      for (int i = 0; i != num_glyphs; ++i)
+      {
+         put(std::uint32_t(glyphs[i].index));
+         put(float(glyphs[i].x));
+         put(float(glyphs[i].y));
+      }
+   }
+
+   void display_list::replay(canvas& cnv) const
+   {
+      auto& cr = cnv._context;
+      auto  end = _buffer.data() + _buffer.size();
+
+      // For recording a replay: The variants are shared by address
+      auto  find_variants = [this](pixmap::variants* v)
+      {
+         for (auto const& p : _variants)
+            if (p.get() == v)
+               return p;
+         return pixmap::variants_ptr{};
+      };
+
+      for (reader r{ _buffer.data() }; r.p != end;)
+      {
+         auto  o = r.get<op>();
+         switch (o)
+         {
+            case op::save:             cnv.save(); break;
+            case op::restore:          cnv.restore(); break;
+            case op::translate:        cnv.translate(r.get<point>()); break;
+            case op::rotate:           cnv.rotate(r.get<float>()); break;
+            case op::scale:            cnv.scale(r.get<point>()); break;
+            case op::begin_path:       cnv.begin_path(); break;
+            case op::close_path:       cnv.close_path(); break;
+            case op::fill:             cnv.fill(); break;
+            case op::fill_preserve:    cnv.fill_preserve(); break;
+            case op::stroke:           cnv.stroke(); break;
+            case op::stroke_preserve:  cnv.stroke_preserve(); break;
+            case op::clip:             cnv.clip(); break;
+            case op::move_to:          cnv.move_to(r.get<point>()); break;
+            case op::line_to:          cnv.line_to(r.get<point>()); break;
+            case op::rect:             cnv.rect(r.get<rect>()); break;
+            case op::fill_color:       cnv.fill_style(r.get<color>()); break;
+            case op::stroke_color:     cnv.stroke_style(r.get<color>()); break;
+            case op::line_width:       cnv.line_width(r.get<float>()); break;
+            case op::font_size:        cnv.font_size(r.get<float>()); break;
+            case op::text_align:       cnv.text_align(r.get<int>()); break;
+
+            case op::skew:
+            {
+               auto  sx = r.get<float>();
+               auto  sy = r.get<float>();
+               cnv.skew(sx, sy);
+               break;
+            }
+
+            case op::arc:
+            {
+               auto  p = r.get<point>();
+               auto  radius = r.get<float>();
+               auto  start = r.get<float>();
+               auto  end_ = r.get<float>();
+               cnv.arc(p, radius, start, end_, r.get<bool>());
+               break;
+            }
+
+            case op::round_rect:
+            {
+               auto  bounds = r.get<rect>();
+               cnv.round_rect(bounds, r.get<float>());
+               break;
+            }
+
+            case op::linear_gradient:
+            {
+               canvas::linear_gradient gr;
+               gr.start = r.get<point>();
+               gr.end = r.get<point>();
+               for (auto n = r.get<std::uint32_t>(); n != 0; --n)
+               {
+                  auto  offset = r.get<float>();
+                  gr.add_color_stop({ offset, r.get<color>() });
+               }
+               cnv.fill_style(gr);
+               break;
+            }
+
+            case op::radial_gradient:
+            {
+               canvas::radial_gradient gr;
+               gr.c1 = r.get<point>();
+               gr.c1_radius = r.get<float>();
+               gr.c2 = r.get<point>();
+               gr.c2_radius = r.get<float>();
+               for (auto n = r.get<std::uint32_t>(); n != 0; --n)
+               {
+                  auto  offset = r.get<float>();
+                  gr.add_color_stop({ offset, r.get<color>() });
+               }
+               cnv.fill_style(gr);
+               break;
+            }
+
+            case op::fill_rule:
+               cnv.fill_rule(canvas::fill_rule_enum(r.get<std::uint8_t>()));
+               break;
+
+            case op::shadow:
+            {
+               auto  bounds = r.get<rect>();
+               auto  radius = r.get<float>();
+               cnv.fill_shadow(bounds, radius, r.get<float>());
+               break;
+            }
+
+            case op::font:
+            {
+               auto  face = r.pointer<cairo_font_face_t>();
+               if (auto list = cnv._recording)
+               {
+                  list->add(op::font);
+                  list->put_font(face);
+               }
+               cairo_set_font_face(&cr, face);
+               break;
+            }
+
+            case op::fill_text:
+            {
+               auto  p = r.get<point>();
+               cnv.fill_text(p, r.string());
+               break;
+            }
+
+            case op::stroke_text:
+            {
+               auto  p = r.get<point>();
+               cnv.stroke_text(p, r.string());
+               break;
+            }
+
+            case op::glyphs:
+            {
+               auto  offset = r.get<point>();
+               bool  has_color = r.get<std::uint8_t>();
+               auto  c = r.get<color>();
+               auto  n = r.get<std::uint32_t>();
+               auto  font = r.pointer<cairo_scaled_font_t>();
+
+               std::vector<cairo_glyph_t> glyphs(n);
+               for (auto& g : glyphs)
+               {
+                  g.index = r.get<std::uint32_t>();
+                  g.x = r.get<float>();
+                  g.y = r.get<float>();
+               }
+
+               if (auto list = cnv._recording)
+                  list->add_glyphs(font, glyphs.data(), int(n), offset, has_color? &c : nullptr);
+               canvas::pause_recording pause{ cnv };
+               auto  state = cnv.new_state();
+               cairo_set_scaled_font(&cr, font);
+               cairo_translate(&cr, offset.x, offset.y);
+               if (has_color)
+                  cairo_set_source_rgba(&cr, c.red, c.green, c.blue, c.alpha);
+               else
+                  cnv.apply_fill_style();
+               cairo_show_glyphs(&cr, glyphs.data(), int(n));
+               break;
+            }
+
+            case op::draw:
+            {
+               auto  src = r.get<rect>();
+               auto  dest = r.get<rect>();
+               auto  surface = r.pointer<cairo_surface_t>();
+               auto  generation = r.get<std::uint32_t>();
+               auto  v = r.pointer<pixmap::variants>();
+
+               if (auto list = cnv._recording)
+               {
+                  list->add(o, src, dest);
+                  list->put_surface(surface, generation);
+                  if (v)
+                     list->_variants.push_back(find_variants(v));
+                  list->put(std::uint64_t(reinterpret_cast<std::uintptr_t>(v)));
+               }
+
+               // As canvas::draw, but from the surface and the variants,
+               // as the pixmap may be gone.
+               canvas::pause_recording pause{ cnv };
+               auto  state = cnv.new_state();
+               auto  scale_ = point{ dest.width() / src.width(), dest.height() / src.height() };
+               cnv.translate(dest.top_left());
+               cnv.scale(scale_);
+               pixmap::set_source(cr, surface, v, src);
+               cnv.rect({ 0, 0, dest.width() / scale_.x, dest.height() / scale_.y });
+               cairo_fill(&cr);
+               break;
+            }
+
+            case op::draw_mask:
+            {
+               auto  src = r.get<rect>();
+               auto  dest = r.get<rect>();
+               auto  surface = r.pointer<cairo_surface_t>();
+               auto  generation = r.get<std::uint32_t>();
+
+               if (auto list = cnv._recording)
+               {
+                  list->add(o, src, dest);
+                  list->put_surface(surface, generation);
+               }
+
+               // As canvas::draw_mask, but from the surface, as the pixmap
+               // may be gone.
+               canvas::pause_recording pause{ cnv };
+               auto  state = cnv.new_state();
+               auto  scale_ = point{ dest.width() / src.width(), dest.height() / src.height() };
+               cnv.translate(dest.top_left());
+               cnv.scale(scale_);
+               cnv.rect({ 0, 0, dest.width() / scale_.x, dest.height() / scale_.y });
+               cairo_clip(&cr);
+               cnv.apply_fill_style();
+               cairo_mask_surface(&cr, surface, -src.left, -src.top);
+               break;
+            }
+         }
+      }
+   }
+
+   void display_list::write(std::ostream& out) const
+   {
+      auto  end = _buffer.data() + _buffer.size();
+      for (reader r{ _buffer.data() }; r.p != end;)
+      {
+         auto  o = r.get<op>();
+         out << op_names[int(o)];
+         switch (o)
+         {
+            case op::translate:
+            case op::scale:
+            case op::move_to:
+            case op::line_to:
+               out << ' ' << r.get<point>();
+               break;
+
+            case op::rotate:
+            case op::line_width:
+            case op::font_size:
+               out << ' ' << r.get<float>();
+               break;
+
+            case op::skew:
+            {
+               auto  sx = r.get<float>();
+               out << ' ' << sx << ' ' << r.get<float>();
+               break;
+            }
+
+            case op::arc:
+            {
+               auto  p = r.get<point>();
+               auto  radius = r.get<float>();
+               auto  start = r.get<float>();
+               auto  end_ = r.get<float>();
+               out << ' ' << p << ' ' << radius << ' ' << start << ' ' << end_
+                  << (r.get<bool>()? " ccw" : "");
+               break;
+            }
+
+            case op::rect:
+               out << ' ' << r.get<rect>();
+               break;
+
+            case op::round_rect:
+            {
+               auto  bounds = r.get<rect>();
+               out << ' ' << bounds << ' ' << r.get<float>();
+               break;
+            }
+
+            case op::fill_color:
+            case op::stroke_color:
+               out << ' ' << r.get<color>();
+               break;
+
+            case op::linear_gradient:
+            case op::radial_gradient:
+            {
+               if (o == op::linear_gradient)
+               {
+                  auto  start = r.get<point>();
+                  out << ' ' << start << ' ' << r.get<point>();
+               }
+               else
+               {
+                  auto  c1 = r.get<point>();
+                  auto  c1_radius = r.get<float>();
+                  auto  c2 = r.get<point>();
+                  out << ' ' << c1 << ' ' << c1_radius << ' ' << c2 << ' ' << r.get<float>();
+               }
+               for (auto n = r.get<std::uint32_t>(); n != 0; --n)
+               {
+                  auto  offset = r.get<float>();
+                  out << " | " << offset << ' ' << r.get<color>();
+               }
+               break;
+            }
+
+            case op::fill_rule:
+               out << (r.get<std::uint8_t>() == canvas::fill_winding? " winding" : " odd_even");
+               break;
+
+            case op::shadow:
+            {
+               auto  bounds = r.get<rect>();
+               auto  radius = r.get<float>();
+               out << ' ' << bounds << ' ' << radius << ' ' << r.get<float>();
+               break;
+            }
+
+            case op::font:
+               out << " face@" << r.pointer<void>();
+               break;
+
+            case op::text_align:
+               out << ' ' << r.get<int>();
+               break;
+
+            case op::fill_text:
+            case op::stroke_text:
+            {
+               auto  p = r.get<point>();
+               out << ' ' << p << " \"" << r.string() << '"';
+               break;
+            }
+
+            case op::glyphs:
+            {
+               auto  offset = r.get<point>();
+               bool  has_color = r.get<std::uint8_t>();
+               auto  c = r.get<color>();
+               auto  n = r.get<std::uint32_t>();
+               out << ' ' << offset << " font@" << r.pointer<void>() << ' ' << n << " glyphs";
+               if (has_color)
+                  out << " color " << c;
+               r.p += n * (sizeof(std::uint32_t) + 2 * sizeof(float));
+               break;
+            }
+
+            case op::draw:
+            case op::draw_mask:
+            {
+               auto  src = r.get<rect>();
+               auto  dest = r.get<rect>();
+               auto  surface = r.pointer<void>();
+               out << ' ' << src << " -> " << dest << " surface@" << surface
+                  << '#' << r.get<std::uint32_t>();
+               if (o == op::draw)
+               {
+                  if (auto v = r.pointer<void>())
+                     out << " mipmapped@" << v;
+               }
+               break;
+            }
+
+            default:
+               break;
+         }
+         out << '\n';
+      }
+   }
+}}
@@ -39,7 +39,7 @@ namespace cycfi { namespace elements
       cnv.fill_style(c);
       cnv.fill();
 
-      // Simulated blurred shadow. cairo does not have blur yet :-(
+      // Blurred shadow, outside the panel
       {
          auto save = cnv.new_state();
 
@@ -49,33 +49,8 @@ namespace cycfi { namespace elements
          cnv.fill_rule(canvas::fill_odd_even);
          cnv.clip();
 
-         rect shr = bounds;
-         shr.left -= 2;
-         shr.top -= 2;
-         shr.right += 6;
-         shr.bottom += 6;
-         cnv.begin_path();
-         cnv.round_rect(shr, corner_radius*2);
-         cnv.fill_style(rgba(0, 0, 0, 20));
-         cnv.fill();
-
-         shr.left += 1;
-         shr.top += 1;
-         shr.right -= 2;
-         shr.bottom -= 2;
-         cnv.begin_path();
-         cnv.round_rect(shr, corner_radius*1.5);
-         cnv.fill_style(rgba(0, 0, 0, 30));
-         cnv.fill();
-
-         shr.left += 1;
-         shr.top += 1;
-         shr.right -= 2;
-         shr.bottom -= 2;
-         cnv.begin_path();
-         cnv.round_rect(shr, corner_radius);
-         cnv.fill_style(rgba(0, 0, 0, 40));
-         cnv.fill();
+         cnv.fill_style(rgba(0, 0, 0, 80));
+         cnv.fill_shadow(bounds.move(1, 2), corner_radius, 3);
       }
    }
 
@@ -31,10 +31,22 @@
 # include <cairo-quartz.h>
 #endif
 
+#include <elements/support/mapped_file.hpp>
+#include <elements/support/resource_bundle.hpp>
+#include <elements/support/text_utils.hpp>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <map>
 #include <mutex>
 #include <memory>
-#include <sstream>
 #include <algorithm>
 #include <vector>
 #include <utility>
@@ -298,28 +310,6 @@ namespace cycfi { namespace elements
          }
       } // namespace
 
-      using cairo_font_map_type = std::map<std::string, cairo_font_face_t*>;
-
-      std::pair<cairo_font_map_type&, std::mutex&> get_cairo_font_map()
-      {
-         static cairo_font_map_type cairo_font_map_;
-         static std::mutex cairo_font_map_mutex_;
-
-         struct cleanup
-         {
-            ~cleanup()
-            {
-               std::lock_guard<std::mutex> lock(cairo_font_map_mutex_);
-               for (auto [key, scaled_font] : cairo_font_map_)
-                  cairo_font_face_destroy(scaled_font);
-               cairo_font_map_.clear();
-            }
-         };
-
-         static cleanup cleanup_;
-         return { cairo_font_map_, cairo_font_map_mutex_ };
-      }
-
       int map_fc_weight(int w)
       {
          enum
@@ -363,45 +353,347 @@ namespace cycfi { namespace elements
          return map(fc::black, 100, fc_black, 220, std::min(w, 220));
       }
 
+      ////////////////////////////////////////////////////////////////////////
+      // font_index: The installed fonts, by family, in a compact binary
+      // format that is cached on disk (see font_index_path()).
+      //
+      // The cache is keyed by the modification times of the font
+      // directories (and their subdirectories). Finding those directories
+      // still loads the fontconfig configuration (but not the fonts) and
+      // walks the directory trees on every launch. On a hit, the file is
+      // memory-mapped and used as is; no font files are scanned. On a miss,
+      // the fonts are enumerated by fontconfig, and the index is built in
+      // memory and saved for the next launch.
+      //
+      // Layout (native endian; the file is never shared across machines):
+      //
+      //    header
+      //    dir_record     [num_dirs]        sorted by path
+      //    family_record  [num_families]    sorted by name
+      //    font_entry     [num_fonts]       grouped by family
+      //    strings        [strings_size]    null terminated
+      //
+      // All strings are offsets into the string table.
+      ////////////////////////////////////////////////////////////////////////
+      constexpr char font_index_magic[8] = "ELFNTIX";
+      constexpr std::uint32_t font_index_version = 1;
+
+      std::uint8_t map_ot_weight(int w)
+      {
+         return map_fc_weight(FcWeightFromOpenType(w));
+      }
+
+      struct font_index_header
+      {
+         char           magic[8];
+         std::uint32_t  version;
+         std::uint32_t  num_dirs;
+         std::uint32_t  num_families;
+         std::uint32_t  num_fonts;
+         std::uint32_t  strings_size;
+         std::uint32_t  reserved;
+      };
+
+      struct dir_record
+      {
+         std::int64_t   mtime;      // -1 if the directory does not exist
+         std::uint32_t  path;
+         std::uint32_t  reserved;
+      };
+
+      struct family_record
+      {
+         std::uint32_t  name;
+         std::uint32_t  first;      // The first font_entry
+         std::uint32_t  count;
+         std::uint32_t  reserved;
+      };
+
       struct font_entry
       {
-         font_entry(FcPattern* pat, FcChar8 const* full_name, FcChar8 const* file)
-         : pattern(fc::pattern_shallow_copy_tag{}, *pat)
-         , full_name(reinterpret_cast<char const*>(full_name))
-         , file(reinterpret_cast<char const*>(file))
+         std::uint32_t  full_name;
+         std::uint32_t  file;
+         std::uint8_t   weight;
+         std::uint8_t   slant;
+         std::uint8_t   stretch;
+         std::uint8_t   reserved;
+      };
+
+      struct font_dir
+      {
+         std::string    path;
+         std::int64_t   mtime;
+      };
+
+      using font_dir_list = std::vector<font_dir>;
+
+      class font_index
+      {
+      public:
+
+         bool           load(fs::path const& path, font_dir_list const& dirs);
+         void           build(font_dir_list const& dirs, std::vector<fs::path> const& app_paths);
+         void           save(fs::path const& path) const;
+
+         char const*    string(std::uint32_t offset) const
+                        { return _strings + offset; }
+         std::pair<font_entry const*, font_entry const*>
+                        family(string_view name) const;
+
+      private:
+
+         bool           validate(char const* data, std::size_t size);
+
+         std::unique_ptr<mapped_file> _file;
+         std::vector<char>    _buffer;
+         font_index_header const* _header = nullptr;
+         family_record const* _families = nullptr;
+         font_entry const*    _fonts = nullptr;
+         char const*          _strings = nullptr;
+      };
+
+      template <typename T>
+      T const* records(char const* data, std::size_t& offset, std::size_t n)
+      {
+         auto p = reinterpret_cast<T const*>(data + offset);
+         offset += n * sizeof(T);
+         return p;
+      }
+
+      bool font_index::validate(char const* data, std::size_t size)
+      {
+         if (size < sizeof(font_index_header))
+            return false;
+
+         auto h = reinterpret_cast<font_index_header const*>(data);
+         if (std::memcmp(h->magic, font_index_magic, sizeof(h->magic)) != 0
+            || h->version != font_index_version
+            || h->strings_size == 0)
+            return false;
+
+         auto expected =
+            sizeof(font_index_header)
+            + std::size_t(h->num_dirs) * sizeof(dir_record)
+            + std::size_t(h->num_families) * sizeof(family_record)
+            + std::size_t(h->num_fonts) * sizeof(font_entry)
+            + h->strings_size
+            ;
+         if (size != expected)
+            return false;
+
+         std::size_t offset = sizeof(font_index_header);
+         auto dirs = records<dir_record>(data, offset, h->num_dirs);
+         auto families = records<family_record>(data, offset, h->num_families);
+         auto fonts = records<font_entry>(data, offset, h->num_fonts);
+         auto strings = data + offset;
+
+         // Everything must point inside the file
+         auto n = h->strings_size;
+         if (strings[n-1] != '\0')
+            return false;
+         for (auto i = 0u; i != h->num_dirs; ++i)
+            if (dirs[i].path >= n)
+               return false;
+         for (auto i = 0u; i != h->num_families; ++i)
+            if (families[i].name >= n
+               || families[i].first > h->num_fonts
+               || families[i].count > h->num_fonts - families[i].first)
+               return false;
+         for (auto i = 0u; i != h->num_fonts; ++i)
+            if (fonts[i].full_name >= n || fonts[i].file >= n)
+               return false;
+
+         _header = h;
+         _families = families;
+         _fonts = fonts;
+         _strings = strings;
+         return true;
+      }
+
+      bool font_index::load(fs::path const& path, font_dir_list const& dirs)
+      {
+         auto file = std::make_unique<mapped_file>(path);
+         if (!*file || !validate(file->data(), file->size()))
+            return false;
+
+         // The index is stale if any of the font directories changed
+         bool stale = _header->num_dirs != dirs.size();
+         if (!stale)
          {
-            if (auto w = pattern.get_weight(); w)
-               weight = map_fc_weight(*w); // map the weight (normalized 0 to 100)
-            else
-               weight = font_constants::weight_normal;
+            auto dir_records = reinterpret_cast<dir_record const*>(_header + 1);
+            for (std::size_t i = 0; i != dirs.size() && !stale; ++i)
+            {
+               stale = dir_records[i].mtime != dirs[i].mtime
+                  || dirs[i].path != string(dir_records[i].path);
+            }
+         }
 
-            if (auto s = pattern.get_slant(); s)
-               slant = (*s * 100) / 110; // normalize 0 to 100
-            else
-               slant = font_constants::slant_normal;
+         if (stale)
+         {
+            _header = nullptr;
+            return false;
+         }
+         _file = std::move(file);
+         return true;
+      }
 
-            if (auto w = pattern.get_width(); w)
-               stretch = (*w * 100) / 200; // normalize 0 to 100
-            else
-               stretch = font_constants::stretch_normal;
+      std::pair<font_entry const*, font_entry const*>
+      font_index::family(string_view name) const
+      {
+         if (!_header)
+            return { nullptr, nullptr };
+
+         auto last = _families + _header->num_families;
+         auto i = std::lower_bound(_families, last, name,
+            [this](family_record const& f, string_view name)
+            {
+               return string_view{ string(f.name) } < name;
+            }
+         );
+         if (i == last || string_view{ string(i->name) } != name)
+            return { nullptr, nullptr };
+         return { _fonts + i->first, _fonts + i->first + i->count };
+      }
+
+      void font_index::build(font_dir_list const& dirs, std::vector<fs::path> const& app_paths)
+      {
+         fc::config& conf = fc::instance();
+
+         for (auto& path : app_paths)
+            conf.app_font_add_dir(reinterpret_cast<FcChar8 const*>(path.generic_string().c_str()));
+
+         fc::pattern pat(fc::pattern_empty_tag{});
+         fc::object_set os(FC_FAMILY, FC_FULLNAME, FC_WIDTH, FC_WEIGHT, FC_SLANT, FC_FILE);
+         fc::font_set_ptr fs = fc::font_list(conf.get(), pat, os);
+
+         struct item
+         {
+            std::string    family;
+            font_entry     entry;
+         };
+
+         std::vector<item> items;
+         std::string strings(1, '\0');    // Offset 0 is the empty string
+         auto add_string = [&strings](char const* s)
+         {
+            auto offset = std::uint32_t(strings.size());
+            strings.append(s);
+            strings.push_back('\0');
+            return offset;
+         };
+
+         for (int i = 0; i < fs->nfont; ++i)
+         {
+            fc::pattern font(fc::pattern_shallow_copy_tag{}, *fs->fonts[i]);
+            FcChar8 *file, *family, *full_name;
+            if (FcPatternGetString(font.handle(), FC_FILE, 0, &file) == FcResultMatch &&
+               FcPatternGetString(font.handle(), FC_FAMILY, 0, &family) == FcResultMatch &&
+               FcPatternGetString(font.handle(), FC_FULLNAME, 0, &full_name) == FcResultMatch
+            )
+            {
+               item it;
+               it.family = reinterpret_cast<char const*>(family);
+               trim(it.family);
+
+               auto& e = it.entry;
+               e.full_name = add_string(reinterpret_cast<char const*>(full_name));
+               e.file = add_string(reinterpret_cast<char const*>(file));
+               e.reserved = 0;
+
+               if (auto w = font.get_weight(); w)
+                  e.weight = map_fc_weight(*w); // map the weight (normalized 0 to 100)
+               else
+                  e.weight = font_constants::weight_normal;
+
+               if (auto s = font.get_slant(); s)
+                  e.slant = (*s * 100) / 110; // normalize 0 to 100
+               else
+                  e.slant = font_constants::slant_normal;
+
+               if (auto w = font.get_width(); w)
+                  e.stretch = (*w * 100) / 200; // normalize 0 to 100
+               else
+                  e.stretch = font_constants::stretch_normal;
+
+               items.push_back(std::move(it));
+            }
          }
 
-         fc::pattern pattern;
-         std::string full_name;
-         std::string file;
-         std::uint8_t weight;
-         std::uint8_t slant;
-         std::uint8_t stretch;
-      };
+         // Keep fontconfig's order within a family: the first of equally
+         // good matches wins.
+         std::stable_sort(items.begin(), items.end(),
+            [](item const& a, item const& b) { return a.family < b.family; }
+         );
+
+         std::vector<dir_record> dir_records;
+         for (auto const& d : dirs)
+            dir_records.push_back({ d.mtime, add_string(d.path.c_str()), 0 });
+
+         std::vector<family_record> family_records;
+         for (std::size_t i = 0; i != items.size(); ++i)
+         {
+            if (i == 0 || items[i].family != items[i-1].family)
+               family_records.push_back({ add_string(items[i].family.c_str()), std::uint32_t(i), 0, 0 });
+            ++family_records.back().count;
+         }
+
+         font_index_header h;
+         std::memcpy(h.magic, font_index_magic, sizeof(h.magic));
+         h.version = font_index_version;
+         h.num_dirs = std::uint32_t(dir_records.size());
+         h.num_families = std::uint32_t(family_records.size());
+         h.num_fonts = std::uint32_t(items.size());
+         h.strings_size = std::uint32_t(strings.size());
+         h.reserved = 0;
+
+         auto append = [this](void const* p, std::size_t n)
+         {
+            auto first = static_cast<char const*>(p);
+            _buffer.insert(_buffer.end(), first, first + n);
+         };
+
+         _buffer.clear();
+         append(&h, sizeof(h));
+         append(dir_records.data(), dir_records.size() * sizeof(dir_record));
+         append(family_records.data(), family_records.size() * sizeof(family_record));
+         for (auto const& it : items)
+            append(&it.entry, sizeof(font_entry));
+         append(strings.data(), strings.size());
+
+         _file.reset();
+         validate(_buffer.data(), _buffer.size());
+      }
 
-      using font_map_type = std::map<std::string, std::vector<font_entry>>;
-      font_map_type& font_map()
+      void font_index::save(fs::path const& path) const
       {
-         static font_map_type font_map_;
-         return font_map_;
+         if (_buffer.empty())
+            return;
+
+         // Write to a temporary file first, so that other processes never
+         // map a partially written index.
+         std::error_code ec;
+         fs::create_directories(path.parent_path(), ec);
+         auto tmp = path;
+         tmp += "." + std::to_string(
+            std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+         {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out)
+               return;
+            out.write(_buffer.data(), _buffer.size());
+            if (!out)
+            {
+               out.close();
+               fs::remove(tmp, ec);
+               return;
+            }
+         }
+         fs::rename(tmp, path, ec);
+         if (ec)
+            fs::remove(tmp, ec);
       }
 
-      void init_font_map()
+      std::vector<fs::path> app_font_paths()
       {
          std::vector<fs::path> paths = font_paths();
 
@@ -416,69 +708,347 @@ namespace cycfi { namespace elements
          paths.push_back(fs::path(windir) / "fonts");
 #endif
 #endif
-         fc::config& conf = fc::instance();
+         return paths;
+      }
 
-         for (auto& path : paths)
-            conf.app_font_add_dir(reinterpret_cast<FcChar8 const*>(path.generic_string().c_str()));
+      // The font directories and all their subdirectories, with their
+      // modification times, sorted by path.
+      font_dir_list font_dirs(std::vector<fs::path> roots)
+      {
+         // The directories in the fontconfig configuration. Only the
+         // configuration is loaded here, not the fonts.
+         if (fc::font_config_ptr conf{ FcInitLoadConfig() })
+         {
+            if (auto list = FcConfigGetConfigDirs(conf.get()))
+            {
+               while (auto dir = FcStrListNext(list))
+                  roots.push_back(fs::path(reinterpret_cast<char const*>(dir)));
+               FcStrListDone(list);
+            }
+         }
 
-         fc::pattern pat(fc::pattern_empty_tag{});
-         fc::object_set os(FC_FAMILY, FC_FULLNAME, FC_WIDTH, FC_WEIGHT, FC_SLANT, FC_FILE);
-         fc::font_set_ptr fs = fc::font_list(conf.get(), pat, os);
+         auto mtime = [](fs::path const& path) -> std::int64_t
+         {
+            std::error_code ec;
+            auto t = fs::last_write_time(path, ec);
+            return ec? -1 : std::int64_t(t.time_since_epoch().count());
+         };
 
-         for (int i = 0; i < fs->nfont; ++i)
+         font_dir_list dirs;
+         for (auto const& root : roots)
          {
-            FcPattern* font = fs->fonts[i];
-            FcChar8 *file, *family, *full_name;
-            if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch &&
-               FcPatternGetString(font, FC_FAMILY, 0, &family) == FcResultMatch &&
-               FcPatternGetString(font, FC_FULLNAME, 0, &full_name) == FcResultMatch
-            )
+            dirs.push_back({ root.generic_string(), mtime(root) });
+            if (dirs.back().mtime == -1)
+               continue;
+
+            std::error_code ec;
+            fs::recursive_directory_iterator
+               i{ root, fs::directory_options::skip_permission_denied, ec }, last;
+            for (; !ec && i != last; i.increment(ec))
             {
-               std::string key = reinterpret_cast<char const*>(family);
-               trim(key);
+               if (i->is_directory(ec))
+                  dirs.push_back({ i->path().generic_string(), mtime(i->path()) });
+            }
+         }
+
+         std::sort(dirs.begin(), dirs.end(),
+            [](font_dir const& a, font_dir const& b) { return a.path < b.path; }
+         );
+         dirs.erase(
+            std::unique(dirs.begin(), dirs.end(),
+               [](font_dir const& a, font_dir const& b) { return a.path == b.path; }
+            )
+          , dirs.end()
+         );
+         return dirs;
+      }
+
+      // Applications with different font paths get their own index
+      fs::path font_index_file(std::vector<fs::path> const& app_paths)
+      {
+         auto dir = font_index_path();
+         if (dir.empty())
+            return {};
 
-               font_map()[key].push_back(font_entry(font, full_name, file));
+         std::uint64_t hash = 14695981039346656037ull;   // FNV-1a
+         for (auto const& path : app_paths)
+         {
+            for (auto c : path.generic_string() + '\0')
+            {
+               hash ^= std::uint8_t(c);
+               hash *= 1099511628211ull;
             }
          }
+
+         char name[32];
+         std::snprintf(name, sizeof(name), "fonts-%016llx.idx", (unsigned long long)hash);
+         return dir / name;
+      }
+
+      font_index const& get_font_index()
+      {
+         static font_index const index = []
+         {
+            font_index index;
+            auto app_paths = app_font_paths();
+            auto dirs = font_dirs(app_paths);
+            auto file = font_index_file(app_paths);
+            if (file.empty() || !index.load(file, dirs))
+            {
+               index.build(dirs, app_paths);
+               if (!file.empty())
+                  index.save(file);
+            }
+            return index;
+         }();
+         return index;
+      }
+
+      // Trims spaces and quotes, like trim, without copying
+      string_view trimmed(string_view s)
+      {
+         auto is_space = [](char c) { return c == ' ' || c == '"'; };
+         while (!s.empty() && is_space(s.front()))
+            s.remove_prefix(1);
+         while (!s.empty() && is_space(s.back()))
+            s.remove_suffix(1);
+         return s;
+      }
+
+      ////////////////////////////////////////////////////////////////////////
+      // Reads the family, full name, weight, slant and stretch from the
+      // 'name' and 'OS/2' tables of a TrueType or OpenType font (or the
+      // first font of a collection) in memory.
+      ////////////////////////////////////////////////////////////////////////
+      inline std::uint16_t be16(unsigned char const* p)
+      {
+         return std::uint16_t((p[0] << 8) | p[1]);
       }
 
-      font_entry const* match(font_descr descr)
+      inline std::uint32_t be32(unsigned char const* p)
       {
-         if (font_map().empty())
-            init_font_map();
+         return (std::uint32_t(be16(p)) << 16) | be16(p + 2);
+      }
 
-         std::istringstream str(std::string{ descr._families });
-         std::string family;
-         while (getline(str, family, ','))
+      std::string utf16be_to_utf8(unsigned char const* p, std::size_t size)
+      {
+         std::string r;
+         for (std::size_t i = 0; i + 1 < size; i += 2)
          {
-            trim(family);
-            if (auto i = font_map().find(family); i != font_map().end())
+            unsigned cp = be16(p + i);
+            if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < size)
             {
-               int min = 10000;
-               std::vector<font_entry>::const_iterator best_match = i->second.end();
-               for (auto j = i->second.begin(); j != i->second.end(); ++j)
+               unsigned lo = be16(p + i + 2);
+               if (lo >= 0xDC00 && lo < 0xE000)
                {
-                  auto const& item = *j;
-
-                  // Get biased score (lower is better). Give `slant` attribute
-                  // the highest bias (3.0), followed by `weight` (1.0) and then
-                  // `stretch` (0.25).
-                  auto diff =
-                     (std::abs(int(descr._weight) - int(item.weight)) * 1.0) +
-                     (std::abs(int(descr._slant) - int(item.slant)) * 3.0) +
-                     (std::abs(int(descr._stretch) - int(item.stretch)) * 0.25)
-                     ;
-                  if (diff < min)
-                  {
-                     min = diff;
-                     best_match = j;
-                  }
+                  cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                  i += 2;
                }
-               if (best_match != i->second.end())
-                  return &*best_match;
             }
+            r += codepoint_to_utf8(cp);
+         }
+         return r;
+      }
+
+      std::uint8_t map_ot_weight(int w);
+
+      template <typename Font>
+      bool read_font_info(string_view data, Font& font)
+      {
+         auto p = reinterpret_cast<unsigned char const*>(data.data());
+         auto size = data.size();
+         auto in_range = [size](std::size_t offset, std::size_t n)
+         {
+            return offset <= size && n <= size - offset;
+         };
+
+         if (!in_range(0, 12))
+            return false;
+
+         std::size_t base = 0;
+         if (be32(p) == 0x74746366)          // 'ttcf'
+         {
+            if (!in_range(0, 16))
+               return false;
+            base = be32(p + 12);
+            if (!in_range(base, 12))
+               return false;
+         }
+
+         std::size_t num_tables = be16(p + base + 4);
+         if (!in_range(base + 12, num_tables * 16))
+            return false;
+
+         unsigned char const* name = nullptr;
+         unsigned char const* os2 = nullptr;
+         std::size_t name_size = 0, os2_size = 0;
+         for (std::size_t i = 0; i != num_tables; ++i)
+         {
+            auto rec = p + base + 12 + i * 16;
+            std::size_t offset = be32(rec + 8);
+            std::size_t length = be32(rec + 12);
+            if (!in_range(offset, length))
+               continue;
+            switch (be32(rec))
+            {
+               case 0x6E616D65:  name = p + offset; name_size = length; break; // 'name'
+               case 0x4F532F32:  os2 = p + offset; os2_size = length; break;   // 'OS/2'
+            }
+         }
+
+         if (!name || name_size < 6)
+            return false;
+
+         // Prefer the typographic family (16) over the family (1), and
+         // English (US) Windows names over the others.
+         std::string names[3];                  // family, full name, typographic family
+         int scores[3] = { 0, 0, 0 };
+         std::size_t count = be16(name + 2);
+         std::size_t storage = be16(name + 4);
+         for (std::size_t i = 0; i != count && 6 + (i + 1) * 12 <= name_size; ++i)
+         {
+            auto rec = name + 6 + i * 12;
+            auto platform = be16(rec);
+            auto encoding = be16(rec + 2);
+            auto language = be16(rec + 4);
+            auto id = be16(rec + 6);
+            std::size_t length = be16(rec + 8);
+            std::size_t offset = storage + be16(rec + 10);
+
+            int slot = (id == 1)? 0 : (id == 4)? 1 : (id == 16)? 2 : -1;
+            if (slot == -1 || offset > name_size || length > name_size - offset)
+               continue;
+
+            int score = (platform == 3 && language == 0x409)? 3 : (platform == 3 || platform == 0)? 2 : 1;
+            if (score <= scores[slot])
+               continue;
+
+            if (platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10)))
+               names[slot] = utf16be_to_utf8(name + offset, length);
+            else if (platform == 1 && encoding == 0)
+               names[slot].assign(reinterpret_cast<char const*>(name + offset), length);
+            else
+               continue;
+            scores[slot] = score;
+         }
+
+         font.family = names[2].empty()? names[0] : names[2];
+         font.full_name = names[1].empty()? font.family : names[1];
+         trim(font.family);
+         if (font.family.empty())
+            return false;
+
+         if (os2 && os2_size >= 64)
+         {
+            // Stretch classes 1 to 9, normalized 0 to 100, the same as
+            // fontconfig's widths
+            static constexpr std::uint8_t stretch[] = { 25, 31, 38, 44, 50, 57, 63, 75, 100 };
+            auto width_class = be16(os2 + 6);
+            auto selection = be16(os2 + 62);
+
+            font.weight = map_ot_weight(be16(os2 + 4));
+            if (width_class >= 1 && width_class <= 9)
+               font.stretch = stretch[width_class - 1];
+            if (selection & (1 << 9))
+               font.slant = font_constants::oblique;
+            else if (selection & 1)
+               font.slant = font_constants::italic;
          }
-         return nullptr;
+         return true;
+      }
+
+      inline string_view family_of(string_view family)
+      {
+         return family;
+      }
+
+      template <typename Font>
+      inline string_view family_of(Font const& font)
+      {
+         return font.family;
+      }
+
+      // The font that best matches descr, in [first, last), or last
+      template <typename Iter>
+      Iter best_match(font_descr const& descr, Iter first, Iter last)
+      {
+         int min = 10000;
+         Iter best = last;
+         for (auto j = first; j != last; ++j)
+         {
+            auto const& item = *j;
+
+            // Get biased score (lower is better). Give `slant` attribute
+            // the highest bias (3.0), followed by `weight` (1.0) and then
+            // `stretch` (0.25).
+            auto diff =
+               (std::abs(int(descr._weight) - int(item.weight)) * 1.0) +
+               (std::abs(int(descr._slant) - int(item.slant)) * 3.0) +
+               (std::abs(int(descr._stretch) - int(item.stretch)) * 0.25)
+               ;
+            if (diff < min)
+            {
+               min = diff;
+               best = j;
+            }
+         }
+         return best;
+      }
+
+      // Fonts found in the resource bundles, sorted by family
+      struct memory_font
+      {
+         std::string    family;
+         std::string    full_name;
+         std::uint8_t   weight = font_constants::weight_normal;
+         std::uint8_t   slant = font_constants::slant_normal;
+         std::uint8_t   stretch = font_constants::stretch_normal;
+         string_view    data;
+      };
+
+      using memory_font_list = std::vector<memory_font>;
+
+      // Where to load a font from: either an installed font file, or a font
+      // in a resource bundle.
+      struct font_source
+      {
+         char const*    full_name = nullptr;
+         char const*    file = nullptr;
+         string_view    data;
+      };
+
+      font_source match(font_descr descr, memory_font_list const& memory_fonts)
+      {
+         // The index is loaded (or built) only if a family is not found in
+         // the bundled fonts.
+         font_index const* index = nullptr;
+
+         auto families = descr._families;
+         while (!families.empty())
+         {
+            auto comma = families.find(',');
+            auto family = trimmed(families.substr(0, comma));
+            families.remove_prefix(
+               (comma == string_view::npos)? families.size() : comma + 1);
+
+            // The application's own (bundled) fonts take precedence
+            auto [mfirst, mlast] = std::equal_range(
+               memory_fonts.begin(), memory_fonts.end(), family,
+               [](auto const& a, auto const& b)
+               {
+                  return family_of(a) < family_of(b);
+               }
+            );
+            if (auto i = best_match(descr, mfirst, mlast); i != mlast)
+               return { i->full_name.c_str(), nullptr, i->data };
+
+            if (!index)
+               index = &get_font_index();
+            auto [first, last] = index->family(family);
+            if (auto i = best_match(descr, first, last); i != last)
+               return { index->string(i->full_name), index->string(i->file), {} };
+         }
+         return {};
       }
 
 #ifndef __APPLE__
@@ -583,10 +1153,37 @@ namespace cycfi { namespace elements
                return free_type_face(nullptr);
          }
 
+         free_type_face load_face(string_view data)
+         {
+            FT_Face ft_face;
+            FT_Error ft_status = FT_New_Memory_Face(
+               _ft_lib, reinterpret_cast<FT_Byte const*>(data.data()), FT_Long(data.size())
+             , 0, &ft_face
+            );
+
+            if (ft_status == 0)
+               return free_type_face(ft_face);
+            else
+               return free_type_face(nullptr);
+         }
+
          [[nodiscard]]
          cairo_font_face_t* load_font(char const* font_path)
          {
-            free_type_face ft_face = load_face(font_path);
+            return load_font(load_face(font_path));
+         }
+
+         // The data must outlive the font
+         [[nodiscard]]
+         cairo_font_face_t* load_memory_font(string_view data)
+         {
+            return load_font(load_face(data));
+         }
+
+      private:
+
+         cairo_font_face_t* load_font(free_type_face ft_face)
+         {
             if (!ft_face)
                return nullptr;
 
@@ -616,62 +1213,323 @@ namespace cycfi { namespace elements
             return cairo_face;
          }
 
-      private:
          FT_Library _ft_lib = nullptr;
       };
-#endif
-   }
-
-   std::vector<fs::path>& font_paths()
-   {
-      static std::vector<fs::path> _paths;
-      return _paths;
-   }
 
-   font::font(font_descr descr)
-   {
-#ifndef __APPLE__
-      static free_type_library ft_lib;
+      free_type_library& get_free_type_library()
+      {
+         static free_type_library ft_lib;
+         return ft_lib;
+      }
 #endif
 
-      auto match_ptr = match(descr);
-      if (match_ptr)
+      cairo_font_face_t* load_font(font_source const& source)
       {
-         auto [cairo_font_map, cairo_font_map_mutex] = get_cairo_font_map();
-         std::lock_guard<std::mutex> lock(cairo_font_map_mutex);
-         if (auto it = cairo_font_map.find(match_ptr->full_name); it != cairo_font_map.end())
-         {
-            _handle = cairo_font_face_reference(it->second);
-         }
-         else
-         {
 #ifdef __APPLE__
-
+         CGFontRef cgfont = nullptr;
+         if (source.file)
+         {
             auto cfstr = CFStringCreateWithCString(
                kCFAllocatorDefault
-             , match_ptr->full_name.c_str()
+             , source.full_name
              , kCFStringEncodingUTF8
             );
-            auto cgfont = CGFontCreateWithFontName(cfstr);
-            _handle = cairo_quartz_font_face_create_for_cgfont(cgfont);
-            if (cgfont)
-               CFRelease(cgfont);
+            cgfont = CGFontCreateWithFontName(cfstr);
             if (cfstr)
                CFRelease(cfstr);
+         }
+         else
+         {
+            // The data must outlive the font, so it is not copied
+            auto provider = CGDataProviderCreateWithData(
+               nullptr, source.data.data(), source.data.size(), nullptr);
+            if (provider)
+            {
+               cgfont = CGFontCreateWithDataProvider(provider);
+               CFRelease(provider);
+            }
+         }
+         auto face = cgfont? cairo_quartz_font_face_create_for_cgfont(cgfont) : nullptr;
+         if (cgfont)
+            CFRelease(cgfont);
+         return face;
 #else
-            _handle = ft_lib.load_font(match_ptr->file.c_str());
+         if (source.file)
+            return get_free_type_library().load_font(source.file);
+         return get_free_type_library().load_memory_font(source.data);
+#endif
+      }
+
+      ////////////////////////////////////////////////////////////////////////
+      // face_cache: The font faces, by font_descr.
+      //
+      // Lookups are lock-free: the table is open addressed, and its slots
+      // are atomic pointers to entries that never change once published.
+      // Only inserting (on a miss, while the font is loaded) takes the
+      // lock. A full table is replaced by one twice as big. Readers may
+      // still be probing the old one, so old tables (which are small, as
+      // the capacity doubles) are kept until exit.
+      //
+      // Failed lookups are cached too (with a null face). Entries with the
+      // same underlying font share a face.
+      ////////////////////////////////////////////////////////////////////////
+      class face_cache
+      {
+      public:
+
+         struct entry
+         {
+            std::uint64_t        hash;
+            std::string          families;
+            std::uint8_t         weight;
+            std::uint8_t         slant;
+            std::uint8_t         stretch;
+            cairo_font_face_t*   face;
+         };
+
+                                 face_cache();
+                                 ~face_cache();
+
+                                 face_cache(face_cache const&) = delete;
+         face_cache&             operator=(face_cache const&) = delete;
+
+         entry const*            find(font_descr const& descr, std::uint64_t hash) const;
+         entry const*            insert(font_descr const& descr, std::uint64_t hash);
+
+      private:
+
+         using slot = std::atomic<entry const*>;
+
+         struct table
+         {
+                                 table(std::size_t capacity);
+
+            std::size_t          mask;
+            std::unique_ptr<slot[]> slots;
+         };
+
+         static bool             equal(entry const& e, font_descr const& descr);
+         static void             put(table& t, entry const* e);
+         void                    scan_bundles();
+
+         std::atomic<table*>     _table;
+
+         // Writers only
+         std::mutex              _mutex;
+         std::vector<std::unique_ptr<table>> _tables;   // The current one is last
+         std::deque<entry>       _entries;
+         std::map<std::string, cairo_font_face_t*> _faces;  // By full name
+         std::map<char const*, cairo_font_face_t*> _memory_faces;  // By data
+         memory_font_list        _memory_fonts;
+         std::size_t             _bundles_scanned = 0;
+      };
+
+      face_cache::table::table(std::size_t capacity)
+       : mask(capacity - 1)
+       , slots(new slot[capacity])
+      {
+         for (std::size_t i = 0; i != capacity; ++i)
+            slots[i].store(nullptr, std::memory_order_relaxed);
+      }
+
+      face_cache::face_cache()
+      {
+#ifndef __APPLE__
+         // The library must outlive the faces we destroy on exit
+         get_free_type_library();
 #endif
+         _tables.push_back(std::make_unique<table>(64));
+         _table.store(_tables.back().get(), std::memory_order_release);
+      }
+
+      face_cache::~face_cache()
+      {
+         for (auto [key, face] : _faces)
+            cairo_font_face_destroy(face);
+         for (auto [key, face] : _memory_faces)
+            cairo_font_face_destroy(face);
+      }
+
+      void face_cache::scan_bundles()
+      {
+         auto is_font = [](string_view path)
+         {
+            auto dot = path.rfind('.');
+            if (dot == string_view::npos)
+               return false;
+            std::string ext{ path.substr(dot) };
+            for (auto& c : ext)
+               c = std::tolower(c);
+            return ext == ".ttf" || ext == ".otf" || ext == ".ttc";
+         };
+
+         auto bundles = resource_bundles();
+         if (bundles.size() == _bundles_scanned)
+            return;
+
+         for (auto i = _bundles_scanned; i != bundles.size(); ++i)
+         {
+            auto const& bundle = *bundles[i];
+            for (std::size_t j = 0; j != bundle.size(); ++j)
+            {
+               if (!is_font(bundle.path(j)))
+                  continue;
+               memory_font font;
+               font.data = bundle.data(j);
+               if (read_font_info(font.data, font))
+                  _memory_fonts.push_back(std::move(font));
+            }
+         }
+         _bundles_scanned = bundles.size();
+
+         // Bundles added first take precedence
+         std::stable_sort(_memory_fonts.begin(), _memory_fonts.end(),
+            [](memory_font const& a, memory_font const& b) { return a.family < b.family; }
+         );
+      }
+
+      bool face_cache::equal(entry const& e, font_descr const& descr)
+      {
+         return e.weight == descr._weight
+            && e.slant == descr._slant
+            && e.stretch == descr._stretch
+            && string_view{ e.families } == descr._families
+            ;
+      }
+
+      void face_cache::put(table& t, entry const* e)
+      {
+         auto i = std::size_t(e->hash) & t.mask;
+         while (t.slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & t.mask;
+         t.slots[i].store(e, std::memory_order_release);
+      }
+
+      face_cache::entry const*
+      face_cache::find(font_descr const& descr, std::uint64_t hash) const
+      {
+         auto const& t = *_table.load(std::memory_order_acquire);
+         for (auto i = std::size_t(hash) & t.mask;; i = (i + 1) & t.mask)
+         {
+            auto e = t.slots[i].load(std::memory_order_acquire);
+            if (!e)
+               return nullptr;
+            if (e->hash == hash && equal(*e, descr))
+               return e;
+         }
+      }
+
+      face_cache::entry const*
+      face_cache::insert(font_descr const& descr, std::uint64_t hash)
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+
+         // Another thread may have added it while we were waiting
+         if (auto e = find(descr, hash))
+            return e;
+
+         scan_bundles();
+
+         cairo_font_face_t* face = nullptr;
+         auto source = match(descr, _memory_fonts);
+         if (source.data.data())
+         {
+            if (auto i = _memory_faces.find(source.data.data()); i != _memory_faces.end())
+            {
+               face = i->second;
+            }
+            else
+            {
+               face = load_font(source);
+               if (face)
+                  _memory_faces[source.data.data()] = face;
+            }
+         }
+         else if (source.full_name)
+         {
+            if (auto i = _faces.find(source.full_name); i != _faces.end())
+            {
+               face = i->second;
+            }
+            else
+            {
+               face = load_font(source);
+               if (face)
+                  _faces[source.full_name] = face;
+            }
+         }
 
-            if (_handle)
-               cairo_font_map[match_ptr->full_name] = cairo_font_face_reference(_handle);
+         _entries.push_back({
+            hash, std::string{ descr._families }
+          , descr._weight, descr._slant, descr._stretch
+          , face
+         });
+         auto e = &_entries.back();
+
+         // Keep the load factor at or below 1/2
+         auto& current = *_tables.back();
+         if (_entries.size() * 2 > current.mask + 1)
+         {
+            auto grown = std::make_unique<table>((current.mask + 1) * 2);
+            for (auto const& old : _entries)
+               put(*grown, &old);
+            _table.store(grown.get(), std::memory_order_release);
+            _tables.push_back(std::move(grown));
          }
+         else
+         {
+            put(current, e);
+         }
+         return e;
       }
-      else
+
+      face_cache& get_face_cache()
       {
-         _handle = nullptr;
+         static face_cache cache;
+         return cache;
       }
    }
 
+   std::vector<fs::path>& font_paths()
+   {
+      static std::vector<fs::path> _paths;
+      return _paths;
+   }
+
+   fs::path& font_index_path()
+   {
+      static fs::path _path = []() -> fs::path
+      {
+#if defined(_WIN32)
+         if (auto dir = std::getenv("LOCALAPPDATA"); dir && *dir)
+            return fs::path(dir) / "elements" / "cache";
+#else
+         auto home = std::getenv("HOME");
+# if defined(__APPLE__)
+         if (home && *home)
+            return fs::path(home) / "Library" / "Caches" / "elements";
+# else
+         if (auto dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+            return fs::path(dir) / "elements";
+         if (home && *home)
+            return fs::path(home) / ".cache" / "elements";
+# endif
+#endif
+         return {};
+      }();
+      return _path;
+   }
+
+   font::font(font_descr descr)
+   {
+      auto& cache = get_face_cache();
+      auto  hash = descr.hash();
+      auto  e = cache.find(descr, hash);
+      if (!e)
+         e = cache.insert(descr, hash);
+      _handle = e->face? cairo_font_face_reference(e->face) : nullptr;
+   }
+
    font::font(font const& rhs)
    {
       _handle = cairo_font_face_reference(rhs._handle);
@@ -4,12 +4,116 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/support/glyphs.hpp>
+#include <elements/support/display_list.hpp>
 #include <elements/support/detail/scratch_context.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace cycfi { namespace elements
 {
    static detail::scratch_context scratch_context_;
 
+   namespace
+   {
+      ////////////////////////////////////////////////////////////////////////
+      // glyph_advances: Per scaled font cache of glyph advances. The cache
+      // is attached to the scaled font as user data, so it lives as long as
+      // the font does. Glyph indices below 65536 are kept in a dense array,
+      // allocated in pages of 256 on demand. The rest go to a hash map.
+      ////////////////////////////////////////////////////////////////////////
+      class glyph_advances
+      {
+      public:
+
+         static glyph_advances*  get(cairo_scaled_font_t* font);
+
+                                 // Not thread safe. Lock mutex() first.
+         float                   advance(cairo_glyph_t const& glyph);
+         std::mutex&             mutex() { return _mutex; }
+
+      private:
+                                 glyph_advances(cairo_scaled_font_t* font)
+                                  : _font(font)
+                                 {}
+
+         static constexpr std::size_t page_size = 256;
+         static constexpr std::size_t num_pages = 256;
+
+         using page = std::array<float, page_size>;
+         using page_ptr = std::unique_ptr<page>;
+         using hash_map = std::unordered_map<unsigned long, float>;
+
+         float                   measure(cairo_glyph_t const& glyph);
+
+         cairo_scaled_font_t*    _font;
+         std::array<page_ptr, num_pages> _pages;
+         hash_map                _others;
+         std::mutex              _mutex;
+      };
+
+      cairo_user_data_key_t advances_key;
+
+      glyph_advances* glyph_advances::get(cairo_scaled_font_t* font)
+      {
+         static std::mutex attach_mutex;
+         std::lock_guard<std::mutex> lock(attach_mutex);
+
+         auto p = static_cast<glyph_advances*>(
+            cairo_scaled_font_get_user_data(font, &advances_key));
+         if (!p)
+         {
+            p = new glyph_advances(font);
+            auto stat = cairo_scaled_font_set_user_data(
+               font, &advances_key, p
+             , [](void* data) { delete static_cast<glyph_advances*>(data); }
+            );
+
+            // This happens only if the font is in an error state
+            if (stat != CAIRO_STATUS_SUCCESS)
+            {
+               delete p;
+               return nullptr;
+            }
+         }
+         return p;
+      }
+
+      float glyph_advances::advance(cairo_glyph_t const& glyph)
+      {
+         auto index = glyph.index;
+         if (index < page_size * num_pages)
+         {
+            auto& pg = _pages[index / page_size];
+            if (!pg)
+            {
+               pg = std::make_unique<page>();
+               pg->fill(std::numeric_limits<float>::quiet_NaN());
+            }
+            auto& a = (*pg)[index % page_size];
+            if (std::isnan(a))
+               a = measure(glyph);
+            return a;
+         }
+
+         auto i = _others.find(index);
+         if (i == _others.end())
+            i = _others.emplace(index, measure(glyph)).first;
+         return i->second;
+      }
+
+      float glyph_advances::measure(cairo_glyph_t const& glyph)
+      {
+         cairo_text_extents_t extents;
+         cairo_scaled_font_glyph_extents(_font, const_cast<cairo_glyph_t*>(&glyph), 1, &extents);
+         return extents.x_advance;
+      }
+   }
+
    glyphs::glyphs(char const* first, char const* last)
     : _first(first)
     , _last(last)
@@ -33,6 +137,8 @@ namespace cycfi { namespace elements
     , _clusters(master._clusters + cluster_start)
     , _cluster_count(cluster_end - cluster_start)
     , _clusterflags(master._clusterflags)
+    , _runs(master._runs)
+    , _run_count(master._run_count)
    {
       CYCFI_ASSERT(_first, "Precondition failure: _first must not be null");
       CYCFI_ASSERT(_last, "Precondition failure: _last must not be null");
@@ -89,11 +195,20 @@ namespace cycfi { namespace elements
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
 
+      // Attributed text is drawn per run
+      if (_run_count)
+         return draw(pos, canvas_, color_runs{});
+
+      auto offset = point{ float(pos.x - _glyphs->x), float(pos.y - _glyphs->y) };
+      if (auto list = canvas_.recording())
+         list->add_glyphs(_scaled_font, _glyphs, _glyph_count, offset, nullptr);
+      canvas::pause_recording pause{ canvas_ };
+
       auto cr = &canvas_.cairo_context();
       auto state = canvas_.new_state();
 
       cairo_set_scaled_font(cr, _scaled_font);
-      cairo_translate(cr, pos.x - _glyphs->x, pos.y - _glyphs->y);
+      cairo_translate(cr, offset.x, offset.y);
       canvas_.apply_fill_style();
 
       cairo_show_text_glyphs(
@@ -103,6 +218,94 @@ namespace cycfi { namespace elements
       );
    }
 
+   void glyphs::draw(point pos, canvas& canvas_, color_runs const& colors)
+   {
+      // return early if there's nothing to draw
+      if (_first == _last)
+         return;
+
+      if (_run_count == 0 && colors.empty())
+         return draw(pos, canvas_);
+
+      CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
+      CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
+      CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
+
+      auto offset = point{ float(pos.x - _glyphs->x), float(pos.y - _glyphs->y) };
+      auto list = canvas_.recording();
+      canvas::pause_recording pause{ canvas_ };
+
+      auto cr = &canvas_.cairo_context();
+      auto state = canvas_.new_state();
+
+      cairo_translate(cr, offset.x, offset.y);
+
+      // Draw the glyphs in segments of the same font and color. Text not
+      // covered by the color runs is drawn with the canvas' fill style.
+      scaled_font*   segment_font = nullptr;
+      color const*   segment_color = nullptr;
+      int            segment_start = 0;
+
+      auto flush = [&](int end)
+      {
+         if (end == segment_start)
+            return;
+         cairo_set_scaled_font(cr, segment_font);
+         if (segment_color)
+         {
+            auto c = *segment_color;
+            cairo_set_source_rgba(cr, c.red, c.green, c.blue, c.alpha);
+
+            // The fill style is no longer the source. Have the next
+            // uncolored segment set it again.
+            canvas_._state.pattern_set = canvas_._state.none_set;
+         }
+         else
+         {
+            canvas_.apply_fill_style();
+         }
+         cairo_show_glyphs(cr, _glyphs + segment_start, end - segment_start);
+         if (list)
+         {
+            list->add_glyphs(
+               segment_font, _glyphs + segment_start, end - segment_start
+             , offset, segment_color
+            );
+         }
+         segment_start = end;
+      };
+
+      auto           color_i = colors.begin();
+      int            glyph_index = 0;
+      std::size_t    byte_index = 0;
+
+      for (int i = 0; i < _cluster_count; i++)
+      {
+         while (color_i != colors.end() && color_i->offset + color_i->length <= byte_index)
+            ++color_i;
+
+         auto  font = font_of(_glyphs + glyph_index);
+         auto  c = (color_i != colors.end() && color_i->offset <= byte_index)?
+            &color_i->color_ : nullptr;
+
+         if (i == 0)
+         {
+            segment_font = font;
+            segment_color = c;
+         }
+         else if (font != segment_font || c != segment_color)
+         {
+            flush(glyph_index);
+            segment_font = font;
+            segment_color = c;
+         }
+
+         glyph_index += _clusters[i].num_glyphs;
+         byte_index += _clusters[i].num_bytes;
+      }
+      flush(_glyph_count);
+   }
+
    float glyphs::width() const
    {
       if (_first == _last)
@@ -116,22 +319,53 @@ namespace cycfi { namespace elements
       {
          cairo_text_extents_t extents;
          auto glyph = _glyphs + _glyph_count -1;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
+         cairo_scaled_font_glyph_extents(font_of(glyph), glyph, 1, &extents);
          return (glyph->x + extents.x_advance) - _glyphs->x;
       }
       return 0;
    }
 
+   void glyphs::cluster_positions(std::vector<cluster_position>& positions) const
+   {
+      if (_first != _last && _cluster_count)
+      {
+         int            glyph_index = 0;
+         std::size_t    byte_index = 0;
+         float          start_x = _glyphs->x;
+
+         for (int i = 0; i < _cluster_count; i++)
+         {
+            positions.push_back({ byte_index, float(_glyphs[glyph_index].x - start_x) });
+            glyph_index += _clusters[i].num_glyphs;
+            byte_index += _clusters[i].num_bytes;
+         }
+      }
+      positions.push_back({ size(), width() });
+   }
+
    glyphs::font_metrics glyphs::metrics() const
    {
-      cairo_font_extents_t font_extents;
-      cairo_scaled_font_extents(_scaled_font, &font_extents);
+      auto get_metrics = [](scaled_font* font) -> font_metrics
+      {
+         cairo_font_extents_t font_extents;
+         cairo_scaled_font_extents(font, &font_extents);
 
-      return {
-         /*ascent=*/    float(font_extents.ascent),
-         /*descent=*/   float(font_extents.descent),
-         /*leading=*/   float(font_extents.height-(font_extents.ascent + font_extents.descent)),
+         return {
+            /*ascent=*/    float(font_extents.ascent),
+            /*descent=*/   float(font_extents.descent),
+            /*leading=*/   float(font_extents.height-(font_extents.ascent + font_extents.descent)),
+         };
       };
+
+      auto result = get_metrics(_scaled_font);
+      for (int i = 0; i < _run_count; ++i)
+      {
+         auto m = get_metrics(_runs[i].font);
+         result.ascent = std::max(result.ascent, m.ascent);
+         result.descent = std::max(result.descent, m.descent);
+         result.leading = std::max(result.leading, m.leading);
+      }
+      return result;
    }
 
    ////////////////////////////////////////////////////////////////////////////
@@ -162,6 +396,31 @@ namespace cycfi { namespace elements
       build(start);
    }
 
+   master_glyphs::master_glyphs(
+      char const* first
+    , char const* last
+    , scaled_font* scaled_font_
+    , point start
+   )
+    : glyphs(first, last)
+   {
+      _scaled_font = cairo_scaled_font_reference(scaled_font_);
+      build(start);
+   }
+
+   master_glyphs::master_glyphs(
+      char const* first
+    , char const* last
+    , master_glyphs const& source
+    , font_runs const& runs
+    , point start
+   )
+    : glyphs(first, last)
+   {
+      _scaled_font = cairo_scaled_font_reference(source._scaled_font);
+      build(runs, start);
+   }
+
    master_glyphs::master_glyphs(master_glyphs&& rhs)
     : glyphs(rhs._first, rhs._last)
    {
@@ -171,10 +430,16 @@ namespace cycfi { namespace elements
       _clusters = rhs._clusters;
       _cluster_count = rhs._cluster_count;
       _clusterflags = rhs._clusterflags;
+      _shaped_runs = std::move(rhs._shaped_runs);
+      _runs = rhs._runs;
+      _run_count = rhs._run_count;
 
       rhs._glyphs = nullptr;
       rhs._clusters = nullptr;
       rhs._scaled_font = nullptr;
+      rhs._shaped_runs.clear();
+      rhs._runs = nullptr;
+      rhs._run_count = 0;
    }
 
    master_glyphs& master_glyphs::operator=(master_glyphs&& rhs)
@@ -189,6 +454,9 @@ namespace cycfi { namespace elements
          _clusters = rhs._clusters;
          _cluster_count = rhs._cluster_count;
          _clusterflags = rhs._clusterflags;
+         _shaped_runs.swap(rhs._shaped_runs);
+         std::swap(_runs, rhs._runs);
+         std::swap(_run_count, rhs._run_count);
 
          rhs._glyphs = nullptr;
          rhs._clusters = nullptr;
@@ -199,19 +467,13 @@ namespace cycfi { namespace elements
 
    master_glyphs::~master_glyphs()
    {
-      if (_glyphs)
-         cairo_glyph_free(_glyphs);
-      if (_clusters)
-         cairo_text_cluster_free(_clusters);
+      release();
       if (_scaled_font)
          cairo_scaled_font_destroy(_scaled_font);
-
-      _glyphs = nullptr;
-      _clusters = nullptr;
       _scaled_font = nullptr;
    }
 
-   void master_glyphs::text(char const* first, char const* last, point start)
+   void master_glyphs::release()
    {
       if (_glyphs)
       {
@@ -223,19 +485,44 @@ namespace cycfi { namespace elements
          cairo_text_cluster_free(_clusters);
          _clusters = nullptr;
       }
+      for (auto const& run : _shaped_runs)
+         cairo_scaled_font_destroy(run.font);
+      _shaped_runs.clear();
+      _runs = nullptr;
+      _run_count = 0;
+      _glyph_count = 0;
+      _cluster_count = 0;
+   }
 
+   void master_glyphs::text(char const* first, char const* last, point start)
+   {
+      release();
       _first = first;
       _last = last;
       build(start);
    }
 
+   void master_glyphs::text(
+      char const* first, char const* last
+    , font_runs const& runs, point start
+   )
+   {
+      release();
+      _first = first;
+      _last = last;
+      build(runs, start);
+   }
+
    void master_glyphs::break_lines(float width, std::vector<glyphs>& lines)
    {
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
 
-      // reurn early if there's nothing to break
+      // An empty text is a single empty line
       if (_first == _last)
+      {
+         lines.push_back(glyphs{ _first, _last });
          return;
+      }
 
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
@@ -265,6 +552,41 @@ namespace cycfi { namespace elements
          start_x = _glyphs[space_glyph_index].x;
       };
 
+      // Get the glyph advances from the font's advance cache. We lock it
+      // once for each font run instead of calling cairo for each glyph.
+      scaled_font*         font = nullptr;
+      glyph_advances*      advances = nullptr;
+      shaped_run const*    run = _runs;
+      std::unique_lock<std::mutex> lock;
+
+      auto  advance = [&](cairo_glyph_t* glyph) -> float
+      {
+         auto  glyph_font = _scaled_font;
+         if (_run_count)
+         {
+            while (run != _runs + _run_count - 1 && run->last <= glyph)
+               ++run;
+            glyph_font = run->font;
+         }
+
+         if (glyph_font != font)
+         {
+            // Release the previous font's lock before taking the next
+            if (lock.owns_lock())
+               lock.unlock();
+            font = glyph_font;
+            advances = glyph_advances::get(font);
+            if (advances)
+               lock = std::unique_lock<std::mutex>(advances->mutex());
+         }
+
+         if (advances)
+            return advances->advance(*glyph);
+         cairo_text_extents_t extents;
+         cairo_scaled_font_glyph_extents(font, glyph, 1, &extents);
+         return extents.x_advance;
+      };
+
       int      glyph_index = 0;
       unsigned codepoint;
       unsigned state = 0;
@@ -277,9 +599,7 @@ namespace cycfi { namespace elements
             cairo_glyph_t*  glyph = _glyphs + glyph_index;
 
             // Check if we exceeded the line width:
-            cairo_text_extents_t extents;
-            cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
-            if (((glyph->x + extents.x_advance) - start_x) > width)
+            if (((glyph->x + advance(glyph)) - start_x) > width)
             {
                // Add the line if we did (exceed the line width)
                add_line();
@@ -332,4 +652,110 @@ namespace cycfi { namespace elements
          throw failed_to_build_master_glyphs{};
       }
    }
+
+   void master_glyphs::build(font_runs const& runs, point start)
+   {
+      if (runs.empty())
+         return build(start);
+
+      // reurn early if there's nothing to build
+      if (_first == _last)
+         return;
+
+      // Split the text into segments: the runs, and the gaps between them
+      // which take the default font.
+      struct segment
+      {
+         std::size_t       offset;
+         std::size_t       length;
+         scaled_font*      font;
+         glyph*            glyphs = nullptr;
+         int               glyph_count = 0;
+         cluster*          clusters = nullptr;
+         int               cluster_count = 0;
+      };
+
+      std::vector<segment> segments;
+      auto  size = std::size_t(_last - _first);
+      std::size_t pos = 0;
+      for (auto const& run : runs)
+      {
+         auto  first = std::min(run.offset, size);
+         auto  last = std::min(run.offset + run.length, size);
+         if (first > pos)
+            segments.push_back({ pos, first - pos, cairo_scaled_font_reference(_scaled_font) });
+         if (last > first)
+         {
+            canvas cnv{ *scratch_context_.context() };
+            cnv.font(run.font_, run.size);
+            auto  font = cairo_get_scaled_font(scratch_context_.context());
+            segments.push_back({ first, last - first, cairo_scaled_font_reference(font) });
+         }
+         pos = std::max(pos, last);
+      }
+      if (pos < size)
+         segments.push_back({ pos, size - pos, cairo_scaled_font_reference(_scaled_font) });
+
+      auto  free_segments = [&]()
+      {
+         for (auto& seg : segments)
+         {
+            if (seg.glyphs)
+               cairo_glyph_free(seg.glyphs);
+            if (seg.clusters)
+               cairo_text_cluster_free(seg.clusters);
+         }
+      };
+
+      // Shape the segments, each starting where the previous one ended
+      int   glyph_count = 0;
+      int   cluster_count = 0;
+      point pen = start;
+      for (auto& seg : segments)
+      {
+         auto stat = cairo_scaled_font_text_to_glyphs(
+            seg.font, pen.x, pen.y, _first + seg.offset, int(seg.length),
+            &seg.glyphs, &seg.glyph_count, &seg.clusters, &seg.cluster_count,
+            &_clusterflags);
+
+         if (stat != CAIRO_STATUS_SUCCESS)
+         {
+            seg.glyphs = nullptr;
+            seg.clusters = nullptr;
+            free_segments();
+            for (auto& seg : segments)
+               cairo_scaled_font_destroy(seg.font);
+            throw failed_to_build_master_glyphs{};
+         }
+
+         if (seg.glyph_count)
+         {
+            auto  last = seg.glyphs + seg.glyph_count - 1;
+            cairo_text_extents_t extents;
+            cairo_scaled_font_glyph_extents(seg.font, last, 1, &extents);
+            pen = { float(last->x + extents.x_advance), float(last->y) };
+         }
+         glyph_count += seg.glyph_count;
+         cluster_count += seg.cluster_count;
+      }
+
+      // Concatenate the segments
+      _glyphs = cairo_glyph_allocate(glyph_count);
+      _clusters = cairo_text_cluster_allocate(cluster_count);
+      _glyph_count = 0;
+      _cluster_count = 0;
+      _shaped_runs.reserve(segments.size());
+      for (auto& seg : segments)
+      {
+         std::copy(seg.glyphs, seg.glyphs + seg.glyph_count, _glyphs + _glyph_count);
+         std::copy(seg.clusters, seg.clusters + seg.cluster_count, _clusters + _cluster_count);
+         _glyph_count += seg.glyph_count;
+         _cluster_count += seg.cluster_count;
+         _shaped_runs.push_back({ seg.font, _glyphs + _glyph_count });
+      }
+      free_segments();
+
+      _runs = _shaped_runs.data();
+      _run_count = int(_shaped_runs.size());
+   }
 }}
@@ -0,0 +1,161 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/icon_atlas.hpp>
+#include <elements/support/text_utils.hpp>
+#include <elements/support/theme.hpp>
+#include <algorithm>
+#include <cmath>
+#include <list>
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      constexpr int atlas_width = 256;
+      constexpr int cell_padding = 1;
+   }
+
+   icon_atlas::icon_atlas(elements::font font_, float size)
+    : _font(std::move(font_))
+    , _size(size)
+    , _pixmap(std::make_unique<pixmap>(point{ atlas_width, 64 }, 1, pixmap_format::a8))
+   {
+      pixmap_context pm_ctx{ *_pixmap };
+      canvas cnv{ *pm_ctx.context() };
+      cnv.font(_font, _size);
+
+      cairo_font_extents_t font_extents;
+      cairo_font_extents(pm_ctx.context(), &font_extents);
+      _ascent = font_extents.ascent;
+      _descent = font_extents.descent;
+   }
+
+   // Shelf packing: cells are placed left to right, in rows as tall as the
+   // tallest cell in them. The pixmap doubles in height when it is full.
+   point icon_atlas::allocate(int width, int height)
+   {
+      if (_shelf_x + width > atlas_width)
+      {
+         _shelf_x = 0;
+         _shelf_y += _shelf_height;
+         _shelf_height = 0;
+      }
+
+      auto  size_ = _pixmap->size();
+      if (_shelf_y + height > size_.y)
+      {
+         auto  new_height = size_.y;
+         while (_shelf_y + height > new_height)
+            new_height *= 2;
+
+         auto  bigger = std::make_unique<pixmap>(
+            point{ size_.x, new_height }, 1, pixmap_format::a8);
+         {
+            pixmap_context pm_ctx{ *bigger };
+            canvas cnv{ *pm_ctx.context() };
+            cnv.draw(*_pixmap, point{ 0, 0 });
+         }
+         _pixmap = std::move(bigger);
+      }
+
+      point pos{ float(_shelf_x), float(_shelf_y) };
+      _shelf_x += width;
+      _shelf_height = std::max(_shelf_height, height);
+      return pos;
+   }
+
+   icon_atlas::glyph const& icon_atlas::get(std::uint32_t code)
+   {
+      if (auto i = _glyphs.find(code); i != _glyphs.end())
+         return i->second;
+
+      auto  utf8 = codepoint_to_utf8(code);
+      cairo_text_extents_t extents;
+      {
+         pixmap_context pm_ctx{ *_pixmap };
+         canvas cnv{ *pm_ctx.context() };
+         cnv.font(_font, _size);
+         cairo_text_extents(pm_ctx.context(), utf8.c_str(), &extents);
+      }
+
+      glyph g{ {}, {}, float(extents.width) };
+      if (extents.width > 0 && extents.height > 0)
+      {
+         // The ink box, in whole pixels, padded so bilinear sampling does
+         // not bleed in from the neighbouring cells
+         auto  x0 = int(std::floor(extents.x_bearing)) - cell_padding;
+         auto  y0 = int(std::floor(extents.y_bearing)) - cell_padding;
+         auto  x1 = int(std::ceil(extents.x_bearing + extents.width)) + cell_padding;
+         auto  y1 = int(std::ceil(extents.y_bearing + extents.height)) + cell_padding;
+         auto  pos = allocate(x1 - x0, y1 - y0);
+
+         pixmap_context pm_ctx{ *_pixmap };
+         canvas cnv{ *pm_ctx.context() };
+         auto& cr = *pm_ctx.context();
+         cnv.font(_font, _size);
+         cairo_rectangle(&cr, pos.x, pos.y, x1 - x0, y1 - y0);
+         cairo_clip(&cr);
+         cairo_set_source_rgba(&cr, 0, 0, 0, 1);
+         cairo_move_to(&cr, pos.x - x0, pos.y - y0);
+         cairo_show_text(&cr, utf8.c_str());
+
+         g.src = rect{ pos.x, pos.y, pos.x + (x1 - x0), pos.y + (y1 - y0) };
+         g.offset = point{ float(x0), float(y0) };
+      }
+      return _glyphs.emplace(code, g).first->second;
+   }
+
+   void icon_atlas::draw(canvas& cnv, rect bounds, std::uint32_t code, float scale)
+   {
+      auto const& g = get(code);
+      if (g.src.width() <= 0)
+         return;
+
+      // The pen position, where fill_text would put it, aligned center and
+      // middle. Snap it to device pixels, so the cells are blitted 1:1.
+      auto& cr = cnv.cairo_context();
+      double x = bounds.left + (bounds.width() / 2) - g.width / (2 * scale);
+      double y = bounds.top + (bounds.height() / 2) + (_ascent - _descent) / (2 * scale);
+      double tsx, tsy;
+      cairo_surface_get_device_scale(cairo_get_target(&cr), &tsx, &tsy);
+      cairo_user_to_device(&cr, &x, &y);
+      x = std::round(x * tsx) / tsx;
+      y = std::round(y * tsy) / tsy;
+      cairo_device_to_user(&cr, &x, &y);
+
+      auto  left = float(x) + g.offset.x / scale;
+      auto  top = float(y) + g.offset.y / scale;
+      cnv.draw_mask(
+         *_pixmap, g.src
+       , rect{ left, top, left + g.src.width() / scale, top + g.src.height() / scale }
+      );
+   }
+
+   icon_atlas& get_icon_atlas(font const& font_, float size)
+   {
+      constexpr std::size_t max_atlases = 16;
+
+      size = std::round(size * 4) / 4;
+
+      // The theme (and its fonts) must outlive the atlases
+      get_theme();
+      static std::list<icon_atlas> atlases;     // Most recently used first
+
+      for (auto i = atlases.begin(); i != atlases.end(); ++i)
+      {
+         if (i->size() == size && i->font() == font_)
+         {
+            atlases.splice(atlases.begin(), atlases, i);
+            return atlases.front();
+         }
+      }
+
+      atlases.emplace_front(font_, size);
+      if (atlases.size() > max_atlases)
+         atlases.pop_back();
+      return atlases.front();
+   }
+}}
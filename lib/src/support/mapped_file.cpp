@@ -0,0 +1,83 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/mapped_file.hpp>
+
+#if defined(_WIN32)
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace cycfi { namespace elements
+{
+#if defined(_WIN32)
+
+   mapped_file::mapped_file(fs::path const& path)
+   {
+      auto file = CreateFileW(
+         path.wstring().c_str(), GENERIC_READ
+       , FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE
+       , nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+      );
+      if (file == INVALID_HANDLE_VALUE)
+         return;
+
+      LARGE_INTEGER size;
+      if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+      {
+         _map = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+         if (_map)
+         {
+            _data = static_cast<char const*>(MapViewOfFile(_map, FILE_MAP_READ, 0, 0, 0));
+            if (_data)
+               _size = std::size_t(size.QuadPart);
+         }
+      }
+      CloseHandle(file);
+   }
+
+   mapped_file::~mapped_file()
+   {
+      if (_data)
+         UnmapViewOfFile(_data);
+      if (_map)
+         CloseHandle(_map);
+   }
+
+#else
+
+   mapped_file::mapped_file(fs::path const& path)
+   {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+         return;
+
+      struct stat st;
+      if (::fstat(fd, &st) == 0 && st.st_size > 0)
+      {
+         auto size = std::size_t(st.st_size);
+         void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+         if (p != MAP_FAILED)
+         {
+            _data = static_cast<char const*>(p);
+            _size = size;
+         }
+      }
+      ::close(fd);
+   }
+
+   mapped_file::~mapped_file()
+   {
+      if (_data)
+         ::munmap(const_cast<char*>(_data), _size);
+   }
+
+#endif
+}}
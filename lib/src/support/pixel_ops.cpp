@@ -0,0 +1,433 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/detail/pixel_ops.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define ELEMENTS_PIXEL_OPS_SSE2
+# include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+# define ELEMENTS_PIXEL_OPS_AVX2
+# define ELEMENTS_TARGET_AVX2
+# include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// Compile the AVX2 kernel regardless, and pick it at runtime
+# define ELEMENTS_PIXEL_OPS_AVX2
+# define ELEMENTS_PIXEL_OPS_AVX2_DISPATCH
+# define ELEMENTS_TARGET_AVX2 __attribute__((target("avx2")))
+# include <immintrin.h>
+#endif
+
+namespace cycfi { namespace elements { namespace detail
+{
+   namespace
+   {
+      // x * a / 255, rounded. Exact for all 8-bit x and a.
+      inline std::uint32_t mul_div_255(std::uint32_t x, std::uint32_t a)
+      {
+         auto t = x * a + 128;
+         return (t + (t >> 8)) >> 8;
+      }
+
+      void convert_scalar(std::uint8_t const* src, std::uint32_t* dest, int n)
+      {
+         for (int i = 0; i != n; ++i, src += 4)
+         {
+            std::uint32_t a = src[3];
+            dest[i] =
+                 (a << 24)
+               | (mul_div_255(src[0], a) << 16)
+               | (mul_div_255(src[1], a) << 8)
+               | mul_div_255(src[2], a)
+               ;
+         }
+      }
+
+      // The SIMD kernels work on little endian 32-bit lanes, where RGBA
+      // bytes are 0xAABBGGRR and ARGB32 is 0xAARRGGBB: swap R and B, then
+      // multiply the color channels (in 16 bits) by the alpha.
+
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+      inline __m128i premultiply_sse2(__m128i px)
+      {
+         auto ga = _mm_set1_epi32(int(0xFF00FF00));
+         auto swapped = _mm_or_si128(
+            _mm_and_si128(px, ga)
+          , _mm_or_si128(
+               _mm_srli_epi32(_mm_and_si128(px, _mm_set1_epi32(0x00FF0000)), 16)
+             , _mm_slli_epi32(_mm_and_si128(px, _mm_set1_epi32(0x000000FF)), 16)
+            )
+         );
+
+         auto zero = _mm_setzero_si128();
+         auto mul = [&](__m128i x)
+         {
+            // Broadcast each pixel's alpha to its 4 channels
+            auto a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+            auto t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+         };
+         auto lo = mul(_mm_unpacklo_epi8(swapped, zero));
+         auto hi = mul(_mm_unpackhi_epi8(swapped, zero));
+         auto result = _mm_packus_epi16(lo, hi);
+
+         // Keep the original alpha
+         auto alpha = _mm_set1_epi32(int(0xFF000000));
+         return _mm_or_si128(_mm_andnot_si128(alpha, result), _mm_and_si128(alpha, px));
+      }
+
+      void convert_sse2(std::uint8_t const* src, std::uint32_t* dest, int n)
+      {
+         int i = 0;
+         for (; i + 4 <= n; i += 4)
+         {
+            auto px = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), premultiply_sse2(px));
+         }
+         convert_scalar(src + i * 4, dest + i, n - i);
+      }
+#endif
+
+#if defined(ELEMENTS_PIXEL_OPS_AVX2)
+      ELEMENTS_TARGET_AVX2
+      inline __m256i premultiply_avx2(__m256i px)
+      {
+         // Swap R and B and broadcast alpha, with byte shuffles (within
+         // each 128-bit lane)
+         auto swap_rb = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+          , 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+         );
+         auto swapped = _mm256_shuffle_epi8(px, swap_rb);
+
+         auto zero = _mm256_setzero_si256();
+         auto mul = [&](__m256i x) ELEMENTS_TARGET_AVX2
+         {
+            auto a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF);
+            auto t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+            return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+         };
+         auto lo = mul(_mm256_unpacklo_epi8(swapped, zero));
+         auto hi = mul(_mm256_unpackhi_epi8(swapped, zero));
+         auto result = _mm256_packus_epi16(lo, hi);
+
+         auto alpha = _mm256_set1_epi32(int(0xFF000000));
+         return _mm256_or_si256(_mm256_andnot_si256(alpha, result), _mm256_and_si256(alpha, px));
+      }
+
+      ELEMENTS_TARGET_AVX2
+      void convert_avx2(std::uint8_t const* src, std::uint32_t* dest, int n)
+      {
+         int i = 0;
+         for (; i + 8 <= n; i += 8)
+         {
+            auto px = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i * 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), premultiply_avx2(px));
+         }
+         convert_scalar(src + i * 4, dest + i, n - i);
+      }
+
+      bool has_avx2()
+      {
+# if defined(ELEMENTS_PIXEL_OPS_AVX2_DISPATCH)
+         static bool const avx2 = __builtin_cpu_supports("avx2");
+         return avx2;
+# else
+         return true;
+# endif
+      }
+#endif
+
+      void downsample_row_scalar(
+         std::uint8_t const* r0, std::uint8_t const* r1
+       , std::uint8_t* dest, int x, int width
+      )
+      {
+         for (auto dw = (width + 1) / 2; x != dw; ++x)
+         {
+            auto x0 = x * 2 * 4;
+            auto x1 = std::min(x * 2 + 1, width - 1) * 4;
+            for (int c = 0; c != 4; ++c)
+               dest[x * 4 + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2;
+         }
+      }
+
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+      void downsample_row_sse2(
+         std::uint8_t const* r0, std::uint8_t const* r1
+       , std::uint8_t* dest, int width
+      )
+      {
+         // 4 source pixels (from each row) make 2 destination pixels
+         auto zero = _mm_setzero_si128();
+         auto round = _mm_set1_epi16(2);
+         int x = 0;
+         for (; x * 2 + 4 <= width; x += 2)
+         {
+            auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(r0 + x * 8));
+            auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(r1 + x * 8));
+            auto lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            auto hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            auto sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x * 4), _mm_packus_epi16(sum, sum));
+         }
+         downsample_row_scalar(r0, r1, dest, x, width);
+      }
+#endif
+
+      void alpha_row_scalar(std::uint32_t const* src, std::uint8_t* dest, int x, int width)
+      {
+         for (; x != width; ++x)
+            dest[x] = std::uint8_t(src[x] >> 24);
+      }
+
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+      void alpha_row_sse2(std::uint32_t const* src, std::uint8_t* dest, int width)
+      {
+         int x = 0;
+         for (; x + 16 <= width; x += 16)
+         {
+            auto  p = reinterpret_cast<__m128i const*>(src + x);
+            auto  a0 = _mm_srli_epi32(_mm_loadu_si128(p), 24);
+            auto  a1 = _mm_srli_epi32(_mm_loadu_si128(p + 1), 24);
+            auto  a2 = _mm_srli_epi32(_mm_loadu_si128(p + 2), 24);
+            auto  a3 = _mm_srli_epi32(_mm_loadu_si128(p + 3), 24);
+            auto  a = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), a);
+         }
+         alpha_row_scalar(src, dest, x, width);
+      }
+#endif
+
+      // Box blur passes. A window of n = 2r+1 pixels is averaged, with the
+      // pixels beyond the edges taken as 0. sum/n is computed as
+      // (sum + n/2) * (65536/n + 1) >> 16, which may overshoot by one
+      // (hence the saturation). Sums fit in 16 bits for r < 128.
+      inline std::uint32_t box_divisor(int r)
+      {
+         return 65536 / (2 * r + 1) + 1;
+      }
+
+      void box_blur_row(std::uint8_t const* src, std::uint8_t* dest, int width, int r)
+      {
+         auto  div = box_divisor(r);
+         auto  half = std::uint32_t(r);
+         std::uint32_t sum = 0;
+         for (int x = 0; x != std::min(r, width); ++x)
+            sum += src[x];
+         for (int x = 0; x != width; ++x)
+         {
+            if (x + r < width)
+               sum += src[x + r];
+            dest[x] = std::uint8_t(std::min<std::uint32_t>(((sum + half) * div) >> 16, 255));
+            if (x - r >= 0)
+               sum -= src[x - r];
+         }
+      }
+
+      void box_blur_columns_scalar(
+         std::uint8_t const* src, std::uint8_t* dest, std::size_t stride
+       , int x, int width, int height, int r
+      )
+      {
+         auto  div = box_divisor(r);
+         auto  half = std::uint32_t(r);
+         for (; x != width; ++x)
+         {
+            std::uint32_t sum = 0;
+            for (int y = 0; y != std::min(r, height); ++y)
+               sum += src[y * stride + x];
+            for (int y = 0; y != height; ++y)
+            {
+               if (y + r < height)
+                  sum += src[(y + r) * stride + x];
+               dest[y * stride + x] =
+                  std::uint8_t(std::min<std::uint32_t>(((sum + half) * div) >> 16, 255));
+               if (y - r >= 0)
+                  sum -= src[(y - r) * stride + x];
+            }
+         }
+      }
+
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+      // Blurs 8 columns at a time, with 16-bit sums
+      void box_blur_columns_sse2(
+         std::uint8_t const* src, std::uint8_t* dest, std::size_t stride
+       , int width, int height, int r
+      )
+      {
+         auto  zero = _mm_setzero_si128();
+         auto  div = _mm_set1_epi16(short(box_divisor(r)));
+         auto  half = _mm_set1_epi16(short(r));
+         auto  load = [&](int x, int y)
+         {
+            auto p = reinterpret_cast<__m128i const*>(src + y * stride + x);
+            return _mm_unpacklo_epi8(_mm_loadl_epi64(p), zero);
+         };
+
+         int x = 0;
+         for (; x + 8 <= width; x += 8)
+         {
+            auto sum = zero;
+            for (int y = 0; y != std::min(r, height); ++y)
+               sum = _mm_add_epi16(sum, load(x, y));
+            for (int y = 0; y != height; ++y)
+            {
+               if (y + r < height)
+                  sum = _mm_add_epi16(sum, load(x, y + r));
+               auto avg = _mm_mulhi_epu16(_mm_add_epi16(sum, half), div);
+               _mm_storel_epi64(
+                  reinterpret_cast<__m128i*>(dest + y * stride + x)
+                , _mm_packus_epi16(avg, avg)
+               );
+               if (y - r >= 0)
+                  sum = _mm_sub_epi16(sum, load(x, y - r));
+            }
+         }
+         box_blur_columns_scalar(src, dest, stride, x, width, height, r);
+      }
+#endif
+
+      using convert_function = void(*)(std::uint8_t const*, std::uint32_t*, int);
+
+      convert_function select_convert()
+      {
+#if defined(ELEMENTS_PIXEL_OPS_AVX2)
+         if (has_avx2())
+            return convert_avx2;
+#endif
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+         return convert_sse2;
+#else
+         return convert_scalar;
+#endif
+      }
+   }
+
+   void parallel_rows(
+      int width, int height
+    , std::function<void(int first, int last)> const& f
+   )
+   {
+      // Below about 1M pixels, threads cost more than they save
+      constexpr std::size_t min_pixels_per_thread = 1024 * 1024;
+
+      auto pixels = std::size_t(width) * std::size_t(height);
+      auto max_threads = std::max(1u, std::min(std::thread::hardware_concurrency(), 8u));
+      auto n = int(std::min<std::size_t>(max_threads, pixels / min_pixels_per_thread));
+      if (n <= 1)
+      {
+         f(0, height);
+         return;
+      }
+
+      std::vector<std::thread> threads;
+      auto band = (height + n - 1) / n;
+      for (int first = band; first < height; first += band)
+         threads.emplace_back(f, first, std::min(first + band, height));
+      f(0, std::min(band, height));
+      for (auto& t : threads)
+         t.join();
+   }
+
+   void argb32_to_a8(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   )
+   {
+      for (int y = 0; y != height; ++y)
+      {
+         auto  row = reinterpret_cast<std::uint32_t const*>(src + y * src_stride);
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+         alpha_row_sse2(row, dest + y * dest_stride, width);
+#else
+         alpha_row_scalar(row, dest + y * dest_stride, 0, width);
+#endif
+      }
+   }
+
+   void downsample_2x(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   )
+   {
+      parallel_rows(width, (height + 1) / 2,
+         [&](int first, int last)
+         {
+            for (int y = first; y != last; ++y)
+            {
+               auto r0 = src + (y * 2) * src_stride;
+               auto r1 = src + std::min(y * 2 + 1, height - 1) * src_stride;
+               auto out = dest + y * dest_stride;
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+               downsample_row_sse2(r0, r1, out, width);
+#else
+               downsample_row_scalar(r0, r1, out, 0, width);
+#endif
+            }
+         }
+      );
+   }
+
+   void rgba_to_argb32(
+      std::uint8_t const* src, std::size_t src_stride
+    , std::uint8_t* dest, std::size_t dest_stride
+    , int width, int height
+   )
+   {
+      static convert_function const convert = select_convert();
+      parallel_rows(width, height,
+         [&](int first, int last)
+         {
+            for (int y = first; y != last; ++y)
+            {
+               convert(
+                  src + y * src_stride
+                , reinterpret_cast<std::uint32_t*>(dest + y * dest_stride)
+                , width
+               );
+            }
+         }
+      );
+   }
+
+   int blur_a8_radius(float sigma)
+   {
+      // Three box blurs approximate a gaussian. Each has a variance of
+      // ((2r+1)^2 - 1) / 12, so r is picked to make the three add up to
+      // about sigma^2.
+      auto r = int(std::lround((std::sqrt(4 * sigma * sigma + 1) - 1) / 2));
+      return std::min(std::max(r, 1), 127);
+   }
+
+   void blur_a8(std::uint8_t* data, std::size_t stride, int width, int height, float sigma)
+   {
+      auto r = blur_a8_radius(sigma);
+      if (width <= 0 || height <= 0)
+         return;
+
+      std::vector<std::uint8_t> tmp(stride * height);
+      for (int pass = 0; pass != 3; ++pass)
+      {
+         for (int y = 0; y != height; ++y)
+            box_blur_row(data + y * stride, tmp.data() + y * stride, width, r);
+#if defined(ELEMENTS_PIXEL_OPS_SSE2)
+         box_blur_columns_sse2(tmp.data(), data, stride, width, height, r);
+#else
+         box_blur_columns_scalar(tmp.data(), data, stride, 0, width, height, r);
+#endif
+      }
+   }
+}}}
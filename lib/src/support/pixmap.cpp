@@ -4,18 +4,28 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/support/pixmap.hpp>
+#include <elements/support/resource_bundle.hpp>
 #include <elements/support/resource_paths.hpp>
+#include <elements/support/detail/pixel_ops.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_PNG 1
 #include <elements/support/detail/stb_image.h>
 #include <infra/assert.hpp>
 #include <infra/filesystem.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <vector>
 
 namespace cycfi { namespace elements
 {
-   pixmap::pixmap(point size, float scale)
-    : _surface(cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size.x, size.y))
+   pixmap::pixmap(point size, float scale, pixmap_format format)
+    : _surface(cairo_image_surface_create(
+         format == pixmap_format::a8? CAIRO_FORMAT_A8 : CAIRO_FORMAT_ARGB32
+       , size.x, size.y
+      ))
+    , _mipmapped(false)
    {
       if (!_surface)
          throw failed_to_load_pixmap{ "Failed to create pixmap." };
@@ -25,68 +35,410 @@ namespace cycfi { namespace elements
       cairo_surface_mark_dirty(_surface);
    }
 
-   pixmap::pixmap(char const* filename, float scale)
+   namespace
+   {
+      cairo_surface_t* from_stb_image(uint8_t* src_data, int w, int h)
+      {
+         if (!src_data)
+            return nullptr;
+
+         auto surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+
+         uint8_t* dest_data = cairo_image_surface_get_data(surface);
+         size_t   src_stride = w * 4;
+         size_t   dest_stride = cairo_image_surface_get_stride(surface);
+
+         // stb_image gives us straight alpha RGBA bytes. Cairo wants
+         // premultiplied, native endian ARGB.
+         cairo_surface_flush(surface);
+         detail::rgba_to_argb32(src_data, src_stride, dest_data, dest_stride, w, h);
+         cairo_surface_mark_dirty(surface);
+
+         stbi_image_free(src_data);
+         return surface;
+      }
+
+      cairo_surface_t* load_png(string_view data)
+      {
+         cairo_read_func_t read =
+            [](void* closure, unsigned char* out, unsigned int length)
+            {
+               auto& in = *static_cast<string_view*>(closure);
+               if (in.size() < length)
+                  return CAIRO_STATUS_READ_ERROR;
+               std::memcpy(out, in.data(), length);
+               in.remove_prefix(length);
+               return CAIRO_STATUS_SUCCESS;
+            };
+         return cairo_image_surface_create_from_png_stream(read, &data);
+      }
+
+      // Keeps only the alpha. Consumes surface.
+      cairo_surface_t* to_a8(cairo_surface_t* surface)
+      {
+         auto  w = cairo_image_surface_get_width(surface);
+         auto  h = cairo_image_surface_get_height(surface);
+         auto  mask = cairo_image_surface_create(CAIRO_FORMAT_A8, w, h);
+         if (cairo_surface_status(mask) == CAIRO_STATUS_SUCCESS)
+         {
+            cairo_surface_flush(surface);
+            auto  dest = cairo_image_surface_get_data(mask);
+            auto  dest_stride = cairo_image_surface_get_stride(mask);
+            if (cairo_image_surface_get_format(surface) == CAIRO_FORMAT_ARGB32)
+            {
+               detail::argb32_to_a8(
+                  cairo_image_surface_get_data(surface), cairo_image_surface_get_stride(surface)
+                , dest, dest_stride, w, h
+               );
+            }
+            else
+            {
+               // No alpha: opaque
+               std::memset(dest, 0xFF, std::size_t(dest_stride) * h);
+            }
+            cairo_surface_mark_dirty(mask);
+         }
+         cairo_surface_destroy(surface);
+         return mask;
+      }
+   }
+
+   pixmap::pixmap(char const* filename, float scale, pixmap_format format)
     : _surface(nullptr)
+    , _mipmapped(false)
    {
       auto  path = std::string(filename);
       auto  pos = path.find_last_of(".");
       if (pos == std::string::npos)
          throw failed_to_load_pixmap{ "Unknown file type." };
 
-      fs::path full_path = find_file(filename);
-      if (full_path.empty())
-         throw failed_to_load_pixmap{ "File does not exist." };
-
       auto  ext = path.substr(pos);
-      if (ext == ".png" || ext == ".PNG")
+      bool  png = ext == ".png" || ext == ".PNG";
+
+      // Resource bundles first. These are loaded from memory.
+      if (auto data = find_resource(filename); data.data())
       {
-         // For PNGs, use Cairo's native PNG loader
-         _surface = cairo_image_surface_create_from_png(full_path.string().c_str());
+         if (png)
+         {
+            _surface = load_png(data);
+         }
+         else
+         {
+            int w, h, components;
+            _surface = from_stb_image(
+               stbi_load_from_memory(
+                  reinterpret_cast<stbi_uc const*>(data.data()), int(data.size())
+                , &w, &h, &components, 4
+               )
+             , w, h
+            );
+         }
       }
       else
       {
-         // For everything else, use stb_image
-         int w, h, components;
-         uint8_t* src_data = stbi_load(full_path.string().c_str(), &w, &h, &components, 4);
+         fs::path full_path = find_file(filename);
+         if (full_path.empty())
+            throw failed_to_load_pixmap{ "File does not exist." };
 
-         if (src_data)
+         if (png)
          {
-            _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
-
-            uint8_t* dest_data = cairo_image_surface_get_data(_surface);
-            size_t   src_stride = w * 4;
-            size_t   dest_stride = cairo_image_surface_get_stride(_surface);
-
-            for (int y = 0; y != h; ++y)
-            {
-               uint8_t* src = src_data + (y * src_stride);
-               uint8_t* dest = dest_data + (y * dest_stride);
-               for (int x = 0; x != w; ++x)
-               {
-                  // $$$ TODO: Deal with endian issues $$$
-
-                  dest[0] = src[2];    // blue
-                  dest[1] = src[1];    // green
-                  dest[2] = src[0];    // red
-                  dest[3] = src[3];    // alpha
-
-                  src += 4;
-                  dest += 4;
-               }
-            }
-
-            stbi_image_free(src_data);
+            // For PNGs, use Cairo's native PNG loader
+            _surface = cairo_image_surface_create_from_png(full_path.string().c_str());
+         }
+         else
+         {
+            // For everything else, use stb_image
+            int w, h, components;
+            _surface = from_stb_image(
+               stbi_load(full_path.string().c_str(), &w, &h, &components, 4), w, h);
          }
       }
 
-      if (!_surface)
+      if (!_surface || cairo_surface_status(_surface) != CAIRO_STATUS_SUCCESS)
+      {
+         if (_surface)
+            cairo_surface_destroy(_surface);
+         _surface = nullptr;
          throw failed_to_load_pixmap{ "Failed to load pixmap." };
+      }
+
+      if (format == pixmap_format::a8)
+         _surface = to_a8(_surface);
 
       // Set scale and flag the surface as dirty
       cairo_surface_set_device_scale(_surface, 1/scale, 1/scale);
       cairo_surface_mark_dirty(_surface);
    }
 
+   extent pixmap_size(char const* filename, float scale)
+   {
+      int w = 0, h = 0, components;
+
+      // PNG: The width and height are in the IHDR chunk, which comes first
+      auto png_size = [&](unsigned char const* p, std::size_t size)
+      {
+         static unsigned char const sig[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+         if (size < 24 || std::memcmp(p, sig, sizeof(sig)) != 0)
+            return false;
+         w = (p[16] << 24) | (p[17] << 16) | (p[18] << 8) | p[19];
+         h = (p[20] << 24) | (p[21] << 16) | (p[22] << 8) | p[23];
+         return true;
+      };
+
+      if (auto data = find_resource(filename); data.data())
+      {
+         auto p = reinterpret_cast<unsigned char const*>(data.data());
+         if (!png_size(p, data.size()))
+            stbi_info_from_memory(p, int(data.size()), &w, &h, &components);
+      }
+      else
+      {
+         fs::path full_path = find_file(filename);
+         if (full_path.empty())
+            return { 0, 0 };
+
+         unsigned char header[24];
+         std::size_t n = 0;
+         if (auto file = std::fopen(full_path.string().c_str(), "rb"))
+         {
+            n = std::fread(header, 1, sizeof(header), file);
+            std::fclose(file);
+         }
+         if (!png_size(header, n))
+            stbi_info(full_path.string().c_str(), &w, &h, &components);
+      }
+      return { w * scale, h * scale };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The mip chain and the exact size copy
+   ////////////////////////////////////////////////////////////////////////////
+   struct pixmap::variants
+   {
+      struct key
+      {
+         bool operator==(key const& rhs) const
+         {
+            return src == rhs.src && width == rhs.width && height == rhs.height;
+         }
+
+         rect                 src;
+         int                  width = 0;
+         int                  height = 0;
+      };
+
+                              variants() = default;
+                              variants(variants const&) = delete;
+                              ~variants();
+
+      variants&               operator=(variants const&) = delete;
+
+      void                    clear();
+      cairo_surface_t*        mip(cairo_surface_t* base, int level);
+      cairo_surface_t*        make_exact(cairo_surface_t* from, key const& k);
+
+      std::vector<cairo_surface_t*> mips;       // mips[i] is 1/2^(i+1) size
+      cairo_surface_t*        exact = nullptr;
+      key                     exact_key;
+      key                     last_key;         // The last exact size asked for
+   };
+
+   pixmap::variants::~variants()
+   {
+      clear();
+   }
+
+   void pixmap::variants::clear()
+   {
+      for (auto s : mips)
+         cairo_surface_destroy(s);
+      mips.clear();
+      if (exact)
+         cairo_surface_destroy(exact);
+      exact = nullptr;
+      exact_key = {};
+      last_key = {};
+   }
+
+   // Returns the pixmap's surface for level 0. Levels are built up to the
+   // one asked for, stopping at 1x1.
+   cairo_surface_t* pixmap::variants::mip(cairo_surface_t* base, int level)
+   {
+      auto  base_w = cairo_image_surface_get_width(base);
+      auto  base_h = cairo_image_surface_get_height(base);
+      while (int(mips.size()) < level)
+      {
+         auto  from = mips.empty()? base : mips.back();
+         auto  w = cairo_image_surface_get_width(from);
+         auto  h = cairo_image_surface_get_height(from);
+         if (w == 1 && h == 1)
+            break;
+
+         auto  to = cairo_image_surface_create(
+            cairo_image_surface_get_format(base), (w + 1) / 2, (h + 1) / 2);
+         if (cairo_surface_status(to) != CAIRO_STATUS_SUCCESS)
+         {
+            cairo_surface_destroy(to);
+            break;
+         }
+
+         cairo_surface_flush(from);
+         cairo_surface_flush(to);
+         detail::downsample_2x(
+            cairo_image_surface_get_data(from), cairo_image_surface_get_stride(from)
+          , cairo_image_surface_get_data(to), cairo_image_surface_get_stride(to)
+          , w, h
+         );
+         cairo_surface_mark_dirty(to);
+
+         // Scale it so that it covers the same user space as the base
+         double scx, scy;
+         cairo_surface_get_device_scale(base, &scx, &scy);
+         cairo_surface_set_device_scale(to
+          , scx * ((w + 1) / 2) / base_w
+          , scy * ((h + 1) / 2) / base_h
+         );
+         mips.push_back(to);
+      }
+      if (level == 0 || mips.empty())
+         return base;
+      return mips[std::min<std::size_t>(level, mips.size()) - 1];
+   }
+
+   cairo_surface_t* pixmap::variants::make_exact(cairo_surface_t* from, key const& k)
+   {
+      auto  to = cairo_image_surface_create(
+         cairo_image_surface_get_format(from), k.width, k.height);
+      if (cairo_surface_status(to) != CAIRO_STATUS_SUCCESS)
+      {
+         cairo_surface_destroy(to);
+         return nullptr;
+      }
+
+      // The copy covers only the src rect, in the pixmap's user space
+      cairo_surface_set_device_scale(to, k.width / k.src.width(), k.height / k.src.height());
+      auto  cr = cairo_create(to);
+      cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+      cairo_set_source_surface(cr, from, -k.src.left, -k.src.top);
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+      cairo_paint(cr);
+      cairo_destroy(cr);
+
+      if (exact)
+         cairo_surface_destroy(exact);
+      exact = to;
+      exact_key = k;
+      return to;
+   }
+
+   pixmap::variants* pixmap::get_variants() const
+   {
+      if (!_mipmapped)
+         return nullptr;
+      if (!_variants)
+         _variants = std::make_shared<variants>();
+      return _variants.get();
+   }
+
+   void pixmap::set_source(cairo_t& ctx, rect src) const
+   {
+      set_source(ctx, _surface, get_variants(), src);
+   }
+
+   void pixmap::set_source(cairo_t& ctx, cairo_surface_t* surface, variants* v, rect src)
+   {
+      auto  format = cairo_image_surface_get_format(surface);
+      if (!v || (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24))
+      {
+         cairo_set_source_surface(&ctx, surface, -src.left, -src.top);
+         return;
+      }
+
+      // Device pixels per pixmap pixel, along each axis
+      cairo_matrix_t mat;
+      cairo_get_matrix(&ctx, &mat);
+      double tsx, tsy, psx, psy;
+      cairo_surface_get_device_scale(cairo_get_target(&ctx), &tsx, &tsy);
+      cairo_surface_get_device_scale(surface, &psx, &psy);
+      auto  rx = std::hypot(mat.xx, mat.yx) * tsx / psx;
+      auto  ry = std::hypot(mat.xy, mat.yy) * tsy / psy;
+
+      // Not scaled down: Draw the pixmap as is
+      if (rx >= 1 || ry >= 1 || src.width() <= 0 || src.height() <= 0)
+      {
+         cairo_set_source_surface(&ctx, surface, -src.left, -src.top);
+         return;
+      }
+
+      // The largest level that is still at least as detailed as the target
+      auto  level = int(std::floor(std::log2(1 / std::max(rx, ry))));
+      bool  axis_aligned = mat.xy == 0 && mat.yx == 0;
+
+      if (axis_aligned)
+      {
+         variants::key k{
+            src
+          , int(std::lround(src.width() * psx * rx))
+          , int(std::lround(src.height() * psy * ry))
+         };
+
+         if (k.width > 0 && k.height > 0)
+         {
+            // Drawn at the same size twice in a row: Keep an exact size copy
+            auto  exact = (v->exact && v->exact_key == k)? v->exact : nullptr;
+            if (!exact && v->last_key == k)
+               exact = v->make_exact(v->mip(surface, level), k);
+            v->last_key = k;
+            if (exact)
+            {
+               cairo_set_source_surface(&ctx, exact, 0, 0);
+               return;
+            }
+         }
+      }
+
+      cairo_set_source_surface(&ctx, v->mip(surface, level), -src.left, -src.top);
+   }
+
+   void pixmap::invalidate()
+   {
+      // Display lists may share the variants: clear them in place
+      if (_variants)
+         _variants->clear();
+      ++_generation;
+   }
+
+   void pixmap::mipmapped(bool val)
+   {
+      _mipmapped = val;
+      if (!val)
+         invalidate();
+   }
+
+   pixmap::pixmap(pixmap&& rhs) noexcept
+    : _surface(rhs._surface)
+    , _mipmapped(rhs._mipmapped)
+    , _variants(std::move(rhs._variants))
+    , _generation(rhs._generation)
+   {
+      rhs._surface = nullptr;
+   }
+
+   pixmap& pixmap::operator=(pixmap&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         if (_surface)
+            cairo_surface_destroy(_surface);
+         _surface = rhs._surface;
+         _mipmapped = rhs._mipmapped;
+         _variants = std::move(rhs._variants);
+         _generation = rhs._generation;
+         rhs._surface = nullptr;
+      }
+      return *this;
+   }
+
    pixmap::~pixmap()
    {
       if (_surface)
@@ -110,8 +462,15 @@ namespace cycfi { namespace elements
       return float(1/scx);
    }
 
+   pixmap_format pixmap::format() const
+   {
+      return cairo_image_surface_get_format(_surface) == CAIRO_FORMAT_A8?
+         pixmap_format::a8 : pixmap_format::argb32;
+   }
+
    void pixmap::scale(float val)
    {
       cairo_surface_set_device_scale(_surface, 1/val, 1/val);
+      invalidate();
    }
 }}
@@ -0,0 +1,171 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/pixmap_cache.hpp>
+#include <elements/support/resource_bundle.hpp>
+#include <elements/support/resource_paths.hpp>
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      std::size_t pixmap_bytes(pixmap const& pm)
+      {
+         // size() is in scaled units: size / scale is the size in pixels
+         auto size = pm.size();
+         auto scale = pm.scale();
+         auto bpp = (pm.format() == pixmap_format::a8)? 1 : 4;
+         return std::size_t(size.x / scale) * std::size_t(size.y / scale) * bpp;
+      }
+
+      // Resource bundles are searched first (see pixmap::pixmap)
+      std::string resolve(char const* filename, pixmap_format format)
+      {
+         std::string prefix = (format == pixmap_format::a8)? "a8:" : "";
+         if (find_resource(filename).data())
+            return prefix + "bundle:" + filename;
+         auto path = find_file(filename);
+         return prefix + (path.empty()? std::string{ filename } : path.generic_string());
+      }
+   }
+
+   pixmap_ptr pixmap_cache::load(char const* filename, float scale, pixmap_format format)
+   {
+      key_type key{ resolve(filename, format), scale };
+      if (auto pm = find(key))
+         return pm;
+
+      // Decode outside the lock. If two threads load the same file at the
+      // same time, the first one to finish wins.
+      auto pm = std::make_shared<pixmap>(filename, scale, format);
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      ++_misses;
+      auto i = _entries.try_emplace(std::move(key)).first;
+      auto& e = i->second;
+      if (auto existing = e.pixmap_.lock())
+      {
+         pm = existing;
+      }
+      else
+      {
+         e.pixmap_ = pm;
+         e.bytes = pixmap_bytes(*pm);
+      }
+      retain(i, pm);
+      purge();
+      return pm;
+   }
+
+   pixmap_ptr pixmap_cache::find(char const* filename, float scale, pixmap_format format)
+   {
+      return find(key_type{ resolve(filename, format), scale });
+   }
+
+   pixmap_ptr pixmap_cache::find(key_type const& key)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (auto i = _entries.find(key); i != _entries.end())
+      {
+         if (auto pm = i->second.pixmap_.lock())
+         {
+            ++_hits;
+            retain(i, pm);
+            return pm;
+         }
+      }
+      return {};
+   }
+
+   void pixmap_cache::retain(entry_map::iterator i, pixmap_ptr const& pm)
+   {
+      auto& e = i->second;
+      if (e.retained)
+      {
+         _lru.splice(_lru.begin(), _lru, e.lru);
+         return;
+      }
+      if (e.bytes > _budget)
+         return;
+      _lru.push_front(i);
+      e.lru = _lru.begin();
+      e.retained = pm;
+      _retained_bytes += e.bytes;
+      trim();
+   }
+
+   void pixmap_cache::trim()
+   {
+      while (_retained_bytes > _budget && !_lru.empty())
+      {
+         auto& e = _lru.back()->second;
+         _retained_bytes -= e.bytes;
+         e.retained.reset();
+         _lru.pop_back();
+      }
+   }
+
+   void pixmap_cache::purge()
+   {
+      // Forget the pixmaps that are no longer in use
+      for (auto i = _entries.begin(); i != _entries.end();)
+      {
+         if (i->second.pixmap_.expired())
+            i = _entries.erase(i);
+         else
+            ++i;
+      }
+   }
+
+   std::size_t pixmap_cache::budget() const
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _budget;
+   }
+
+   void pixmap_cache::budget(std::size_t bytes)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _budget = bytes;
+      trim();
+      purge();
+   }
+
+   pixmap_cache::statistics pixmap_cache::stats() const
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      statistics r;
+      r.hits = _hits;
+      r.misses = _misses;
+      r.retained_bytes = _retained_bytes;
+      for (auto const& [key, e] : _entries)
+      {
+         if (!e.pixmap_.expired())
+         {
+            ++r.pixmaps;
+            r.bytes += e.bytes;
+         }
+      }
+      return r;
+   }
+
+   void pixmap_cache::clear()
+   {
+      entry_map entries;
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _entries.swap(entries);
+         _lru.clear();
+         _retained_bytes = 0;
+      }
+      // The pixmaps are released here, outside the lock
+   }
+
+   pixmap_cache& get_pixmap_cache()
+   {
+      static pixmap_cache cache;
+      return cache;
+   }
+}}
@@ -0,0 +1,255 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/resource_bundle.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Layout (native endian):
+   //
+   //    header
+   //    entry    [count]     sorted by hash, then path
+   //    paths                not null terminated
+   //    data                 each file aligned to 16 bytes
+   //
+   // Offsets are from the start of the bundle.
+   ////////////////////////////////////////////////////////////////////////////
+   struct resource_bundle::header
+   {
+      char                    magic[8];
+      std::uint32_t           version;
+      std::uint32_t           count;
+      std::uint64_t           size;
+   };
+
+   struct resource_bundle::entry
+   {
+      std::uint64_t           hash;
+      std::uint64_t           data_offset;
+      std::uint64_t           data_size;
+      std::uint32_t           path_offset;
+      std::uint32_t           path_size;
+   };
+
+   namespace
+   {
+      constexpr char bundle_magic[8] = "ELRSBND";
+      constexpr std::uint32_t bundle_version = 1;
+      constexpr std::size_t data_alignment = 16;
+
+      std::uint64_t path_hash(string_view path)
+      {
+         std::uint64_t h = 14695981039346656037ull;   // FNV-1a
+         for (auto c : path)
+         {
+            h ^= std::uint8_t(c);
+            h *= 1099511628211ull;
+         }
+         return h;
+      }
+
+      std::size_t align(std::size_t n)
+      {
+         return (n + data_alignment - 1) & ~(data_alignment - 1);
+      }
+   }
+
+   resource_bundle::resource_bundle(fs::path const& path)
+    : _file(std::make_unique<mapped_file>(path))
+   {
+      if (*_file)
+         open(_file->data(), _file->size());
+   }
+
+   resource_bundle::resource_bundle(char const* data, std::size_t size)
+   {
+      if (reinterpret_cast<std::uintptr_t>(data) % alignof(std::uint64_t) != 0)
+      {
+         _copy.resize((size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+         std::memcpy(_copy.data(), data, size);
+         data = reinterpret_cast<char const*>(_copy.data());
+      }
+      open(data, size);
+   }
+
+   void resource_bundle::open(char const* data, std::size_t size)
+   {
+      if (size < sizeof(header))
+         return;
+
+      auto h = reinterpret_cast<header const*>(data);
+      if (std::memcmp(h->magic, bundle_magic, sizeof(h->magic)) != 0
+         || h->version != bundle_version
+         || h->size != size
+         || h->count > (size - sizeof(header)) / sizeof(entry))
+         return;
+
+      // Everything must point inside the bundle
+      auto entries = reinterpret_cast<entry const*>(h + 1);
+      for (std::uint32_t i = 0; i != h->count; ++i)
+      {
+         auto const& e = entries[i];
+         if (e.path_offset > size || e.path_size > size - e.path_offset
+            || e.data_offset > size || e.data_size > size - e.data_offset)
+            return;
+      }
+
+      _data = data;
+      _header = h;
+      _entries = entries;
+   }
+
+   std::size_t resource_bundle::size() const
+   {
+      return _header? _header->count : 0;
+   }
+
+   string_view resource_bundle::path(std::size_t i) const
+   {
+      return { _data + _entries[i].path_offset, _entries[i].path_size };
+   }
+
+   string_view resource_bundle::data(std::size_t i) const
+   {
+      return { _data + _entries[i].data_offset, std::size_t(_entries[i].data_size) };
+   }
+
+   string_view resource_bundle::find(string_view path_) const
+   {
+      if (!_header)
+         return {};
+
+      auto  h = path_hash(path_);
+      auto  last = _entries + _header->count;
+      for (auto i = std::lower_bound(_entries, last, h,
+            [](entry const& e, std::uint64_t h) { return e.hash < h; }
+         ); i != last && i->hash == h; ++i)
+      {
+         auto j = std::size_t(i - _entries);
+         if (path(j) == path_)
+            return data(j);
+      }
+      return {};
+   }
+
+   bool resource_bundle::create(fs::path const& bundle, fs::path const& dir)
+   {
+      struct file
+      {
+         std::uint64_t        hash;
+         std::string          path;
+         fs::path             full_path;
+      };
+
+      std::vector<file> files;
+      std::error_code ec;
+      for (fs::recursive_directory_iterator i{ dir, ec }, last; !ec && i != last; i.increment(ec))
+      {
+         if (i->is_regular_file(ec))
+         {
+            auto path = i->path().lexically_relative(dir).generic_string();
+            files.push_back({ path_hash(path), path, i->path() });
+         }
+      }
+      if (ec)
+         return false;
+
+      std::sort(files.begin(), files.end(),
+         [](file const& a, file const& b)
+         {
+            return std::tie(a.hash, a.path) < std::tie(b.hash, b.path);
+         }
+      );
+
+      std::vector<entry> entries(files.size());
+      std::string paths;
+      std::size_t paths_offset = sizeof(header) + entries.size() * sizeof(entry);
+      for (std::size_t i = 0; i != files.size(); ++i)
+      {
+         entries[i].hash = files[i].hash;
+         entries[i].path_offset = std::uint32_t(paths_offset + paths.size());
+         entries[i].path_size = std::uint32_t(files[i].path.size());
+         paths += files[i].path;
+      }
+
+      std::string data;
+      std::size_t data_offset = align(paths_offset + paths.size());
+      for (std::size_t i = 0; i != files.size(); ++i)
+      {
+         std::ifstream in(files[i].full_path, std::ios::binary);
+         if (!in)
+            return false;
+         data.resize(align(data.size()), '\0');
+         entries[i].data_offset = data_offset + data.size();
+         data.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+         entries[i].data_size = data_offset + data.size() - entries[i].data_offset;
+      }
+
+      header h;
+      std::memcpy(h.magic, bundle_magic, sizeof(h.magic));
+      h.version = bundle_version;
+      h.count = std::uint32_t(entries.size());
+      h.size = data_offset + data.size();
+
+      std::ofstream out(bundle, std::ios::binary);
+      out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+      out.write(reinterpret_cast<char const*>(entries.data()), entries.size() * sizeof(entry));
+      out.write(paths.data(), paths.size());
+      std::string padding(data_offset - paths_offset - paths.size(), '\0');
+      out.write(padding.data(), padding.size());
+      out.write(data.data(), data.size());
+      return bool(out);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The bundles
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      std::pair<std::vector<resource_bundle_ptr>&, std::mutex&>
+      get_resource_bundles()
+      {
+         static std::vector<resource_bundle_ptr> bundles;
+         static std::mutex bundles_mutex;
+         return { bundles, bundles_mutex };
+      }
+   }
+
+   void add_resource_bundle(resource_bundle_ptr bundle)
+   {
+      if (!bundle || !*bundle)
+         return;
+      auto [bundles, bundles_mutex] = get_resource_bundles();
+      std::lock_guard<std::mutex> guard(bundles_mutex);
+      bundles.push_back(std::move(bundle));
+   }
+
+   std::vector<resource_bundle_ptr> resource_bundles()
+   {
+      auto [bundles, bundles_mutex] = get_resource_bundles();
+      std::lock_guard<std::mutex> guard(bundles_mutex);
+      return bundles;
+   }
+
+   string_view find_resource(string_view path)
+   {
+      auto [bundles, bundles_mutex] = get_resource_bundles();
+      std::lock_guard<std::mutex> guard(bundles_mutex);
+      for (auto const& bundle : bundles)
+      {
+         if (auto data = bundle->find(path); data.data())
+            return data;
+      }
+      return {};
+   }
+}}
@@ -0,0 +1,199 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/shaped_text.hpp>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // shaped_text
+   ////////////////////////////////////////////////////////////////////////////
+   shaped_text::shaped_text(string_view text, cairo_scaled_font_t* scaled_font_)
+    : detail::shaped_text_storage{ std::string(text) }
+    , master_glyphs(_text.data(), _text.data() + _text.size(), scaled_font_)
+   {
+      std::memset(&_extents, 0, sizeof(_extents));
+      if (_glyph_count)
+         cairo_scaled_font_glyph_extents(_scaled_font, _glyphs, _glyph_count, &_extents);
+      cairo_scaled_font_extents(_scaled_font, &_font_extents);
+   }
+
+   std::size_t shaped_text::memory_size() const
+   {
+      return sizeof(shaped_text)
+         + _text.capacity()
+         + _glyph_count * sizeof(glyph)
+         + _cluster_count * sizeof(cluster)
+         ;
+   }
+
+   void shaped_text::show(cairo_t& cr, point p) const
+   {
+      if (!_glyph_count)
+         return;
+
+      cairo_matrix_t save;
+      cairo_get_matrix(&cr, &save);
+      cairo_translate(&cr, p.x, p.y);
+      cairo_show_glyphs(&cr, _glyphs, _glyph_count);
+      cairo_set_matrix(&cr, &save);
+   }
+
+   void shaped_text::path(cairo_t& cr, point p) const
+   {
+      if (!_glyph_count)
+         return;
+
+      cairo_matrix_t save;
+      cairo_get_matrix(&cr, &save);
+      cairo_translate(&cr, p.x, p.y);
+      cairo_glyph_path(&cr, _glyphs, _glyph_count);
+      cairo_set_matrix(&cr, &save);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The shaped text cache
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      constexpr std::size_t default_shaped_text_cache_budget = 4 * 1024 * 1024;
+
+      struct cache_entry
+      {
+         cairo_font_face_t*   face;
+         float                size;
+         shaped_text_ptr      run;
+      };
+
+      // The index maps the hash of (face, size, text) to entries in the LRU
+      // list. Collisions are resolved by comparing the entries themselves,
+      // so a lookup does not need to allocate a key.
+      using lru_list = std::list<cache_entry>;
+      using cache_index = std::unordered_multimap<std::size_t, lru_list::iterator>;
+
+      struct shaped_text_cache
+      {
+         lru_list             lru;
+         cache_index          index;
+         std::size_t          bytes = 0;
+         std::size_t          budget = default_shaped_text_cache_budget;
+         std::size_t          hits = 0;
+         std::size_t          misses = 0;
+         std::mutex           mutex;
+
+         void evict(std::size_t target)
+         {
+            while (bytes > target && !lru.empty())
+            {
+               auto last = std::prev(lru.end());
+               auto range = index.equal_range(key_hash(last->face, last->size, last->run->text()));
+               for (auto i = range.first; i != range.second; ++i)
+               {
+                  if (i->second == last)
+                  {
+                     index.erase(i);
+                     break;
+                  }
+               }
+               bytes -= last->run->memory_size();
+               lru.erase(last);
+            }
+         }
+
+         static std::size_t key_hash(cairo_font_face_t* face, float size, string_view text)
+         {
+            auto h = std::hash<string_view>{}(text);
+            h ^= std::hash<void*>{}(face) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            h ^= std::hash<float>{}(size) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h;
+         }
+      };
+
+      shaped_text_cache& get_cache()
+      {
+         static shaped_text_cache cache_;
+         return cache_;
+      }
+
+      shaped_text_ptr shape(cairo_font_face_t* face, float size, string_view utf8)
+      {
+         cairo_matrix_t font_matrix;
+         cairo_matrix_t ctm;
+         cairo_matrix_init_scale(&font_matrix, size, size);
+         cairo_matrix_init_identity(&ctm);
+         auto options = cairo_font_options_create();
+         auto scaled_font = cairo_scaled_font_create(face, &font_matrix, &ctm, options);
+         cairo_font_options_destroy(options);
+
+         shaped_text_ptr run;
+         if (cairo_scaled_font_status(scaled_font) == CAIRO_STATUS_SUCCESS)
+            run = std::make_shared<shaped_text>(utf8, scaled_font);
+         cairo_scaled_font_destroy(scaled_font);
+         return run;
+      }
+   }
+
+   shaped_text_ptr get_shaped_text(cairo_font_face_t* face, float size, string_view utf8)
+   {
+      auto& cache = get_cache();
+      auto hash = shaped_text_cache::key_hash(face, size, utf8);
+      {
+         std::lock_guard<std::mutex> lock(cache.mutex);
+         auto range = cache.index.equal_range(hash);
+         for (auto i = range.first; i != range.second; ++i)
+         {
+            auto entry = i->second;
+            if (entry->face == face && entry->size == size && entry->run->text() == utf8)
+            {
+               cache.lru.splice(cache.lru.begin(), cache.lru, entry);
+               ++cache.hits;
+               return entry->run;
+            }
+         }
+         ++cache.misses;
+      }
+
+      // Shape outside the lock. If another thread shapes the same text
+      // concurrently, we end up with a duplicate entry that is eventually
+      // evicted.
+      auto run = shape(face, size, utf8);
+      if (!run)
+         return run;
+
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      cache.lru.push_front({ face, size, run });
+      cache.index.emplace(hash, cache.lru.begin());
+      cache.bytes += run->memory_size();
+      cache.evict(cache.budget);
+      return run;
+   }
+
+   shaped_text_cache_info get_shaped_text_cache_info()
+   {
+      auto& cache = get_cache();
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      return { cache.hits, cache.misses, cache.lru.size(), cache.bytes, cache.budget };
+   }
+
+   void set_shaped_text_cache_budget(std::size_t bytes)
+   {
+      auto& cache = get_cache();
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      cache.budget = bytes;
+      cache.evict(cache.budget);
+   }
+
+   void clear_shaped_text_cache()
+   {
+      auto& cache = get_cache();
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      cache.evict(0);
+   }
+}}
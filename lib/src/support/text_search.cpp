@@ -0,0 +1,368 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/text_search.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define ELEMENTS_SEARCH_SSE2
+# include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+# define ELEMENTS_SEARCH_AVX2
+# define ELEMENTS_TARGET_AVX2
+# include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+// Compile the AVX2 kernel regardless, and pick it at runtime
+# define ELEMENTS_SEARCH_AVX2
+# define ELEMENTS_SEARCH_AVX2_DISPATCH
+# define ELEMENTS_TARGET_AVX2 __attribute__((target("avx2")))
+# include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+namespace cycfi { namespace elements
+{
+   namespace
+   {
+      constexpr auto npos = string_view::npos;
+
+      inline char fold(char c)
+      {
+         return (c >= 'A' && c <= 'Z')? char(c + ('a' - 'A')) : c;
+      }
+
+      std::string fold(string_view s)
+      {
+         std::string r(s);
+         for (auto& c : r)
+            c = fold(c);
+         return r;
+      }
+
+      inline unsigned count_trailing_zeros(std::uint32_t mask)
+      {
+#if defined(_MSC_VER)
+         unsigned long index;
+         _BitScanForward(&index, mask);
+         return unsigned(index);
+#else
+         return unsigned(__builtin_ctz(mask));
+#endif
+      }
+
+      // The pattern, p, is already folded if ignore_case is true
+      inline bool equal(char const* s, char const* p, std::size_t m, bool ignore_case)
+      {
+         if (!ignore_case)
+            return std::memcmp(s, p, m) == 0;
+         for (std::size_t i = 0; i != m; ++i)
+            if (fold(s[i]) != p[i])
+               return false;
+         return true;
+      }
+
+      std::size_t find_scalar(
+         char const* s, std::size_t n
+       , char const* p, std::size_t m
+       , bool ignore_case, std::size_t i
+      )
+      {
+         for (; i + m <= n; ++i)
+         {
+            auto c = ignore_case? fold(s[i]) : s[i];
+            if (c == p[0] && equal(s + i, p, m, ignore_case))
+               return i;
+         }
+         return npos;
+      }
+
+      // The SIMD kernels compare the first and last bytes of the pattern
+      // against a block of candidate positions at once, and verify only
+      // the candidates where both match.
+
+#if defined(ELEMENTS_SEARCH_SSE2)
+      inline __m128i fold_sse2(__m128i x)
+      {
+         // SSE2 has no unsigned compare: bias 'A'..'Z' to the bottom of
+         // the signed range and do a signed compare instead.
+         auto t = _mm_sub_epi8(x, _mm_set1_epi8(char('A' + 128)));
+         auto upper = _mm_cmplt_epi8(t, _mm_set1_epi8(char(-128 + 26)));
+         return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+      }
+
+      std::size_t find_sse2(
+         char const* s, std::size_t n
+       , char const* p, std::size_t m
+       , bool ignore_case, std::size_t i
+      )
+      {
+         auto first = _mm_set1_epi8(p[0]);
+         auto last = _mm_set1_epi8(p[m-1]);
+         for (; i + m - 1 + 16 <= n; i += 16)
+         {
+            auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i + m - 1));
+            if (ignore_case)
+            {
+               a = fold_sse2(a);
+               b = fold_sse2(b);
+            }
+            auto eq = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+            auto mask = std::uint32_t(_mm_movemask_epi8(eq));
+            while (mask)
+            {
+               auto bit = count_trailing_zeros(mask);
+               if (equal(s + i + bit, p, m, ignore_case))
+                  return i + bit;
+               mask &= mask - 1;
+            }
+         }
+         return find_scalar(s, n, p, m, ignore_case, i);
+      }
+#endif
+
+#if defined(ELEMENTS_SEARCH_AVX2)
+      ELEMENTS_TARGET_AVX2
+      inline __m256i fold_avx2(__m256i x)
+      {
+         auto t = _mm256_sub_epi8(x, _mm256_set1_epi8(char('A' + 128)));
+         auto upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(char(-128 + 26)), t);
+         return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+      }
+
+      ELEMENTS_TARGET_AVX2
+      std::size_t find_avx2(
+         char const* s, std::size_t n
+       , char const* p, std::size_t m
+       , bool ignore_case, std::size_t i
+      )
+      {
+         auto first = _mm256_set1_epi8(p[0]);
+         auto last = _mm256_set1_epi8(p[m-1]);
+         for (; i + m - 1 + 32 <= n; i += 32)
+         {
+            auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s + i));
+            auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s + i + m - 1));
+            if (ignore_case)
+            {
+               a = fold_avx2(a);
+               b = fold_avx2(b);
+            }
+            auto eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+            auto mask = std::uint32_t(_mm256_movemask_epi8(eq));
+            while (mask)
+            {
+               auto bit = count_trailing_zeros(mask);
+               if (equal(s + i + bit, p, m, ignore_case))
+                  return i + bit;
+               mask &= mask - 1;
+            }
+         }
+         return find_scalar(s, n, p, m, ignore_case, i);
+      }
+
+      bool has_avx2()
+      {
+# if defined(ELEMENTS_SEARCH_AVX2_DISPATCH)
+         static bool const avx2 = __builtin_cpu_supports("avx2");
+         return avx2;
+# else
+         return true;
+# endif
+      }
+#endif
+
+      // The pattern, p, is already folded if ignore_case is true
+      std::size_t find_folded(
+         char const* s, std::size_t n
+       , char const* p, std::size_t m
+       , bool ignore_case, std::size_t i
+      )
+      {
+         if (m == 0 || m > n || i > n - m)
+            return npos;
+#if defined(ELEMENTS_SEARCH_AVX2)
+         if (has_avx2())
+            return find_avx2(s, n, p, m, ignore_case, i);
+#endif
+#if defined(ELEMENTS_SEARCH_SSE2)
+         return find_sse2(s, n, p, m, ignore_case, i);
+#else
+         return find_scalar(s, n, p, m, ignore_case, i);
+#endif
+      }
+   }
+
+   std::size_t find_text(string_view text, string_view pattern, bool ignore_case, std::size_t pos)
+   {
+      if (!ignore_case)
+         return find_folded(
+            text.data(), text.size(), pattern.data(), pattern.size(), false, pos);
+
+      auto p = fold(pattern);
+      return find_folded(text.data(), text.size(), p.data(), p.size(), true, pos);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_search
+   ////////////////////////////////////////////////////////////////////////////
+   void text_search::find(text_storage const& text, string_view pattern, bool ignore_case)
+   {
+      auto  p = ignore_case? fold(pattern) : std::string(pattern);
+      bool  extends =
+         !_pattern.empty()
+         && ignore_case == _ignore_case
+         && p.size() >= _pattern.size()
+         && p.compare(0, _pattern.size(), _pattern) == 0
+         ;
+
+      _pattern = std::move(p);
+      _ignore_case = ignore_case;
+
+      if (_pattern.empty())
+      {
+         _matches.clear();
+         return;
+      }
+
+      if (extends)
+      {
+         // Every match of the new pattern is a match of the previous one
+         _matches.erase(
+            std::remove_if(_matches.begin(), _matches.end(),
+               [&](std::size_t pos) { return !match_at(text, pos); }
+            )
+          , _matches.end()
+         );
+         return;
+      }
+
+      _matches.clear();
+      scan(text, 0, text.size(), _matches);
+   }
+
+   void text_search::update(
+      text_storage const& text
+    , std::size_t pos
+    , std::size_t erased, std::size_t inserted
+   )
+   {
+      if (_pattern.empty())
+         return;
+
+      // Remove the matches that overlap the erased text (or straddle pos,
+      // if nothing was erased) and shift the ones that follow.
+      auto  m = _pattern.size();
+      auto  from = (pos >= m)? pos - m + 1 : 0;
+      auto  first = std::lower_bound(_matches.begin(), _matches.end(), from);
+      auto  last = std::lower_bound(first, _matches.end(), pos + erased);
+      for (auto i = last; i != _matches.end(); ++i)
+         *i = *i - erased + inserted;
+
+      // Rescan around the edit for matches that start before the end of
+      // the inserted text.
+      match_list found;
+      scan(text, from, std::min(text.size(), pos + inserted + m - 1), found);
+
+      auto  i = _matches.erase(first, last);
+      _matches.insert(i, found.begin(), found.end());
+   }
+
+   void text_search::refresh(text_storage const& text)
+   {
+      _matches.clear();
+      if (!_pattern.empty())
+         scan(text, 0, text.size(), _matches);
+   }
+
+   void text_search::clear()
+   {
+      _pattern.clear();
+      _matches.clear();
+   }
+
+   text_search::const_iterator text_search::first_match(std::size_t pos) const
+   {
+      auto  m = _pattern.size();
+      return std::lower_bound(_matches.begin(), _matches.end(), (pos >= m)? pos - m + 1 : 0);
+   }
+
+   bool text_search::match_at(text_storage const& text, std::size_t pos) const
+   {
+      if (pos + _pattern.size() > text.size())
+         return false;
+
+      bool  result = true;
+      auto  p = _pattern.data();
+      text.for_each_chunk(pos, _pattern.size(),
+         [&](string_view chunk)
+         {
+            if (result)
+               result = equal(chunk.data(), p, chunk.size(), _ignore_case);
+            p += chunk.size();
+         }
+      );
+      return result;
+   }
+
+   void text_search::scan(
+      text_storage const& text
+    , std::size_t first, std::size_t last
+    , match_list& out
+   ) const
+   {
+      auto  p = _pattern.data();
+      auto  m = _pattern.size();
+      auto  pos = first;
+
+      // carry holds the last m-1 bytes before the current chunk. Matches
+      // that straddle chunks are found in carry + the head of the chunk.
+      std::string carry;
+      std::string window;
+
+      text.for_each_chunk(first, last - first,
+         [&](string_view chunk)
+         {
+            if (!carry.empty())
+            {
+               window.assign(carry);
+               window.append(chunk.data(), std::min(chunk.size(), m - 1));
+               for (auto i = find_folded(window.data(), window.size(), p, m, _ignore_case, 0);
+                  i != npos && i < carry.size();
+                  i = find_folded(window.data(), window.size(), p, m, _ignore_case, i + 1))
+               {
+                  out.push_back(pos - carry.size() + i);
+               }
+            }
+
+            for (auto i = find_folded(chunk.data(), chunk.size(), p, m, _ignore_case, 0);
+               i != npos;
+               i = find_folded(chunk.data(), chunk.size(), p, m, _ignore_case, i + 1))
+            {
+               out.push_back(pos + i);
+            }
+
+            if (chunk.size() >= m - 1)
+            {
+               carry.assign(chunk.data() + chunk.size() - (m - 1), m - 1);
+            }
+            else
+            {
+               carry.append(chunk.data(), chunk.size());
+               if (carry.size() > m - 1)
+                  carry.erase(0, carry.size() - (m - 1));
+            }
+            pos += chunk.size();
+         }
+      );
+   }
+}}
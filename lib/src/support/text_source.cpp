@@ -0,0 +1,150 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/text_source.hpp>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(_WIN32)
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <cerrno>
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // file_text_source
+   ////////////////////////////////////////////////////////////////////////////
+#if defined(_WIN32)
+
+   file_text_source::file_text_source(fs::path const& path)
+    : _file(CreateFileW(
+         path.wstring().c_str(), GENERIC_READ
+       , FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE
+       , nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+      ))
+   {
+      _size = file_size();
+   }
+
+   file_text_source::~file_text_source()
+   {
+      if (is_open())
+         CloseHandle(_file);
+   }
+
+   bool file_text_source::is_open() const
+   {
+      return _file != INVALID_HANDLE_VALUE;
+   }
+
+   std::size_t file_text_source::file_size() const
+   {
+      LARGE_INTEGER size;
+      if (!is_open() || !GetFileSizeEx(_file, &size))
+         return 0;
+      return std::size_t(size.QuadPart);
+   }
+
+   namespace
+   {
+      std::size_t read_at(void* file, std::size_t pos, std::size_t n, char* out)
+      {
+         OVERLAPPED at = {};
+         at.Offset = DWORD(std::uint64_t(pos) & 0xFFFFFFFF);
+         at.OffsetHigh = DWORD(std::uint64_t(pos) >> 32);
+         DWORD got = 0;
+         if (!ReadFile(file, out, DWORD(std::min<std::size_t>(n, 1 << 30)), &got, &at))
+            return 0;
+         return got;
+      }
+   }
+
+#else
+
+   file_text_source::file_text_source(fs::path const& path)
+    : _fd(::open(path.c_str(), O_RDONLY))
+   {
+      _size = file_size();
+   }
+
+   file_text_source::~file_text_source()
+   {
+      if (is_open())
+         ::close(_fd);
+   }
+
+   bool file_text_source::is_open() const
+   {
+      return _fd != -1;
+   }
+
+   std::size_t file_text_source::file_size() const
+   {
+      struct stat st;
+      if (!is_open() || ::fstat(_fd, &st) != 0)
+         return 0;
+      return std::size_t(st.st_size);
+   }
+
+   namespace
+   {
+      std::size_t read_at(int fd, std::size_t pos, std::size_t n, char* out)
+      {
+         ssize_t got;
+         do
+            got = ::pread(fd, out, n, off_t(pos));
+         while (got == -1 && errno == EINTR);
+         return (got > 0)? std::size_t(got) : 0;
+      }
+   }
+
+#endif
+
+   std::size_t file_text_source::size() const
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _size;
+   }
+
+   void file_text_source::read(std::size_t pos, std::size_t n, std::string& out) const
+   {
+      auto size_ = size();
+      pos = std::min(pos, size_);
+      n = std::min(n, size_ - pos);
+      out.resize(n);
+
+      // The file may have shrunk since size() was taken. The read then
+      // comes back short and out is trimmed to what was actually read.
+      std::size_t total = 0;
+      while (total < n)
+      {
+#if defined(_WIN32)
+         auto got = read_at(_file, pos + total, n - total, &out[total]);
+#else
+         auto got = read_at(_fd, pos + total, n - total, &out[total]);
+#endif
+         if (got == 0)
+            break;
+         total += got;
+      }
+      out.resize(total);
+   }
+
+   bool file_text_source::update()
+   {
+      auto size_ = file_size();
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (size_ == _size)
+         return false;
+      _size = size_;
+      return true;
+   }
+}}
@@ -0,0 +1,340 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/text_storage.hpp>
+#include <elements/support/text_utils.hpp>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // text_storage
+   ////////////////////////////////////////////////////////////////////////////
+   std::string text_storage::substr(std::size_t pos, std::size_t n) const
+   {
+      std::string result;
+      for_each_chunk(pos, n,
+         [&result](string_view chunk)
+         {
+            result.append(chunk.data(), chunk.size());
+         }
+      );
+      return result;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // string_text_storage
+   ////////////////////////////////////////////////////////////////////////////
+   void string_text_storage::replace(std::size_t pos, std::size_t n, string_view str)
+   {
+      _text.replace(pos, n, str.data(), str.size());
+   }
+
+   text_storage_ptr string_text_storage::snapshot() const
+   {
+      return std::make_shared<string_text_storage>(_text);
+   }
+
+   text_chunk string_text_storage::chunk(std::size_t pos) const
+   {
+      if (pos >= _text.size())
+         return { _text.size(), {} };
+      return { 0, _text };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // rope_text_storage
+   ////////////////////////////////////////////////////////////////////////////
+   namespace detail
+   {
+      struct rope_node
+      {
+         using node_ptr = std::shared_ptr<rope_node const>;
+
+         std::size_t          size = 0;         // Size in bytes
+         int                  height = 0;       // Leaves have zero height
+         node_ptr             left;             // Branches only
+         node_ptr             right;            // Branches only
+         std::string          text;             // Leaves only
+      };
+   }
+
+   namespace
+   {
+      using detail::rope_node;
+      using node_ptr = rope_node::node_ptr;
+
+      constexpr std::size_t max_leaf_size = 1024;
+
+      int height(node_ptr const& n)
+      {
+         return n? n->height : -1;
+      }
+
+      node_ptr make_leaf(string_view text)
+      {
+         if (text.empty())
+            return {};
+         auto n = std::make_shared<rope_node>();
+         n->size = text.size();
+         n->text = std::string(text);
+         return n;
+      }
+
+      node_ptr make_branch(node_ptr left, node_ptr right)
+      {
+         auto n = std::make_shared<rope_node>();
+         n->size = left->size + right->size;
+         n->height = std::max(left->height, right->height) + 1;
+         n->left = std::move(left);
+         n->right = std::move(right);
+         return n;
+      }
+
+      // Makes a branch of left and right whose heights differ by at most
+      // two, rotating as needed to restore the AVL invariant.
+      node_ptr balance(node_ptr const& left, node_ptr const& right)
+      {
+         if (height(left) > height(right) + 1)
+         {
+            if (height(left->left) >= height(left->right))
+               return make_branch(left->left, make_branch(left->right, right));
+            auto const& c = left->right;
+            return make_branch(
+               make_branch(left->left, c->left), make_branch(c->right, right));
+         }
+         if (height(right) > height(left) + 1)
+         {
+            if (height(right->right) >= height(right->left))
+               return make_branch(make_branch(left, right->left), right->right);
+            auto const& c = right->left;
+            return make_branch(
+               make_branch(left, c->left), make_branch(c->right, right->right));
+         }
+         return make_branch(left, right);
+      }
+
+      // Concatenates two ropes. Small adjacent leaves are merged.
+      node_ptr join(node_ptr const& left, node_ptr const& right)
+      {
+         if (!left)
+            return right;
+         if (!right)
+            return left;
+
+         if (left->height == 0 && right->height == 0
+            && left->size + right->size <= max_leaf_size)
+         {
+            auto n = std::make_shared<rope_node>();
+            n->size = left->size + right->size;
+            n->text.reserve(n->size);
+            n->text.append(left->text).append(right->text);
+            return n;
+         }
+
+         if (left->height > right->height + 1)
+            return balance(left->left, join(left->right, right));
+         if (right->height > left->height + 1)
+            return balance(join(left, right->left), right->right);
+         return make_branch(left, right);
+      }
+
+      node_ptr build(string_view text)
+      {
+         std::vector<node_ptr> nodes;
+         for (std::size_t i = 0; i < text.size(); i += max_leaf_size)
+            nodes.push_back(make_leaf(text.substr(i, max_leaf_size)));
+
+         while (nodes.size() > 1)
+         {
+            std::vector<node_ptr> parents;
+            for (std::size_t i = 0; i + 1 < nodes.size(); i += 2)
+               parents.push_back(make_branch(nodes[i], nodes[i+1]));
+            if (nodes.size() % 2)
+               parents.back() = join(parents.back(), nodes.back());
+            nodes.swap(parents);
+         }
+         return nodes.empty()? node_ptr{} : nodes.front();
+      }
+
+      std::pair<node_ptr, node_ptr> split(node_ptr const& n, std::size_t pos)
+      {
+         if (!n || pos == 0)
+            return { {}, n };
+         if (pos >= n->size)
+            return { n, {} };
+
+         if (n->height == 0)
+         {
+            string_view text = n->text;
+            return { make_leaf(text.substr(0, pos)), make_leaf(text.substr(pos)) };
+         }
+
+         if (pos < n->left->size)
+         {
+            auto parts = split(n->left, pos);
+            return { parts.first, join(parts.second, n->right) };
+         }
+         auto parts = split(n->right, pos - n->left->size);
+         return { join(n->left, parts.first), parts.second };
+      }
+
+      // Replaces n bytes at pos with str. Only the path to the edited leaf
+      // is copied if the edit falls within a leaf. Otherwise, the subtree
+      // that spans the edit is split and rejoined.
+      node_ptr edit(node_ptr const& n, std::size_t pos, std::size_t erase, string_view str)
+      {
+         if (n->height == 0)
+         {
+            std::string text;
+            text.reserve(n->size - erase + str.size());
+            text.append(n->text, 0, pos);
+            text.append(str.data(), str.size());
+            text.append(n->text, pos + erase, std::string::npos);
+            return build(text);
+         }
+
+         auto left_size = n->left->size;
+         if (pos + erase <= left_size)
+            return join(edit(n->left, pos, erase, str), n->right);
+         if (pos >= left_size)
+            return join(n->left, edit(n->right, pos - left_size, erase, str));
+
+         auto head = split(n, pos);
+         auto tail = split(head.second, erase);
+         return join(join(head.first, build(str)), tail.second);
+      }
+   }
+
+   rope_text_storage::rope_text_storage(string_view text)
+    : _root(build(text))
+   {}
+
+   std::size_t rope_text_storage::size() const
+   {
+      return _root? _root->size : 0;
+   }
+
+   void rope_text_storage::replace(std::size_t pos, std::size_t n, string_view str)
+   {
+      pos = std::min(pos, size());
+      n = std::min(n, size() - pos);
+      if (n == 0 && str.empty())
+         return;
+      _root = _root? edit(_root, pos, n, str) : build(str);
+   }
+
+   text_storage_ptr rope_text_storage::snapshot() const
+   {
+      return std::make_shared<rope_text_storage>(*this);
+   }
+
+   text_chunk rope_text_storage::chunk(std::size_t pos) const
+   {
+      if (pos >= size())
+         return { size(), {} };
+
+      auto n = _root.get();
+      std::size_t offset = 0;
+      while (n->height != 0)
+      {
+         if (pos - offset < n->left->size)
+         {
+            n = n->left.get();
+         }
+         else
+         {
+            offset += n->left->size;
+            n = n->right.get();
+         }
+      }
+      return { offset, n->text };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // text_cursor
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      bool is_continuation(char c)
+      {
+         return (uint8_t(c) & 0xC0) == 0x80;
+      }
+   }
+
+   text_cursor::text_cursor(text_storage const& storage, std::size_t pos)
+    : _storage(&storage)
+    , _size(storage.size())
+    , _pos(std::min(pos, _size))
+   {}
+
+   void text_cursor::position(std::size_t pos)
+   {
+      _pos = std::min(pos, _size);
+   }
+
+   unsigned text_cursor::codepoint() const
+   {
+      unsigned state = utf8_accept;
+      unsigned cp = 0;
+      for (auto pos = _pos; pos < _size; ++pos)
+      {
+         state = decode_utf8(state, cp, uint8_t(byte_at(pos)));
+         if (state == utf8_accept)
+            return cp;
+         if (state == utf8_reject)
+            break;
+      }
+      return 0xFFFD; // The replacement character
+   }
+
+   char const* text_cursor::utf8() const
+   {
+      if (at_end())
+         return "";
+
+      auto c = byte_at(_pos);
+      std::size_t len = 1;
+      if (c & utf8_mask::first)
+         len = (c & utf8_mask::third)? ((c & utf8_mask::fourth)? 4 : 3) : 2;
+      len = std::min(len, _size - _pos);
+
+      // Point directly into the chunk if the codepoint does not straddle
+      // chunks, otherwise, copy it.
+      auto first = _pos - _chunk.offset;
+      if (first + len <= _chunk.text.size())
+         return _chunk.text.data() + first;
+
+      std::memset(_utf8, 0, sizeof(_utf8));
+      for (std::size_t i = 0; i != len; ++i)
+         _utf8[i] = byte_at(_pos + i);
+      return _utf8;
+   }
+
+   text_cursor& text_cursor::next()
+   {
+      if (_pos < _size)
+      {
+         ++_pos;
+         while (_pos < _size && is_continuation(byte_at(_pos)))
+            ++_pos;
+      }
+      return *this;
+   }
+
+   text_cursor& text_cursor::prev()
+   {
+      if (_pos > 0)
+      {
+         --_pos;
+         while (_pos > 0 && is_continuation(byte_at(_pos)))
+            --_pos;
+      }
+      return *this;
+   }
+}}
@@ -4,14 +4,40 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/support/text_utils.hpp>
+#include <elements/support/icon_atlas.hpp>
 #include <elements/support/theme.hpp>
+#include <cairo.h>
+#include <cmath>
 
 namespace cycfi { namespace elements
 {
    void draw_icon(canvas& cnv, rect bounds, uint32_t code, float size, color c)
    {
+      // Icons up to this size (in device pixels) are drawn from an atlas
+      constexpr float max_atlas_size = 128;
+
       auto  state = cnv.new_state();
       auto& thm = get_theme();
+
+      // Blit the icon from an atlas, if the transform is a plain (uniform)
+      // scale by a whole number, such as a HiDPI backing scale. Otherwise,
+      // e.g. while zooming, draw it as text: every scale in an animation
+      // would rasterize a new atlas.
+      auto& cr = cnv.cairo_context();
+      cairo_matrix_t mat;
+      cairo_get_matrix(&cr, &mat);
+      double tsx, tsy;
+      cairo_surface_get_device_scale(cairo_get_target(&cr), &tsx, &tsy);
+      auto  scale = float(mat.xx * tsx);
+      if (thm.icon_font && mat.xy == 0 && mat.yx == 0 && scale > 0
+         && scale == std::round(scale) && mat.xx * tsx == mat.yy * tsy
+         && size * scale <= max_atlas_size)
+      {
+         cnv.fill_style(c);
+         get_icon_atlas(thm.icon_font, size * scale).draw(cnv, bounds, code, scale);
+         return;
+      }
+
       float cx = bounds.left + (bounds.width() / 2);
       float cy = bounds.top + (bounds.height() / 2);
       cnv.font(thm.icon_font, size);
@@ -57,6 +57,7 @@ namespace cycfi { namespace elements
     , text_box_font              { font_descr{ "Open Sans" } }
     , text_box_font_size         { 14.0 }
     , text_box_hilite_color      { rgba(0, 127, 255, 100) }
+    , text_box_find_hilite_color { rgba(255, 200, 0, 110) }
     , text_box_caret_color       { rgba(0, 190, 255, 255) }
     , text_box_caret_width       { 1.2 }
     , inactive_font_color        { rgba(127, 127, 127, 150) }
@@ -73,6 +74,8 @@ namespace cycfi { namespace elements
     , minor_grid_color           { indicator_color }
     , minor_grid_width           { 0.4 }
 
+    , image_placeholder_color    { rgba(127, 127, 127, 32) }
+
     , dialog_button_size         { 100 }
     , message_textbox_size       { { 300, 120 } }
 
@@ -0,0 +1,248 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/undo_history.hpp>
+#include <utility>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // undoable_text
+   ////////////////////////////////////////////////////////////////////////////
+   undoable_text::undoable_text()
+    : _handle(std::make_shared<undoable_text*>(this))
+   {}
+
+   // A copy is a different text, with a history of its own
+   undoable_text::undoable_text(undoable_text const& /* rhs */)
+    : _handle(std::make_shared<undoable_text*>(this))
+   {}
+
+   // The history of the moved text follows it here
+   undoable_text::undoable_text(undoable_text&& rhs) noexcept
+    : _handle(std::move(rhs._handle))
+   {
+      *_handle = this;
+      rhs._handle = std::make_shared<undoable_text*>(&rhs);
+   }
+
+   undoable_text& undoable_text::operator=(undoable_text const& rhs)
+   {
+      if (this != &rhs)
+         _handle = std::make_shared<undoable_text*>(this);
+      return *this;
+   }
+
+   undoable_text& undoable_text::operator=(undoable_text&& rhs) noexcept
+   {
+      if (this != &rhs)
+      {
+         _handle = std::move(rhs._handle);
+         *_handle = this;
+         rhs._handle = std::make_shared<undoable_text*>(&rhs);
+      }
+      return *this;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // undo_history
+   ////////////////////////////////////////////////////////////////////////////
+   std::size_t undo_history::entry_bytes(entry const& e)
+   {
+      return sizeof(entry) + e.delta.removed.capacity() + e.delta.inserted.capacity();
+   }
+
+   undo_history::step& undo_history::current_step()
+   {
+      // Inside a group, all entries go to the step started by the group
+      if (_group && _group_started)
+         return _undo.back();
+
+      _undo.emplace_back();
+      if (_group)
+         _group_started = true;
+      return _undo.back();
+   }
+
+   void undo_history::add_entry(entry e)
+   {
+      // Anything new invalidates the redo history
+      for (auto const& s : _redo)
+         _bytes -= s.bytes;
+      _redo.clear();
+
+      auto& s = current_step();
+      auto  n = entry_bytes(e);
+      s.entries.push_back(std::move(e));
+      s.bytes += n;
+      _bytes += n;
+      trim();
+   }
+
+   void undo_history::add(task t)
+   {
+      entry e;
+      e.t = std::move(t);
+      add_entry(std::move(e));
+      _coalesce = false;
+   }
+
+   void undo_history::add(
+      undoable_text& target, text_delta delta
+    , selection before, selection after
+    , bool coalesce
+   )
+   {
+      // Merge with the previous edit if we are still typing, in the same
+      // place, on the same target.
+      if (coalesce && _coalesce && !_undo.empty() && _redo.empty())
+      {
+         auto& s = _undo.back();
+         auto& last = s.entries.back();
+         auto& d = last.delta;
+         auto  old_bytes = entry_bytes(last);
+         bool  merged = false;
+
+         if (last.is_edit && last.target.lock() == target.undo_handle())
+         {
+            if (delta.removed.empty() && delta.pos == d.pos + d.inserted.size())
+            {
+               // Inserting after the previous insert
+               d.inserted += delta.inserted;
+               merged = true;
+            }
+            else if (delta.inserted.empty() && d.inserted.empty())
+            {
+               if (delta.pos + delta.removed.size() == d.pos)
+               {
+                  // Backspacing before the previous delete
+                  d.removed.insert(0, delta.removed);
+                  d.pos = delta.pos;
+                  merged = true;
+               }
+               else if (delta.pos == d.pos)
+               {
+                  // Deleting forward at the same position
+                  d.removed += delta.removed;
+                  merged = true;
+               }
+            }
+         }
+
+         if (merged)
+         {
+            last.after = after;
+            auto  new_bytes = entry_bytes(last);
+            s.bytes = s.bytes - old_bytes + new_bytes;
+            _bytes = _bytes - old_bytes + new_bytes;
+            trim();
+            return;
+         }
+      }
+
+      entry e;
+      e.is_edit = true;
+      e.target = target.undo_handle();
+      e.delta = std::move(delta);
+      e.before = before;
+      e.after = after;
+      add_entry(std::move(e));
+      _coalesce = coalesce && _group == 0;
+   }
+
+   bool undo_history::undo()
+   {
+      if (_undo.empty())
+         return false;
+
+      _coalesce = false;
+      auto s = std::move(_undo.back());
+      _undo.pop_back();
+
+      // Undo the entries in reverse
+      for (auto i = s.entries.rbegin(); i != s.entries.rend(); ++i)
+      {
+         if (i->is_edit)
+         {
+            auto const& d = i->delta;
+            if (auto target = i->target.lock())
+               (*target)->apply_delta(
+                  d.pos, d.inserted.size(), d.removed, i->before.start, i->before.end);
+         }
+         else if (i->t.undo)
+         {
+            i->t.undo();
+         }
+      }
+      _redo.push_back(std::move(s));
+      return true;
+   }
+
+   bool undo_history::redo()
+   {
+      if (_redo.empty())
+         return false;
+
+      _coalesce = false;
+      auto s = std::move(_redo.back());
+      _redo.pop_back();
+
+      for (auto& e : s.entries)
+      {
+         if (e.is_edit)
+         {
+            auto const& d = e.delta;
+            if (auto target = e.target.lock())
+               (*target)->apply_delta(
+                  d.pos, d.removed.size(), d.inserted, e.after.start, e.after.end);
+         }
+         else if (e.t.redo)
+         {
+            e.t.redo();
+         }
+      }
+      _undo.push_back(std::move(s));
+      return true;
+   }
+
+   void undo_history::clear()
+   {
+      _undo.clear();
+      _redo.clear();
+      _bytes = 0;
+      _group_started = false;
+      _coalesce = false;
+   }
+
+   void undo_history::begin_group()
+   {
+      if (_group++ == 0)
+         _group_started = false;
+      _coalesce = false;
+   }
+
+   void undo_history::end_group()
+   {
+      if (_group > 0 && --_group == 0)
+         _group_started = false;
+   }
+
+   void undo_history::max_bytes(std::size_t max)
+   {
+      _max_bytes = max;
+      trim();
+   }
+
+   void undo_history::trim()
+   {
+      // Drop the oldest steps, but always keep the latest one (and the one
+      // being grouped)
+      while (_bytes > _max_bytes && _undo.size() > 1)
+      {
+         _bytes -= _undo.front().bytes;
+         _undo.pop_front();
+      }
+   }
+}}
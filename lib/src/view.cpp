@@ -295,39 +295,17 @@
 
    void view::add_undo(undo_redo_task f)
    {
-      _undo_stack.push(f);
-      if (has_redo())
-      {
-         // clear the redo stack
-         undo_stack_type empty{};
-         _redo_stack.swap(empty);
-      }
+      _history.add(std::move(f));
    }
 
    bool view::undo()
    {
-      if (has_undo())
-      {
-         auto t = _undo_stack.top();
-         _undo_stack.pop();
-         _redo_stack.push(t);
-         t.undo();  // execute undo function
-         return true;
-      }
-      return false;
+      return _history.undo();
    }
 
    bool view::redo()
    {
-      if (has_redo())
-      {
-         auto t = _redo_stack.top();
-         _undo_stack.push(t);
-         _redo_stack.pop();
-         t.redo();  // execute redo function
-         return true;
-      }
-      return false;
+      return _history.redo();
    }
 
    void view::begin_focus()